@@ -40,6 +40,7 @@ namespace network {
     void mainClearBottleneckStats(const char userid[]);
     void mainUpdateServerFrameStats(uint8_t changedPerc, uint32_t all,
                                     uint32_t jpeg, uint32_t webp, uint32_t analysis,
+                                    uint32_t jpegpredicted, uint32_t webppredicted,
                                     uint32_t jpegarea, uint32_t webparea,
                                     uint16_t njpeg, uint16_t nwebp,
                                     uint16_t enc, uint16_t scale,
@@ -127,6 +128,8 @@ namespace network {
       uint32_t jpeg;
       uint32_t webp;
       uint32_t analysis;
+      uint32_t jpegpredicted;
+      uint32_t webppredicted;
       uint32_t jpegarea;
       uint32_t webparea;
       uint16_t njpeg;
@@ -135,6 +135,7 @@ void GetAPIMessager::mainClearBottleneckStats(const char userid[]) {
 
 void GetAPIMessager::mainUpdateServerFrameStats(uint8_t changedPerc,
 	uint32_t all, uint32_t jpeg, uint32_t webp, uint32_t analysis,
+	uint32_t jpegpredicted, uint32_t webppredicted,
 	uint32_t jpegarea, uint32_t webparea,
 	uint16_t njpeg, uint16_t nwebp,
 	uint16_t enc, uint16_t scale,
@@ -148,6 +149,8 @@ void GetAPIMessager::mainUpdateServerFrameStats(uint8_t changedPerc,
 	serverFrameStats.jpeg = jpeg;
 	serverFrameStats.webp = webp;
 	serverFrameStats.analysis = analysis;
+	serverFrameStats.jpegpredicted = jpegpredicted;
+	serverFrameStats.webppredicted = webppredicted;
 	serverFrameStats.jpegarea = jpegarea;
 	serverFrameStats.webparea = webparea;
 	serverFrameStats.njpeg = njpeg;
@@ -620,8 +623,8 @@ void GetAPIMessager::netGetFrameStats(char *buf, uint32_t len) {
 	},
 	"server_side" : [
 		{ "process_name": "Analysis", "time": 20 },
-		{ "process_name": "TightWEBPEncoder", "time": 20, "count": 64, "area": 12 },
-		{ "process_name": "TightJPEGEncoder", "time": 20, "count": 64, "area": 12 }
+		{ "process_name": "TightWEBPEncoder", "time": 20, "predicted": 18, "count": 64, "area": 12 },
+		{ "process_name": "TightJPEGEncoder", "time": 20, "predicted": 18, "count": 64, "area": 12 }
 	],
 	"client_side" : [
 		{
@@ -670,17 +673,19 @@ void GetAPIMessager::netGetFrameStats(char *buf, uint32_t len) {
 	           "\t\t{ \"process_name\": \"Analysis\", \"time\": %u },\n"
 	           "\t\t{ \"process_name\": \"Screenshot\", \"time\": %u },\n"
 	           "\t\t{ \"process_name\": \"Encoding_total\", \"time\": %u, \"videoscaling\": %u },\n"
-	           "\t\t{ \"process_name\": \"TightJPEGEncoder\", \"time\": %u, \"count\": %u, \"area\": %u },\n"
-	           "\t\t{ \"process_name\": \"TightWEBPEncoder\", \"time\": %u, \"count\": %u, \"area\": %u }\n"
+	           "\t\t{ \"process_name\": \"TightJPEGEncoder\", \"time\": %u, \"predicted\": %u, \"count\": %u, \"area\": %u },\n"
+	           "\t\t{ \"process_name\": \"TightWEBPEncoder\", \"time\": %u, \"predicted\": %u, \"count\": %u, \"area\": %u }\n"
 	           "\t],\n",
 	           serverFrameStats.analysis,
 	           serverFrameStats.shot,
 	           serverFrameStats.enc,
 	           serverFrameStats.scale,
 	           serverFrameStats.jpeg,
+	           serverFrameStats.jpegpredicted,
 	           serverFrameStats.njpeg,
 	           serverFrameStats.jpegarea,
 	           serverFrameStats.webp,
+	           serverFrameStats.webppredicted,
 	           serverFrameStats.nwebp,
 	           serverFrameStats.webparea);
 
@@ -128,6 +128,17 @@ void Socket::setFd(int fd)
   isShutdown_ = false;
 }
 
+void Socket::setStreams(rdr::FdInStream* in, rdr::FdOutStream* out)
+{
+#ifndef WIN32
+  fcntl(out->getFd(), F_SETFD, FD_CLOEXEC);
+#endif
+
+  instream = in;
+  outstream = out;
+  isShutdown_ = false;
+}
+
 SocketListener::SocketListener(int fd)
   : fd(fd), filter(0)
 {
@@ -60,6 +60,8 @@ namespace network {
     Socket();
 
     void setFd(int fd);
+    // For sockets with a protocol layer of their own on top of the fd
+    void setStreams(rdr::FdInStream* in, rdr::FdOutStream* out);
 
   private:
     rdr::FdInStream* instream;
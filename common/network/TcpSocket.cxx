@@ -36,7 +36,10 @@
 #endif
 
 #include <sys/un.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <wordexp.h>
@@ -50,10 +53,14 @@
 #include <network/GetAPI.h>
 #include <network/TcpSocket.h>
 #include <network/Udp.h>
+#include <network/WebSocketStream.h>
 #include <rfb/LogWriter.h>
 #include <rfb/Configuration.h>
 #include <rfb/ServerCore.h>
 
+#include <map>
+#include <string>
+
 #ifdef WIN32
 #include <os/winerrno.h>
 #endif
@@ -126,11 +133,34 @@ int network::getSockPort(int sock)
   }
 }
 
-WebSocket::WebSocket(int sock) : Socket(sock)
+WebSocket::WebSocket(int sock) : Socket(sock), peerName(NULL)
+{
+}
+
+WebSocket::WebSocket(ws_ctx_t *ctx, const char *name)
+{
+  int one = 1;
+
+  // Reads wait in select() and TLS writes must not block
+  fcntl(ctx->sockfd, F_SETFL, fcntl(ctx->sockfd, F_GETFL) | O_NONBLOCK);
+
+  if (setsockopt(ctx->sockfd, IPPROTO_TCP, TCP_NODELAY,
+                 (char *)&one, sizeof(one)) < 0)
+    vlog.error("unable to setsockopt TCP_NODELAY: %d", errorNumber);
+
+  setStreams(new WebSocketInStream(ctx), new WebSocketOutStream(ctx));
+  peerName = rfb::strDup(name);
+}
+
+WebSocket::~WebSocket()
 {
+  rfb::strFree(peerName);
 }
 
 char* WebSocket::getPeerAddress() {
+  if (peerName)
+    return rfb::strDup(peerName);
+
   struct sockaddr_un addr;
   socklen_t len = sizeof(struct sockaddr_un);
   if (getpeername(getFd(), (struct sockaddr *) &addr, &len) != 0) {
@@ -147,6 +177,21 @@ char* WebSocket::getPeerEndpoint() {
   return rfb::strDup(buf);
 }
 
+bool WebSocket::cork(bool enable) {
+  // Nothing to gain on the proxy's unix socket
+  if (!peerName)
+    return true;
+
+#ifndef TCP_CORK
+  return false;
+#else
+  int one = enable ? 1 : 0;
+  if (setsockopt(getFd(), IPPROTO_TCP, TCP_CORK, (char *)&one, sizeof(one)) < 0)
+    return false;
+  return true;
+#endif
+}
+
 // -=- TcpSocket
 
 TcpSocket::TcpSocket(int sock) : Socket(sock)
@@ -438,6 +483,71 @@ int TcpListener::getMyPort() {
 
 extern settings_t settings;
 
+// Clients the websocket server has handed over, until the main loop
+// picks them up. Keyed on the name of the unix socket that woke it up.
+struct PendingWebSocket {
+  ws_ctx_t *ctx;
+  int wakeSock;
+};
+
+static std::map<std::string, PendingWebSocket> pendingWebSockets;
+static pthread_mutex_t pendingWebSocketsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint8_t handoffCb(ws_ctx_t *ws_ctx)
+{
+  // Hixie and base64 clients still need the proxy
+  if (!ws_ctx->hybi || ws_ctx->opcode != OPCODE_BINARY)
+    return 0;
+
+  char sockname[32];
+  sprintf(sockname, ".KasmVNCSock%u", getpid());
+
+  struct sockaddr_un addr;
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sockname);
+  addr.sun_path[0] = '\0';
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+
+  // Named the same way as the proxy's, so the peer address is unchanged
+  struct sockaddr_un myaddr;
+  memset(&myaddr, 0, sizeof(myaddr));
+  myaddr.sun_family = AF_UNIX;
+  snprintf(myaddr.sun_path, sizeof(myaddr.sun_path), ".%s@%s_%lu.%lu",
+           ws_ctx->user, ws_ctx->ip, tv.tv_sec, tv.tv_usec);
+  myaddr.sun_path[0] = '\0';
+
+  const std::string name(myaddr.sun_path + 1);
+
+  int wakeSock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (wakeSock < 0)
+    return 0;
+
+  if (bind(wakeSock, (struct sockaddr *) &myaddr, sizeof(struct sockaddr_un))) {
+    close(wakeSock);
+    return 0;
+  }
+
+  pthread_mutex_lock(&pendingWebSocketsMutex);
+  pendingWebSockets[name] = { ws_ctx, wakeSock };
+  pthread_mutex_unlock(&pendingWebSocketsMutex);
+
+  if (connect(wakeSock, (struct sockaddr *) &addr,
+              sizeof(sa_family_t) + strlen(sockname)) < 0) {
+    vlog.error("Could not hand over websocket client: %s", strerror(errno));
+
+    pthread_mutex_lock(&pendingWebSocketsMutex);
+    pendingWebSockets.erase(name);
+    pthread_mutex_unlock(&pendingWebSocketsMutex);
+
+    close(wakeSock);
+    return 0;
+  }
+
+  return 1;
+}
+
 static uint8_t *screenshotCb(void *messager, uint16_t w, uint16_t h, const uint8_t q,
                              const uint8_t dedup,
                              uint32_t *len, uint8_t *staging)
@@ -608,11 +718,8 @@ static void openssl_threads() {
 #endif
 }
 
-WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
-                         socklen_t listenaddrlen,
-                         bool sslonly, const char *cert, const char *certkey,
-                         bool disablebasicauth,
-                         const char *httpdir)
+static int bindWebsocket(const struct sockaddr *listenaddr,
+                         socklen_t listenaddrlen, bool reuseport)
 {
   int one = 1;
   vnc_sockaddr_t sa;
@@ -649,14 +756,70 @@ WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
   }
 #endif
 
+#ifdef SO_REUSEPORT
+  // Several sockets on the same port, the kernel spreads new
+  // connections between them
+  if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+                              (char *)&one, sizeof(one)) < 0) {
+    int e = errorNumber;
+    closesocket(sock);
+    throw SocketException("unable to set SO_REUSEPORT", e);
+  }
+#endif
+
   if (bind(sock, &sa.u.sa, listenaddrlen) == -1) {
     int e = errorNumber;
     closesocket(sock);
     throw SocketException("failed to bind socket, is someone else on our -websocketPort?", e);
   }
 
+  return sock;
+}
+
+WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
+                         socklen_t listenaddrlen,
+                         bool sslonly, const char *cert, const char *certkey,
+                         bool disablebasicauth,
+                         const char *httpdir)
+{
+  vnc_sockaddr_t sa;
+  int sock;
+  unsigned i;
+
+#ifdef SO_REUSEPORT
+  const bool reuseport = rfb::Server::websocketReusePort &&
+                         rfb::Server::websocketThreads > 1;
+#else
+  const bool reuseport = false;
+#endif
+
+  memcpy (&sa, listenaddr, listenaddrlen);
+  sock = bindWebsocket(listenaddr, listenaddrlen, reuseport);
+
   listen(sock); // sets the internal fd
 
+  // A reconnect storm easily overflows the default backlog
+  ::listen(sock, SOMAXCONN);
+
+  // One listening socket per event loop, so they don't all wake up for
+  // every connection and then fight over it
+  settings.listen_socks = NULL;
+  if (reuseport) {
+    // Same port as the first, even if that one was picked for us
+    vnc_sockaddr_t bound;
+    socklen_t boundlen = sizeof(bound);
+    getsockname(sock, &bound.u.sa, &boundlen);
+
+    settings.listen_socks = new int[rfb::Server::websocketThreads];
+    settings.listen_socks[0] = sock;
+    for (i = 1; i < (unsigned) rfb::Server::websocketThreads; i++) {
+      settings.listen_socks[i] = bindWebsocket(&bound.u.sa, boundlen, true);
+      if (::listen(settings.listen_socks[i], SOMAXCONN) < 0)
+        throw SocketException("unable to set socket to listening mode", errorNumber);
+    }
+    vlog.info("Websocket port shared by %d listeners", (int) rfb::Server::websocketThreads);
+  }
+
   //
   // External TCP socket now created. Create the internal ones
   //
@@ -688,12 +851,15 @@ WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
   settings.cert = cert;
   settings.key = certkey;
   settings.ssl_only = sslonly;
+  settings.ktls = rfb::Server::kernelTLS;
   settings.verbose = vlog.getLevel() >= vlog.LEVEL_DEBUG;
   settings.httpdir = NULL;
   if (httpdir && httpdir[0])
     settings.httpdir = realpath(httpdir, NULL);
 
   settings.listen_sock = sock;
+  settings.threads = rfb::Server::websocketThreads;
+  settings.pin_threads = rfb::Server::websocketPinThreads;
 
   settings.messager = messager = new GetAPIMessager(settings.passwdfile);
   settings.screenshotCb = screenshotCb;
@@ -720,6 +886,8 @@ WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
   settings.getSessionsCb = getSessionsCb;
   settings.get_system_stats_cb = get_system_stats_cb;
 
+  settings.handoffCb = handoffCb;
+
   openssl_threads();
 
   pthread_t tid;
@@ -734,7 +902,30 @@ WebsocketListener::WebsocketListener(const struct sockaddr *listenaddr,
 }
 
 Socket* WebsocketListener::createSocket(int fd) {
-  return new WebSocket(fd);
+  struct sockaddr_un addr;
+  socklen_t len = sizeof(struct sockaddr_un);
+  PendingWebSocket pending = { NULL, -1 };
+
+  memset(&addr, 0, sizeof(addr));
+  if (getpeername(fd, (struct sockaddr *) &addr, &len) == 0) {
+    pthread_mutex_lock(&pendingWebSocketsMutex);
+    std::map<std::string, PendingWebSocket>::iterator it =
+      pendingWebSockets.find(addr.sun_path + 1);
+    if (it != pendingWebSockets.end()) {
+      pending = it->second;
+      pendingWebSockets.erase(it);
+    }
+    pthread_mutex_unlock(&pendingWebSocketsMutex);
+  }
+
+  if (!pending.ctx)
+    return new WebSocket(fd);
+
+  // The unix socket was only there to wake us up
+  closesocket(fd);
+  closesocket(pending.wakeSock);
+
+  return new WebSocket(pending.ctx, addr.sun_path + 1);
 }
 
 void WebsocketListener::getMyAddresses(std::list<char*>* result) {
@@ -43,6 +43,8 @@
 /* Tunnelling support. */
 #define TUNNEL_PORT_OFFSET 5500
 
+struct ws_ctx_t;
+
 namespace network {
 
   /* Tunnelling support. */
@@ -67,11 +69,18 @@ namespace network {
   class WebSocket : public Socket {
   public:
     WebSocket(int sock);
+    // A client the websocket server has done the handshake for, framed
+    // directly on its TCP socket rather than through the proxy
+    WebSocket(ws_ctx_t *ctx, const char *name);
+    virtual ~WebSocket();
 
     virtual char* getPeerAddress();
     virtual char* getPeerEndpoint();
 
-    virtual bool cork(bool enable) { return true; }
+    virtual bool cork(bool enable);
+
+  private:
+    char *peerName;
   };
 
   class TcpListener : public SocketListener {
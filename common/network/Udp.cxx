@@ -21,24 +21,36 @@
 #endif
 
 #include <arpa/inet.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <time.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <list>
+#include <vector>
 
 #include <network/GetAPI.h>
 #include <network/Udp.h>
+#include <network/UdpFec.h>
 #include <network/webudp/WuHost.h>
 #include <network/webudp/Wu.h>
 #include <network/websocket.h>
 #include <rfb/LogWriter.h>
 #include <rfb/ServerCore.h>
-#include <rfb/xxhash.h>
 
 using namespace network;
 
 static rfb::LogWriter vlog("WebUdp");
 static WuHost *host = NULL;
+// Clients may be encoded, and so flushed, from several threads at once
+static pthread_mutex_t sendmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t pacer;
+static std::list<UdpStream *> streams;
+
+static void *udppacer(void *);
 
 rfb::IntParameter udpSize("udpSize", "UDP packet data size", 1296, 500, 1400);
 
@@ -64,6 +76,8 @@ void *udpserver(void *nport) {
 
 	__sync_bool_compare_and_swap(&host, host, myhost);
 
+	pthread_create(&pacer, NULL, udppacer, NULL);
+
 	GetAPIMessager *msgr = (GetAPIMessager *) settings.messager;
 
 	WuHostSetErrorCallback(host, udperr);
@@ -81,9 +95,18 @@ void *udpserver(void *nport) {
 				addr = WuClientGetAddress(e.client);
 				msgr->netUdpUpgrade(e.client, htonl(addr.host));
 			break;
-			case WuEvent_ClientLeave:
+			case WuEvent_ClientLeave: {
 				vlog.info("client leave");
+
+				// The pacer may still hold pieces for it
+				pthread_mutex_lock(&sendmutex);
+				std::list<UdpStream *>::iterator it;
+				for (it = streams.begin(); it != streams.end(); it++)
+					(*it)->clientGone(e.client);
+				pthread_mutex_unlock(&sendmutex);
+
 				WuHostRemoveClient(host, e.client);
+			}
 			break;
 			default:
 				vlog.error("client sent data, this is unexpected");
@@ -94,68 +117,323 @@ void *udpserver(void *nport) {
 	return NULL;
 }
 
-// Send one packet, split into N UDP-sized pieces
-static uint8_t udpsend(WuClient *client, const uint8_t *data, unsigned len, uint32_t *id,
-			const uint32_t *frame) {
-	const uint32_t DATA_MAX = udpSize;
-
-	uint8_t buf[1400 + sizeof(uint32_t) * 5];
-	const uint32_t pieces = (len / DATA_MAX) + ((len % DATA_MAX) ? 1 : 0);
+// Messages of at most this many pieces are interactive (typing, small
+// changes) and skip the pacing. Everything sent over UDP is framebuffer
+// data, the cursor goes over the websocket, so they still must not get
+// ahead of an earlier update: while bulk pieces are waiting they queue
+// behind them.
+#define INTERACTIVE_PIECES 4
+
+// Most the token bucket holds, as time at the current rate, but always
+// enough for a decent batch of pieces
+#define BURST_MS 2
+#define MIN_BURST (16 * 1024)
+
+// The bandwidth estimate falls back to its first window after every pause,
+// so pacing only follows it up, and never goes below this. What the client
+// reports brings it down: a quarter off for a report with more than 2% of
+// pieces lost. A clean report while pieces were kept waiting ramps it up
+// an eighth.
+#define MIN_RATE (1024 * 1024)
+#define LOSS_BACKOFF 0.02
+
+struct network::UdpMessage {
+	std::vector<uint8_t> buf;
+	std::vector<const uint8_t *> ptrs;
+	std::vector<int32_t> lens;
+	uint32_t count;
+	uint32_t next;
+	struct timeval queued;
+};
+
+static pthread_cond_t sendcond = PTHREAD_COND_INITIALIZER;
+
+static unsigned msSince(const struct timeval &then, const struct timeval &now) {
+	return (now.tv_sec - then.tv_sec) * 1000 + (now.tv_usec - then.tv_usec) / 1000;
+}
 
-	uint32_t i;
+// Sends what each stream's rate allows, and sleeps until one can send more
+// or something new is queued
+static void *udppacer(void *) {
+	pthread_mutex_lock(&sendmutex);
 
-	for (i = 0; i < pieces; i++) {
-		const unsigned curlen = len > DATA_MAX ? DATA_MAX : len;
-		const uint32_t hash = XXH64(data, curlen, 0);
+	while (1) {
+		struct timeval now;
+		int wait = -1;
 
-		memcpy(buf, id, sizeof(uint32_t));
-		memcpy(&buf[4], &i, sizeof(uint32_t));
-		memcpy(&buf[8], &pieces, sizeof(uint32_t));
-		memcpy(&buf[12], &hash, sizeof(uint32_t));
-		memcpy(&buf[16], frame, sizeof(uint32_t));
+		gettimeofday(&now, NULL);
 
-		memcpy(&buf[20], data, curlen);
-		data += curlen;
-		len -= curlen;
+		std::list<UdpStream *>::iterator it;
+		for (it = streams.begin(); it != streams.end(); it++) {
+			const int ms = (*it)->sendQueued(now);
+			if (ms >= 0 && (wait < 0 || ms < wait))
+				wait = ms;
+		}
 
-		if (WuHostSendBinary(host, client, buf, curlen + sizeof(uint32_t) * 5) < 0)
-			return 1;
+		if (wait < 0) {
+			pthread_cond_wait(&sendcond, &sendmutex);
+		} else {
+			struct timespec ts;
+			ts.tv_sec = now.tv_sec + wait / 1000;
+			ts.tv_nsec = (now.tv_usec + (wait % 1000) * 1000) * 1000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&sendcond, &sendmutex, &ts);
+		}
 	}
 
-	(*id)++;
-
-	return 0;
+	return NULL;
 }
 
 UdpStream::UdpStream(): OutStream(), client(NULL), total_len(0), id(0), failed(false),
-	                frame(0) {
+	                frame(0), fec(false), loss(0), rate(0), tokens(0), backlogged(false), queued(0),
+	                sent(0), delaySum(0), delayCount(0), delayMax(0) {
 	ptr = data;
 	end = data + UDPSTREAM_BUFSIZE;
 
+	gettimeofday(&lastRefill, NULL);
+
 	srand(time(NULL));
+
+	pthread_mutex_lock(&sendmutex);
+	streams.push_back(this);
+	pthread_mutex_unlock(&sendmutex);
+}
+
+UdpStream::~UdpStream() {
+	pthread_mutex_lock(&sendmutex);
+	streams.remove(this);
+	pthread_mutex_unlock(&sendmutex);
+
+	dropQueued();
+	while (!spare.empty()) {
+		delete spare.front();
+		spare.pop_front();
+	}
+}
+
+void UdpStream::setClient(WuClient *cli) {
+	pthread_mutex_lock(&sendmutex);
+	client = cli;
+	pthread_mutex_unlock(&sendmutex);
+}
+
+void UdpStream::clientGone(const WuClient *cli) {
+	if (client != cli)
+		return;
+
+	client = NULL;
+	dropQueued();
+}
+
+void UdpStream::dropQueued() {
+	while (!interactive.empty()) {
+		delete interactive.front();
+		interactive.pop_front();
+	}
+	while (!bulk.empty()) {
+		delete bulk.front();
+		bulk.pop_front();
+	}
+	queued = 0;
 }
 
 void UdpStream::flush() {
 	const unsigned len = ptr - data;
 	total_len += len;
 
-	if (client) {
-		if (udpsend(client, data, len, &id, &frame)) {
-			vlog.error("Error sending udp, client gone?");
-			failed = true;
-		}
-	} else {
+	if (!client) {
 		vlog.error("Tried to send udp without a client");
+		ptr = data;
+		return;
+	}
+
+	const uint32_t pieces = (len + udpSize - 1) / udpSize;
+	const unsigned group = fec ? udpFecGroupSize(loss, pieces) : 0;
+	const uint32_t count = udpPieceCount(len, udpSize, group);
+
+	pthread_mutex_lock(&sendmutex);
+
+	const bool wasFailed = failed;
+	UdpMessage *msg;
+	if (!spare.empty()) {
+		msg = spare.front();
+		spare.pop_front();
+	} else {
+		msg = new UdpMessage;
 	}
 
+	msg->buf.resize(len + count * (UDP_PIECE_HEADER + UDP_PARITY_EXTRA) +
+			(count - pieces) * udpSize);
+	msg->ptrs.resize(count);
+	msg->lens.resize(count);
+	msg->count = udpBuildPieces(msg->buf.data(), msg->ptrs.data(), msg->lens.data(),
+				    data, len, udpSize, id, frame, group);
+	msg->next = 0;
+	gettimeofday(&msg->queued, NULL);
+	id++;
+
+	for (uint32_t i = 0; i < msg->count; i++)
+		queued += msg->lens[i];
+
+	const bool urgent = pieces <= INTERACTIVE_PIECES && bulk.empty();
+	if (urgent)
+		interactive.push_back(msg);
+	else
+		bulk.push_back(msg);
+
+	// Interactive updates, and everything when not pacing, go out right
+	// away, the rest is up to the pacer
+	if (!rate || urgent)
+		sendQueued(msg->queued);
+	if (!bulk.empty())
+		pthread_cond_signal(&sendcond);
+
+	pthread_mutex_unlock(&sendmutex);
+
+	if (failed && !wasFailed)
+		vlog.error("Error sending udp, client gone?");
+
 	ptr = data;
 }
 
+int UdpStream::sendQueued(const struct timeval &now) {
+	if (interactive.empty() && bulk.empty())
+		return -1;
+
+	// Left while this was queued
+	if (!client) {
+		dropQueued();
+		return -1;
+	}
+
+	if (rate) {
+		const size_t burst = std::max((size_t) (rate * BURST_MS / 1000),
+					      (size_t) MIN_BURST);
+		tokens += rate * ((now.tv_sec - lastRefill.tv_sec) +
+				  (now.tv_usec - lastRefill.tv_usec) / 1000000.0);
+		if (tokens > burst)
+			tokens = burst;
+	}
+	lastRefill = now;
+
+	while (!interactive.empty() || !bulk.empty()) {
+		// Interactive messages go out regardless, bulk ones pay it back
+		const bool urgent = !interactive.empty();
+		UdpMessage *msg = urgent ? interactive.front() : bulk.front();
+		size_t bytes = 0;
+		uint32_t n = 0;
+
+		while (msg->next + n < msg->count) {
+			const int32_t len = msg->lens[msg->next + n];
+			if (rate && !urgent && bytes + len > tokens)
+				break;
+			bytes += len;
+			n++;
+		}
+
+		if (!n)
+			break;
+
+		if (WuHostSendBinaryBatch(host, client, &msg->ptrs[msg->next],
+					  &msg->lens[msg->next], n) < 0)
+			failed = true;
+
+		msg->next += n;
+		if (rate)
+			tokens -= bytes;
+		queued -= bytes;
+		sent += bytes;
+
+		if (msg->next == msg->count) {
+			const unsigned delay = msSince(msg->queued, now);
+			delaySum += delay;
+			delayCount++;
+			if (delay > delayMax)
+				delayMax = delay;
+
+			if (urgent)
+				interactive.pop_front();
+			else
+				bulk.pop_front();
+
+			if (spare.size() < 4)
+				spare.push_back(msg);
+			else
+				delete msg;
+		}
+	}
+
+	if (bulk.empty())
+		return -1;
+
+	backlogged = true;
+
+	// Time until there are tokens for the next piece
+	const UdpMessage *msg = bulk.front();
+	const double needed = msg->lens[msg->next] - tokens;
+
+	return std::max((int) (needed * 1000 / rate), 1);
+}
+
+void UdpStream::setRate(const size_t bytesPerSecond) {
+	pthread_mutex_lock(&sendmutex);
+	if (!bytesPerSecond)
+		rate = 0;
+	else
+		rate = std::max(std::max(rate, bytesPerSecond), (size_t) MIN_RATE);
+	pthread_mutex_unlock(&sendmutex);
+}
+
+size_t UdpStream::queuedBytes() const {
+	pthread_mutex_lock(&sendmutex);
+	const size_t ret = queued;
+	pthread_mutex_unlock(&sendmutex);
+
+	return ret;
+}
+
+size_t UdpStream::sentBytes() const {
+	pthread_mutex_lock(&sendmutex);
+	const size_t ret = sent;
+	pthread_mutex_unlock(&sendmutex);
+
+	return ret;
+}
+
+void UdpStream::getQueueDelay(unsigned &avg, unsigned &max) {
+	pthread_mutex_lock(&sendmutex);
+	avg = delayCount ? delaySum / delayCount : 0;
+	max = delayMax;
+	delaySum = delayCount = delayMax = 0;
+	pthread_mutex_unlock(&sendmutex);
+}
+
 void UdpStream::overrun(size_t needed) {
 	vlog.error("Udp buffer overrun");
 	abort();
 }
 
+void UdpStream::reportLoss(const unsigned lost, const unsigned total) {
+	if (!total || lost > total)
+		return;
+
+	// Smooth over a few reports, a single bad one shouldn't swing it
+	loss = loss * 0.75 + (double) lost / total * 0.25;
+
+	pthread_mutex_lock(&sendmutex);
+	if (rate) {
+		if ((double) lost / total > LOSS_BACKOFF)
+			rate = std::max(rate * 3 / 4, (size_t) MIN_RATE);
+		else if (backlogged)
+			rate += rate / 8;
+	}
+	backlogged = false;
+	pthread_mutex_unlock(&sendmutex);
+}
+
 bool UdpStream::isFailed() const {
 	return failed;
 }
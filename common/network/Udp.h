@@ -20,6 +20,8 @@
 #define __NETWORK_UDP_H__
 
 #include <stdint.h>
+#include <sys/time.h>
+#include <deque>
 #include <rdr/OutStream.h>
 
 void *udpserver(void *unused);
@@ -29,30 +31,74 @@ namespace network {
 
 	#define UDPSTREAM_BUFSIZE (1024 * 1024)
 
+	struct UdpMessage;
+
 	class UdpStream: public rdr::OutStream {
 		public:
 			UdpStream();
+			virtual ~UdpStream();
 			virtual void flush();
 			virtual size_t length() { return total_len; }
 			virtual void overrun(size_t needed);
 
-			void setClient(WuClient *cli) {
-				client = cli;
-			}
+			void setClient(WuClient *cli);
+
+			// The client left and is about to be freed, nothing may be
+			// sent to it from now on. Needs the send lock.
+			void clientGone(const WuClient *cli);
 
 			void setFrameNumber(const unsigned in) {
 				frame = in;
 			}
 
+			// Only for clients that can rebuild pieces from parity
+			void setFec(const bool on) {
+				fec = on;
+			}
+
+			// The client saw lost of the last total pieces go missing
+			void reportLoss(const unsigned lost, const unsigned total);
+
+			// Pace bulk updates at no less than this many bytes per
+			// second, 0 sends everything at once. Loss reports bring
+			// the rate down again.
+			void setRate(const size_t bytesPerSecond);
+
+			// Bytes flushed but still waiting for their turn, and bytes
+			// actually sent
+			size_t queuedBytes() const;
+			size_t sentBytes() const;
+
+			// Average and longest time messages waited to be sent since
+			// the last call, in ms
+			void getQueueDelay(unsigned &avg, unsigned &max);
+
+			// Sends what the rate allows. Returns the ms until more can
+			// be sent, or -1 if nothing is left. Needs the send lock.
+			int sendQueued(const struct timeval &now);
+
 			bool isFailed() const;
 			void clearFailed();
 		private:
+			void dropQueued();
+
 			uint8_t data[UDPSTREAM_BUFSIZE];
 			WuClient *client;
 			size_t total_len;
 			uint32_t id;
 			bool failed;
 			uint32_t frame;
+			bool fec;
+			double loss;
+
+			std::deque<UdpMessage *> interactive, bulk, spare;
+			size_t rate;
+			double tokens;
+			bool backlogged;
+			struct timeval lastRefill;
+			size_t queued, sent;
+			unsigned long long delaySum, delayCount;
+			unsigned delayMax;
 	};
 }
 
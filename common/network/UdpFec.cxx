@@ -0,0 +1,147 @@
+/* Copyright (C) Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <network/UdpFec.h>
+#include <rfb/xxhash.h>
+
+using namespace network;
+
+// Below this, the odd full frame costs less than parity on everything
+static const double MIN_FEC_LOSS = 0.001;
+
+// Chance a message should have of arriving whole
+static const double MIN_COMPLETION = 0.95;
+
+unsigned network::udpFecGroupSize(double loss, uint32_t pieces) {
+	static const unsigned sizes[] = { 32, 16, 8, 4, 2 };
+	unsigned i, best;
+	double most;
+
+	if (loss < MIN_FEC_LOSS)
+		return 0;
+
+	// The least parity that still gets nearly every message through. A
+	// group only fails once more than one of its pieces is lost.
+	//
+	// Large messages on a bad link may not get there at all, then go for
+	// whatever gets the most of them through on average.
+	best = 0;
+	most = pow(1 - loss, pieces);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		const unsigned n = sizes[i] + 1;
+		const double failure = 1 - pow(1 - loss, n) -
+		                       n * loss * pow(1 - loss, n - 1);
+		const unsigned groups = (pieces + sizes[i] - 1) / sizes[i];
+		const double completion = pow(1 - failure, groups);
+		const double useful = completion * pieces / (pieces + groups);
+
+		if (completion >= MIN_COMPLETION)
+			return sizes[i];
+
+		if (useful > most) {
+			best = sizes[i];
+			most = useful;
+		}
+	}
+
+	return best;
+}
+
+uint32_t network::udpPieceCount(unsigned len, unsigned pieceSize, unsigned group) {
+	const uint32_t pieces = (len + pieceSize - 1) / pieceSize;
+
+	if (!group)
+		return pieces;
+
+	return pieces + (pieces + group - 1) / group;
+}
+
+static void writeHeader(uint8_t *buf, uint32_t id, uint32_t index, uint32_t count,
+                        const uint8_t *payload, unsigned len, uint32_t frame) {
+	const uint32_t hash = XXH64(payload, len, 0);
+
+	memcpy(buf, &id, sizeof(uint32_t));
+	memcpy(&buf[4], &index, sizeof(uint32_t));
+	memcpy(&buf[8], &count, sizeof(uint32_t));
+	memcpy(&buf[12], &hash, sizeof(uint32_t));
+	memcpy(&buf[16], &frame, sizeof(uint32_t));
+}
+
+uint32_t network::udpBuildPieces(uint8_t *out, const uint8_t **ptrs, int32_t *lens,
+                                 const uint8_t *data, unsigned len, unsigned pieceSize,
+                                 uint32_t id, uint32_t frame, unsigned group) {
+	const uint32_t pieces = (len + pieceSize - 1) / pieceSize;
+	const uint32_t count = pieces | (group << 16);
+
+	uint8_t parity[UDP_PARITY_EXTRA + 1400];
+	uint16_t paritylen = 0;
+	uint32_t i, n;
+
+	n = 0;
+	for (i = 0; i < pieces; i++) {
+		const unsigned curlen = len > pieceSize ? pieceSize : len;
+
+		writeHeader(out, id, i, count, data, curlen, frame);
+		memcpy(out + UDP_PIECE_HEADER, data, curlen);
+
+		ptrs[n] = out;
+		lens[n] = UDP_PIECE_HEADER + curlen;
+		out += lens[n];
+		n++;
+
+		if (group) {
+			unsigned j;
+
+			if (i % group == 0) {
+				memset(parity, 0, UDP_PARITY_EXTRA + pieceSize);
+				paritylen = 0;
+			}
+
+			paritylen ^= curlen;
+			for (j = 0; j < curlen; j++)
+				parity[UDP_PARITY_EXTRA + j] ^= data[j];
+
+			if ((i % group == group - 1) || (i == pieces - 1)) {
+				memcpy(parity, &paritylen, sizeof(uint16_t));
+
+				writeHeader(out, id, pieces + i / group, count,
+				            parity, UDP_PARITY_EXTRA + pieceSize, frame);
+				memcpy(out + UDP_PIECE_HEADER, parity,
+				       UDP_PARITY_EXTRA + pieceSize);
+
+				ptrs[n] = out;
+				lens[n] = UDP_PIECE_HEADER + UDP_PARITY_EXTRA + pieceSize;
+				out += lens[n];
+				n++;
+			}
+		}
+
+		data += curlen;
+		len -= curlen;
+	}
+
+	return n;
+}
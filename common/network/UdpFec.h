@@ -0,0 +1,57 @@
+/* Copyright (C) Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// Splitting UDP messages in to pieces, with optional XOR parity.
+//
+// Every piece starts with five 32-bit fields in host byte order: message
+// id, piece index, piece count, hash of the payload and frame number.
+//
+// With FEC the high 16 bits of the piece count hold the group size N.
+// After every N data pieces, and after the last one, comes a parity piece
+// whose index is the piece count plus the group number. Its payload is
+// the 16-bit XOR of the group's payload lengths, followed by the XOR of
+// the payloads zero padded to the piece size. Any one lost piece of a
+// group can be rebuilt from the others.
+//
+
+#ifndef __NETWORK_UDPFEC_H__
+#define __NETWORK_UDPFEC_H__
+
+#include <stdint.h>
+
+namespace network {
+
+	#define UDP_PIECE_HEADER (sizeof(uint32_t) * 5)
+	#define UDP_PARITY_EXTRA sizeof(uint16_t)
+
+	// Data pieces per parity piece for a message of the given number of
+	// pieces, 0 if the loss is too low to be worth it
+	unsigned udpFecGroupSize(double loss, uint32_t pieces);
+
+	// Number of pieces, parity included, a message of len bytes becomes
+	uint32_t udpPieceCount(unsigned len, unsigned pieceSize, unsigned group);
+
+	// Lays out the pieces of a message one after the other in out, and
+	// points ptrs and lens at each. Returns the number of pieces.
+	uint32_t udpBuildPieces(uint8_t *out, const uint8_t **ptrs, int32_t *lens,
+	                        const uint8_t *data, unsigned len, unsigned pieceSize,
+	                        uint32_t id, uint32_t frame, unsigned group);
+}
+
+#endif // __NETWORK_UDPFEC_H__
@@ -0,0 +1,388 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <rdr/Exception.h>
+#include <network/WebSocketStream.h>
+#include <rfb/LogWriter.h>
+#include "websocket.h"
+
+using namespace network;
+using namespace rdr;
+
+static rfb::LogWriter vlog("WebSocket");
+
+// Big enough for several TLS records worth of data from the client
+static const size_t RAW_BUF_SIZE = 65536;
+
+// The most a single TLS record can carry
+static const size_t TLS_RECORD_SIZE = 16384;
+
+static const U8 OPCODE_CLOSE = 0x08;
+
+WebSocketInStream::WebSocketInStream(ws_ctx_t* ctx_)
+  : FdInStream(ctx_->sockfd), ctx(ctx_), rawLen(0),
+    frameLeft(0), maskPos(0), skipFrame(false)
+{
+  raw = new U8[RAW_BUF_SIZE];
+}
+
+WebSocketInStream::~WebSocketInStream()
+{
+  delete [] raw;
+}
+
+bool WebSocketInStream::fillBuffer(size_t maxSize, bool wait)
+{
+  while (true) {
+    size_t n;
+
+    n = decode((U8*)end, maxSize);
+    if (n != 0) {
+      end += n;
+      return true;
+    }
+
+    n = readWithTimeoutOrCallback(raw + rawLen, RAW_BUF_SIZE - rawLen, wait);
+    if (n == 0) {
+      if (!wait)
+        return false;
+      // Only part of a TLS record so far
+      continue;
+    }
+
+    rawLen += n;
+  }
+}
+
+size_t WebSocketInStream::decode(U8* out, size_t len)
+{
+  size_t pos, outLen;
+
+  pos = outLen = 0;
+
+  while ((pos < rawLen) && (outLen < len)) {
+    if (frameLeft == 0) {
+      const U8* hdr = raw + pos;
+      size_t avail = rawLen - pos;
+      size_t hdrLen = 2;
+      U64 payload;
+      U8 opcode;
+
+      if (avail < hdrLen)
+        break;
+
+      opcode = hdr[0] & 0x0f;
+      if (!(hdr[1] & 0x80))
+        throw Exception("WebSocket: client frame not masked");
+
+      payload = hdr[1] & 0x7f;
+      if (payload == 126)
+        hdrLen += 2;
+      else if (payload == 127)
+        hdrLen += 8;
+      hdrLen += 4;
+
+      if (avail < hdrLen)
+        break;
+
+      if (payload == 126) {
+        payload = (hdr[2] << 8) | hdr[3];
+      } else if (payload == 127) {
+        payload = 0;
+        for (int i = 0; i < 8; i++)
+          payload = (payload << 8) | hdr[2 + i];
+      }
+
+      // Hand out what we have first, the close is seen on the next call
+      if (opcode == OPCODE_CLOSE) {
+        if (outLen != 0)
+          break;
+        throw EndOfStream();
+      }
+
+      memcpy(mask, hdr + hdrLen - 4, 4);
+      maskPos = 0;
+      frameLeft = payload;
+      // Pings and pongs carry nothing for us
+      skipFrame = (opcode & 0x08) != 0;
+
+      pos += hdrLen;
+      continue;
+    }
+
+    size_t n = rawLen - pos;
+    if (n > frameLeft)
+      n = frameLeft;
+    if (!skipFrame && (n > len - outLen))
+      n = len - outLen;
+
+    if (!skipFrame) {
+      const U8* in = raw + pos;
+      for (size_t i = 0; i < n; i++)
+        out[outLen + i] = in[i] ^ mask[(maskPos + i) & 3];
+      maskPos = (maskPos + n) & 3;
+      outLen += n;
+    }
+
+    pos += n;
+    frameLeft -= n;
+  }
+
+  memmove(raw, raw + pos, rawLen - pos);
+  rawLen -= pos;
+
+  return outLen;
+}
+
+size_t WebSocketInStream::readFd(void* buf, size_t len)
+{
+  int n;
+
+  if (!ctx->ssl)
+    return FdInStream::readFd(buf, len);
+
+  n = SSL_read(ctx->ssl, buf, len);
+  if (n > 0)
+    return n;
+
+  switch (SSL_get_error(ctx->ssl, n)) {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+    return 0;
+  case SSL_ERROR_ZERO_RETURN:
+    throw EndOfStream();
+  case SSL_ERROR_SYSCALL:
+    if (errno == 0)
+      throw EndOfStream();
+    throw SystemException("SSL_read", errno);
+  default:
+    throw Exception("SSL_read: %s", ERR_error_string(ERR_get_error(), NULL));
+  }
+}
+
+bool WebSocketInStream::readPending()
+{
+  return ctx->ssl && (SSL_pending(ctx->ssl) > 0);
+}
+
+WebSocketOutStream::WebSocketOutStream(ws_ctx_t* ctx_)
+  : FdOutStream(ctx_->sockfd), ctx(ctx_),
+    headerLen(0), headerPos(0), payloadLeft(0), record(NULL),
+    recordLen(0), recordPayload(0), kernelTLS(false),
+    frames(0), writes(0), bytes(0)
+{
+  kernelTLS = ws_ktls_send(ctx);
+  if (ctx->ssl && !kernelTLS) {
+    record = new U8[TLS_RECORD_SIZE];
+    SSL_set_mode(ctx->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  }
+}
+
+WebSocketOutStream::~WebSocketOutStream()
+{
+  // The FdOutStream destructor would write out anything left unframed
+  try {
+    while (sentUpTo != ptr)
+      flushBuffer(true);
+  } catch (Exception&) {
+  }
+  sentUpTo = ptr;
+
+  if (frames)
+    vlog.info("Sent %llu bytes in %llu frames using %llu writes%s",
+              bytes, frames, writes, kernelTLS ? ", kernel TLS" : "");
+
+  delete [] record;
+
+  if (ctx->ssl)
+    SSL_free(ctx->ssl);
+  if (ctx->ssl_ctx)
+    SSL_CTX_free(ctx->ssl_ctx);
+  free_ws_ctx(ctx);
+}
+
+void WebSocketOutStream::startFrame(size_t len)
+{
+  header[0] = 0x80 | OPCODE_BINARY;
+  if (len <= 125) {
+    header[1] = len;
+    headerLen = 2;
+  } else if (len <= 65535) {
+    header[1] = 126;
+    header[2] = len >> 8;
+    header[3] = len;
+    headerLen = 4;
+  } else {
+    header[1] = 127;
+    for (int i = 0; i < 8; i++)
+      header[2 + i] = (U64)len >> (56 - i * 8);
+    headerLen = 10;
+  }
+
+  headerPos = 0;
+  payloadLeft = len;
+  frames++;
+}
+
+bool WebSocketOutStream::flushBuffer(bool wait)
+{
+  bool progress;
+
+  // Start on the next frame once the previous one is out
+  if ((headerPos == headerLen) && (payloadLeft == 0) && (recordLen == 0))
+    startFrame(ptr - sentUpTo);
+
+  if (!waitForWrite((blocking || wait)? timeoutms : 0)) {
+    // If non-blocking then we're done here
+    if (!blocking && !wait)
+      return false;
+
+    throw TimedOut();
+  }
+
+  if (ctx->ssl && !kernelTLS)
+    progress = writeRecord();
+  else
+    progress = writeFrame();
+
+  if (!progress && !blocking && !wait)
+    return false;
+
+  return true;
+}
+
+bool WebSocketOutStream::writeFrame()
+{
+  struct iovec iov[2];
+  struct msghdr msg;
+  ssize_t n;
+  size_t len;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+
+  if (headerPos < headerLen) {
+    iov[msg.msg_iovlen].iov_base = header + headerPos;
+    iov[msg.msg_iovlen].iov_len = headerLen - headerPos;
+    msg.msg_iovlen++;
+  }
+  if (payloadLeft != 0) {
+    iov[msg.msg_iovlen].iov_base = sentUpTo;
+    iov[msg.msg_iovlen].iov_len = payloadLeft;
+    msg.msg_iovlen++;
+  }
+
+  do {
+    n = sendmsg(getFd(), &msg, MSG_DONTWAIT);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return false;
+    throw SystemException("write", errno);
+  }
+
+  writes++;
+  bytes += n;
+  gettimeofday(&lastWrite, NULL);
+
+  len = headerLen - headerPos;
+  if (len > (size_t)n)
+    len = n;
+  headerPos += len;
+  n -= len;
+
+  sentUpTo += n;
+  payloadLeft -= n;
+
+  return true;
+}
+
+bool WebSocketOutStream::writeRecord()
+{
+  int n;
+
+  // Pack as much as we have in to one record, so that only the last
+  // record of a flush is ever short
+  if (recordLen == 0) {
+    recordPayload = 0;
+
+    while (recordLen < TLS_RECORD_SIZE) {
+      size_t len;
+
+      if ((headerPos == headerLen) && (payloadLeft == 0)) {
+        len = ptr - (sentUpTo + recordPayload);
+        if (len == 0)
+          break;
+        startFrame(len);
+      }
+
+      len = headerLen - headerPos;
+      if (len > TLS_RECORD_SIZE - recordLen)
+        len = TLS_RECORD_SIZE - recordLen;
+      memcpy(record + recordLen, header + headerPos, len);
+      headerPos += len;
+      recordLen += len;
+
+      len = payloadLeft;
+      if (len > TLS_RECORD_SIZE - recordLen)
+        len = TLS_RECORD_SIZE - recordLen;
+      memcpy(record + recordLen, sentUpTo + recordPayload, len);
+      payloadLeft -= len;
+      recordPayload += len;
+      recordLen += len;
+    }
+  }
+
+  n = SSL_write(ctx->ssl, record, recordLen);
+  if (n <= 0) {
+    switch (SSL_get_error(ctx->ssl, n)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      // Has to be retried with the same record
+      return false;
+    case SSL_ERROR_ZERO_RETURN:
+      throw EndOfStream();
+    case SSL_ERROR_SYSCALL:
+      throw SystemException("SSL_write", errno);
+    default:
+      throw Exception("SSL_write: %s", ERR_error_string(ERR_get_error(), NULL));
+    }
+  }
+
+  writes++;
+  bytes += n;
+  gettimeofday(&lastWrite, NULL);
+
+  sentUpTo += recordPayload;
+  recordLen = 0;
+
+  return true;
+}
@@ -0,0 +1,100 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// WebSocketInStream and WebSocketOutStream speak HyBi WebSocket framing,
+// optionally over TLS, directly on the client's TCP socket. The handshake
+// has already been done by the websocket server thread.
+//
+
+#ifndef __NETWORK_WEBSOCKETSTREAM_H__
+#define __NETWORK_WEBSOCKETSTREAM_H__
+
+#include <rdr/FdInStream.h>
+#include <rdr/FdOutStream.h>
+
+struct ws_ctx_t;
+
+namespace network {
+
+  class WebSocketInStream : public rdr::FdInStream {
+  public:
+    WebSocketInStream(ws_ctx_t* ctx);
+    virtual ~WebSocketInStream();
+
+  private:
+    virtual bool fillBuffer(size_t maxSize, bool wait);
+
+    virtual size_t readFd(void* buf, size_t len);
+    virtual bool readPending();
+
+    // Moves as much frame payload as possible from the raw buffer
+    size_t decode(rdr::U8* out, size_t len);
+
+    ws_ctx_t* ctx;
+
+    rdr::U8* raw;
+    size_t rawLen;
+
+    // State of the frame currently being received
+    rdr::U64 frameLeft;
+    rdr::U8 mask[4];
+    unsigned maskPos;
+    bool skipFrame;
+  };
+
+  // The out stream owns the connection state, and frees it once the
+  // last data has been flushed
+  class WebSocketOutStream : public rdr::FdOutStream {
+  public:
+    WebSocketOutStream(ws_ctx_t* ctx);
+    virtual ~WebSocketOutStream();
+
+  private:
+    virtual bool flushBuffer(bool wait);
+
+    void startFrame(size_t len);
+
+    // Send as much of the current frame as the socket takes, returns
+    // false if nothing could be sent right now
+    bool writeFrame();
+    bool writeRecord();
+
+    ws_ctx_t* ctx;
+
+    // The frame header goes out on the side, the payload is sent
+    // straight from the stream buffer
+    rdr::U8 header[10];
+    size_t headerLen;
+    size_t headerPos;
+    size_t payloadLeft;
+
+    // With TLS, headers and payload are packed into full records
+    rdr::U8* record;
+    size_t recordLen;
+    size_t recordPayload;
+
+    // The kernel encrypts, so frames go out as if in the clear
+    bool kernelTLS;
+
+    rdr::U64 frames, writes, bytes;
+  };
+
+}
+
+#endif
@@ -0,0 +1,295 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "httpcache.h"
+
+#define CACHE_BUCKETS 256
+// Anything bigger, like downloads, is sent straight from disk
+#define CACHE_MAX_FILE (4 * 1024 * 1024)
+#define CACHE_MAX_TOTAL (64 * 1024 * 1024)
+
+static httpcache_file_t *buckets[CACHE_BUCKETS];
+static size_t cachedbytes;
+static uint64_t usetick;
+static pthread_mutex_t cachemutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned hashpath(const char *path) {
+    unsigned h = 2166136261u;
+
+    for (; *path; path++)
+        h = (h ^ (uint8_t) *path) * 16777619u;
+
+    return h % CACHE_BUCKETS;
+}
+
+static size_t filebytes(const httpcache_file_t *file) {
+    return file->size + file->gzlen + file->brlen;
+}
+
+static void freefile(httpcache_file_t *file) {
+    free(file->path);
+    free(file->data);
+    free(file->gz);
+    free(file->br);
+    free(file);
+}
+
+// Unlinks *prev from its bucket, it is freed once no longer in use
+static void dropfile(httpcache_file_t **prev) {
+    httpcache_file_t * const old = *prev;
+
+    *prev = old->next;
+    cachedbytes -= filebytes(old);
+    old->stale = 1;
+    if (!old->refs)
+        freefile(old);
+}
+
+// Makes room by dropping the least recently used file. Returns 0 if
+// there was nothing left to drop.
+static uint8_t evictoldest() {
+    httpcache_file_t **oldest = NULL, **prev;
+    unsigned i;
+
+    for (i = 0; i < CACHE_BUCKETS; i++) {
+        for (prev = &buckets[i]; *prev; prev = &(*prev)->next) {
+            if (!oldest || (*prev)->lastuse < (*oldest)->lastuse)
+                oldest = prev;
+        }
+    }
+
+    if (!oldest)
+        return 0;
+
+    dropfile(oldest);
+    return 1;
+}
+
+static uint8_t *readall(const int fd, const size_t len) {
+    uint8_t *buf = malloc(len ? len : 1);
+    size_t done = 0;
+
+    while (done < len) {
+        const ssize_t n = read(fd, buf + done, len - done);
+        if (n <= 0) {
+            free(buf);
+            return NULL;
+        }
+        done += n;
+    }
+
+    return buf;
+}
+
+// Only kept if it saves at least a tenth
+static void gzipfile(httpcache_file_t *file) {
+    z_stream zs;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    const size_t bound = deflateBound(&zs, file->size);
+    file->gz = malloc(bound);
+
+    zs.next_in = file->data;
+    zs.avail_in = file->size;
+    zs.next_out = file->gz;
+    zs.avail_out = bound;
+
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END ||
+        zs.total_out > (size_t) file->size - file->size / 10) {
+        free(file->gz);
+        file->gz = NULL;
+    } else {
+        file->gzlen = zs.total_out;
+    }
+
+    deflateEnd(&zs);
+}
+
+// A .br made when the web client was built is used as is
+static void loadbrotli(httpcache_file_t *file) {
+    char brpath[PATH_MAX + 4];
+    struct stat st;
+    int fd;
+
+    snprintf(brpath, sizeof(brpath), "%s.br", file->path);
+
+    fd = open(brpath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    // A leftover from an older version of the file is no use
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_mtime >= file->mtime &&
+        st.st_size < file->size) {
+        file->br = readall(fd, st.st_size);
+        if (file->br)
+            file->brlen = st.st_size;
+    }
+
+    close(fd);
+}
+
+// Otherwise it is compressed here, on the same terms as gzip. Quality 9
+// is well ahead of gzip already, the top levels take seconds on big files.
+static void brotlifile(httpcache_file_t *file) {
+#ifdef HAVE_BROTLI
+    size_t len = BrotliEncoderMaxCompressedSize(file->size);
+
+    if (!len)
+        return;
+
+    file->br = malloc(len);
+
+    if (!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE,
+                               file->size, file->data, &len, file->br) ||
+        len > (size_t) file->size - file->size / 10) {
+        free(file->br);
+        file->br = NULL;
+    } else {
+        file->brlen = len;
+    }
+#endif
+}
+
+static httpcache_file_t *loadfile(const char *path, const uint8_t compress) {
+    httpcache_file_t *file;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > CACHE_MAX_FILE) {
+        close(fd);
+        return NULL;
+    }
+
+    file = calloc(1, sizeof(httpcache_file_t));
+    file->path = strdup(path);
+    file->mtime = st.st_mtime;
+    file->size = st.st_size;
+    httpcache_etag(file->etag, &st);
+
+    file->data = readall(fd, st.st_size);
+    close(fd);
+
+    if (!file->data) {
+        freefile(file);
+        return NULL;
+    }
+
+    if (compress) {
+        gzipfile(file);
+        loadbrotli(file);
+        if (!file->br)
+            brotlifile(file);
+    }
+
+    return file;
+}
+
+void httpcache_etag(char *out, const struct stat *st) {
+    sprintf(out, "\"%lx-%llx\"", (unsigned long) st->st_mtime,
+            (unsigned long long) st->st_size);
+}
+
+const httpcache_file_t *httpcache_get(const char *inpath, const uint8_t compress) {
+    httpcache_file_t *file, **prev;
+    char path[PATH_MAX];
+    struct stat st;
+    unsigned i;
+
+    // "dir//file" and "dir/file" are the same entry
+    for (i = 0; *inpath && i < PATH_MAX - 1; inpath++) {
+        if (*inpath == '/' && i && path[i - 1] == '/')
+            continue;
+        path[i++] = *inpath;
+    }
+    path[i] = '\0';
+
+    const unsigned bucket = hashpath(path);
+
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > CACHE_MAX_FILE)
+        return NULL;
+
+    pthread_mutex_lock(&cachemutex);
+    for (file = buckets[bucket]; file; file = file->next) {
+        if (!strcmp(file->path, path))
+            break;
+    }
+    if (file && file->mtime == st.st_mtime && file->size == st.st_size) {
+        file->refs++;
+        file->lastuse = ++usetick;
+        pthread_mutex_unlock(&cachemutex);
+        return file;
+    }
+    pthread_mutex_unlock(&cachemutex);
+
+    // Compressing can take a moment, don't hold up the other loops
+    file = loadfile(path, compress);
+    if (!file)
+        return NULL;
+
+    pthread_mutex_lock(&cachemutex);
+
+    // Drop the old copy, or one another loop loaded meanwhile
+    for (prev = &buckets[bucket]; *prev; prev = &(*prev)->next) {
+        if (!strcmp((*prev)->path, path)) {
+            dropfile(prev);
+            break;
+        }
+    }
+
+    while (cachedbytes + filebytes(file) > CACHE_MAX_TOTAL && evictoldest())
+        ;
+
+    file->refs = 1;
+    file->lastuse = ++usetick;
+    file->next = buckets[bucket];
+    buckets[bucket] = file;
+    cachedbytes += filebytes(file);
+
+    pthread_mutex_unlock(&cachemutex);
+
+    return file;
+}
+
+void httpcache_release(const httpcache_file_t *cfile) {
+    httpcache_file_t * const file = (httpcache_file_t *) cfile;
+
+    pthread_mutex_lock(&cachemutex);
+    file->refs--;
+    if (file->stale && !file->refs)
+        freefile(file);
+    pthread_mutex_unlock(&cachemutex);
+}
@@ -0,0 +1,66 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifndef __NETWORK_HTTP_CACHE_H__
+#define __NETWORK_HTTP_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A web client file held in memory, with its compressed variants if they
+// are worth it. Entries are replaced when the file on disk changes, or
+// evicted least recently used first when the cache is full. Either way
+// the old one lives on until released.
+typedef struct httpcache_file_t {
+    char *path;
+    time_t mtime;
+    off_t size;
+    char etag[48];
+
+    uint8_t *data;
+    uint8_t *gz;
+    size_t gzlen;
+    uint8_t *br;
+    size_t brlen;
+
+    unsigned refs;
+    uint64_t lastuse;
+    uint8_t stale;
+    struct httpcache_file_t *next;
+} httpcache_file_t;
+
+// Returns the cached file, loading or reloading it as needed, or NULL if
+// it doesn't exist or is too large to cache. Gzip and brotli are only
+// tried for compress; a fresh "<path>.br" next to the file is preferred
+// to compressing it with brotli here.
+const httpcache_file_t *httpcache_get(const char *path, const uint8_t compress);
+void httpcache_release(const httpcache_file_t *file);
+
+// Same ETag as a cached copy of the file would have
+void httpcache_etag(char *out, const struct stat *st);
+
+#ifdef __cplusplus
+} // extern C
+#endif
+
+#endif
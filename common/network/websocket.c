@@ -23,6 +23,11 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <ftw.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -36,6 +41,7 @@
 #include <openssl/md5.h> /* md5 hash */
 #include <openssl/sha.h> /* sha1 hash */
 #include "websocket.h"
+#include "httpcache.h"
 #include "jsonescape.h"
 #include <network/Blacklist.h>
 
@@ -49,6 +55,20 @@ settings_t settings;
 
 extern int wakeuppipe[2];
 
+#define MAX_EVENTS 64
+#define HANDSHAKE_TIMEOUT 10
+#define REQUEST_MAX (16 * 1024)
+
+// Request workers: at most this many, and seconds an extra one stays idle
+#define WORKER_MAX 256
+#define WORKER_IDLE_TIMEOUT 30
+
+// HTTP keep-alive: seconds a connection may sit idle, requests per
+// connection, and idle connections each event loop holds on to
+#define KEEPALIVE_TIMEOUT 5
+#define KEEPALIVE_REQUESTS 100
+#define KEEPALIVE_MAX_IDLE 64
+
 extern char *extra_headers;
 extern unsigned extra_headers_len;
 
@@ -267,7 +287,6 @@ ws_ctx_t *ws_socket(ws_ctx_t *ctx, int socket) {
 }
 
 ws_ctx_t *ws_socket_ssl(ws_ctx_t *ctx, int socket, const char * certfile, const char * keyfile) {
-    int ret;
     char msg[1024];
     const char * use_keyfile;
     ws_socket(ctx, socket);
@@ -288,6 +307,13 @@ ws_ctx_t *ws_socket_ssl(ws_ctx_t *ctx, int socket, const char * certfile, const
 
     SSL_CTX_set_options(ctx->ssl_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
 
+#ifdef SSL_OP_ENABLE_KTLS
+    // Let the kernel do the encryption where it can, OpenSSL quietly
+    // stays in user space if the kernel or cipher has no support
+    if (settings.ktls)
+        SSL_CTX_set_options(ctx->ssl_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
     if (SSL_CTX_use_PrivateKey_file(ctx->ssl_ctx, use_keyfile,
                                     SSL_FILETYPE_PEM) <= 0) {
         sprintf(msg, "Unable to load private key file %s\n", use_keyfile);
@@ -304,19 +330,23 @@ ws_ctx_t *ws_socket_ssl(ws_ctx_t *ctx, int socket, const char * certfile, const
 //        fatal(msg);
 //    }
 
-    // Associate socket and ssl object
+    // Associate socket and ssl object. The caller runs the TLS handshake,
+    // so that it can wait for the client without blocking.
     ctx->ssl = SSL_new(ctx->ssl_ctx);
     SSL_set_fd(ctx->ssl, socket);
-
-    ret = SSL_accept(ctx->ssl);
-    if (ret < 0) {
-        ERR_print_errors_fp(stderr);
-        return NULL;
-    }
+    SSL_set_accept_state(ctx->ssl);
 
     return ctx;
 }
 
+int ws_ktls_send(ws_ctx_t *ctx) {
+#ifdef SSL_OP_ENABLE_KTLS
+    return ctx->ssl && BIO_get_ktls_send(SSL_get_wbio(ctx->ssl));
+#else
+    return 0;
+#endif
+}
+
 void ws_socket_free(ws_ctx_t *ctx) {
     if (ctx->ssl) {
         SSL_free(ctx->ssl);
@@ -962,9 +992,99 @@ static void dirlisting(ws_ctx_t *ws_ctx, const char fullpath[], const char path[
     weblog(200, wsthread_handler_id, 0, origip, ip, user, 1, path, totallen);
 }
 
-static void servefile(ws_ctx_t *ws_ctx, const char *in, const char * const user,
-                      const char * const ip, const char * const origip) {
+// Whether the request header line name: contains token
+static uint8_t hasHeaderToken(const char *in, const char *name, const char *token) {
+    const char *hdr = strcasestr(in, name);
+    if (!hdr)
+        return 0;
+
+    hdr += strlen(name);
+    const char *end = strchr(hdr, '\r');
+    if (!end)
+        end = hdr + strlen(hdr);
+
+    const unsigned toklen = strlen(token);
+    const char *pos;
+    for (pos = hdr; pos + toklen <= end; pos++) {
+        if (strncasecmp(pos, token, toklen))
+            continue;
+        if (pos != hdr && pos[-1] != ' ' && pos[-1] != ',' && pos[-1] != '\t')
+            continue;
+        if (pos + toklen != end && pos[toklen] != ',' && pos[toklen] != ';' &&
+            pos[toklen] != ' ')
+            continue;
+        return 1;
+    }
+
+    return 0;
+}
+
+static uint8_t isCompressible(const char *mime) {
+    return !strncmp(mime, "text/", 5) || !strcmp(mime, "application/javascript") ||
+           !strcmp(mime, "image/svg+xml");
+}
+
+static uint8_t sendAll(ws_ctx_t *ws_ctx, const void *buf, size_t len) {
+    while (len) {
+        const ssize_t sent = ws_send(ws_ctx, buf, len);
+        if (sent <= 0)
+            return 0;
+        buf = (const char *) buf + sent;
+        len -= sent;
+    }
+
+    return 1;
+}
+
+// Large files that aren't cached go from disk to the socket, without a
+// trip through user space where possible
+static uint8_t sendFd(ws_ctx_t *ws_ctx, const int fd, const uint64_t filesize) {
+    off_t offset = 0;
+
+#ifdef SSL_OP_ENABLE_KTLS
+    // The kernel encrypts, so the file needn't pass through us at all
+    if (ws_ktls_send(ws_ctx)) {
+        while ((uint64_t) offset < filesize) {
+            const ossl_ssize_t sent = SSL_sendfile(ws_ctx->ssl, fd, offset,
+                                                   filesize - offset, 0);
+            if (sent <= 0)
+                return 0;
+            offset += sent;
+        }
+        return 1;
+    }
+#endif
+
+    if (!ws_ctx->ssl) {
+        while ((uint64_t) offset < filesize) {
+            const ssize_t sent = sendfile(ws_ctx->sockfd, fd, &offset,
+                                          filesize - offset);
+            if (sent <= 0)
+                return 0;
+        }
+        return 1;
+    }
+
+    char buf[WS_MAX_BUF_SIZE * 4];
+    ssize_t count;
+    while ((count = read(fd, buf, sizeof(buf))) > 0) {
+        if (!sendAll(ws_ctx, buf, count))
+            return 0;
+        offset += count;
+    }
+
+    return (uint64_t) offset == filesize;
+}
+
+/*
+ * Web client files are served from memory, compressed when the client
+ * takes it, and revalidated by ETag. Returns 1 if the connection can be
+ * kept open for the next request.
+ */
+static uint8_t servefile(ws_ctx_t *ws_ctx, const char *in, const char * const user,
+                         const char * const ip, const char * const origip) {
     char buf[WS_MAX_BUF_SIZE], path[PATH_MAX], fullpath[PATH_MAX];
+    const char * const request = in;
 
     //fprintf(stderr, "http servefile input '%s'\n", in);
 
@@ -981,6 +1101,11 @@ static void servefile(ws_ctx_t *ws_ctx, const char *in, const char * const user,
         goto nope;
     }
 
+    // HTTP/1.1 connections stay open unless the client says otherwise
+    const uint8_t keepalive = !strncmp(end, " HTTP/1.1\r\n", 11) &&
+                              !hasHeaderToken(request, "\nConnection:", "close") &&
+                              ++ws_ctx->requests < KEEPALIVE_REQUESTS;
+
     end = memchr(in, '?', len);
     if (end)
         len = end - in;
@@ -1007,41 +1132,106 @@ static void servefile(ws_ctx_t *ws_ctx, const char *in, const char * const user,
     if (dir) {
         closedir(dir);
         dirlisting(ws_ctx, fullpath, buf, user, ip, origip);
-        return;
+        return 0;
     }
 
-    FILE *f = fopen(fullpath, "r");
-    if (!f) {
-        handler_msg("file not found or insufficient permissions\n");
-        goto nope;
+    const char * const mime = name2mime(path);
+    const httpcache_file_t *cached = NULL;
+    char etag[48], connection[64];
+    struct stat st;
+    int fd = -1;
+
+    // Downloads change under us and can be huge, leave them on disk
+    if (!strcasestr(path, "Downloads/"))
+        cached = httpcache_get(fullpath, isCompressible(mime));
+
+    if (cached) {
+        strcpy(etag, cached->etag);
+    } else {
+        fd = open(fullpath, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0)
+                close(fd);
+            handler_msg("file not found or insufficient permissions\n");
+            goto nope;
+        }
+        httpcache_etag(etag, &st);
+    }
+
+    if (keepalive)
+        sprintf(connection, "keep-alive\r\nKeep-Alive: timeout=%u, max=%u",
+                KEEPALIVE_TIMEOUT, KEEPALIVE_REQUESTS - ws_ctx->requests);
+    else
+        strcpy(connection, "close");
+
+    // The client already has this version
+    if (hasHeaderToken(request, "\nIf-None-Match:", etag)) {
+        sprintf(buf, "HTTP/1.1 304 Not Modified\r\n"
+                     "Server: KasmVNC/4.0\r\n"
+                     "Connection: %s\r\n"
+                     "ETag: %s\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "%s"
+                     "\r\n",
+                     connection, etag, extra_headers ? extra_headers : "");
+        const uint8_t ok = sendAll(ws_ctx, buf, strlen(buf));
+        weblog(304, wsthread_handler_id, 0, origip, ip, user, 1, path, strlen(buf));
+
+        if (cached)
+            httpcache_release(cached);
+        else
+            close(fd);
+        return ok && keepalive;
     }
 
-    fseeko(f, 0, SEEK_END);
-    const uint64_t filesize = ftello(f);
-    rewind(f);
+    const uint8_t *body = cached ? cached->data : NULL;
+    uint64_t filesize = cached ? (uint64_t) cached->size : (uint64_t) st.st_size;
+    const char *encoding = "";
+
+    if (cached && cached->br &&
+        hasHeaderToken(request, "\nAccept-Encoding:", "br")) {
+        body = cached->br;
+        filesize = cached->brlen;
+        encoding = "Content-Encoding: br\r\n";
+    } else if (cached && cached->gz &&
+               hasHeaderToken(request, "\nAccept-Encoding:", "gzip")) {
+        body = cached->gz;
+        filesize = cached->gzlen;
+        encoding = "Content-Encoding: gzip\r\n";
+    }
 
     sprintf(buf, "HTTP/1.1 200 OK\r\n"
                  "Server: KasmVNC/4.0\r\n"
-                 "Connection: close\r\n"
+                 "Connection: %s\r\n"
                  "Content-type: %s\r\n"
                  "Content-length: %" PRIu64 "\r\n"
                  "%s"
+                 "%s"
+                 "ETag: %s\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "%s"
                  "\r\n",
-                 name2mime(path), filesize, extra_headers ? extra_headers : "");
+                 connection, mime, filesize, encoding,
+                 cached && (cached->gz || cached->br) ? "Vary: Accept-Encoding\r\n" : "",
+                 etag, extra_headers ? extra_headers : "");
     const unsigned hdrlen = strlen(buf);
-    ws_send(ws_ctx, buf, hdrlen);
+    uint8_t ok = sendAll(ws_ctx, buf, hdrlen);
 
     //fprintf(stderr, "http servefile output '%s'\n", buf);
 
-    unsigned count;
-    while ((count = fread(buf, 1, WS_MAX_BUF_SIZE, f))) {
-        ws_send(ws_ctx, buf, count);
+    if (cached) {
+        if (ok)
+            ok = sendAll(ws_ctx, body, filesize);
+        httpcache_release(cached);
+    } else {
+        if (ok)
+            ok = sendFd(ws_ctx, fd, filesize);
+        close(fd);
     }
-    fclose(f);
 
     weblog(200, wsthread_handler_id, 0, origip, ip, user, 1, path, hdrlen + filesize);
 
-    return;
+    return ok && keepalive;
 nope:
     sprintf(buf, "HTTP/1.1 404 Not Found\r\n"
                  "Server: KasmVNC/4.0\r\n"
@@ -1052,6 +1242,7 @@ nope:
                  "404", extra_headers ? extra_headers : "");
     ws_send(ws_ctx, buf, strlen(buf));
     weblog(404, wsthread_handler_id, 0, origip, ip, user, 1, path, strlen(buf));
+    return 0;
 }
 
 static uint8_t allUsersPresent(const struct kasmpasswd_t * const inset) {
@@ -1888,74 +2079,22 @@ timeout:
     return 1;
 }
 
-ws_ctx_t *do_handshake(int sock, char * const ip) {
-    char handshake[16 * 1024], response[4096], sha1[29], trailer[17];
+/*
+ * Answers one request, read in full by the event loop. Returns the context
+ * once a websocket is set up, or NULL if the connection is done with. If an
+ * HTTP request was served and the connection stays open, *keepalive is set
+ * instead.
+ */
+ws_ctx_t *do_handshake(ws_ctx_t *ws_ctx, char *handshake, char * const ip,
+                       uint8_t *keepalive) {
+    char response[4096], sha1[29], trailer[17];
     char *scheme, *pre;
     headers_t *headers;
-    int len, i, offset;
-    ws_ctx_t * ws_ctx;
+    int len;
     char *response_protocol;
 
-    // Peek, but don't read the data
-    len = recv(sock, handshake, 1024, MSG_PEEK);
-    handshake[len] = 0;
-    if (len == 0) {
-        handler_msg("ignoring empty handshake\n");
-        return NULL;
-    } else if ((bcmp(handshake, "\x16", 1) == 0) ||
-               (bcmp(handshake, "\x80", 1) == 0)) {
-        // SSL
-        if (!settings.cert) {
-            handler_msg("SSL connection but no cert specified\n");
-            return NULL;
-        } else if (access(settings.cert, R_OK) != 0) {
-            handler_msg("SSL connection but '%s' not found\n",
-                        settings.cert);
-            return NULL;
-        }
-        ws_ctx = alloc_ws_ctx();
-        ws_socket_ssl(ws_ctx, sock, settings.cert, settings.key);
-        if (! ws_ctx) { return NULL; }
-        scheme = "wss";
-        handler_msg("using SSL socket\n");
-    } else if (settings.ssl_only) {
-        handler_msg("non-SSL connection disallowed\n");
-        return NULL;
-    } else {
-        ws_ctx = alloc_ws_ctx();
-        ws_socket(ws_ctx, sock);
-        if (! ws_ctx) { return NULL; }
-        scheme = "ws";
-        handler_msg("using plain (not SSL) socket\n");
-    }
-    offset = 0;
-    for (i = 0; i < 10; i++) {
-        /* (offset + 1): reserve one byte for the trailing '\0' */
-        if (0 > (len = ws_recv(ws_ctx, handshake + offset, sizeof(handshake) - (offset + 1)))) {
-            handler_emsg("Read error during handshake: %m\n");
-            free_ws_ctx(ws_ctx);
-            return NULL;
-        } else if (0 == len) {
-            handler_emsg("Client closed during handshake\n");
-            free_ws_ctx(ws_ctx);
-            return NULL;
-        }
-        offset += len;
-        handshake[offset] = 0;
-        if (strstr(handshake, "\r\n\r\n")) {
-            break;
-        } else if (sizeof(handshake) <= (size_t)(offset + 1)) {
-            handler_emsg("Oversized handshake\n");
-            send400(ws_ctx, "-", ip, ", too large");
-            free_ws_ctx(ws_ctx);
-            return NULL;
-        } else if (9 == i) {
-            handler_emsg("Incomplete handshake\n");
-            free_ws_ctx(ws_ctx);
-            return NULL;
-        }
-        usleep(10);
-    }
+    *keepalive = 0;
+    scheme = ws_ctx->ssl ? "wss" : "ws";
 
     // Proxied?
     char origip[64];
@@ -1996,7 +2135,6 @@ ws_ctx_t *do_handshake(int sock, char * const ip) {
                           "\r\n");
         ws_send(ws_ctx, response, strlen(response));
         weblog(401, wsthread_handler_id, 0, origip, ip, "-", 1, url, strlen(response));
-        free_ws_ctx(ws_ctx);
         return NULL;
     }
 
@@ -2013,7 +2151,6 @@ ws_ctx_t *do_handshake(int sock, char * const ip) {
                               "\r\n", extra_headers ? extra_headers : "");
             ws_send(ws_ctx, response, strlen(response));
             weblog(401, wsthread_handler_id, 0, origip, ip, "-", 1, url, strlen(response));
-            free_ws_ctx(ws_ctx);
             return NULL;
         }
 
@@ -2023,7 +2160,6 @@ ws_ctx_t *do_handshake(int sock, char * const ip) {
             wserr("Authentication attempt failed, client sent invalid BasicAuth\n");
             bl_addFailure(ip);
             send403(ws_ctx, origip, ip);
-            free_ws_ctx(ws_ctx);
             return NULL;
         }
         len = end - hdr;
@@ -2096,7 +2232,6 @@ ws_ctx_t *do_handshake(int sock, char * const ip) {
                               "\r\n", extra_headers ? extra_headers : "");
             ws_send(ws_ctx, response, strlen(response));
             weblog(401, wsthread_handler_id, 0, origip, ip, inuser, 1, url, strlen(response));
-            free_ws_ctx(ws_ctx);
             return NULL;
         }
         handler_emsg("BasicAuth matched\n");
@@ -2126,11 +2261,13 @@ ws_ctx_t *do_handshake(int sock, char * const ip) {
             }
         }
 
-        if (settings.httpdir && settings.httpdir[0])
-            servefile(ws_ctx, handshake, inuser, ip, origip);
+        if (settings.httpdir && settings.httpdir[0] &&
+            servefile(ws_ctx, handshake, inuser, ip, origip)) {
+            *keepalive = 1;
+            return NULL;
+        }
 
 done:
-        free_ws_ctx(ws_ctx);
         return NULL;
     }
 
@@ -2174,86 +2311,718 @@ void proxy_handler(ws_ctx_t *ws_ctx);
 
 __thread unsigned wsthread_handler_id;
 
-void *subthread(void *ptr) {
+// Only old style clients that need the proxy get a thread of their own
+static void *proxythread(void *ptr) {
 
     struct wspass_t * const pass = ptr;
+    ws_ctx_t * const ws_ctx = pass->ws_ctx;
+
+    wsthread_handler_id = pass->id;
+
+    proxy_handler(ws_ctx);
+    if (pipe_error) {
+        handler_emsg("Closing due to SIGPIPE\n");
+    }
+
+    free((void *) pass);
+
+    ws_socket_free(ws_ctx);
+    free_ws_ctx(ws_ctx);
+
+    handler_msg("handler exit\n");
+
+    return NULL;
+}
+
+static void set_socket_timeout(int sock, unsigned sec) {
+    struct timeval tv;
+    tv.tv_sec = sec;
+    tv.tv_usec = 0;
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static void set_socket_nonblock(int sock, uint8_t on) {
+    const int flags = fcntl(sock, F_GETFL);
+
+    fcntl(sock, F_SETFL, on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+/*
+ * Each event loop has its own epoll set, and lists of the connections it
+ * waits on: those yet to send a request, and kept alive ones between
+ * requests. Workers hand kept alive connections back to the loop that owns
+ * them through its eventfd.
+ */
+struct evloop_t {
+    int efd;
+    int wakefd;
+    pthread_mutex_t lock;
+    struct wspass_t *returned;
+
+    // Only touched by the loop itself. Closing holds those dropped while
+    // handling a batch of events, until the batch is done.
+    struct wspass_t *pending, *idle, *closing;
+    unsigned numidle;
+    time_t expired;
+};
+
+static struct evloop_t *loops;
+
+/*
+ * Requests run on a pool of workers, so that API calls, screenshots and
+ * downloads never hold up an event loop. The pool grows while all are
+ * busy, and shrinks back to one per loop when idle.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct wspass_t *head, *tail;
+    unsigned queued, idle, count;
+} workers = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// Where a connection is at while its event loop waits on it
+enum {
+    WS_DETECT,      // nothing read yet, TLS or not
+    WS_TLS,         // TLS handshake
+    WS_REQUEST,     // reading the request
+    WS_CLOSED,      // dropped, closed once the batch of events is done
+};
+
+// What a connection waits for next
+enum {
+    STEP_READ,
+    STEP_WRITE,
+    STEP_DONE,
+    STEP_CLOSE,
+};
+
+static void close_client(struct wspass_t *pass) {
+    if (pass->ws_ctx) {
+        ws_socket_free(pass->ws_ctx);
+        free_ws_ctx(pass->ws_ctx);
+    } else {
+        shutdown(pass->csock, SHUT_RDWR);
+        close(pass->csock);
+    }
+    free(pass->req);
+    free((void *) pass);
+}
+
+// Maps a failed TLS call to what it waits for
+static int ssl_step(ws_ctx_t *ws_ctx, int ret) {
+    switch (SSL_get_error(ws_ctx->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            return STEP_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return STEP_WRITE;
+        default:
+            return STEP_CLOSE;
+    }
+}
+
+static int read_request(struct wspass_t *pass) {
+    ws_ctx_t * const ws_ctx = pass->ws_ctx;
+    ssize_t len;
+
+    if (!pass->req && !(pass->req = malloc(REQUEST_MAX)))
+        { fatal("malloc of request"); }
+
+    while (1) {
+        /* (reqlen + 1): reserve one byte for the trailing '\0' */
+        len = ws_recv(ws_ctx, pass->req + pass->reqlen,
+                      REQUEST_MAX - (pass->reqlen + 1));
+        if (len <= 0) {
+            if (ws_ctx->ssl) {
+                const int step = ssl_step(ws_ctx, len);
+                if (step != STEP_CLOSE)
+                    return step;
+            } else if (len < 0 && errno == EINTR) {
+                continue;
+            } else if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return STEP_READ;
+            }
+
+            if (len < 0) {
+                handler_emsg("Read error during handshake: %m\n");
+            } else if (!pass->idle) {
+                handler_emsg("Client closed during handshake\n");
+            }
+            return STEP_CLOSE;
+        }
+
+        // The next request on a kept alive connection has started
+        if (pass->idle) {
+            pass->idle = 0;
+            pass->deadline = time(NULL) + HANDSHAKE_TIMEOUT;
+        }
+
+        pass->reqlen += len;
+        pass->req[pass->reqlen] = 0;
+        if (strstr(pass->req, "\r\n\r\n")) {
+            return STEP_DONE;
+        } else if (REQUEST_MAX <= pass->reqlen + 1) {
+            handler_emsg("Oversized handshake\n");
+            send400(ws_ctx, "-", pass->ip, ", too large");
+            return STEP_CLOSE;
+        }
+    }
+}
+
+/*
+ * Takes a connection as far as it goes without blocking: TLS or plain,
+ * the TLS handshake, then the request.
+ */
+static int advance_client(struct wspass_t *pass) {
+    char first;
+    ssize_t len;
+    int ret;
+
+    while (1) {
+        switch (pass->state) {
+            case WS_DETECT:
+                // Peek, but don't read the data
+                len = recv(pass->csock, &first, 1, MSG_PEEK);
+                if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                                errno == EINTR))
+                    return STEP_READ;
+                if (len <= 0) {
+                    handler_msg("ignoring empty handshake\n");
+                    return STEP_CLOSE;
+                }
+
+                if (first == '\x16' || first == '\x80') {
+                    if (!settings.cert) {
+                        handler_msg("SSL connection but no cert specified\n");
+                        return STEP_CLOSE;
+                    } else if (access(settings.cert, R_OK) != 0) {
+                        handler_msg("SSL connection but '%s' not found\n",
+                                    settings.cert);
+                        return STEP_CLOSE;
+                    }
+                    pass->ws_ctx = ws_socket_ssl(alloc_ws_ctx(), pass->csock,
+                                                 settings.cert, settings.key);
+                    handler_msg("using SSL socket\n");
+                    pass->state = WS_TLS;
+                } else if (settings.ssl_only) {
+                    handler_msg("non-SSL connection disallowed\n");
+                    return STEP_CLOSE;
+                } else {
+                    pass->ws_ctx = ws_socket(alloc_ws_ctx(), pass->csock);
+                    handler_msg("using plain (not SSL) socket\n");
+                    pass->state = WS_REQUEST;
+                }
+                break;
+            case WS_TLS:
+                ret = SSL_accept(pass->ws_ctx->ssl);
+                if (ret <= 0) {
+                    ret = ssl_step(pass->ws_ctx, ret);
+                    if (ret == STEP_CLOSE)
+                        ERR_print_errors_fp(stderr);
+                    return ret;
+                }
+
+                handler_msg("kernel TLS %s\n",
+                            ws_ktls_send(pass->ws_ctx) ? "active" : "not available");
+                pass->state = WS_REQUEST;
+                break;
+            default:
+                return read_request(pass);
+        }
+    }
+}
+
+static void unlink_client(struct evloop_t *loop, struct wspass_t *pass) {
+    if (pass->prev)
+        pass->prev->next = pass->next;
+    else if (pass->idle)
+        loop->idle = pass->next;
+    else
+        loop->pending = pass->next;
+
+    if (pass->next)
+        pass->next->prev = pass->prev;
+
+    if (pass->idle)
+        loop->numidle--;
+}
+
+// Waits on the connection until its deadline. The newest are at the front,
+// so the oldest idle ones go first when there are too many.
+static void wait_client(struct evloop_t *loop, struct wspass_t *pass,
+                        uint32_t events) {
+    struct wspass_t ** const head = pass->idle ? &loop->idle : &loop->pending;
+    struct epoll_event ev;
+
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = pass;
+    if (epoll_ctl(loop->efd, EPOLL_CTL_ADD, pass->csock, &ev) < 0) {
+        close_client(pass);
+        return;
+    }
+
+    pass->prev = NULL;
+    pass->next = *head;
+    if (*head)
+        (*head)->prev = pass;
+    *head = pass;
+
+    if (pass->idle && ++loop->numidle > KEEPALIVE_MAX_IDLE) {
+        struct wspass_t *old = loop->idle;
+        while (old->next)
+            old = old->next;
+
+        // It may still have an event further on in this batch
+        unlink_client(loop, old);
+        epoll_ctl(loop->efd, EPOLL_CTL_DEL, old->csock, NULL);
+        old->state = WS_CLOSED;
+        old->next = loop->closing;
+        loop->closing = old;
+    }
+}
+
+static void expire_list(struct evloop_t *loop, struct wspass_t *pass,
+                        const time_t now) {
+    struct wspass_t *next;
+
+    for (; pass; pass = next) {
+        next = pass->next;
+        if (now < pass->deadline)
+            continue;
+
+        if (!pass->idle) {
+            wsthread_handler_id = pass->id;
+            handler_emsg("Incomplete handshake\n");
+        }
+        unlink_client(loop, pass);
+        epoll_ctl(loop->efd, EPOLL_CTL_DEL, pass->csock, NULL);
+        close_client(pass);
+    }
+}
+
+// Closes the connections that are past their deadline, once a second,
+// and those dropped during the last batch of events
+static void expire_clients(struct evloop_t *loop) {
+    const time_t now = time(NULL);
+    struct wspass_t *pass, *next;
+
+    for (pass = loop->closing; pass; pass = next) {
+        next = pass->next;
+        close_client(pass);
+    }
+    loop->closing = NULL;
+
+    if (now == loop->expired)
+        return;
+    loop->expired = now;
+
+    expire_list(loop, loop->pending, now);
+    expire_list(loop, loop->idle, now);
+}
+
+// Hands a kept alive connection back to its event loop
+static void return_client(struct wspass_t *pass) {
+    struct evloop_t * const loop = &loops[pass->loop];
+    const uint64_t one = 1;
+
+    pass->state = WS_REQUEST;
+    pass->idle = 1;
+    pass->deadline = time(NULL) + KEEPALIVE_TIMEOUT;
+    set_socket_nonblock(pass->csock, 1);
+
+    pthread_mutex_lock(&loop->lock);
+    pass->next = loop->returned;
+    loop->returned = pass;
+    pthread_mutex_unlock(&loop->lock);
+
+    if (write(loop->wakefd, &one, sizeof(one)) < 0)
+        handler_emsg("Unable to wake event loop: %m\n");
+}
+
+/*
+ * Runs on a worker once the request is in. Websocket clients are handed
+ * on, anything long-lived gets a thread of its own.
+ */
+static void serve_request(struct wspass_t *pass) {
 
     const int csock = pass->csock;
     wsthread_handler_id = pass->id;
+    pipe_error = 0;
 
     ws_ctx_t *ws_ctx;
+    uint8_t keepalive;
+    char ip[64];
+
+    // Each request may name its own forwarded address
+    memcpy(ip, pass->ip, sizeof(ip));
+
+    ws_ctx = do_handshake(pass->ws_ctx, pass->req, ip, &keepalive);
+
+    free(pass->req);
+    pass->req = NULL;
+    pass->reqlen = 0;
 
-    ws_ctx = do_handshake(csock, pass->ip);
     if (ws_ctx == NULL) {
+        if (keepalive) {
+            return_client(pass);
+            return;
+        }
+
         handler_msg("No connection after handshake\n");
-        goto out;   // Child process exits
+        close_client(pass);
+        handler_msg("handler exit\n");
+        return;
     }
 
-    memcpy(ws_ctx->ip, pass->ip, sizeof(pass->ip));
+    memcpy(ws_ctx->ip, ip, sizeof(ip));
 
-    proxy_handler(ws_ctx);
-    if (pipe_error) {
-        handler_emsg("Closing due to SIGPIPE\n");
+    set_socket_timeout(csock, 0);
+
+    if (settings.handoffCb && settings.handoffCb(ws_ctx)) {
+        // The VNC server reads and writes the socket itself from now on
+        handler_msg("handed off to VNC server\n");
+        free((void *) pass);
+        return;
     }
-out:
-    free((void *) pass);
 
-    if (ws_ctx) {
-        ws_socket_free(ws_ctx);
-        free_ws_ctx(ws_ctx);
-    } else {
-        shutdown(csock, SHUT_RDWR);
-        close(csock);
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&tid, &attr, proxythread, pass)) {
+        handler_emsg("Unable to start proxy thread\n");
+        close_client(pass);
     }
-    handler_msg("handler exit\n");
+
+    pthread_attr_destroy(&attr);
+}
+
+static void *worker(void *unused) {
+    struct timespec until;
+    struct wspass_t *pass;
+    int ret;
+
+    pthread_mutex_lock(&workers.lock);
+    while (1) {
+        if (!workers.head) {
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += WORKER_IDLE_TIMEOUT;
+
+            workers.idle++;
+            ret = pthread_cond_timedwait(&workers.wake, &workers.lock, &until);
+            workers.idle--;
+
+            if (ret == ETIMEDOUT && !workers.head &&
+                workers.count > settings.threads)
+                break;
+            continue;
+        }
+
+        pass = workers.head;
+        workers.head = pass->next;
+        if (!workers.head)
+            workers.tail = NULL;
+        workers.queued--;
+        pthread_mutex_unlock(&workers.lock);
+
+        serve_request(pass);
+
+        pthread_mutex_lock(&workers.lock);
+    }
+    workers.count--;
+    pthread_mutex_unlock(&workers.lock);
 
     return NULL;
 }
 
-void *start_server(void *unused) {
+static void queue_request(struct wspass_t *pass) {
+    // Workers may block, the socket timeouts bound each read and write
+    set_socket_nonblock(pass->csock, 0);
+    set_socket_timeout(pass->csock, HANDSHAKE_TIMEOUT);
+
+    pthread_mutex_lock(&workers.lock);
+
+    pass->next = NULL;
+    if (workers.tail)
+        workers.tail->next = pass;
+    else
+        workers.head = pass;
+    workers.tail = pass;
+    workers.queued++;
+
+    if (workers.queued > workers.idle && workers.count < WORKER_MAX) {
+        pthread_t tid;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        if (pthread_create(&tid, &attr, worker, NULL) == 0)
+            workers.count++;
+        else if (!workers.count)
+            handler_emsg("Unable to start worker thread\n");
+
+        pthread_attr_destroy(&attr);
+    }
+
+    pthread_cond_signal(&workers.wake);
+    pthread_mutex_unlock(&workers.lock);
+}
+
+static void drive_client(struct evloop_t *loop, struct wspass_t *pass) {
+    wsthread_handler_id = pass->id;
+
+    switch (advance_client(pass)) {
+        case STEP_READ:
+            wait_client(loop, pass, EPOLLIN);
+            break;
+        case STEP_WRITE:
+            wait_client(loop, pass, EPOLLOUT);
+            break;
+        case STEP_DONE:
+            queue_request(pass);
+            break;
+        default:
+            if (!pass->idle) {
+                handler_msg("No connection after handshake\n");
+                handler_msg("handler exit\n");
+            }
+            close_client(pass);
+            break;
+    }
+}
+
+// Picks up the connections workers have handed back. The next request
+// may already be sitting in the TLS buffer, where epoll can't see it, so
+// each is tried before going back to waiting.
+static void take_returned(struct evloop_t *loop) {
+    struct wspass_t *pass, *next;
+    uint64_t count;
+
+    if (read(loop->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        handler_emsg("Unable to read event loop wakeup: %m\n");
+
+    pthread_mutex_lock(&loop->lock);
+    pass = loop->returned;
+    loop->returned = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    for (; pass; pass = next) {
+        next = pass->next;
+        drive_client(loop, pass);
+    }
+}
+
+static void accept_clients(struct evloop_t *loop, int lsock) {
     int csock;
     struct sockaddr_in cli_addr;
     socklen_t clilen;
 
-//    printf("Waiting for connections on %s:%d\n",
-//            settings.listen_host, settings.listen_port);
-
     while (1) {
         clilen = sizeof(cli_addr);
-        pipe_error = 0;
-        do {
-            csock = accept(settings.listen_sock,
-                           (struct sockaddr *) &cli_addr,
-                           &clilen);
-        } while (csock == -1 && errno == EINTR);
+        csock = accept4(lsock,
+                        (struct sockaddr *) &cli_addr,
+                        &clilen, SOCK_CLOEXEC | SOCK_NONBLOCK);
 
         if (csock < 0) {
-            error("ERROR on accept");
-            continue;
+            if (errno == EINTR)
+                continue;
+            // Drained, or another loop got there first
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                error("ERROR on accept");
+            return;
         }
+
         struct wspass_t *pass = calloc(1, sizeof(struct wspass_t));
         inet_ntop(cli_addr.sin_family, &cli_addr.sin_addr, pass->ip, sizeof(pass->ip));
 
+        pass->id = __sync_fetch_and_add(&settings.handler_id, 1);
+        pass->csock = csock;
+        pass->loop = loop - loops;
+        pass->state = WS_DETECT;
+        pass->deadline = time(NULL) + HANDSHAKE_TIMEOUT;
+
         char logbuf[2][1024];
-        wslog(logbuf[0], settings.handler_id, 0);
+        wslog(logbuf[0], pass->id, 0);
         sprintf(logbuf[1], "got client connection from %s\n",
                     pass->ip);
         fprintf(stderr, "%s%s", logbuf[0], logbuf[1]);
 
-        pthread_t tid;
-        pass->id = settings.handler_id;
-        pass->csock = csock;
+        // Nothing to do until the request comes in
+        wait_client(loop, pass, EPOLLIN);
+    }
+}
+
+// Pins the calling thread to the nth CPU it may run on
+static void pin_thread(unsigned n) {
+    cpu_set_t allowed, cpu;
+    unsigned i, count;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+
+    n %= CPU_COUNT(&allowed);
+    for (i = 0, count = 0; i < CPU_SETSIZE; i++) {
+        if (!CPU_ISSET(i, &allowed))
+            continue;
+        if (count++ != n)
+            continue;
+
+        CPU_ZERO(&cpu);
+        CPU_SET(i, &cpu);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu) == 0)
+            handler_msg("event loop %u pinned to CPU %u\n", n, i);
+        return;
+    }
+}
+
+static void *event_loop(void *arg) {
+    struct epoll_event ev, events[MAX_EVENTS];
+    const unsigned index = (uintptr_t) arg;
+    struct evloop_t * const loop = &loops[index];
+    int efd, n, i, lsock;
+
+    if (settings.pin_threads)
+        pin_thread(index);
+
+    efd = loop->efd;
+
+    if (settings.listen_socks) {
+        // A socket of our own, the kernel picked us for its connections
+        lsock = settings.listen_socks[index];
+        ev.events = EPOLLIN;
+    } else {
+        // Every loop listens, the kernel wakes just one per connection
+        lsock = settings.listen_sock;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    }
+    ev.data.ptr = NULL;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, lsock, &ev) < 0) {
+        error("ERROR adding listening socket to epoll");
+        return NULL;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = loop;
+    if (epoll_ctl(efd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0) {
+        error("ERROR adding wakeup to epoll");
+        return NULL;
+    }
+
+    while (1) {
+        n = epoll_wait(efd, events, MAX_EVENTS,
+                       loop->pending || loop->idle ? 1000 : -1);
+        if (n < 0) {
+            if (errno != EINTR)
+                error("ERROR in epoll_wait");
+            continue;
+        }
+
+        for (i = 0; i < n; i++) {
+            struct wspass_t * const pass = events[i].data.ptr;
+
+            if (!pass) {
+                accept_clients(loop, lsock);
+                continue;
+            } else if (events[i].data.ptr == loop) {
+                take_returned(loop);
+                continue;
+            } else if (pass->state == WS_CLOSED) {
+                continue;
+            }
+
+            epoll_ctl(efd, EPOLL_CTL_DEL, pass->csock, NULL);
+            unlink_client(loop, pass);
+            drive_client(loop, pass);
+        }
+
+        expire_clients(loop);
+    }
+
+    return NULL;
+}
+
+static int warm_file(const char *path, const struct stat *st, int type,
+                     struct FTW *ftw) {
+    const char * const name = path + ftw->base;
+
+    if (type == FTW_D && !strcmp(name, "Downloads"))
+        return FTW_SKIP_SUBTREE;
+
+    if (type == FTW_F) {
+        const unsigned len = strlen(name);
+        if (len > 3 && !strcmp(name + len - 3, ".br"))
+            return FTW_CONTINUE;
+
+        const httpcache_file_t *file = httpcache_get(path,
+                                                     isCompressible(name2mime(path)));
+        if (file)
+            httpcache_release(file);
+    }
+
+    return FTW_CONTINUE;
+}
+
+// Loads and compresses the web client up front, so that the first
+// viewers needn't wait for it
+static void *warm_cache(void *unused) {
+    nftw(settings.httpdir, warm_file, 16, FTW_PHYS | FTW_ACTIONRETVAL);
+    return NULL;
+}
+
+void *start_server(void *unused) {
+    unsigned i, threads;
 
+//    printf("Waiting for connections on %s:%d\n",
+//            settings.listen_host, settings.listen_port);
+
+    threads = settings.threads ? settings.threads : 1;
+
+    loops = calloc(threads, sizeof(struct evloop_t));
+    for (i = 0; i < threads; i++) {
+        loops[i].efd = epoll_create1(EPOLL_CLOEXEC);
+        loops[i].wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loops[i].efd < 0 || loops[i].wakefd < 0) {
+            error("ERROR creating event loop");
+            return NULL;
+        }
+        pthread_mutex_init(&loops[i].lock, NULL);
+    }
+
+    // The loops may share a listening socket, so accept must never block
+    fcntl(settings.listen_sock, F_SETFL,
+          fcntl(settings.listen_sock, F_GETFL) | O_NONBLOCK);
+    if (settings.listen_socks) {
+        for (i = 1; i < threads; i++)
+            fcntl(settings.listen_socks[i], F_SETFL,
+                  fcntl(settings.listen_socks[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    if (settings.httpdir && settings.httpdir[0]) {
+        pthread_t tid;
         pthread_attr_t attr;
         pthread_attr_init(&attr);
         pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
-        pthread_create(&tid, &attr, subthread, pass);
+        pthread_create(&tid, &attr, warm_cache, NULL);
 
         pthread_attr_destroy(&attr);
+    }
+
+    for (i = 1; i < threads; i++) {
+        pthread_t tid;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        pthread_create(&tid, &attr, event_loop, (void *) (uintptr_t) i);
 
-        settings.handler_id += 1;
+        pthread_attr_destroy(&attr);
     }
+
+    event_loop((void *) (uintptr_t) 0);
+
     handler_msg("websockify exit\n");
 
     return NULL;
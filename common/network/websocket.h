@@ -45,7 +45,7 @@ typedef struct {
     char key3[8+1];
 } headers_t;
 
-typedef struct {
+typedef struct ws_ctx_t {
     int        sockfd;
     SSL_CTX   *ssl_ctx;
     SSL       *ssl;
@@ -60,12 +60,29 @@ typedef struct {
 
     char      user[USERNAME_LEN];
     char      ip[64];
+
+    // HTTP requests served on this connection
+    unsigned   requests;
 } ws_ctx_t;
 
 struct wspass_t {
     int csock;
     unsigned id;
     char ip[64];
+    ws_ctx_t *ws_ctx;
+
+    // The event loop that owns the connection while it waits
+    unsigned loop;
+    // Where the loop is at, and the request read so far
+    uint8_t state;
+    char *req;
+    unsigned reqlen;
+
+    // Closed if the request isn't in by then. Idle is set while a kept
+    // alive connection waits for the next request.
+    time_t deadline;
+    uint8_t idle;
+    struct wspass_t *prev, *next;
 };
 
 struct kasmpasswd_entry_t;
@@ -73,12 +90,17 @@ struct kasmpasswd_entry_t;
 typedef struct {
     int verbose;
     int listen_sock;
+    // With SO_REUSEPORT, a listening socket for each event loop
+    int *listen_socks;
     unsigned int handler_id;
+    unsigned int threads;
+    int pin_threads;
     const char *cert;
     const char *key;
     uint8_t disablebasicauth;
     const char *passwdfile;
     int ssl_only;
+    int ktls;
     const char *httpdir;
 
     void *messager;
@@ -112,6 +134,8 @@ typedef struct {
     void (*getSessionsCb)(void *messager, char **buf);
 
     void (*get_system_stats_cb)(void *messager, const char **ptr, uint32_t *len);
+
+    uint8_t (*handoffCb)(ws_ctx_t *ws_ctx);
 } settings_t;
 
 #ifdef __cplusplus
@@ -124,6 +148,10 @@ ssize_t ws_recv(ws_ctx_t *ctx, void *buf, size_t len);
 
 ssize_t ws_send(ws_ctx_t *ctx, const void *buf, size_t len);
 
+void free_ws_ctx(ws_ctx_t *ctx);
+
+int ws_ktls_send(ws_ctx_t *ctx);
+
 /* base64.c declarations */
 //int b64_ntop(u_char const *src, size_t srclength, char *target, size_t targsize);
 //int b64_pton(char const *src, u_char *target, size_t targsize);
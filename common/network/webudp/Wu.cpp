@@ -36,11 +36,16 @@ struct Wu {
   WuErrorFn errorCallback;
   WuErrorFn debugCallback;
   WuWriteFn writeUdpData;
+  WuWriteBatchFn writeUdpBatch;
+
+  // Encrypted datagrams waiting for writeUdpBatch
+  uint8_t batchBuffer[64][2048];
 };
 
 const double kMaxClientTtl = 9.0;
 const double heartbeatInterval = 4.0;
 const int kDefaultMTU = 1400;
+const int32_t kMaxBatch = 64;
 
 static void DefaultErrorCallback(const char*, void*) {}
 static void WriteNothing(const uint8_t*, size_t, const WuClient*, void*) {}
@@ -667,6 +672,86 @@ static int32_t WuSendData(Wu* wu, WuClient* client, const uint8_t* data,
   return 0;
 }
 
+static void WuWriteBatch(const Wu* wu, const WuClient* client,
+                         const uint8_t* const* data, const size_t* lengths,
+                         int32_t count) {
+  if (wu->writeUdpBatch) {
+    wu->writeUdpBatch(data, lengths, count, client, wu->userData);
+    return;
+  }
+
+  for (int32_t i = 0; i < count; i++) {
+    wu->writeUdpData(data[i], lengths[i], client, wu->userData);
+  }
+}
+
+int32_t WuSendBinaryBatch(Wu* wu, WuClient* client,
+                          const uint8_t* const* data, const int32_t* lengths,
+                          int32_t count) {
+  if (client->state < WuClient_DataChannelOpen) {
+    return -1;
+  }
+
+  if (!SSL_is_init_finished(client->ssl)) {
+    return 0;
+  }
+
+  SctpPacket packet;
+  packet.sourcePort = wu->port;
+  packet.destionationPort = client->remoteSctpPort;
+  packet.verificationTag = client->sctpVerificationTag;
+
+  SctpChunk rc;
+  rc.type = Sctp_Data;
+  rc.flags = kSctpFlagCompleteUnreliable;
+
+  auto* dc = &rc.as.data;
+  dc->streamId = 0;
+  dc->streamSeq = 0;
+  dc->protoId = DCProto_Binary;
+
+  const uint8_t* datagrams[kMaxBatch];
+  size_t datagramLengths[kMaxBatch];
+  int32_t numDatagrams = 0;
+
+  uint8_t outBuffer[4096];
+
+  for (int32_t i = 0; i < count; i++) {
+    rc.length = SctpDataChunkLength(lengths[i]);
+    dc->tsn = client->tsn++;
+    dc->userData = data[i];
+    dc->userDataLength = lengths[i];
+
+    // Everything but the padding after the user data gets written
+    memset(outBuffer + 12 + rc.length, 0, 4);
+    size_t bytesWritten = SerializeSctpPacket(&packet, &rc, 1, outBuffer,
+                                              sizeof(outBuffer));
+    SSL_write(client->ssl, outBuffer, bytesWritten);
+
+    // Each write is one record, so one datagram
+    while (BIO_ctrl_pending(client->outBio) > 0) {
+      if (numDatagrams == kMaxBatch) {
+        WuWriteBatch(wu, client, datagrams, datagramLengths, numDatagrams);
+        numDatagrams = 0;
+      }
+
+      uint8_t* slot = wu->batchBuffer[numDatagrams];
+      int bytes = BIO_read(client->outBio, slot, sizeof(wu->batchBuffer[0]));
+      if (bytes > 0) {
+        datagrams[numDatagrams] = slot;
+        datagramLengths[numDatagrams] = bytes;
+        numDatagrams++;
+      }
+    }
+  }
+
+  if (numDatagrams) {
+    WuWriteBatch(wu, client, datagrams, datagramLengths, numDatagrams);
+  }
+
+  return 0;
+}
+
 int32_t WuSendText(Wu* wu, WuClient* client, const char* text, int32_t length) {
   return WuSendData(wu, client, (const uint8_t*)text, length, DCProto_String);
 }
@@ -732,6 +817,10 @@ void WuSetUDPWriteFunction(Wu* wu, WuWriteFn write) {
   wu->writeUdpData = write;
 }
 
+void WuSetUDPWriteBatchFunction(Wu* wu, WuWriteBatchFn write) {
+  wu->writeUdpBatch = write;
+}
+
 WuAddress WuClientGetAddress(const WuClient* client) { return client->address; }
 
 void WuSetErrorCallback(Wu* wu, WuErrorFn callback) {
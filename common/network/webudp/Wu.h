@@ -16,6 +16,9 @@ typedef struct Wu Wu;
 typedef void (*WuErrorFn)(const char* err, void* userData);
 typedef void (*WuWriteFn)(const uint8_t* data, size_t length,
                           const WuClient* client, void* userData);
+typedef void (*WuWriteBatchFn)(const uint8_t* const* data,
+                               const size_t* lengths, int32_t count,
+                               const WuClient* client, void* userData);
 
 typedef enum {
   WuEvent_BinaryData,
@@ -56,6 +59,14 @@ int32_t WuUpdate(Wu* wu, WuEvent* evt);
 int32_t WuSendText(Wu* wu, WuClient* client, const char* text, int32_t length);
 int32_t WuSendBinary(Wu* wu, WuClient* client, const uint8_t* data,
                      int32_t length);
+/*
+ * Sends each buffer as its own message, like calling WuSendBinary for
+ * each, but the datagrams are handed to the batch write function
+ * together.
+ */
+int32_t WuSendBinaryBatch(Wu* wu, WuClient* client,
+                          const uint8_t* const* data, const int32_t* lengths,
+                          int32_t count);
 void WuReportError(Wu* wu, const char* error);
 void WuReportDebug(Wu* wu, const char* error);
 void WuRemoveClient(Wu* wu, WuClient* client);
@@ -65,6 +76,7 @@ SDPResult WuExchangeSDP(Wu* wu, const char* sdp, int32_t length);
 void WuHandleUDP(Wu* wu, const WuAddress* remote, const uint8_t* data,
                  int32_t length);
 void WuSetUDPWriteFunction(Wu* wu, WuWriteFn write);
+void WuSetUDPWriteBatchFunction(Wu* wu, WuWriteBatchFn write);
 void WuSetUserData(Wu* wu, void* userData);
 void WuSetErrorCallback(Wu* wu, WuErrorFn callback);
 void WuSetDebugCallback(Wu* wu, WuErrorFn callback);
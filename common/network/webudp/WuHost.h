@@ -24,6 +24,9 @@ int32_t WuHostSendText(WuHost* host, WuClient* client, const char* text,
                        int32_t length);
 int32_t WuHostSendBinary(WuHost* host, WuClient* client, const uint8_t* data,
                          int32_t length);
+int32_t WuHostSendBinaryBatch(WuHost* host, WuClient* client,
+                              const uint8_t* const* data,
+                              const int32_t* lengths, int32_t count);
 void WuHostSetErrorCallback(WuHost* host, WuErrorFn callback);
 void WuHostSetDebugCallback(WuHost* host, WuErrorFn callback);
 WuClient* WuHostFindClient(const WuHost* host, WuAddress address);
@@ -34,6 +34,7 @@ struct WuHost {
   struct epoll_event* events;
   int32_t maxEvents;
   uint16_t port;
+  int gso;
   char errBuf[512];
 };
 
@@ -68,6 +69,26 @@ static void WriteUDPData(const uint8_t* data, size_t length,
          sizeof(netaddr));
 }
 
+static void WriteUDPBatch(const uint8_t* const* data, const size_t* lengths,
+                          int32_t count, const WuClient* client,
+                          void* userData) {
+  WuHost* host = (WuHost*)userData;
+
+  WuAddress address = WuClientGetAddress(client);
+  struct sockaddr_in netaddr;
+  netaddr.sin_family = AF_INET;
+  netaddr.sin_port = htons(address.port);
+  netaddr.sin_addr.s_addr = htonl(address.host);
+
+  const int gso = host->gso;
+  if (SendUDPBatch(host->udpfd, &netaddr, data, lengths, count, &host->gso) < 0) {
+    HandleErrno(host, "UDP send failed");
+  }
+  if (gso && !host->gso) {
+    WuReportDebug(host->wu, "UDP GSO not available, using sendmmsg");
+  }
+}
+
 int32_t WuHostServe(WuHost* host, WuEvent* evt, int timeout) {
   if (pthread_mutex_lock(&wumutex))
     abort();
@@ -184,6 +205,8 @@ int32_t WuHostCreate(const char* hostAddr, uint16_t port, int32_t maxClients, Wu
 
   WuSetUserData(ctx->wu, ctx);
   WuSetUDPWriteFunction(ctx->wu, WriteUDPData);
+  WuSetUDPWriteBatchFunction(ctx->wu, WriteUDPBatch);
+  ctx->gso = 1;
 
   *host = ctx;
 
@@ -209,6 +232,17 @@ int32_t WuHostSendBinary(WuHost* host, WuClient* client, const uint8_t* data,
   return ret;
 }
 
+int32_t WuHostSendBinaryBatch(WuHost* host, WuClient* client,
+                              const uint8_t* const* data,
+                              const int32_t* lengths, int32_t count) {
+  if (pthread_mutex_lock(&wumutex))
+    abort();
+  int32_t ret = WuSendBinaryBatch(host->wu, client, data, lengths, count);
+  pthread_mutex_unlock(&wumutex);
+
+  return ret;
+}
+
 void WuHostSetErrorCallback(WuHost* host, WuErrorFn callback) {
   WuSetErrorCallback(host->wu, callback);
 }
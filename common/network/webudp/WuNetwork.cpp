@@ -1,11 +1,21 @@
 #include "WuNetwork.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include "WuMath.h"
+
+// Kernel limits for one segmented send
+const int32_t kMaxGsoSegments = 64;
+const size_t kMaxGsoBytes = 65507;
+
+const int32_t kMaxMmsgBatch = 64;
 
 void HexDump(const uint8_t* src, size_t len) {
   for (size_t i = 0; i < len; i++) {
@@ -56,3 +66,123 @@ int CreateSocket(uint16_t port) {
 
   return -1;
 }
+
+#ifdef UDP_SEGMENT
+// Sends data as one large datagram the kernel cuts into lengths[0] sized
+// pieces. All but the last must be exactly that size.
+static int SendSegmented(int fd, const struct sockaddr_in* addr,
+                         const uint8_t* const* data, const size_t* lengths,
+                         int32_t count) {
+  struct iovec iov[kMaxGsoSegments];
+  char control[CMSG_SPACE(sizeof(uint16_t))];
+  struct msghdr msg;
+
+  for (int32_t i = 0; i < count; i++) {
+    iov[i].iov_base = (void*)data[i];
+    iov[i].iov_len = lengths[i];
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = (void*)addr;
+  msg.msg_namelen = sizeof(*addr);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = count;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = IPPROTO_UDP;
+  cm->cmsg_type = UDP_SEGMENT;
+  cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  const uint16_t segment = lengths[0];
+  memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+
+  ssize_t r;
+  do {
+    r = sendmsg(fd, &msg, 0);
+  } while (r < 0 && errno == EINTR);
+
+  return r < 0 ? -1 : 0;
+}
+#endif
+
+int32_t SendUDPBatch(int fd, const struct sockaddr_in* addr,
+                     const uint8_t* const* data, const size_t* lengths,
+                     int32_t count, int* gso) {
+  int32_t sent = 0;
+  // Cleared for the rest of this batch only, when a segmented send fails
+  // for reasons that say nothing about GSO support
+  int tryGso = *gso;
+
+  while (sent < count) {
+#ifdef UDP_SEGMENT
+    if (tryGso) {
+      // The longest run of same sized datagrams, plus a shorter tail
+      int32_t n = 0;
+      size_t total = 0;
+      while (sent + n < count && n < kMaxGsoSegments &&
+             lengths[sent + n] <= lengths[sent] &&
+             total + lengths[sent + n] <= kMaxGsoBytes) {
+        total += lengths[sent + n];
+        n++;
+        if (lengths[sent + n - 1] != lengths[sent]) {
+          break;
+        }
+      }
+
+      if (n > 1) {
+        if (SendSegmented(fd, addr, data + sent, lengths + sent, n) == 0) {
+          sent += n;
+          continue;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          return sent;
+        }
+
+        switch (errno) {
+        case EIO:
+        case EINVAL:
+        case ENOPROTOOPT:
+        case EOPNOTSUPP:
+          // Not supported by this kernel or device, don't try again
+          *gso = 0;
+          break;
+        }
+
+        // Either way, send this batch one datagram at a time
+        tryGso = 0;
+      }
+    }
+#endif
+
+    struct mmsghdr msgs[kMaxMmsgBatch];
+    struct iovec iov[kMaxMmsgBatch];
+    const int32_t n = Min(count - sent, kMaxMmsgBatch);
+
+    memset(msgs, 0, sizeof(msgs[0]) * n);
+    for (int32_t i = 0; i < n; i++) {
+      iov[i].iov_base = (void*)data[sent + i];
+      iov[i].iov_len = lengths[sent + i];
+      msgs[i].msg_hdr.msg_name = (void*)addr;
+      msgs[i].msg_hdr.msg_namelen = sizeof(*addr);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int r = sendmmsg(fd, msgs, n, 0);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return sent;
+      }
+      return sent ? sent : -1;
+    }
+
+    sent += r;
+  }
+
+  return sent;
+}
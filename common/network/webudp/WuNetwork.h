@@ -7,3 +7,15 @@
 void HexDump(const uint8_t* src, size_t len);
 int MakeNonBlocking(int sfd);
 int CreateSocket(uint16_t port);
+
+/*
+ * Sends count datagrams to addr with as few syscalls as possible, as UDP
+ * GSO sends while *gso is set, sendmmsg otherwise. *gso is cleared if the
+ * kernel says it doesn't support GSO, other errors only fall back for the
+ * batch. Returns the number of datagrams sent, which is
+ * less than count if the socket buffer filled up, or -1 on error.
+ */
+struct sockaddr_in;
+int32_t SendUDPBatch(int fd, const struct sockaddr_in* addr,
+                     const uint8_t* const* data, const size_t* lengths,
+                     int32_t count, int* gso);
@@ -22,6 +22,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <rdr/BufferedOutStream.h>
 #include <rdr/Exception.h>
 
@@ -31,10 +33,12 @@ using namespace rdr;
 static const size_t DEFAULT_BUF_SIZE = 16384;
 
 BufferedOutStream::BufferedOutStream()
-  : bufSize(DEFAULT_BUF_SIZE), offset(0)
+  : bufSize(DEFAULT_BUF_SIZE), maxBufSize(DEFAULT_BUF_SIZE), offset(0),
+    peakUsage(0)
 {
   ptr = start = sentUpTo = new U8[bufSize];
   end = start + bufSize;
+  gettimeofday(&lastSizeCheck, NULL);
 }
 
 BufferedOutStream::~BufferedOutStream()
@@ -53,8 +57,21 @@ size_t BufferedOutStream::bufferUsage()
   return ptr - sentUpTo;
 }
 
+void BufferedOutStream::setMaxBufferSize(size_t size)
+{
+  if (size < DEFAULT_BUF_SIZE)
+    size = DEFAULT_BUF_SIZE;
+
+  maxBufSize = size;
+}
+
 void BufferedOutStream::flush()
 {
+  struct timeval now;
+
+  if (bufferUsage() > peakUsage)
+    peakUsage = bufferUsage();
+
   while (sentUpTo < ptr) {
     size_t len;
 
@@ -67,8 +84,45 @@ void BufferedOutStream::flush()
   }
 
   // Managed to flush everything?
-  if (sentUpTo == ptr)
-    ptr = sentUpTo = start;
+  if (sentUpTo != ptr)
+    return;
+
+  ptr = sentUpTo = start;
+
+  if (bufSize == DEFAULT_BUF_SIZE)
+    return;
+
+  // Shrink the buffer if it hasn't been used much for a while
+  gettimeofday(&now, NULL);
+  if ((now.tv_sec - lastSizeCheck.tv_sec) * 1000 +
+      (now.tv_usec - lastSizeCheck.tv_usec) / 1000 < 5000)
+    return;
+
+  // Allow 3x since peak usage is rarely a power of two
+  if (peakUsage * 3 < bufSize)
+    resize(bufSize / 2);
+
+  lastSizeCheck = now;
+  peakUsage = 0;
+}
+
+void BufferedOutStream::resize(size_t size)
+{
+  U8* newBuffer;
+
+  if (size < DEFAULT_BUF_SIZE)
+    size = DEFAULT_BUF_SIZE;
+
+  newBuffer = new U8[size];
+  memcpy(newBuffer, sentUpTo, ptr - sentUpTo);
+
+  ptr = newBuffer + (ptr - sentUpTo);
+  sentUpTo = newBuffer;
+
+  delete [] start;
+  start = newBuffer;
+  end = start + size;
+  bufSize = size;
 }
 
 void BufferedOutStream::overrun(size_t needed)
@@ -90,6 +144,17 @@ void BufferedOutStream::overrun(size_t needed)
       memmove(start, sentUpTo, ptr - sentUpTo);
       ptr = start + (ptr - sentUpTo);
       sentUpTo = start;
+    } else if (needed + bufferUsage() <= maxBufSize) {
+      size_t newSize;
+
+      // Allowed to queue up more data, so grow rather than wait
+      newSize = bufSize;
+      while (newSize < needed + bufferUsage())
+        newSize *= 2;
+      if (newSize > maxBufSize)
+        newSize = maxBufSize;
+
+      resize(newSize);
     } else {
       size_t len;
 
@@ -24,6 +24,8 @@
 #ifndef __RDR_BUFFEREDOUTSTREAM_H__
 #define __RDR_BUFFEREDOUTSTREAM_H__
 
+#include <sys/time.h>
+
 #include <rdr/OutStream.h>
 
 namespace rdr {
@@ -38,6 +40,11 @@ namespace rdr {
 
     size_t bufferUsage();
 
+    // setMaxBufferSize() lets the buffer grow up to this size, rather
+    // than waiting for the data to be sent when it runs full. The extra
+    // space is given back once it is no longer needed.
+    void setMaxBufferSize(size_t size);
+
   private:
     // flushBuffer() requests that the stream be flushed. Returns true if it is
     // able to progress the output (which might still not mean any bytes
@@ -48,11 +55,17 @@ namespace rdr {
 
     virtual void overrun(size_t needed);
 
+    void resize(size_t size);
+
   private:
     size_t bufSize;
+    size_t maxBufSize;
     size_t offset;
     U8* start;
 
+    size_t peakUsage;
+    struct timeval lastSizeCheck;
+
   protected:
     U8* sentUpTo;
 
@@ -104,6 +104,9 @@ size_t FdInStream::readWithTimeoutOrCallback(void* buf, size_t len, bool wait)
 {
   int n;
   while (true) {
+    if (readPending())
+      break;
+
     do {
       fd_set fds;
       struct timeval tv;
@@ -131,6 +134,13 @@ size_t FdInStream::readWithTimeoutOrCallback(void* buf, size_t len, bool wait)
     blockCallback->blockCallback();
   }
 
+  return readFd(buf, len);
+}
+
+size_t FdInStream::readFd(void* buf, size_t len)
+{
+  int n;
+
   do {
     n = ::recv(fd, (char*)buf, len, 0);
   } while (n < 0 && errno == EINTR);
@@ -45,11 +45,18 @@ namespace rdr {
     void setBlockCallback(FdInStreamBlockCallback* blockCallback);
     int getFd() { return fd; }
 
+  protected:
+    size_t readWithTimeoutOrCallback(void* buf, size_t len, bool wait=true);
+
+    // readFd() does the actual read once the fd is readable, and
+    // readPending() tells if there is data buffered below us that select()
+    // cannot see. Streams with a protocol layer on the fd override these.
+    virtual size_t readFd(void* buf, size_t len);
+    virtual bool readPending() { return false; }
+
   private:
     virtual bool fillBuffer(size_t maxSize, bool wait);
 
-    size_t readWithTimeoutOrCallback(void* buf, size_t len, bool wait=true);
-
     int fd;
     bool closeWhenDone;
     int timeoutms;
@@ -52,7 +52,7 @@
 using namespace rdr;
 
 FdOutStream::FdOutStream(int fd_, bool blocking_, int timeoutms_)
-  : fd(fd_), blocking(blocking_), timeoutms(timeoutms_)
+  : blocking(blocking_), timeoutms(timeoutms_), fd(fd_)
 {
   gettimeofday(&lastWrite, NULL);
 }
@@ -113,6 +113,32 @@ size_t FdOutStream::writeWithTimeout(const void* data, size_t length, int timeou
 {
   int n;
 
+  if (!waitForWrite(timeoutms))
+    return 0;
+
+  do {
+    // select only guarantees that you can write SO_SNDLOWAT without
+    // blocking, which is normally 1. Use MSG_DONTWAIT to avoid
+    // blocking, when possible.
+#ifndef MSG_DONTWAIT
+    n = ::send(fd, (const char*)data, length, 0);
+#else
+    n = ::send(fd, (const char*)data, length, MSG_DONTWAIT);
+#endif
+  } while (n < 0 && (errno == EINTR));
+
+  if (n < 0)
+    throw SystemException("write", errno);
+
+  gettimeofday(&lastWrite, NULL);
+
+  return n;
+}
+
+bool FdOutStream::waitForWrite(int timeoutms)
+{
+  int n;
+
   do {
     fd_set fds;
     struct timeval tv;
@@ -133,24 +159,5 @@ size_t FdOutStream::writeWithTimeout(const void* data, size_t length, int timeou
   if (n < 0)
     throw SystemException("select", errno);
 
-  if (n == 0)
-    return 0;
-
-  do {
-    // select only guarantees that you can write SO_SNDLOWAT without
-    // blocking, which is normally 1. Use MSG_DONTWAIT to avoid
-    // blocking, when possible.
-#ifndef MSG_DONTWAIT
-    n = ::send(fd, (const char*)data, length, 0);
-#else
-    n = ::send(fd, (const char*)data, length, MSG_DONTWAIT);
-#endif
-  } while (n < 0 && (errno == EINTR));
-
-  if (n < 0)
-    throw SystemException("write", errno);
-
-  gettimeofday(&lastWrite, NULL);
-
-  return n;
+  return n != 0;
 }
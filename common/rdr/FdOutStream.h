@@ -43,13 +43,19 @@ namespace rdr {
 
     unsigned getIdleTime();
 
+  protected:
+    // waitForWrite() returns false if the fd did not become writable
+    // within the timeout, for streams that do their own writes
+    bool waitForWrite(int timeoutms);
+
+    bool blocking;
+    int timeoutms;
+    struct timeval lastWrite;
+
   private:
     virtual bool flushBuffer(bool wait);
     size_t writeWithTimeout(const void* data, size_t length, int timeoutms);
     int fd;
-    bool blocking;
-    int timeoutms;
-    struct timeval lastWrite;
   };
 
 }
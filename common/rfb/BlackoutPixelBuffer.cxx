@@ -0,0 +1,90 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+
+#include <rfb/BlackoutPixelBuffer.h>
+
+using namespace rfb;
+
+BlackoutPixelBuffer::BlackoutPixelBuffer()
+  : source(NULL), composed(NULL)
+{
+}
+
+BlackoutPixelBuffer::~BlackoutPixelBuffer()
+{
+  delete composed;
+}
+
+bool BlackoutPixelBuffer::update(PixelBuffer* source_, const Rect& visible_)
+{
+  const Rect clipped = visible_.intersect(source_->getRect());
+
+  source = source_;
+
+  if (format.equal(source->getPF()) &&
+      width_ == source->width() && height_ == source->height() &&
+      visible.equals(clipped))
+    return false;
+
+  format = source->getPF();
+  width_ = source->width();
+  height_ = source->height();
+  visible = clipped;
+
+  // What used to be visible might not be any more
+  delete composed;
+  composed = NULL;
+
+  return true;
+}
+
+const rdr::U8* BlackoutPixelBuffer::getBuffer(const Rect& r, int* stride) const
+{
+  if (r.enclosed_by(visible))
+    return source->getBuffer(r, stride);
+
+  os::AutoMutex a(&mutex);
+
+  if (!composed) {
+    rdr::U8* data;
+    int cstride;
+
+    composed = new ManagedPixelBuffer(format, width_, height_);
+    data = composed->getBufferRW(composed->getRect(), &cstride);
+    memset(data, 0, (size_t)cstride * height_ * (format.bpp/8));
+    composed->commitBufferRW(composed->getRect());
+  }
+
+  const Rect part = r.intersect(visible);
+  if (!part.is_empty()) {
+    const rdr::U8* src;
+    int srcStride;
+
+    src = source->getBuffer(part, &srcStride);
+    composed->imageRect(part, src, srcStride);
+  }
+
+  return composed->getBuffer(r, stride);
+}
+
+void BlackoutPixelBuffer::grabRegion(const Region& region)
+{
+  source->grabRegion(region);
+}
@@ -0,0 +1,58 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_BLACKOUTPIXELBUFFER_H__
+#define __RFB_BLACKOUTPIXELBUFFER_H__
+
+#include <os/Mutex.h>
+#include <rfb/PixelBuffer.h>
+
+namespace rfb {
+
+  // A view of another PixelBuffer where everything outside the visible
+  // rect reads as black, for DLP_Region.
+  //
+  // Rects inside the visible area point straight into the source. Any
+  // other rect is put together in a buffer of our own, which is only
+  // allocated the first time it is needed, and is black except for
+  // what gets copied in from the source.
+  class BlackoutPixelBuffer : public PixelBuffer {
+  public:
+    BlackoutPixelBuffer();
+    virtual ~BlackoutPixelBuffer();
+
+    // Returns true if the size, format or visible area changed, in
+    // which case everything has to be sent again
+    bool update(PixelBuffer* source, const Rect& visible);
+
+    const Rect& getVisible() const { return visible; }
+
+    virtual const rdr::U8* getBuffer(const Rect& r, int* stride) const;
+    virtual void grabRegion(const Region& region);
+
+  protected:
+    PixelBuffer* source;
+    Rect visible;
+
+    // getBuffer() may be called from several encoders at once
+    mutable ManagedPixelBuffer* composed;
+    mutable os::Mutex mutex;
+  };
+
+}
+
+#endif
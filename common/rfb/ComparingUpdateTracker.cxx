@@ -27,10 +27,14 @@
 #include <rfb/LogWriter.h>
 #include <rfb/ServerCore.h>
 #include <rfb/ComparingUpdateTracker.h>
+#include <rfb/blockcmp.h>
+#include <rfb/cpuid.h>
 
 #include <rfb/adler32.h>
 #include <rfb/xxhash.h>
 
+#include <tbb/parallel_for.h>
+
 using namespace rfb;
 
 static LogWriter vlog("ComparingUpdateTracker");
@@ -94,11 +98,26 @@ protected:
 
 	const uint8_t *olddata;
 	uint32_t *totals, *starts, *idxtable, *curs;
+
+	// In hash-only mode, the 64-bit hash of every 64-pixel row of each
+	// block stands in for olddata
+	std::vector<rdr::U64> oldrows;
+	uint_fast32_t rowCols;
+
+	bool rowMatches(const uint8_t * const ptr, const uint_fast32_t x,
+			const uint_fast32_t y) const {
+		if (!oldrows.empty())
+			return XXH64(ptr, blockBytes, 0) ==
+				oldrows[y * rowCols + x / SCROLLBLOCK_SIZE];
+
+		return memcmp(ptr, &olddata[y * lineBytes + x * d], blockBytes) == 0;
+	}
 public:
 	scrollHasher_t(): w(0), h(0), d(0), lineBytes(0), blockBytes(0), hashtable(NULL),
 				hashw(0), hashAnd(0), hashShift(0),
 				lastOffX(0), lastOffY(0),
-				olddata(NULL), totals(NULL), starts(NULL), idxtable(NULL) {
+				olddata(NULL), totals(NULL), starts(NULL), idxtable(NULL),
+				rowCols(0) {
 
 		assert(sizeof(hashdata_t) == sizeof(uint32_t));
 	}
@@ -115,6 +134,12 @@ public:
 	virtual void calcHashes(const uint8_t *ptr,
 			const uint32_t w_, const uint32_t h_, const uint32_t d_) = 0;
 
+	// Only the vertical hasher can work from row hashes alone
+	virtual bool calcRowHashes(const rdr::U64 *rows, const uint32_t cols,
+			const uint32_t w_, const uint32_t h_, const uint32_t d_) {
+		return false;
+	}
+
 	virtual void invalidate(const uint_fast32_t x, uint_fast32_t y, uint_fast32_t h) = 0;
 
 	virtual void findBestMatch(const uint8_t * const ptr, const uint_fast32_t maxLines,
@@ -142,6 +167,57 @@ public:
 	void calcHashes(const uint8_t *ptr,
 			const uint32_t w_, const uint32_t h_, const uint32_t d_) {
 
+		resize(w_, h_, d_);
+
+		if (!olddata)
+			olddata = (const uint8_t *) malloc(w * h * d);
+
+		// We need to make a copy, since the comparer incrementally updates its copy
+		memcpy((uint8_t *) olddata, ptr, w * h * d);
+
+		for (uint_fast32_t y = 0; y < h; y++) {
+			const uint8_t *inptr0 = olddata;
+			inptr0 += y * lineBytes;
+			for (uint_fast32_t x = 0; x < w; x += SCROLLBLOCK_SIZE) {
+				if (w - x < SCROLLBLOCK_SIZE)
+					break;
+
+				const uint_fast32_t idx = (y << hashShift) + x / SCROLLBLOCK_SIZE;
+				hashtable[idx].hash = XXH64(inptr0, blockBytes, 0);
+
+				inptr0 += blockBytes;
+			}
+		}
+
+		buildIndex();
+	}
+
+	bool calcRowHashes(const rdr::U64 *rows, const uint32_t cols,
+			const uint32_t w_, const uint32_t h_, const uint32_t d_) {
+
+		resize(w_, h_, d_);
+
+		// Same reason for the copy as above
+		rowCols = cols;
+		oldrows.assign(rows, rows + cols * h);
+
+		for (uint_fast32_t y = 0; y < h; y++) {
+			for (uint_fast32_t x = 0; x < w; x += SCROLLBLOCK_SIZE) {
+				if (w - x < SCROLLBLOCK_SIZE)
+					break;
+
+				const uint_fast32_t idx = (y << hashShift) + x / SCROLLBLOCK_SIZE;
+				hashtable[idx].hash = oldrows[y * cols + x / SCROLLBLOCK_SIZE];
+			}
+		}
+
+		buildIndex();
+
+		return true;
+	}
+
+	void resize(const uint32_t w_, const uint32_t h_, const uint32_t d_) {
+
 		if (w != w_ || h != h_) {
 			// Reallocate
 			w = w_;
@@ -159,11 +235,12 @@ public:
 			idxtable = (uint32_t *) realloc(idxtable,
 								hashw * h * sizeof(uint32_t));
 
-			olddata = (const uint8_t *) realloc((void *) olddata, w * h * d);
+			free((void *) olddata);
+			olddata = NULL;
 		}
+	}
 
-		// We need to make a copy, since the comparer incrementally updates its copy
-		memcpy((uint8_t *) olddata, ptr, w * h * d);
+	void buildIndex() {
 
 		//memset(hashtable, 0, hashw * h * sizeof(uint32_t));
 		//memset(idxtable, 0, w * h * sizeof(uint32_t));
@@ -172,17 +249,12 @@ public:
 		//memset(curs, 0, NUM_TOTALS * sizeof(uint32_t));
 
 		for (uint_fast32_t y = 0; y < h; y++) {
-			const uint8_t *inptr0 = olddata;
-			inptr0 += y * lineBytes;
+			const hashdata_t *src = &hashtable[y << hashShift];
 			for (uint_fast32_t x = 0; x < w; x += SCROLLBLOCK_SIZE) {
 				if (w - x < SCROLLBLOCK_SIZE)
 					break;
 
-				const uint_fast32_t idx = (y << hashShift) + x / SCROLLBLOCK_SIZE;
-				hashtable[idx].hash = XXH64(inptr0, blockBytes, 0);
-				totals[hashtable[idx].hash % NUM_TOTALS]++;
-
-				inptr0 += blockBytes;
+				totals[src[x / SCROLLBLOCK_SIZE].hash % NUM_TOTALS]++;
 			}
 		}
 
@@ -272,7 +344,7 @@ public:
 			curidx = (tryY << hashShift) + tryX / SCROLLBLOCK_SIZE;
 			curhash = hashtable[curidx].hash;
 			if (curhash == starthash &&
-				memcmp(ptr, &olddata[tryY * lineBytes + tryX * d], blockBytes) == 0) {
+				rowMatches(ptr, tryX, tryY)) {
 
 				matches[0].hash = curhash;
 				matches[0].idx = curidx;
@@ -294,7 +366,7 @@ public:
 			const uint_fast32_t oldy = curidx >> hashShift;
 			const uint_fast32_t oldx = curidx & hashAnd;
 
-			if (memcmp(ptr, &olddata[oldy * lineBytes + oldx * blockBytes], blockBytes))
+			if (!rowMatches(ptr, oldx * SCROLLBLOCK_SIZE, oldy))
 				continue;
 
 			matches[found].hash = curhash;
@@ -327,9 +399,7 @@ public:
 					break;*/
 				if (!hashtable[matches[i].idx + (k << hashShift)].hash)
 					break; // Invalidated
-				if (memcmp(ptr + lineBytes * k,
-						&olddata[(oldy + k) * lineBytes + oldx * blockBytes],
-						blockBytes))
+				if (!rowMatches(ptr + lineBytes * k, oldx * SCROLLBLOCK_SIZE, oldy + k))
 					break;
 			}
 			if (k > bestmatches) {
@@ -403,9 +473,7 @@ public:
 		for (i = 0; i < lowest; i++) {
 			if (!hashtable[((tmpy - lowest + i) << hashShift) + inx / SCROLLBLOCK_SIZE].hash)
 				return; // Invalidated
-			if (memcmp(ptr + lineBytes * i,
-					&olddata[(tmpy - lowest + i) * lineBytes + tmpx * d],
-					blockBytes))
+			if (!rowMatches(ptr + lineBytes * i, tmpx, tmpy - lowest + i))
 				return;
 		}
 
@@ -672,14 +740,17 @@ public:
 
 ComparingUpdateTracker::ComparingUpdateTracker(PixelBuffer* buffer)
   : fb(buffer), oldFb(fb->getPF(), 0, 0), firstCompare(true),
-    enabled(true), detectScroll(false), totalPixels(0), missedPixels(0),
-    scrollHasher(NULL)
+    enabled(true), detectScroll(false), hashOnly(Server::compareHashOnly),
+    hashCols(0), totalPixels(0), missedPixels(0), scrollHasher(NULL)
 {
     changed.assign_union(fb->getRect());
-    if (Server::detectHorizontal)
+    // Horizontal scroll detection needs the old pixels
+    if (Server::detectHorizontal && !hashOnly)
       scrollHasher = new scrollHasher_bothDir_t;
     else
       scrollHasher = new scrollHasher_vert_t;
+
+    arena.initialize(cpu_info::cores_count);
 }
 
 ComparingUpdateTracker::~ComparingUpdateTracker()
@@ -700,6 +771,21 @@ bool ComparingUpdateTracker::compare(bool skipScrollDetection, const Region &ski
   if (!enabled)
     return false;
 
+  if (firstCompare && hashOnly) {
+    // Same as below, but we only remember what the blocks hash to
+    hashCols = (fb->width() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    blockHashes.assign(hashCols * ((fb->height() + BLOCK_SIZE - 1) / BLOCK_SIZE), 0);
+    rowHashes.assign(Server::detectScrolling ? hashCols * fb->height() : 0, 0);
+
+    std::vector<CompareStrip> strips;
+    addStrips(fb->getRect(), &strips);
+    compareStrips(&strips);
+
+    firstCompare = false;
+
+    return false;
+  }
+
   if (firstCompare) {
     // NB: We leave the change region untouched on this iteration,
     // since in effect the entire framebuffer has changed.
@@ -718,8 +804,12 @@ bool ComparingUpdateTracker::compare(bool skipScrollDetection, const Region &ski
   }
 
   copied.get_rects(&rects, copy_delta.x<=0, copy_delta.y<=0);
-  for (i = rects.begin(); i != rects.end(); i++)
-    oldFb.copyRect(*i, copy_delta);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    if (hashOnly)
+      invalidateHashes(*i);
+    else
+      oldFb.copyRect(*i, copy_delta);
+  }
 
   changed.get_rects(&rects);
 
@@ -732,20 +822,78 @@ bool ComparingUpdateTracker::compare(bool skipScrollDetection, const Region &ski
     changedArea += i->area();
   }
   if (atLeast64 && Server::detectScrolling && !skipScrollDetection &&
+      (!hashOnly || !rowHashes.empty()) &&
       (changedArea * 100) / (fb->width() * fb->height()) > (unsigned) Server::scrollDetectLimit) {
     detectScroll = true;
-    Rect pos(0, 0, oldFb.width(), oldFb.height());
-    int unused;
-    scrollHasher->calcHashes(oldFb.getBuffer(pos, &unused), oldFb.width(), oldFb.height(),
-    				oldFb.getPF().bpp / 8);
+    if (hashOnly) {
+      scrollHasher->calcRowHashes(&rowHashes[0], hashCols, fb->width(), fb->height(),
+                                  fb->getPF().bpp / 8);
+    } else {
+      Rect pos(0, 0, oldFb.width(), oldFb.height());
+      int unused;
+      scrollHasher->calcHashes(oldFb.getBuffer(pos, &unused), oldFb.width(), oldFb.height(),
+      				oldFb.getPF().bpp / 8);
+    }
     // Invalidating lossy areas is not needed, the lossy region tracking tracks copies too
   }
 
   copyPassRects.clear();
 
+  if (hashOnly) {
+    // Hashes are kept for a fixed grid of blocks, so compare whole blocks
+    Region aligned;
+    for (i = rects.begin(); i != rects.end(); i++) {
+      Rect r = *i;
+      r.tl.x &= ~(BLOCK_SIZE - 1);
+      r.tl.y &= ~(BLOCK_SIZE - 1);
+      r.br.x = (r.br.x + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+      r.br.y = (r.br.y + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+      aligned.assign_union(r.intersect(fb->getRect()));
+    }
+    aligned.get_rects(&rects);
+  } else if (detectScroll && !Server::detectHorizontal) {
+    // Scroll detection works on whole blocks. Widening the rects can make
+    // them overlap, so merge them again to keep every pixel in one strip.
+    Region aligned;
+    for (i = rects.begin(); i != rects.end(); i++) {
+      Rect r = *i;
+      r.tl.x &= ~(BLOCK_SIZE - 1);
+      aligned.assign_union(r);
+    }
+    aligned.get_rects(&rects);
+  }
+
+  // Split everything in rows of blocks. Comparing them and updating oldFb
+  // is independent per strip, so that part runs in parallel.
+  std::vector<CompareStrip> strips;
+  std::vector<size_t> rectStrips;
+  for (i = rects.begin(); i != rects.end(); i++) {
+    rectStrips.push_back(strips.size());
+    Rect r = i->intersect(fb->getRect());
+    if (!r.is_empty())
+      addStrips(r, &strips);
+  }
+  rectStrips.push_back(strips.size());
+
+  compareStrips(&strips);
+
   Region newChanged;
-  for (i = rects.begin(); i != rects.end(); i++)
-    compareRect(*i, &newChanged, skipCursorArea);
+  for (size_t r = 0; r + 1 < rectStrips.size(); r++) {
+    std::vector<Rect> changedBlocks;
+
+    for (size_t s = rectStrips[r]; s < rectStrips[r + 1]; s++)
+      scanStrip(strips[s], &changedBlocks, skipCursorArea);
+
+    if (!changedBlocks.empty()) {
+      Region temp;
+      temp.setOrderedRects(changedBlocks);
+      newChanged.assign_union(temp);
+    }
+  }
+
+  // Whole blocks were checked, but only the damaged part can differ
+  if (hashOnly)
+    newChanged.assign_intersect(changed);
 
   changed.get_rects(&rects);
   for (i = rects.begin(); i != rects.end(); i++)
@@ -820,147 +968,252 @@ static void tryMerge(std::vector<CopyPassRect> &copyPassRects,
  }
 }
 
-void ComparingUpdateTracker::compareRect(const Rect& inr, Region* newChanged,
-                                         const Region &skipCursorArea)
+void ComparingUpdateTracker::addStrips(const Rect& r,
+                                       std::vector<CompareStrip>* strips)
 {
-    Rect r = inr;
-    if (detectScroll && !Server::detectHorizontal)
-      r.tl.x &= ~(BLOCK_SIZE - 1);
+  for (int blockTop = r.tl.y; blockTop < r.br.y; blockTop += BLOCK_SIZE) {
+    CompareStrip strip;
+    strip.rect = Rect(r.tl.x, blockTop, r.br.x, __rfbmin(r.br.y, blockTop+BLOCK_SIZE));
+    strips->push_back(strip);
+  }
+}
 
-  if (!r.enclosed_by(fb->getRect())) {
-    Rect safe;
-    // Crop the rect and try again
-    safe = r.intersect(fb->getRect());
-    if (!safe.is_empty())
-      compareRect(safe, newChanged, skipCursorArea);
-    return;
+void ComparingUpdateTracker::compareStrips(std::vector<CompareStrip>* strips)
+{
+  if (strips->size() > 1) {
+    arena.execute([&] {
+      tbb::parallel_for(static_cast<size_t>(0), strips->size(), [&](size_t s) {
+        if (hashOnly)
+          hashStrip(&(*strips)[s]);
+        else
+          compareStrip(&(*strips)[s]);
+      });
+    });
+  } else if (!strips->empty()) {
+    if (hashOnly)
+      hashStrip(&(*strips)[0]);
+    else
+      compareStrip(&(*strips)[0]);
   }
+}
 
+// Compares one row of blocks and brings oldFb up to date. Strips never
+// overlap, so any number of these can run at once.
+void ComparingUpdateTracker::compareStrip(CompareStrip* strip)
+{
+  const Rect& pos = strip->rect;
   int bytesPerPixel = fb->getPF().bpp/8;
+
   int oldStride;
-  rdr::U8* oldData = oldFb.getBufferRW(r, &oldStride);
+  rdr::U8* oldBlockPtr = oldFb.getBufferRW(pos, &oldStride);
   int oldStrideBytes = oldStride * bytesPerPixel;
 
-  std::vector<Rect> changedBlocks;
+  int fbStride;
+  const rdr::U8* newBlockPtr = fb->getBuffer(pos, &fbStride);
+  int newStrideBytes = fbStride * bytesPerPixel;
+
+  int blockHeight = pos.height();
+
+  strip->firstChanged.clear();
 
-  for (int blockTop = r.tl.y; blockTop < r.br.y; blockTop += BLOCK_SIZE)
+  for (int blockLeft = pos.tl.x; blockLeft < pos.br.x; blockLeft += BLOCK_SIZE)
   {
-    // Get a strip of the source buffer
-    Rect pos(r.tl.x, blockTop, r.br.x, __rfbmin(r.br.y, blockTop+BLOCK_SIZE));
-    int fbStride;
-    const rdr::U8* newBlockPtr = fb->getBuffer(pos, &fbStride);
-    int newStrideBytes = fbStride * bytesPerPixel;
-
-    rdr::U8* oldBlockPtr = oldData;
-    int blockBottom = __rfbmin(blockTop+BLOCK_SIZE, r.br.y);
-
-    for (int blockLeft = r.tl.x; blockLeft < r.br.x; blockLeft += BLOCK_SIZE)
-    {
-      const rdr::U8* newPtr = newBlockPtr;
-      rdr::U8* oldPtr = oldBlockPtr;
-
-      int blockRight = __rfbmin(blockLeft+BLOCK_SIZE, r.br.x);
-      int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
-      bool changed = false;
-      int y;
-
-      for (y = blockTop; y < blockBottom; y++)
+    int blockRight = __rfbmin(blockLeft+BLOCK_SIZE, pos.br.x);
+    int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
+
+    int y = blockFirstChangedRow(oldBlockPtr, oldStrideBytes,
+                                 newBlockPtr, newStrideBytes,
+                                 blockWidthInBytes, blockHeight);
+    if (y >= 0) {
+      // A block has changed - copy the remainder to the oldFb
+      const rdr::U8* newPtr = newBlockPtr + y * newStrideBytes;
+      rdr::U8* oldPtr = oldBlockPtr + y * oldStrideBytes;
+      for (int y2 = y; y2 < blockHeight; y2++)
       {
-        if (memcmp(oldPtr, newPtr, blockWidthInBytes) != 0)
-        {
-          // A block has changed - copy the remainder to the oldFb
-          changed = true;
-          const rdr::U8* savedPtr = newPtr;
-          for (int y2 = y; y2 < blockBottom; y2++)
-          {
-            memcpy(oldPtr, newPtr, blockWidthInBytes);
-            newPtr += newStrideBytes;
-            oldPtr += oldStrideBytes;
-          }
-          newPtr = savedPtr;
-          break;
-        }
-
+        memcpy(oldPtr, newPtr, blockWidthInBytes);
         newPtr += newStrideBytes;
         oldPtr += oldStrideBytes;
       }
+    }
 
-      if (!changed || (changed && !detectScroll) ||
-          (skipCursorArea.numRects() &&
-           !skipCursorArea.intersect(Rect(blockLeft, blockTop, blockRight, blockBottom)).is_empty())) {
-        if (changed || skipCursorArea.numRects())
-          changedBlocks.push_back(Rect(blockLeft, blockTop,
-                                       blockRight, blockBottom));
+    strip->firstChanged.push_back(y);
 
-        oldBlockPtr += blockWidthInBytes;
-        newBlockPtr += blockWidthInBytes;
-        continue;
-      }
+    oldBlockPtr += blockWidthInBytes;
+    newBlockPtr += blockWidthInBytes;
+  }
 
-      uint_fast32_t outx, outy, outlines;
-      if (blockRight - blockLeft < SCROLLBLOCK_SIZE) {
-        // Block too small, put it out outright as changed
-        changedBlocks.push_back(Rect(blockLeft, blockTop,
-                                     blockRight, blockBottom));
-      } else {
-        // First, try to find a full block
-        outlines = 0;
-        if (blockBottom - blockTop == SCROLLBLOCK_SIZE)
-          scrollHasher->findBlock(newBlockPtr, blockLeft, blockTop, &outx, &outy,
-                                 &outlines);
-
-        if (outlines == SCROLLBLOCK_SIZE) {
-          // Perfect match!
-          // success += outlines;
-          tryMerge(copyPassRects, blockTop, blockLeft, blockRight, outlines, outx, outy);
-
-          scrollHasher->invalidate(blockLeft, blockTop, outlines);
-
-          oldBlockPtr += blockWidthInBytes;
-          newBlockPtr += blockWidthInBytes;
-          continue;
-        }
+  oldFb.commitBufferRW(pos);
+}
+
+// Same as compareStrip(), but against the stored hashes of the blocks.
+// The strip must be aligned to the block grid.
+void ComparingUpdateTracker::hashStrip(CompareStrip* strip)
+{
+  const Rect& pos = strip->rect;
+  int bytesPerPixel = fb->getPF().bpp/8;
+
+  int fbStride;
+  const rdr::U8* newBlockPtr = fb->getBuffer(pos, &fbStride);
+  int newStrideBytes = fbStride * bytesPerPixel;
+
+  int blockHeight = pos.height();
+  rdr::U64 rows[BLOCK_SIZE];
+
+  strip->firstChanged.clear();
+
+  for (int blockLeft = pos.tl.x; blockLeft < pos.br.x; blockLeft += BLOCK_SIZE)
+  {
+    int blockRight = __rfbmin(blockLeft+BLOCK_SIZE, pos.br.x);
+    int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
+    int col = blockLeft / BLOCK_SIZE;
+
+    const rdr::U8* newPtr = newBlockPtr;
+    for (int y = 0; y < blockHeight; y++) {
+      rows[y] = XXH64(newPtr, blockWidthInBytes, 0);
+      newPtr += newStrideBytes;
+    }
+
+    rdr::U64 hash = XXH64(rows, blockHeight * sizeof(rdr::U64), 0);
+    rdr::U64* stored = &blockHashes[pos.tl.y / BLOCK_SIZE * hashCols + col];
 
-        for (; y < blockBottom; y += outlines)
-        {
-          // We have the first changed line. Find the best match, if any
-          scrollHasher->findBestMatch(newPtr, blockBottom - y, blockLeft, y,
-                                      &outx, &outy, &outlines);
-
-          if (!outlines) {
-            // Heuristic, if a line did not match, probably
-            // the next few won't either
-            changedBlocks.push_back(Rect(blockLeft, y,
-                                         blockRight, __rfbmin(y + 4, blockBottom)));
-            y += 4;
-            newPtr += newStrideBytes * 4;
-            // unfound += 4;
-            continue;
-          }
-          // success += outlines;
-
-          // Try to merge it with the last rect
-          tryMerge(copyPassRects, y, blockLeft, blockRight, outlines, outx, outy);
-
-          scrollHasher->invalidate(blockLeft, y, outlines);
-
-          newPtr += newStrideBytes * outlines;
+    int first = -1;
+    if (hash != *stored) {
+      *stored = hash;
+      first = 0;
+
+      if (!rowHashes.empty()) {
+        rdr::U64* storedRows = &rowHashes[pos.tl.y * hashCols + col];
+
+        // A block may have been invalidated without any row changing
+        for (first = 0; first < blockHeight; first++) {
+          if (rows[first] != storedRows[first * hashCols])
+            break;
         }
+        if (first == blockHeight)
+          first = 0;
+
+        for (int y = 0; y < blockHeight; y++)
+          storedRows[y * hashCols] = rows[y];
       }
+    }
+
+    strip->firstChanged.push_back(first);
+
+    newBlockPtr += blockWidthInBytes;
+  }
+}
+
+// Forgets the hashes under r, used when it was changed by a copy
+void ComparingUpdateTracker::invalidateHashes(const Rect& inr)
+{
+  Rect r = inr.intersect(fb->getRect());
+  if (r.is_empty())
+    return;
+
+  for (int row = r.tl.y / BLOCK_SIZE; row <= (r.br.y - 1) / BLOCK_SIZE; row++) {
+    for (int col = r.tl.x / BLOCK_SIZE; col <= (r.br.x - 1) / BLOCK_SIZE; col++)
+      blockHashes[row * hashCols + col] = 0;
+  }
+
+  if (rowHashes.empty())
+    return;
+
+  for (int y = r.tl.y; y < r.br.y; y++) {
+    for (int col = r.tl.x / BLOCK_SIZE; col <= (r.br.x - 1) / BLOCK_SIZE; col++)
+      rowHashes[y * hashCols + col] = 0;
+  }
+}
+
+// Turns the compare results of one strip into changed blocks and scroll
+// copies. The scroll hasher and copyPassRects are order dependent, so this
+// runs serially in strip order.
+void ComparingUpdateTracker::scanStrip(const CompareStrip& strip,
+                                       std::vector<Rect>* changedBlocks,
+                                       const Region &skipCursorArea)
+{
+  const Rect& pos = strip.rect;
+  int bytesPerPixel = fb->getPF().bpp/8;
+
+  int fbStride;
+  const rdr::U8* newBlockPtr = fb->getBuffer(pos, &fbStride);
+  int newStrideBytes = fbStride * bytesPerPixel;
+
+  int blockTop = pos.tl.y;
+  int blockBottom = pos.br.y;
+
+  std::vector<int>::const_iterator firstChanged = strip.firstChanged.begin();
+
+  for (int blockLeft = pos.tl.x; blockLeft < pos.br.x;
+       blockLeft += BLOCK_SIZE, ++firstChanged)
+  {
+    int blockRight = __rfbmin(blockLeft+BLOCK_SIZE, pos.br.x);
+    int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
+    bool changed = *firstChanged >= 0;
+    int y = changed ? blockTop + *firstChanged : blockBottom;
+    const rdr::U8* newPtr = newBlockPtr + (y - blockTop) * newStrideBytes;
+
+    if (!changed || (changed && !detectScroll) ||
+        (skipCursorArea.numRects() &&
+         !skipCursorArea.intersect(Rect(blockLeft, blockTop, blockRight, blockBottom)).is_empty())) {
+      if (changed || skipCursorArea.numRects())
+        changedBlocks->push_back(Rect(blockLeft, blockTop,
+                                      blockRight, blockBottom));
 
-      oldBlockPtr += blockWidthInBytes;
       newBlockPtr += blockWidthInBytes;
+      continue;
     }
 
-    oldData += oldStrideBytes * BLOCK_SIZE;
-  }
+    uint_fast32_t outx, outy, outlines;
+    if (blockRight - blockLeft < SCROLLBLOCK_SIZE) {
+      // Block too small, put it out outright as changed
+      changedBlocks->push_back(Rect(blockLeft, blockTop,
+                                    blockRight, blockBottom));
+    } else {
+      // First, try to find a full block
+      outlines = 0;
+      if (blockBottom - blockTop == SCROLLBLOCK_SIZE)
+        scrollHasher->findBlock(newBlockPtr, blockLeft, blockTop, &outx, &outy,
+                               &outlines);
+
+      if (outlines == SCROLLBLOCK_SIZE) {
+        // Perfect match!
+        // success += outlines;
+        tryMerge(copyPassRects, blockTop, blockLeft, blockRight, outlines, outx, outy);
+
+        scrollHasher->invalidate(blockLeft, blockTop, outlines);
 
-  oldFb.commitBufferRW(r);
+        newBlockPtr += blockWidthInBytes;
+        continue;
+      }
+
+      for (; y < blockBottom; y += outlines)
+      {
+        // We have the first changed line. Find the best match, if any
+        scrollHasher->findBestMatch(newPtr, blockBottom - y, blockLeft, y,
+                                    &outx, &outy, &outlines);
+
+        if (!outlines) {
+          // Heuristic, if a line did not match, probably
+          // the next few won't either
+          changedBlocks->push_back(Rect(blockLeft, y,
+                                        blockRight, __rfbmin(y + 4, blockBottom)));
+          y += 4;
+          newPtr += newStrideBytes * 4;
+          // unfound += 4;
+          continue;
+        }
+        // success += outlines;
+
+        // Try to merge it with the last rect
+        tryMerge(copyPassRects, y, blockLeft, blockRight, outlines, outx, outy);
+
+        scrollHasher->invalidate(blockLeft, y, outlines);
+
+        newPtr += newStrideBytes * outlines;
+      }
+    }
 
-  if (!changedBlocks.empty()) {
-    Region temp;
-    temp.setOrderedRects(changedBlocks);
-    newChanged->assign_union(temp);
+    newBlockPtr += blockWidthInBytes;
   }
 }
 
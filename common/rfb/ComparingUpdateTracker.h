@@ -20,6 +20,8 @@
 #define __RFB_COMPARINGUPDATETRACKER_H__
 
 #include <rfb/UpdateTracker.h>
+#include <tbb/task_arena.h>
+#include <vector>
 
 class scrollHasher_t;
 
@@ -51,16 +53,36 @@ namespace rfb {
     rdr::U8 changedPerc;
 
   private:
-    void compareRect(const Rect& r, Region* newchanged, const Region &skipCursorArea);
+    // One row of blocks, and per block the first changed line or -1
+    struct CompareStrip {
+      Rect rect;
+      std::vector<int> firstChanged;
+    };
+
+    void addStrips(const Rect& r, std::vector<CompareStrip>* strips);
+    void compareStrips(std::vector<CompareStrip>* strips);
+    void compareStrip(CompareStrip* strip);
+    void hashStrip(CompareStrip* strip);
+    void invalidateHashes(const Rect& r);
+    void scanStrip(const CompareStrip& strip, std::vector<Rect>* changedBlocks,
+                   const Region &skipCursorArea);
     PixelBuffer* fb;
     ManagedPixelBuffer oldFb;
     bool firstCompare;
     bool enabled;
     bool detectScroll;
 
+    // Hash-only mode keeps no oldFb, only a hash per 64x64 block and, for
+    // scroll detection, one per row of every block
+    bool hashOnly;
+    int hashCols;
+    std::vector<rdr::U64> blockHashes;
+    std::vector<rdr::U64> rowHashes;
+
     rdr::U32 totalPixels, missedPixels;
     scrollHasher_t *scrollHasher;
     std::vector<CopyPassRect> copyPassRects;
+    tbb::task_arena arena;
   };
 
 }
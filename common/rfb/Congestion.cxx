@@ -31,17 +31,26 @@
  * We use a simplistic form of slow start in order to ramp up quickly
  * from an idle state. We do not have any persistent threshold though
  * as we have too much noise for it to be reliable.
+ *
+ * On Linux we can do better by asking the kernel. TCP_INFO gives us the
+ * delivery rate and minimum RTT as TCP itself measured them, so like BBR
+ * we keep the highest delivery rate of the last few round trips as the
+ * bottleneck bandwidth, and allow twice the resulting bandwidth-delay
+ * product in flight. TCP_NOTSENT_LOWAT stops the kernel from queueing
+ * up more than a fraction of that, so that updates wait in our buffer
+ * rather than going stale in the socket.
  */
 
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 #include <sys/time.h>
 
 #ifdef __linux__
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <netinet/tcp.h>
+#include <linux/tcp.h>
 #include <linux/sockios.h>
 #endif
 
@@ -69,6 +78,10 @@ static constexpr unsigned MINIMUM_WINDOW = 4096;
 // limit for now...
 static constexpr unsigned MAXIMUM_WINDOW = 4194304;
 
+// Lower bound for TCP_NOTSENT_LOWAT, so that the kernel always has a few
+// segments at hand
+static constexpr unsigned MINIMUM_LOWAT = 16384;
+
 // Compare position even when wrapped around
 static inline bool isAfter(unsigned a, unsigned b) {
     return a != b && a - b <= UINT_MAX / 2;
@@ -218,6 +231,9 @@ void Congestion::gotPong() {
 }
 
 bool Congestion::isCongested() const {
+    if (kernelStats)
+        return kernelInFlight >= getWindow();
+
     if (getInFlight() < congWindow)
         return false;
 
@@ -225,6 +241,17 @@ bool Congestion::isCongested() const {
 }
 
 int Congestion::getUncongestedETA() {
+    if (kernelStats) {
+        const unsigned window = getWindow();
+
+        if (kernelInFlight < window)
+            return 0;
+        if (bottleneckBw == 0)
+            return -1;
+
+        return __rfbmax((kernelInFlight - window) * 1000 / bottleneckBw, 1);
+    }
+
     const unsigned targetAcked = lastPosition - congWindow;
 
     // Simple case?
@@ -282,7 +309,79 @@ int Congestion::getUncongestedETA() {
     }
 }
 
+void Congestion::sampleSocket(int fd) {
+#ifdef __linux__
+    struct tcp_info info;
+    socklen_t len;
+    timeval now;
+
+    len = sizeof(info);
+    if ((fd < 0) ||
+        (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) ||
+        (len < offsetof(struct tcp_info, tcpi_delivery_rate) +
+               sizeof(info.tcpi_delivery_rate))) {
+        kernelStats = false;
+        return;
+    }
+
+    gettimeofday(&now, nullptr);
+
+    if (!kernelStats) {
+        kernelStats = true;
+        bottleneckBw = roundMaxBw = 0;
+        while (!bwRounds.empty())
+            bwRounds.pop_front();
+        roundStart = now;
+    }
+
+    kernelRTT = __rfbmax(info.tcpi_min_rtt / 1000, 1);
+    kernelInFlight = info.tcpi_unacked * info.tcpi_snd_mss +
+                     info.tcpi_notsent_bytes;
+
+    // We rarely keep the link busy, so most samples are application
+    // limited. Those only tell us that the link can do at least that
+    // much, so they may raise the estimate but never lower it.
+    const size_t rate = info.tcpi_delivery_rate;
+    if (!info.tcpi_delivery_rate_app_limited || rate > bottleneckBw)
+        roundMaxBw = __rfbmax(roundMaxBw, rate);
+
+    // Windowed max over the last ten round trips. Rounds without a usable
+    // sample don't count, or an idle link would forget its bandwidth.
+    if (msBetween(&roundStart, &now) >= kernelRTT) {
+        if (roundMaxBw != 0) {
+            if (bwRounds.size() == bwRounds.capacity())
+                bwRounds.pop_front();
+            bwRounds.push_back(roundMaxBw);
+            roundMaxBw = 0;
+        }
+        roundStart = now;
+    }
+
+    bottleneckBw = roundMaxBw;
+    for (auto iter = bwRounds.cbegin(); !(iter == bwRounds.cend()); ++iter)
+        bottleneckBw = __rfbmax(bottleneckBw, *iter);
+
+    // Half a window unsent covers the kernel until our next write. Only
+    // bother the kernel when the target has moved noticeably.
+    const unsigned lowat = __rfbmax(getWindow() / 2, MINIMUM_LOWAT);
+    if ((lowat > notSentLowat * 5 / 4) || (lowat < notSentLowat * 3 / 4)) {
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                       &lowat, sizeof(lowat)) == 0)
+            notSentLowat = lowat;
+    }
+
+#ifdef CONGESTION_DEBUG
+    vlog.debug("Kernel: %g Mbps, min RTT %u ms, %u bytes in flight, "
+               "lowat %u", bottleneckBw * 8.0 / 1000000.0, kernelRTT,
+               kernelInFlight, notSentLowat);
+#endif
+#endif
+}
+
 size_t Congestion::getBandwidth() const {
+    if (kernelStats && bottleneckBw != 0)
+        return bottleneckBw;
+
     // No measurements yet? Guess RTT of 60 ms
     if (safeBaseRTT == (unsigned) -1)
         return congWindow * 1000 / 60;
@@ -290,7 +389,14 @@ size_t Congestion::getBandwidth() const {
     return congWindow * 1000 / safeBaseRTT;
 }
 
+size_t Congestion::getQueueLimit(unsigned frameMs) const {
+    return __rfbmin(getWindow(), getBandwidth() * frameMs / 1000);
+}
+
 unsigned Congestion::getPingTime() const {
+    if (kernelStats)
+        return kernelRTT;
+
     return safeBaseRTT;
 }
 
@@ -313,10 +419,14 @@ void Congestion::debugTrace(const char *filename, int fd) {
             (ioctl(fd, SIOCOUTQ, &buffered) == 0)) {
             struct timeval now;
             gettimeofday(&now, nullptr);
-            fprintf(f, "%u.%06u,%u,%u,%u,%u\n",
+            // The ping based columns come first, as they always have,
+            // then the kernel based model's window and in flight bytes
+            fprintf(f, "%u.%06u,%u,%u,%u,%u,%u,%u,%llu,%u\n",
                     (unsigned) now.tv_sec, (unsigned) now.tv_usec,
                     congWindow, info.tcpi_snd_cwnd * info.tcpi_snd_mss,
-                    getInFlight(), buffered);
+                    getInFlight(), buffered, getWindow(), kernelInFlight,
+                    (unsigned long long) info.tcpi_delivery_rate,
+                    info.tcpi_min_rtt);
         }
         fclose(f);
     }
@@ -391,6 +501,19 @@ unsigned Congestion::getInFlight() const {
     return lastPosition - acked;
 }
 
+unsigned Congestion::getWindow() const {
+    if (!kernelStats || bottleneckBw == 0)
+        return congWindow;
+
+    size_t window = bottleneckBw * kernelRTT / 1000 * 2;
+    if (window < MINIMUM_WINDOW)
+        window = MINIMUM_WINDOW;
+    if (window > MAXIMUM_WINDOW)
+        window = MAXIMUM_WINDOW;
+
+    return window;
+}
+
 void Congestion::updateCongestion() {
     // We want at least three measurements to avoid noise
     if (measurements < 3)
@@ -136,6 +136,16 @@ namespace rfb {
 
         void gotPong();
 
+        // sampleSocket() reads what the kernel knows about the TCP
+        // connection, and bases the estimates below on its delivery rate
+        // and minimum RTT instead of our own pings, BBR style. It also
+        // keeps the kernel's queue of unsent data short, so that the
+        // backlog stays with us where isCongested() can see it. Pass -1,
+        // or a socket without TCP_INFO, to use the ping based model.
+        void sampleSocket(int fd);
+
+        [[nodiscard]] bool usingKernelStats() const { return kernelStats; }
+
         // isCongested() determines if the transport is currently congested
         // or if more data can be sent.
         bool isCongested() const;
@@ -150,6 +160,11 @@ namespace rfb {
         // per second.
         size_t getBandwidth() const;
 
+        // getQueueLimit() returns how many bytes of encoded updates may be
+        // waiting to be sent while the next one is encoded. This is at most
+        // one congestion window, or what can be sent in frameMs.
+        size_t getQueueLimit(unsigned frameMs) const;
+
         unsigned getPingTime() const;
         double getJitter() const;
 
@@ -163,6 +178,10 @@ namespace rfb {
 
         unsigned getInFlight() const;
 
+        // getWindow() returns how many bytes may be in flight, from the
+        // kernel's estimates if used, otherwise the congestion window.
+        unsigned getWindow() const;
+
         void updateCongestion();
 
     private:
@@ -195,6 +214,16 @@ namespace rfb {
 
         double rttvar{0.0};
         double srtt{0.0};
+
+        // Kernel assisted model
+        bool kernelStats{false};
+        size_t bottleneckBw{0};
+        unsigned kernelRTT{0};
+        unsigned kernelInFlight{0};
+        unsigned notSentLowat{0};
+        size_t roundMaxBw{0};
+        timeval roundStart{};
+        CircularBuffer<size_t, 10> bwRounds;
     };
 }
 
@@ -63,7 +63,7 @@ ConnParams::ConnParams()
     supportsContinuousUpdates(false), supportsExtendedClipboard(false),
     supportsDisconnectNotify(false),
     supportsDirectMouse(false),
-    supportsUdp(false),
+    supportsUdp(false), supportsUdpFec(false),
     compressLevel(2), qualityLevel(-1), fineQualityLevel(-1),
     subsampling(subsampleUndefined), name_(0), cursorPos_(0, 0), verStrPos(0),
     ledState_(ledUnknown), shandler(NULL)
@@ -153,6 +153,7 @@ void ConnParams::setEncodings(int nEncodings, const rdr::S32* encodings)
   supportsQOI = false;
   supportsDisconnectNotify = false;
   supportsDirectMouse = false;
+  supportsUdpFec = false;
   compressLevel = -1;
   qualityLevel = -1;
   fineQualityLevel = -1;
@@ -230,6 +231,10 @@ void ConnParams::setEncodings(int nEncodings, const rdr::S32* encodings)
       supportsDirectMouse = true;
       clientparlog("directMouse", true);
       break;
+    case pseudoEncodingUdpFec:
+      supportsUdpFec = true;
+      clientparlog("udpFec", true);
+      break;
     case pseudoEncodingFence:
       supportsFence = true;
       clientparlog("fence", true);
@@ -122,6 +122,7 @@ namespace rfb {
     bool supportsDirectMouse;
 
     bool supportsUdp;
+    bool supportsUdpFec;
 
     int compressLevel;
     int qualityLevel;
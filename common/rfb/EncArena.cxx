@@ -0,0 +1,100 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <rfb/EncArena.h>
+
+using namespace rfb;
+
+std::atomic<unsigned> EncArena::contexts(0);
+
+static const size_t minBufferSize = 4096;
+
+EncOutStream::EncOutStream(EncBytes *buf_): buf(buf_) {
+  // Whatever room there already is gets written over
+  buf->resize(buf->capacity() > minBufferSize ? buf->capacity() : minBufferSize);
+
+  ptr = buf->data();
+  end = ptr + buf->size();
+}
+
+void EncOutStream::finish() {
+  buf->resize(ptr - buf->data());
+
+  ptr = end = buf->data() + buf->size();
+}
+
+size_t EncOutStream::length() {
+  return ptr - buf->data();
+}
+
+void EncOutStream::overrun(size_t needed) {
+  const size_t pos = ptr - buf->data();
+
+  if (pos + needed > buf->size() * 2)
+    buf->resize(pos + needed);
+  else
+    buf->resize(buf->size() * 2);
+
+  ptr = buf->data() + pos;
+  end = buf->data() + buf->size();
+}
+
+EncArena::EncArena(): frames(0), created(0), growths(0) {
+}
+
+void EncArena::begin(const size_t rects) {
+  countGrowth();
+
+  for (size_t i = 0; i < buffers.size(); i++) {
+    // Still in the cache, or still being written out elsewhere
+    if (buffers[i].use_count() > 1) {
+      buffers[i] = std::make_shared<EncBytes>();
+      created++;
+    }
+
+    buffers[i]->clear();
+  }
+
+  while (buffers.size() < rects) {
+    buffers.push_back(std::make_shared<EncBytes>());
+    created++;
+  }
+
+  capacities.resize(buffers.size());
+  for (size_t i = 0; i < buffers.size(); i++)
+    capacities[i] = buffers[i]->capacity();
+
+  if (rects)
+    frames++;
+}
+
+unsigned long long EncArena::allocations() {
+  countGrowth();
+
+  return created + growths;
+}
+
+// Compares against the capacities at the start of the frame, so that
+// the compressing threads don't need to count anything
+void EncArena::countGrowth() {
+  for (size_t i = 0; i < capacities.size(); i++) {
+    if (buffers[i]->capacity() != capacities[i]) {
+      growths++;
+      capacities[i] = buffers[i]->capacity();
+    }
+  }
+}
@@ -0,0 +1,111 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_ENCARENA_H__
+#define __RFB_ENCARENA_H__
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <rdr/OutStream.h>
+
+#include <stdint.h>
+
+namespace rfb {
+
+  // Leaves what a vector grows by uninitialised, as encoders are about
+  // to write over it anyway
+  template<class T> class NoInitAllocator : public std::allocator<T> {
+  public:
+    template<class U> struct rebind { typedef NoInitAllocator<U> other; };
+
+    NoInitAllocator() noexcept {}
+    template<class U> NoInitAllocator(const NoInitAllocator<U>&) noexcept {}
+
+    template<class U> void construct(U *p) { ::new((void *) p) U; }
+    template<class U, class... Args> void construct(U *p, Args&&... args) {
+      ::new((void *) p) U(std::forward<Args>(args)...);
+    }
+  };
+
+  typedef std::vector<uint8_t, NoInitAllocator<uint8_t> > EncBytes;
+
+  // Compressed rect data. Shared between the cache and any updates still
+  // writing it out, so entries are never copied.
+  typedef std::shared_ptr<const EncBytes> EncBuffer;
+
+  //
+  // An OutStream writing straight into an EncBytes, which grows as
+  // needed. finish() cuts it down to what was written.
+  //
+
+  class EncOutStream : public rdr::OutStream {
+  public:
+    EncOutStream(EncBytes *buf);
+
+    void finish();
+    size_t length() override;
+
+    // For filling in what was left blank earlier
+    rdr::U8 *at(size_t pos) { return buf->data() + pos; }
+
+  protected:
+    void overrun(size_t needed) override;
+
+    EncBytes *buf;
+  };
+
+  //
+  // Output buffers for the compressed rects of a frame, one per rect.
+  // Once nothing else holds a buffer, like the cache, it is emptied and
+  // handed to the same rect of the next frame with the room it had, so
+  // a steady stream of updates compresses without allocating.
+  //
+
+  class EncArena {
+  public:
+    EncArena();
+
+    // Readies a buffer for each of the rects of a new frame
+    void begin(size_t rects);
+
+    // Only to be used by whoever is compressing rect i
+    const std::shared_ptr<EncBytes> &get(size_t i) const { return buffers[i]; }
+
+    // Allocations of the frames so far, new buffers and ones that grew
+    unsigned long long allocations();
+    unsigned frameCount() const { return frames; }
+
+    // Compressor contexts set up by the encoders. They are kept per
+    // thread and shared by all connections.
+    static std::atomic<unsigned> contexts;
+
+  protected:
+    void countGrowth();
+
+    std::vector<std::shared_ptr<EncBytes> > buffers;
+    std::vector<size_t> capacities;
+
+    unsigned frames;
+    unsigned long long created, growths;
+  };
+}
+
+#endif
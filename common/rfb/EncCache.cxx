@@ -18,55 +18,117 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
  * USA.
  */
+#include <string.h>
+
 #include <rfb/EncCache.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/util.h>
+#include <rfb/xxhash.h>
 
 using namespace rfb;
 
-EncCache::EncCache() {
-  enabled = false;
+static LogWriter vlog("EncCache");
+
+EncCache::EncCache(): enabled(false), bytes(0), maxBytes(0),
+                      hits(0), misses(0), evictions(0) {
 }
 
 EncCache::~EncCache() {
 }
 
+uint64_t EncCache::hashPixels(const PixelBuffer *pb) {
+  const Rect &r = pb->getRect();
+  char pfstr[256];
+  int stride;
+
+  // The same bytes mean different things in different formats
+  pb->getPF().print(pfstr, sizeof(pfstr));
+  uint64_t hash = XXH64(pfstr, strlen(pfstr), 0);
+
+  const rdr::U8 *buf = pb->getBuffer(r, &stride);
+  const size_t rowBytes = r.width() * (pb->getPF().bpp / 8);
+  const size_t strideBytes = stride * (pb->getPF().bpp / 8);
+
+  if (rowBytes == strideBytes)
+    return XXH64(buf, rowBytes * r.height(), hash);
+
+  for (int y = 0; y < r.height(); y++) {
+    hash = XXH64(buf, rowBytes, hash);
+    buf += strideBytes;
+  }
+
+  return hash;
+}
+
 void EncCache::clear() {
-  std::map<EncId, const void *>::iterator it;
-  for (it = cache.begin(); it != cache.end(); it++)
-    free((void *) it->second);
+  os::AutoMutex a(&mutex);
 
   cache.clear();
+  lru.clear();
+  bytes = 0;
+}
+
+void EncCache::add(const EncId &id, const EncBuffer &data) {
+  os::AutoMutex a(&mutex);
+
+  // Another client may have encoded the same rect meanwhile
+  if (cache.find(id) != cache.end())
+    return;
+
+  lru.emplace_front(id, data);
+  cache[id] = lru.begin();
+  bytes += data->size();
+
+  evict();
 }
 
-void EncCache::add(uint8_t type, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
-                   uint32_t len, const void *data) {
+EncBuffer EncCache::get(const EncId &id) {
+  os::AutoMutex a(&mutex);
+
+  const auto it = cache.find(id);
+  if (it == cache.end()) {
+    misses++;
+    return EncBuffer();
+  }
 
-  EncId id;
+  hits++;
+  lru.splice(lru.begin(), lru, it->second);
 
-  id.type = type;
-  id.x = x;
-  id.y = y;
-  id.w = w;
-  id.h = h;
-  id.len = len;
+  return it->second->second;
+}
+
+void EncCache::setMaxBytes(const size_t bytes_) {
+  os::AutoMutex a(&mutex);
+
+  maxBytes = bytes_;
+  enabled = maxBytes != 0;
 
-  cache[id] = data;
+  evict();
 }
 
-const void *EncCache::get(uint8_t type, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
-                          uint32_t &len) const {
+// Must be called with the mutex held
+void EncCache::evict() {
+  while (bytes > maxBytes && !lru.empty()) {
+    const auto &last = lru.back();
+
+    // Any update still using the data keeps its own reference
+    bytes -= last.second->size();
+    cache.erase(last.first);
+    lru.pop_back();
+    evictions++;
+  }
+}
 
-  EncId id;
+void EncCache::logStats() {
+  char str[1024];
 
-  id.type = type;
-  id.x = x;
-  id.y = y;
-  id.w = w;
-  id.h = h;
+  os::AutoMutex a(&mutex);
 
-  std::map<EncId, const void *>::const_iterator it = cache.find(id);
-  if (it == cache.end())
-    return NULL;
+  if (!hits && !misses)
+    return;
 
-  len = it->first.len;
-  return it->second;
+  iecPrefix(bytes, "B", str, sizeof(str));
+  vlog.info("%llu hits, %llu misses (%.1f%% hit rate), %llu evictions, %s in use",
+            hits, misses, hits * 100.0 / (hits + misses), evictions, str);
 }
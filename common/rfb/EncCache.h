@@ -21,26 +21,45 @@
 #ifndef __RFB_ENCCACHE_H__
 #define __RFB_ENCCACHE_H__
 
-#include <map>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include <os/Mutex.h>
 #include <rdr/types.h>
+#include <rfb/EncArena.h>
 
 #include <stdint.h>
 #include <stdlib.h>
 
 namespace rfb {
 
+  class PixelBuffer;
+
+  // Encoded rects are identified by what they contain, not where they
+  // are, so a rect that comes back later or elsewhere, or is shared
+  // between clients, only gets encoded once.
   struct EncId {
-    uint8_t type;
-    uint16_t x, y, w, h;
-    uint32_t len;
-
-    bool operator <(const EncId &other) const {
-      return type < other.type ||
-             x < other.x ||
-             y < other.y ||
-             w < other.w ||
-             h < other.h;
+    uint64_t hash; // of the source pixels, see EncCache::hashPixels()
+    uint16_t w, h;
+    uint8_t type; // encoder class
+    uint8_t quality;
+    bool lowQuality; // video mode quality override
+
+    bool operator ==(const EncId &other) const {
+      return hash == other.hash &&
+             w == other.w &&
+             h == other.h &&
+             type == other.type &&
+             quality == other.quality &&
+             lowQuality == other.lowQuality;
+    }
+  };
+
+  struct EncIdHasher {
+    size_t operator()(const EncId &id) const {
+      return id.hash ^ (id.type << 8 | id.quality << 1 | id.lowQuality);
     }
   };
 
@@ -49,16 +68,33 @@ namespace rfb {
     EncCache();
     ~EncCache();
 
+    static uint64_t hashPixels(const PixelBuffer *pb);
+
     void clear();
-    void add(uint8_t type, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
-             uint32_t len, const void *data);
-    const void *get(uint8_t type, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
-                    uint32_t &len) const;
+    void add(const EncId &id, const EncBuffer &data);
+    EncBuffer get(const EncId &id);
+
+    // Evicts the least recently used entries over this many bytes
+    void setMaxBytes(size_t bytes);
+
+    void logStats();
 
     bool enabled;
 
   protected:
-    std::map<EncId, const void *> cache;
+    void evict();
+
+    typedef std::list<std::pair<EncId, EncBuffer> > LruList;
+
+    // Most recently used first
+    LruList lru;
+    std::unordered_map<EncId, LruList::iterator, EncIdHasher> cache;
+
+    size_t bytes, maxBytes;
+    unsigned long long hits, misses, evictions;
+
+    // Clients may be encoded in parallel, see Server::clientThreads
+    os::Mutex mutex;
   };
 }
 
@@ -25,6 +25,8 @@
 #include <rfb/EncodeManager.h>
 #include <rfb/Encoder.h>
 #include <rfb/Palette.h>
+#include <rfb/RectAnalysis.h>
+#include <rfb/scale_avx2.h>
 #include <rfb/scale_sse2.h>
 #include <rfb/SConnection.h>
 #include <rfb/ServerCore.h>
@@ -35,6 +37,7 @@
 #include <rfb/Watermark.h>
 
 #include <execution>
+#include <limits>
 #include <rfb/HextileEncoder.h>
 #include <rfb/RREEncoder.h>
 #include <rfb/RawEncoder.h>
@@ -43,6 +46,7 @@
 #include <rfb/TightQOIEncoder.h>
 #include <rfb/TightWEBPEncoder.h>
 #include <rfb/ZRLEEncoder.h>
+#include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
 
 #include "encoders/EncoderProbe.h"
@@ -53,20 +57,11 @@ using namespace rfb;
 
 static LogWriter vlog("EncodeManager");
 
-// If this rect was touched this update, add this to its quality score
-#define SCORE_INCREMENT 32
-
 // Split each rectangle into smaller ones no larger than this area,
 // and no wider than this width.
 static constexpr int SubRectMaxArea = 65536;
 static constexpr int SubRectMaxWidth = 2048;
 
-// The size in pixels of either side of each block tested when looking
-// for solid blocks.
-static constexpr int SolidSearchBlock = 16;
-// Don't bother with blocks smaller than this
-static constexpr int SolidBlockMinArea = 2048;
-
 namespace rfb {
 
 enum EncoderClass {
@@ -92,17 +87,6 @@ enum EncoderType {
   encoderTypeMax,
 };
 
-struct RectInfo {
-  int rleRuns;
-  Palette *palette;
-};
-
-struct QualityInfo {
-  struct timeval lastUpdate{};
-  Rect rect;
-  unsigned score{};
-};
-
 };
 
 static const char *encoderClassName(EncoderClass klass)
@@ -167,7 +151,8 @@ static void updateMaxVideoRes(uint16_t *x, uint16_t *y) {
   }
 }
 
-EncodeManager::EncodeManager(SConnection *conn_, EncCache *encCache_, const FFmpeg& ffmpeg_, const video_encoders::EncoderProbe &encoder_probe_) :
+EncodeManager::EncodeManager(SConnection *conn_, EncCache *encCache_, const FFmpeg& ffmpeg_, const video_encoders::EncoderProbe &encoder_probe_,
+                             SharedVideoEncoders *sharedVideoEncoders) :
     conn(conn_), dynamicQualityMin(-1), dynamicQualityOff(-1), areaCur(0), videoDetected(false), videoTimer(this),
     watermarkStats(0), maxEncodingTime(0), framesSinceEncPrint(0), ffmpeg(ffmpeg_), ffmpeg_available(ffmpeg.is_available()),
     encoder_probe(encoder_probe_), encCache(encCache_)
@@ -193,13 +178,15 @@ EncodeManager::EncodeManager(SConnection *conn_, EncCache *encCache_, const FFmp
                 conn_->cp.height,
                 static_cast<uint8_t>(Server::frameRate),
                 static_cast<uint8_t>(Server::groupOfPicture),
-                static_cast<uint8_t>(Server::videoQualityCRFCQP)});
+                static_cast<uint8_t>(Server::videoQualityCRFCQP)},
+            sharedVideoEncoders);
     }
 
     video_mode_available = ffmpeg_available && Server::videoCodec[0];
 
     webpBenchResult = ((TightWEBPEncoder *) encoders[encoderTightWEBP])->benchmark();
     vlog.info("WEBP benchmark result: %u ms", webpBenchResult);
+    scheduler.seed(webpBenchResult);
 
     unsigned videoTime = rfb::Server::videoTime;
     if (videoTime < 1)
@@ -231,7 +218,7 @@ EncodeManager::EncodeManager(SConnection *conn_, EncCache *encCache_, const FFmp
     }
 
     const auto num_cores = cpu_info::cores_count;
-    arena.initialize(num_cores);
+    arena.initialize(Server::rectThreads ? (int) Server::rectThreads : num_cores);
 }
 
 EncodeManager::~EncodeManager()
@@ -242,9 +229,6 @@ EncodeManager::~EncodeManager()
 
     for (auto iter = encoders.begin(); iter != encoders.end(); ++iter)
         delete *iter;
-
-    for (auto it = qualityList.begin(); it != qualityList.end(); ++it)
-        delete *it;
 }
 
 void EncodeManager::logStats()
@@ -322,6 +306,15 @@ void EncodeManager::logStats()
   iecPrefix(bytes, "B", a, sizeof(a));
   vlog.info("         %s (1:%g ratio)", a, ratio);
 
+  if (encArena.frameCount()) {
+    const unsigned long long allocs = encArena.allocations();
+
+    vlog.info("  Output buffer allocations: %llu, %.1f per frame",
+              allocs, (double) allocs / encArena.frameCount());
+    vlog.info("  Compressor contexts: %u, shared by all connections",
+              EncArena::contexts.load());
+  }
+
   if (watermarkData) {
     siPrefix(watermarkStats, "B", a, sizeof(a));
     vlog.info("  Watermark data sent: %s", a);
@@ -443,7 +436,14 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
 
     bool video_mode = video_mode_available && conn->cp.encoder_config.encoder != KasmVideoEncoders::Encoder::unavailable;
     if (video_mode) {
-        video_mode = updateVideo(changed, layout, pb, fullRefreshRequested);
+        // The video encoders keep their converted frames between updates,
+        // so they need to know about everything that changed on screen,
+        // including copies and the cursor
+        Region damage = changed_.union_(copied);
+        for (const auto &rect : copypassed)
+            damage.assign_union(rect.rect);
+
+        video_mode = updateVideo(damage, layout, pb, fullRefreshRequested);
         if (!video_mode)
             conn->cp.encoder_config.encoder = KasmVideoEncoders::Encoder::unavailable;
     }
@@ -504,7 +504,7 @@ bool EncodeManager::updateVideo(const Region &changed, const ScreenSet &layout,
         return false;
 
     static const Palette palette;
-    if (!screen_encoder_manager->writeFrame(pb, palette, fullRefreshRequested))
+    if (!screen_encoder_manager->writeFrame(pb, changed, palette, fullRefreshRequested))
         return false;
 
     std::vector<Rect> rects;
@@ -823,107 +823,37 @@ void EncodeManager::writeCopyRects(const Region& copied, const Point& delta)
 void EncodeManager::writeSolidRects(Region *changed, const PixelBuffer* pb)
 {
   std::vector<Rect> rects;
-  std::vector<Rect>::const_iterator rect;
+  std::vector<SolidRect>::const_iterator solid;
 
   changed->get_rects(&rects);
-  for (rect = rects.begin(); rect != rects.end(); ++rect)
-    findSolidRect(*rect, changed, pb);
-}
-
-void EncodeManager::findSolidRect(const Rect& rect, Region *changed,
-                                  const PixelBuffer* pb)
-{
-  Rect sr;
-  int dx, dy, dw, dh;
-
-  // We start by finding a solid 16x16 block
-  for (dy = rect.tl.y; dy < rect.br.y; dy += SolidSearchBlock) {
-
-    dh = SolidSearchBlock;
-    if (dy + dh > rect.br.y)
-      dh = rect.br.y - dy;
-
-    for (dx = rect.tl.x; dx < rect.br.x; dx += SolidSearchBlock) {
-      // We define it like this to guarantee alignment
-      rdr::U32 _buffer;
-      rdr::U8* colourValue = (rdr::U8*)&_buffer;
-
-      dw = SolidSearchBlock;
-      if (dx + dw > rect.br.x)
-        dw = rect.br.x - dx;
-
-      pb->getImage(colourValue, Rect(dx, dy, dx+1, dy+1));
-
-      sr.setXYWH(dx, dy, dw, dh);
-      if (checkSolidTile(sr, colourValue, pb)) {
-        Rect erb, erp;
-
-        Encoder *encoder;
-
-        // We then try extending the area by adding more blocks
-        // in both directions and pick the combination that gives
-        // the largest area.
-        sr.setXYWH(dx, dy, rect.br.x - dx, rect.br.y - dy);
-        extendSolidAreaByBlock(sr, colourValue, pb, &erb);
-
-        // Did we end up getting the entire rectangle?
-        if (erb.equals(rect))
-          erp = erb;
-        else {
-          // Don't bother with sending tiny rectangles
-          if (erb.area() < SolidBlockMinArea)
-            continue;
-
-          // Extend the area again, but this time one pixel
-          // row/column at a time.
-          extendSolidAreaByPixel(rect, erb, colourValue, pb, &erp);
-        }
-
-        // Send solid-color rectangle.
-        encoder = startRect(erp, encoderSolid);
-        if (encoder->flags & EncoderUseNativePF) {
-          encoder->writeSolidRect(erp.width(), erp.height(),
-                                  pb->getPF(), colourValue);
-        } else {
-          rdr::U32 _buffer2;
-          rdr::U8* converted = (rdr::U8*)&_buffer2;
-
-          conn->cp.pf().bufferFromBuffer(converted, pb->getPF(),
-                                         colourValue, 1);
-
-          encoder->writeSolidRect(erp.width(), erp.height(),
-                                  conn->cp.pf(), converted);
-        }
-        endRect();
-
-        changed->assign_subtract(Region(erp));
 
-        // Search remaining areas by recursion
-        // FIXME: Is this the best way to divide things up?
+  solidRects.clear();
+  arena.execute([&] {
+    solidSearch.find(pb, rects, &solidRects);
+  });
 
-        // Left? (Note that we've already searched a SolidSearchBlock
-        //        pixels high strip here)
-        if ((erp.tl.x != rect.tl.x) && (erp.height() > SolidSearchBlock)) {
-          sr.setXYWH(rect.tl.x, erp.tl.y + SolidSearchBlock,
-                     erp.tl.x - rect.tl.x, erp.height() - SolidSearchBlock);
-          findSolidRect(sr, changed, pb);
-        }
+  for (solid = solidRects.begin(); solid != solidRects.end(); ++solid) {
+    const Rect& erp = solid->rect;
+    Encoder *encoder;
 
-        // Right?
-        if (erp.br.x != rect.br.x) {
-          sr.setXYWH(erp.br.x, erp.tl.y, rect.br.x - erp.br.x, erp.height());
-          findSolidRect(sr, changed, pb);
-        }
+    // Send solid-color rectangle.
+    encoder = startRect(erp, encoderSolid);
+    if (encoder->flags & EncoderUseNativePF) {
+      encoder->writeSolidRect(erp.width(), erp.height(),
+                              pb->getPF(), solid->colour);
+    } else {
+      rdr::U32 _buffer2;
+      rdr::U8* converted = (rdr::U8*)&_buffer2;
 
-        // Below?
-        if (erp.br.y != rect.br.y) {
-          sr.setXYWH(rect.tl.x, erp.br.y, rect.width(), rect.br.y - erp.br.y);
-          findSolidRect(sr, changed, pb);
-        }
+      conn->cp.pf().bufferFromBuffer(converted, pb->getPF(),
+                                     solid->colour, 1);
 
-        return;
-      }
+      encoder->writeSolidRect(erp.width(), erp.height(),
+                              conn->cp.pf(), converted);
     }
+    endRect();
+
+    changed->assign_subtract(Region(erp));
   }
 }
 
@@ -990,170 +920,187 @@ void EncodeManager::updateVideoStats(const std::vector<Rect> &rects, const Pixel
   }
 }
 
+// Scalers write into dst when given, so that it can be reused across frames
+static ManagedPixelBuffer *scaleTarget(const PixelBuffer *pb, const uint16_t w,
+                                       const uint16_t h, ManagedPixelBuffer *dst)
+{
+  if (!dst)
+    return new ManagedPixelBuffer(pb->getPF(), w, h);
+
+  dst->setPF(pb->getPF());
+  dst->setSize(w, h);
+  return dst;
+}
+
+// Target rows are independent in all scalers, so split them among threads
+template<class F> static void scaleRows(const uint16_t h, const F &fn)
+{
+  tbb::parallel_for(tbb::blocked_range<uint16_t>(0, h, 16),
+                    [&](const tbb::blocked_range<uint16_t> &r) {
+    fn(r.begin(), r.end());
+  });
+}
+
 PixelBuffer *rfb::nearestScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
-                                 const float diff)
+                                 const float diff, ManagedPixelBuffer *dst)
 {
-  ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), w, h);
-  uint16_t x, y;
+  ManagedPixelBuffer *newpb = scaleTarget(pb, w, h, dst);
   int oldstride, newstride;
   const rdr::U8 *oldpxorig = pb->getBuffer(pb->getRect(), &oldstride);
-  const rdr::U8 *oldpx;
-  rdr::U8 *newpx = newpb->getBufferRW(newpb->getRect(), &newstride);
+  rdr::U8 *newpxorig = newpb->getBufferRW(newpb->getRect(), &newstride);
   const uint16_t bpp = pb->getPF().bpp / 8;
   const float rowstep = 1 / diff;
 
-  for (y = 0; y < h; y++) {
-    const uint16_t ny = rowstep * y;
-    oldpx = oldpxorig + oldstride * bpp * ny;
-    for (x = 0; x < w; x++) {
-      const uint16_t newx = x / diff;
-      memcpy(&newpx[x * bpp], &oldpx[newx * bpp], bpp);
+  scaleRows(h, [&](const uint16_t starty, const uint16_t endy) {
+    if (bpp == 4 && cpu_info::has_avx2) {
+      AVX2_nearest(oldpxorig, w, newpxorig, oldstride, newstride, diff, starty, endy);
+      return;
     }
-    newpx += newstride * bpp;
-  }
+
+    uint16_t x, y;
+    const rdr::U8 *oldpx;
+    rdr::U8 *newpx = newpxorig + newstride * bpp * starty;
+
+    for (y = starty; y < endy; y++) {
+      const uint16_t ny = rowstep * y;
+      oldpx = oldpxorig + oldstride * bpp * ny;
+      for (x = 0; x < w; x++) {
+        const uint16_t newx = x / diff;
+        memcpy(&newpx[x * bpp], &oldpx[newx * bpp], bpp);
+      }
+      newpx += newstride * bpp;
+    }
+  });
 
   return newpb;
 }
 
 PixelBuffer *rfb::bilinearScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
-                                 const float diff)
+                                 const float diff, ManagedPixelBuffer *dst)
 {
-  ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), w, h);
-  uint16_t x, y;
+  ManagedPixelBuffer *newpb = scaleTarget(pb, w, h, dst);
   int oldstride, newstride;
   const rdr::U8 *oldpx = pb->getBuffer(pb->getRect(), &oldstride);
-  rdr::U8 *newpx = newpb->getBufferRW(newpb->getRect(), &newstride);
+  rdr::U8 *newpxorig = newpb->getBufferRW(newpb->getRect(), &newstride);
   const uint16_t bpp = pb->getPF().bpp / 8;
   const float invdiff = 1 / diff;
 
-  for (y = 0; y < h; y++) {
-    const float ny = y * invdiff;
-    const uint16_t lowy = ny;
-    const uint16_t highy = lowy + 1;
-    const uint16_t bot = (ny - lowy) * 256;
-    const uint16_t top = 256 - bot;
-
-    const rdr::U8 *lowyptr = oldpx + oldstride * bpp * lowy;
-    const rdr::U8 *highyptr = oldpx + oldstride * bpp * highy;
-
-    for (x = 0; x < w; x++) {
-      const float nx = x * invdiff;
-      const uint16_t lowx = nx;
-      const uint16_t highx = lowx + 1;
-      const uint16_t right = (nx - lowx) * 256;
-      const uint16_t left = 256 - right;
-
-      unsigned i;
-      uint32_t val, val2;
-      for (i = 0; i < bpp; i++) {
-        val = lowyptr[lowx * bpp + i] * left;
-        val += lowyptr[highx * bpp + i] * right;
-        val >>= 8;
-
-        val2 = highyptr[lowx * bpp + i] * left;
-        val2 += highyptr[highx * bpp + i] * right;
-        val2 >>= 8;
-
-        newpx[x * bpp + i] = (val * top + val2 * bot) >> 8;
+  scaleRows(h, [&](const uint16_t starty, const uint16_t endy) {
+    if (bpp == 4 && cpu_info::has_avx2) {
+      AVX2_scale(oldpx, w, h, newpxorig, oldstride, newstride, diff, starty, endy);
+      return;
+    } else if (bpp == 4 && cpu_info::has_sse2) {
+      SSE2_scale(oldpx, w, h, newpxorig, oldstride, newstride, diff, starty, endy);
+      return;
+    }
+
+    uint16_t x, y;
+    rdr::U8 *newpx = newpxorig + newstride * bpp * starty;
+
+    for (y = starty; y < endy; y++) {
+      const float ny = y * invdiff;
+      const uint16_t lowy = ny;
+      const uint16_t highy = lowy + 1;
+      const uint16_t bot = (ny - lowy) * 256;
+      const uint16_t top = 256 - bot;
+
+      const rdr::U8 *lowyptr = oldpx + oldstride * bpp * lowy;
+      const rdr::U8 *highyptr = oldpx + oldstride * bpp * highy;
+
+      for (x = 0; x < w; x++) {
+        const float nx = x * invdiff;
+        const uint16_t lowx = nx;
+        const uint16_t highx = lowx + 1;
+        const uint16_t right = (nx - lowx) * 256;
+        const uint16_t left = 256 - right;
+
+        unsigned i;
+        uint32_t val, val2;
+        for (i = 0; i < bpp; i++) {
+          val = lowyptr[lowx * bpp + i] * left;
+          val += lowyptr[highx * bpp + i] * right;
+          val >>= 8;
+
+          val2 = highyptr[lowx * bpp + i] * left;
+          val2 += highyptr[highx * bpp + i] * right;
+          val2 >>= 8;
+
+          newpx[x * bpp + i] = (val * top + val2 * bot) >> 8;
+        }
       }
+      newpx += newstride * bpp;
     }
-    newpx += newstride * bpp;
-  }
+  });
 
   return newpb;
 }
 
-PixelBuffer *rfb::progressiveBilinearScale(const PixelBuffer *pb,
-                                 const uint16_t tgtw, const uint16_t tgth,
-                                 const float tgtdiff)
+static void halve(const PixelBuffer *pb, ManagedPixelBuffer *newpb)
 {
-  if (cpu_info::has_sse2) {
-    if (tgtdiff >= 0.5f) {
-      ManagedPixelBuffer *newpb = new ManagedPixelBuffer(pb->getPF(), tgtw, tgth);
-
-      int oldstride, newstride;
-      const rdr::U8 *oldpx = pb->getBuffer(pb->getRect(), &oldstride);
-      rdr::U8 *newpx = newpb->getBufferRW(newpb->getRect(), &newstride);
-
-      SSE2_scale(oldpx, tgtw, tgth, newpx, oldstride, newstride, tgtdiff);
-      return newpb;
-    }
-
-    PixelBuffer *newpb;
-    uint16_t neww, newh, oldw, oldh;
-    bool del = false;
-
-    do {
-      oldw = pb->getRect().width();
-      oldh = pb->getRect().height();
-      neww = oldw / 2;
-      newh = oldh / 2;
-
-      newpb = new ManagedPixelBuffer(pb->getPF(), neww, newh);
-
-      int oldstride, newstride;
-      const rdr::U8 *oldpx = pb->getBuffer(pb->getRect(), &oldstride);
-      rdr::U8 *newpx = ((ManagedPixelBuffer *) newpb)->getBufferRW(newpb->getRect(),
-                                                                   &newstride);
-
-      SSE2_halve(oldpx, neww, newh, newpx, oldstride, newstride);
-
-      if (del)
-        delete pb;
-      del = true;
-
-      pb = newpb;
-    } while (tgtw * 2 < neww);
+  int oldstride, newstride;
+  const rdr::U8 *oldpx = pb->getBuffer(pb->getRect(), &oldstride);
+  rdr::U8 *newpx = newpb->getBufferRW(newpb->getRect(), &newstride);
+  const uint16_t neww = newpb->width();
 
-    // Final, non-halving step
-    if (tgtw != neww || tgth != newh) {
-      oldw = pb->getRect().width();
-      oldh = pb->getRect().height();
+  scaleRows(newpb->height(), [&](const uint16_t starty, const uint16_t endy) {
+    const rdr::U8 *src = oldpx + oldstride * starty * 2 * 4;
+    rdr::U8 *dst = newpx + newstride * starty * 4;
 
-      newpb = new ManagedPixelBuffer(pb->getPF(), tgtw, tgth);
+    if (cpu_info::has_avx2)
+      AVX2_halve(src, neww, endy - starty, dst, oldstride, newstride);
+    else
+      SSE2_halve(src, neww, endy - starty, dst, oldstride, newstride);
+  });
+}
 
-      int oldstride, newstride;
-      const rdr::U8 *oldpx = pb->getBuffer(pb->getRect(), &oldstride);
-      rdr::U8 *newpx = ((ManagedPixelBuffer *) newpb)->getBufferRW(newpb->getRect(),
-                                                                   &newstride);
+// tmp, if given, points to two buffers for the halving steps, and is only
+// used along with dst
+PixelBuffer *rfb::progressiveBilinearScale(const PixelBuffer *pb,
+                                 const uint16_t tgtw, const uint16_t tgth,
+                                 const float tgtdiff,
+                                 ManagedPixelBuffer *dst, ManagedPixelBuffer *tmp)
+{
+  if (tgtdiff >= 0.5f)
+    return bilinearScale(pb, tgtw, tgth, tgtdiff, dst);
 
-      SSE2_scale(oldpx, tgtw, tgth, newpx, oldstride, newstride, tgtw / (float) oldw);
-      if (del)
-        delete pb;
-    }
+  if (!dst)
+    tmp = NULL;
 
-    return newpb;
-  } // SSE2
+  const PixelBuffer *src = pb;
+  ManagedPixelBuffer *newpb;
+  uint16_t neww, newh, oldw;
+  unsigned step = 0;
 
-  if (tgtdiff >= 0.5f)
-    return bilinearScale(pb, tgtw, tgth, tgtdiff);
+  do {
+    neww = src->getRect().width() / 2;
+    newh = src->getRect().height() / 2;
 
-  PixelBuffer *newpb;
-  uint16_t neww, newh, oldw, oldh;
-  bool del = false;
+    newpb = scaleTarget(pb, neww, newh, tmp ? &tmp[step++ % 2] : NULL);
 
-  do {
-    oldw = pb->getRect().width();
-    oldh = pb->getRect().height();
-    neww = oldw / 2;
-    newh = oldh / 2;
+    if (cpu_info::has_sse2)
+      halve(src, newpb);
+    else
+      bilinearScale(src, neww, newh, 0.5f, newpb);
 
-    newpb = bilinearScale(pb, neww, newh, 0.5f);
-    if (del)
-      delete pb;
-    del = true;
+    if (!tmp && src != pb)
+      delete src;
 
-    pb = newpb;
+    src = newpb;
   } while (tgtw * 2 < neww);
 
   // Final, non-halving step
   if (tgtw != neww || tgth != newh) {
-    oldw = pb->getRect().width();
-    oldh = pb->getRect().height();
-
-    newpb = bilinearScale(pb, tgtw, tgth, tgtw / (float) oldw);
-    if (del)
-      delete pb;
+    oldw = src->getRect().width();
+
+    newpb = (ManagedPixelBuffer *) bilinearScale(src, tgtw, tgth, tgtw / (float) oldw, dst);
+    if (!tmp)
+      delete src;
+  } else if (dst) {
+    int stride;
+    newpb = scaleTarget(pb, tgtw, tgth, dst);
+    newpb->imageRect(newpb->getRect(), src->getBuffer(src->getRect(), &stride), stride);
+    if (!tmp)
+      delete src;
   }
 
   return newpb;
@@ -1167,8 +1114,10 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
   std::vector<uint8_t> encoderTypes;
   std::vector<uint8_t> isWebp, fromCache;
   std::vector<Palette> palettes;
-  std::vector<std::vector<uint8_t> > compresseds;
-  std::vector<uint32_t> ms;
+  std::vector<EncBuffer> compresseds;
+  std::vector<uint32_t> us;
+  std::vector<EncodeScheduler::Tile> tiles;
+  std::vector<size_t> fullColour, order;
 
   webpTookTooLong.store(false, std::memory_order_relaxed);
   changed.get_rects(&rects);
@@ -1183,6 +1132,21 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
     rects.push_back(pb->getRect());
   }
 
+  const int klass = fullColourClass();
+  const unsigned threads = arena.max_concurrency();
+
+  EncodeScheduler::Codec codec;
+  unsigned long long frameArea;
+
+  // Without LastRect the number of rects was sent up front, as counted
+  // with the fixed tile size
+  const bool costTiles = conn->cp.supportsLastRect && threads > 1 &&
+                         scheduledCodec(klass, &codec);
+
+  frameArea = 0;
+  for (const auto& rect : rects)
+    frameArea += rect.area();
+
   subrects.reserve(rects.size() * 1.5f);
 
   for (const auto& rect : rects) {
@@ -1192,8 +1156,13 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
     const auto w = rect.width();
     const auto h = rect.height();
 
+    int maxArea = SubRectMaxArea;
+    if (costTiles)
+      maxArea = scheduler.tileArea(codec, scaledQuality(rect), frameArea,
+                                   threads, frameBudget(klass, start));
+
     // No split necessary?
-    if ((((w*h) < SubRectMaxArea) && (w < SubRectMaxWidth)) ||
+    if ((((w*h) < maxArea) && (w < SubRectMaxWidth)) ||
         (videoDetected && !video_mode_available && !encoders[encoderTightWEBP]->isSupported())) {
       subrects.push_back(rect);
       trackRectQuality(rect);
@@ -1205,7 +1174,14 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
     else
       sw = SubRectMaxWidth;
 
-    sh = SubRectMaxArea / sw;
+    sh = maxArea / sw;
+
+    // Smaller tiles than usual are cut squarer rather than into strips
+    if (maxArea < SubRectMaxArea && sh < EncodeScheduler::minTileHeight &&
+        h > sh) {
+      sh = h < EncodeScheduler::minTileHeight ? h : EncodeScheduler::minTileHeight;
+      sw = maxArea / sh;
+    }
 
     for (sr.tl.y = rect.tl.y; sr.tl.y < rect.br.y; sr.tl.y += sh) {
       sr.br.y = sr.tl.y + sh;
@@ -1231,7 +1207,7 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
   palettes.resize(subrects_size);
   compresseds.resize(subrects_size);
   scaledrects.resize(subrects_size);
-  ms.resize(subrects_size);
+  us.resize(subrects_size);
 
   // In case the current resolution is above the max video res, and video was detected,
   // scale to that res, keeping aspect ratio
@@ -1248,20 +1224,24 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
 
     const uint16_t neww = pb->getRect().width() * diff;
     const uint16_t newh = pb->getRect().height() * diff;
-    switch (Server::videoScaling) {
-      case 0:
-        scaledpb = nearestScale(pb, neww, newh,
-                      diff);
-      break;
-      case 1:
-        scaledpb = bilinearScale(pb, neww, newh,
-                      diff);
-      break;
-      case 2:
-        scaledpb = progressiveBilinearScale(pb, neww, newh,
-                      diff);
-      break;
-    }
+
+    // The scalers split their rows over the calling arena
+    arena.execute([&] {
+      switch (Server::videoScaling) {
+        case 0:
+          scaledpb = nearestScale(pb, neww, newh,
+                        diff, &scaledFb);
+        break;
+        case 1:
+          scaledpb = bilinearScale(pb, neww, newh,
+                        diff, &scaledFb);
+        break;
+        case 2:
+          scaledpb = progressiveBilinearScale(pb, neww, newh,
+                        diff, &scaledFb, scaleTmp);
+        break;
+      }
+    });
 
     for (uint32_t i = 0; i < subrects_size; ++i) {
       const Rect old = scaledrects[i] = subrects[i];
@@ -1288,24 +1268,91 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
   }
   scalingTime = msSince(&scalestart);
 
+  encArena.begin(subrects_size);
+
     arena.execute([&] {
         tbb::parallel_for(static_cast<size_t>(0), subrects_size, [&](size_t i) {
             encoderTypes[i] = getEncoderType(subrects[i], pb, &palettes[i], compresseds[i],
-                        &isWebp[i], &fromCache[i],
-                        scaledpb, scaledrects[i], ms[i]);
-            checkWebpFallback(start);
+                        encArena.get(i), scaledpb);
         });
     });
 
+  // Plan the full colour rects, now that it is known which they are
   for (uint32_t i = 0; i < subrects_size; ++i) {
-    if (encoderTypes[i] == encoderFullColour) {
+    if (encoderTypes[i] != encoderFullColour || klass == encoderClassMax)
+      continue;
+
+    EncodeScheduler::Tile tile;
+    tile.area = scaledpb ? scaledrects[i].area() : subrects[i].area();
+    tile.quality = scaledQuality(subrects[i]);
+    scheduledCodec(klass, &tile.codec);
+
+    tiles.push_back(tile);
+    fullColour.push_back(i);
+  }
+
+  scheduler.plan(&tiles, threads, frameBudget(klass, start));
+  EncodeScheduler::order(tiles, &order);
+
+  // Each thread takes the next most expensive rect until none are left
+  std::atomic<size_t> next(0);
+
+    arena.execute([&] {
+        tbb::parallel_for(tbb::blocked_range<unsigned>(0, threads, 1),
+                          [&](const tbb::blocked_range<unsigned> &range) {
+            for (unsigned t = range.begin(); t != range.end(); t++) {
+                size_t n;
+                while ((n = next.fetch_add(1, std::memory_order_relaxed)) < order.size()) {
+                    const EncodeScheduler::Tile &tile = tiles[order[n]];
+                    const size_t i = fullColour[order[n]];
+
+                    compressFullColour(subrects[i], pb, codecClass(tile.codec),
+                                       tile.quality,
+                                       compresseds[i], encArena.get(i),
+                                       &isWebp[i], &fromCache[i],
+                                       scaledpb, scaledrects[i], us[i]);
+                    checkWebpFallback(start);
+                }
+            }
+        }, tbb::simple_partitioner());
+    });
+
+  uint64_t jpegUs = 0, webpUs = 0;
+  double jpegPredicted = 0, webpPredicted = 0;
+
+  for (size_t n = 0; n < tiles.size(); n++) {
+    const EncodeScheduler::Tile &tile = tiles[n];
+    const size_t i = fullColour[n];
+
+    if (fromCache[i]) {
       if (isWebp[i])
-        webpstats.ms += ms[i];
+        webpUs += us[i];
       else
-        jpegstats.ms += ms[i]; // Also covers QOI for now
+        jpegUs += us[i];
+      continue;
+    }
+
+    // Predicted against actual only for what was really compressed
+    if (isWebp[i]) {
+      webpUs += us[i];
+      webpPredicted += tile.cost;
+    } else {
+      jpegUs += us[i]; // Also covers QOI for now
+      jpegPredicted += tile.cost;
     }
+
+    EncodeScheduler::Codec used = tile.codec;
+    if (used == EncodeScheduler::codecWEBP && !isWebp[i])
+      used = EncodeScheduler::codecJPEG; // The frame ran late after all
+
+    scheduler.learn(used, tile.quality, tile.area, us[i]);
   }
 
+  webpstats.ms += webpUs / 1000;
+  webpstats.predicted += (uint32_t) webpPredicted;
+  jpegstats.ms += jpegUs / 1000;
+  jpegstats.predicted += (uint32_t) jpegPredicted;
+
   if (start) {
     encodingTime = msSince(start);
 
@@ -1327,28 +1374,14 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
   if (webpTookTooLong.load(std::memory_order_relaxed))
     activeEncoders[encoderFullColour] = encoderTightJPEG;
 
-  for (uint32_t i = 0; i < subrects_size; ++i) {
-    if (encCache->enabled && !compresseds[i].empty() && !fromCache[i] &&
-    !encoders[encoderTightQOI]->isSupported()) {
-      void *tmp = malloc(compresseds[i].size());
-      memcpy(tmp, &compresseds[i][0], compresseds[i].size());
-      encCache->add(isWebp[i] ? encoderTightWEBP : encoderTightJPEG,
-                    subrects[i].tl.x, subrects[i].tl.y, subrects[i].width(), subrects[i].height(),
-                    compresseds[i].size(), tmp);
-    }
-
+  for (uint32_t i = 0; i < subrects_size; ++i)
     writeSubRect(subrects[i], pb, encoderTypes[i], palettes[i], compresseds[i], isWebp[i]);
-  }
-
-  if (scaledpb)
-    delete scaledpb;
 }
 
 uint8_t EncodeManager::getEncoderType(const Rect& rect, const PixelBuffer *pb,
-                                      Palette *pal, std::vector<uint8_t> &compressed,
-                                      uint8_t *isWebp, uint8_t *fromCache,
-                                      const PixelBuffer *scaledpb, const Rect& scaledrect,
-                                      uint32_t &ms) const
+                                      Palette *pal, EncBuffer &compressed,
+                                      const std::shared_ptr<EncBytes> &out,
+                                      const PixelBuffer *scaledpb) const
 {
   struct RectInfo info;
   unsigned int maxColours = 256;
@@ -1398,101 +1431,178 @@ uint8_t EncodeManager::getEncoderType(const Rect& rect, const PixelBuffer *pb,
   if (scaledpb || conn->cp.supportsQOI)
     type = encoderFullColour;
 
-  *isWebp = 0;
-  *fromCache = 0;
-  ms = 0;
-  if (type == encoderFullColour) {
-    uint32_t len;
-    const void *data;
-    struct timeval start;
-    gettimeofday(&start, NULL);
+  // Tight tells the client to reset a zlib stream before a rect, so
+  // palette rects can be compressed on their own here instead of one by
+  // one through the shared streams. That costs some compression, so
+  // only when there is more than one thread to do it. RectThreads=1
+  // keeps the shared streams.
+  if (type != encoderFullColour && type != encoderSolid &&
+      activeEncoders[type] == encoderTight &&
+      Server::rectThreads != 1 &&
+      tbb::this_task_arena::max_concurrency() > 1) {
+    ((TightEncoder *) encoders[encoderTight])->compressOnly(ppb, *pal, *out);
+    compressed = out;
+  }
 
-    if (encCache && video_mode_available) {
-      // nop, send this as a skip rect
-    } else if (encCache->enabled &&
-        (data = encCache->get(activeEncoders[encoderFullColour],
-                              rect.tl.x, rect.tl.y, rect.width(), rect.height(),
-                              len))) {
-      compressed.resize(len);
-      memcpy(&compressed[0], data, len);
-      *fromCache = 1;
-    } else if (activeEncoders[encoderFullColour] == encoderTightWEBP && !webpTookTooLong) {
-      if (scaledpb) {
-        delete ppb;
-        ppb = preparePixelBuffer(scaledrect, scaledpb,
-                                 encoders[encoderTightWEBP]->flags & EncoderUseNativePF ?
-                                 false : true);
-      } else if (encoders[encoderTightWEBP]->flags & EncoderUseNativePF) {
-        delete ppb;
-        ppb = preparePixelBuffer(rect, pb, false);
-      }
+  delete ppb;
 
-      ((TightWEBPEncoder *) encoders[encoderTightWEBP])->compressOnly(ppb,
-                                                                      scaledQuality(rect),
-                                                                      compressed,
-                                                                      videoDetected);
-      *isWebp = 1;
-    } else if (activeEncoders[encoderFullColour] == encoderTightQOI) {
-      if (scaledpb) {
-        delete ppb;
-        ppb = preparePixelBuffer(scaledrect, scaledpb,
-                                 encoders[encoderTightQOI]->flags & EncoderUseNativePF ?
-                                 false : true);
-      } else if (encoders[encoderTightQOI]->flags & EncoderUseNativePF) {
-        delete ppb;
-        ppb = preparePixelBuffer(rect, pb, false);
-      }
+  return type;
+}
 
-      ((TightQOIEncoder *) encoders[encoderTightQOI])->compressOnly(ppb,
-                                                                      scaledQuality(rect),
-                                                                      compressed,
-                                                                      videoDetected);
-    } else if (activeEncoders[encoderFullColour] == encoderTightJPEG || webpTookTooLong) {
-      if (scaledpb) {
-        delete ppb;
-        ppb = preparePixelBuffer(scaledrect, scaledpb,
-                                 encoders[encoderTightJPEG]->flags & EncoderUseNativePF ?
-                                 false : true);
-      } else if (encoders[encoderTightJPEG]->flags & EncoderUseNativePF) {
-        delete ppb;
-        ppb = preparePixelBuffer(rect, pb, false);
-      }
+void EncodeManager::compressFullColour(const Rect& rect, const PixelBuffer *pb,
+                                       int klass, unsigned quality,
+                                       EncBuffer &compressed,
+                                       const std::shared_ptr<EncBytes> &out,
+                                       uint8_t *isWebp, uint8_t *fromCache,
+                                       const PixelBuffer *scaledpb, const Rect& scaledrect,
+                                       uint32_t &us) const
+{
+  struct timeval start;
+  gettimeofday(&start, NULL);
+
+  PixelBuffer *ppb;
+
+  // Planned as WebP, but the frame has run late after all
+  if (klass == encoderTightWEBP && webpTookTooLong)
+    klass = encoderTightJPEG;
 
-      ((TightJPEGEncoder *) encoders[encoderTightJPEG])->compressOnly(ppb,
-                                                                      scaledQuality(rect),
-                                                                      compressed,
-                                                                      videoDetected);
+  if (scaledpb)
+    ppb = preparePixelBuffer(scaledrect, scaledpb,
+                             encoders[klass]->flags & EncoderUseNativePF ?
+                             false : true);
+  else
+    ppb = preparePixelBuffer(rect, pb,
+                             encoders[klass]->flags & EncoderUseNativePF ?
+                             false : true);
+
+  const bool useCache = encCache->enabled;
+  EncId id;
+
+  if (useCache) {
+    id.hash = EncCache::hashPixels(ppb);
+    id.w = ppb->width();
+    id.h = ppb->height();
+    id.type = klass;
+    id.quality = quality;
+    id.lowQuality = videoDetected;
+
+    compressed = encCache->get(id);
+  }
+
+  if (compressed) {
+    *fromCache = 1;
+  } else {
+    switch (klass) {
+    case encoderTightWEBP:
+      ((TightWEBPEncoder *) encoders[klass])->compressOnly(ppb, quality, *out,
+                                                           videoDetected);
+      break;
+    case encoderTightQOI:
+      ((TightQOIEncoder *) encoders[klass])->compressOnly(ppb, quality, *out,
+                                                          videoDetected);
+      break;
+    default:
+      ((TightJPEGEncoder *) encoders[klass])->compressOnly(ppb, quality, *out,
+                                                           videoDetected);
+      break;
     }
 
-    ms = msSince(&start);
+    compressed = out;
+    if (useCache && !out->empty())
+      encCache->add(id, compressed);
   }
 
+  *isWebp = klass == encoderTightWEBP;
+
   delete ppb;
 
-  return type;
+  us = usSince(&start);
+}
+
+// The class full colour rects are compressed with ahead of writing, or
+// encoderClassMax if they are written directly
+int EncodeManager::fullColourClass() const
+{
+  if (video_mode_available)
+    return encoderClassMax; // nop, send this as a skip rect
+
+  switch (activeEncoders[encoderFullColour]) {
+  case encoderTightWEBP:
+  case encoderTightQOI:
+  case encoderTightJPEG:
+    return activeEncoders[encoderFullColour];
+  default:
+    return encoderClassMax;
+  }
+}
+
+bool EncodeManager::scheduledCodec(int klass, EncodeScheduler::Codec *codec)
+{
+  switch (klass) {
+  case encoderTightWEBP:
+    *codec = EncodeScheduler::codecWEBP;
+    return true;
+  case encoderTightQOI:
+    *codec = EncodeScheduler::codecQOI;
+    return true;
+  case encoderTightJPEG:
+    *codec = EncodeScheduler::codecJPEG;
+    return true;
+  default:
+    return false;
+  }
+}
+
+int EncodeManager::codecClass(EncodeScheduler::Codec codec)
+{
+  switch (codec) {
+  case EncodeScheduler::codecWEBP:
+    return encoderTightWEBP;
+  case EncodeScheduler::codecQOI:
+    return encoderTightQOI;
+  default:
+    return encoderTightJPEG;
+  }
+}
+
+// What is left of the time for encoding the frame. WebP only gets its
+// share of it, after which the old fallback switched everything to JPEG.
+double EncodeManager::frameBudget(int klass, const struct timeval *start) const
+{
+  if (!start)
+    return std::numeric_limits<double>::infinity();
+
+  if (klass == encoderTightWEBP)
+    return webpFallbackUs / 1000.0 - usSince(start) / 1000.0;
+
+  return 1000.0 / rfb::Server::frameRate - usSince(start) / 1000.0;
 }
 
 void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb,
                                  const uint8_t type, const Palette &pal,
-                                 const std::vector<uint8_t> &compressed,
+                                 const EncBuffer &compressed,
                                  const uint8_t isWebp)
 {
   PixelBuffer *ppb;
   Encoder *encoder;
 
-  encoder = startRect(rect, type, compressed.size() == 0, isWebp ? STARTRECT_OVERRIDE_WEBP : STARTRECT_NO_OVERRIDE);
+  const bool haveCompressed = compressed && !compressed->empty();
+
+  encoder = startRect(rect, type, !haveCompressed, isWebp ? STARTRECT_OVERRIDE_WEBP : STARTRECT_NO_OVERRIDE);
 
-  if (compressed.size()) {
-    if (isWebp) {
-      ((TightWEBPEncoder *) encoder)->writeOnly(compressed);
+  if (haveCompressed) {
+    if (type != encoderFullColour) {
+      ((TightEncoder *) encoder)->writeOnly(*compressed);
+    } else if (isWebp) {
+      ((TightWEBPEncoder *) encoder)->writeOnly(*compressed);
       webpstats.area += rect.area();
       webpstats.rects++;
     } else if (encoders[encoderTightQOI]->isSupported()) {
-      ((TightQOIEncoder *) encoder)->writeOnly(compressed);
+      ((TightQOIEncoder *) encoder)->writeOnly(*compressed);
       jpegstats.area += rect.area(); // Also QOI for now
       jpegstats.rects++;
     } else {
-      ((TightJPEGEncoder *) encoder)->writeOnly(compressed);
+      ((TightJPEGEncoder *) encoder)->writeOnly(*compressed);
       jpegstats.area += rect.area();
       jpegstats.rects++;
     }
@@ -1510,115 +1620,6 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb,
   endRect(isWebp ? STARTRECT_OVERRIDE_WEBP : STARTRECT_NO_OVERRIDE);
 }
 
-bool EncodeManager::checkSolidTile(const Rect& r, const rdr::U8* colourValue,
-                                   const PixelBuffer *pb)
-{
-  switch (pb->getPF().bpp) {
-  case 32:
-    return checkSolidTile(r, *(const rdr::U32*)colourValue, pb);
-  case 16:
-    return checkSolidTile(r, *(const rdr::U16*)colourValue, pb);
-  default:
-    return checkSolidTile(r, *(const rdr::U8*)colourValue, pb);
-  }
-}
-
-void EncodeManager::extendSolidAreaByBlock(const Rect& r,
-                                           const rdr::U8* colourValue,
-                                           const PixelBuffer *pb, Rect* er)
-{
-  int dx, dy, dw, dh;
-  int w_prev;
-  Rect sr;
-  int w_best = 0, h_best = 0;
-
-  w_prev = r.width();
-
-  // We search width first, back off when we hit a different colour,
-  // and restart with a larger height. We keep track of the
-  // width/height combination that gives us the largest area.
-  for (dy = r.tl.y; dy < r.br.y; dy += SolidSearchBlock) {
-
-    dh = SolidSearchBlock;
-    if (dy + dh > r.br.y)
-      dh = r.br.y - dy;
-
-    // We test one block here outside the x loop in order to break
-    // the y loop right away.
-    dw = SolidSearchBlock;
-    if (dw > w_prev)
-      dw = w_prev;
-
-    sr.setXYWH(r.tl.x, dy, dw, dh);
-    if (!checkSolidTile(sr, colourValue, pb))
-      break;
-
-    for (dx = r.tl.x + dw; dx < r.tl.x + w_prev;) {
-
-      dw = SolidSearchBlock;
-      if (dx + dw > r.tl.x + w_prev)
-        dw = r.tl.x + w_prev - dx;
-
-      sr.setXYWH(dx, dy, dw, dh);
-      if (!checkSolidTile(sr, colourValue, pb))
-        break;
-
-      dx += dw;
-    }
-
-    w_prev = dx - r.tl.x;
-    if (w_prev * (dy + dh - r.tl.y) > w_best * h_best) {
-      w_best = w_prev;
-      h_best = dy + dh - r.tl.y;
-    }
-  }
-
-  er->tl.x = r.tl.x;
-  er->tl.y = r.tl.y;
-  er->br.x = er->tl.x + w_best;
-  er->br.y = er->tl.y + h_best;
-}
-
-void EncodeManager::extendSolidAreaByPixel(const Rect& r, const Rect& sr,
-                                           const rdr::U8* colourValue,
-                                           const PixelBuffer *pb, Rect* er)
-{
-  int cx, cy;
-  Rect tr;
-
-  // Try to extend the area upwards.
-  for (cy = sr.tl.y - 1; cy >= r.tl.y; cy--) {
-    tr.setXYWH(sr.tl.x, cy, sr.width(), 1);
-    if (!checkSolidTile(tr, colourValue, pb))
-      break;
-  }
-  er->tl.y = cy + 1;
-
-  // ... downwards.
-  for (cy = sr.br.y; cy < r.br.y; cy++) {
-    tr.setXYWH(sr.tl.x, cy, sr.width(), 1);
-    if (!checkSolidTile(tr, colourValue, pb))
-      break;
-  }
-  er->br.y = cy;
-
-  // ... to the left.
-  for (cx = sr.tl.x - 1; cx >= r.tl.x; cx--) {
-    tr.setXYWH(cx, er->tl.y, 1, er->height());
-    if (!checkSolidTile(tr, colourValue, pb))
-      break;
-  }
-  er->tl.x = cx + 1;
-
-  // ... to the right.
-  for (cx = sr.br.x; cx < r.br.x; cx++) {
-    tr.setXYWH(cx, er->tl.y, 1, er->height());
-    if (!checkSolidTile(tr, colourValue, pb))
-      break;
-  }
-  er->br.x = cx;
-}
-
 PixelBuffer* EncodeManager::preparePixelBuffer(const Rect& rect,
                                                const PixelBuffer *pb,
                                                bool convert) const
@@ -1653,30 +1654,6 @@ PixelBuffer* EncodeManager::preparePixelBuffer(const Rect& rect,
   return offsetPixelBuffer;
 }
 
-bool EncodeManager::analyseRect(const PixelBuffer *pb,
-                                struct RectInfo *info, int maxColours) const
-{
-  const rdr::U8* buffer;
-  int stride;
-
-  buffer = pb->getBuffer(pb->getRect(), &stride);
-
-  switch (pb->getPF().bpp) {
-  case 32:
-    return analyseRect(pb->width(), pb->height(),
-                       (const rdr::U32*)buffer, stride,
-                       info, maxColours);
-  case 16:
-    return analyseRect(pb->width(), pb->height(),
-                       (const rdr::U16*)buffer, stride,
-                       info, maxColours);
-  default:
-    return analyseRect(pb->width(), pb->height(),
-                       (const rdr::U8*)buffer, stride,
-                       info, maxColours);
-  }
-}
-
 void EncodeManager::OffsetPixelBuffer::update(const PixelFormat& pf,
                                               int width, int height,
                                               const rdr::U8* data_,
@@ -1695,114 +1672,25 @@ rdr::U8* EncodeManager::OffsetPixelBuffer::getBufferRW(const Rect& r, int* strid
   throw rfb::Exception("Invalid write attempt to OffsetPixelBuffer");
 }
 
-// Preprocessor generated, optimised methods
-
-#define BPP 8
-#include "EncodeManagerBPP.cxx"
-#undef BPP
-#define BPP 16
-#include "EncodeManagerBPP.cxx"
-#undef BPP
-#define BPP 32
-#include "EncodeManagerBPP.cxx"
-#undef BPP
-
 // Dynamic quality tracking
 void EncodeManager::updateQualities() {
   struct timeval now;
   gettimeofday(&now, NULL);
 
   // Remove elements that haven't been touched in 5s. Update the scores.
-  for (std::list<QualityInfo*>::iterator it = qualityList.begin(); it != qualityList.end(); ) {
-    QualityInfo * const cur = *it;
-    const unsigned since = msBetween(&cur->lastUpdate, &now);
-    if (since > 5000) {
-      delete cur;
-      it = qualityList.erase(it);
-    } else {
-      cur->score -= cur->score / 16;
-      it++;
-    }
-  }
-}
-
-static bool closeEnough(const Rect& unioned, const int& unionArea,
-                        const Rect& check, const int& checkArea) {
-  const Point p = unioned.tl.subtract(check.tl);
-  if (abs(p.x) > 32 ||
-      abs(p.y) > 32)
-      return false;
-
-  if (abs(unionArea - checkArea) > 4096)
-    return false;
-
-  return true;
+  qualities.decay(now);
 }
 
 void EncodeManager::trackRectQuality(const Rect& rect) {
-
-  const int searchArea = rect.area();
   struct timeval now;
   gettimeofday(&now, NULL);
 
-  for (std::list<QualityInfo*>::iterator it = qualityList.begin(); it != qualityList.end(); it++) {
-    QualityInfo * const cur = *it;
-    const int curArea = cur->rect.area();
-    const Rect unioned = cur->rect.union_boundary(rect);
-    const int unionArea = unioned.area();
-    // Is this close enough to match?
-    // e.g. ads that change parts in one frame and more in others
-    if (rect.enclosed_by(cur->rect) ||
-        cur->rect.enclosed_by(rect) ||
-        closeEnough(unioned, unionArea, cur->rect, curArea) ||
-        closeEnough(unioned, unionArea, rect, searchArea)) {
-
-        // This existing rect matched. Set it to the larger of the two,
-        // and add to its score.
-        if (searchArea > curArea)
-          cur->rect = rect;
-
-        cur->score += SCORE_INCREMENT;
-        cur->lastUpdate = now;
-        return;
-    }
-  }
-
-  // It wasn't found, add it
-  QualityInfo *info = new QualityInfo;
-  info->rect = rect;
-  info->score = 0;
-  info->lastUpdate = now;
-  qualityList.push_back(info);
+  qualities.track(rect, now);
 }
 
 // Returns the change-tracked quality, 0-128, where 128 is max quality
 unsigned EncodeManager::getQuality(const Rect& rect) const {
-
-  const int searchArea = rect.area();
-
-  for (std::list<QualityInfo*>::const_iterator it = qualityList.begin(); it != qualityList.end(); it++) {
-    const QualityInfo * const cur = *it;
-    const int curArea = cur->rect.area();
-    const Rect unioned = cur->rect.union_boundary(rect);
-    const int unionArea = unioned.area();
-    // Is this close enough to match?
-    // e.g. ads that change parts in one frame and more in others
-    if (rect.enclosed_by(cur->rect) ||
-        cur->rect.enclosed_by(rect) ||
-        closeEnough(unioned, unionArea, cur->rect, curArea) ||
-        closeEnough(unioned, unionArea, rect, searchArea)) {
-
-        unsigned score = cur->score;
-        if (score > 128)
-          score = 128;
-        score = 128 - score;
-
-        return score;
-    }
-  }
-
-  return 128; // Not found, this shouldn't happen - return max quality then
+  return qualities.get(rect);
 }
 
 // Returns the scaled quality, 0-9, where 9 is max
@@ -22,11 +22,14 @@
 #define __RFB_ENCODEMANAGER_H__
 
 #include <vector>
-#include <list>
 
 #include <rdr/types.h>
+#include <rfb/EncCache.h>
+#include <rfb/EncodeScheduler.h>
 #include <rfb/PixelBuffer.h>
+#include <rfb/QualityMap.h>
 #include <rfb/Region.h>
+#include <rfb/SolidSearch.h>
 #include <rfb/Timer.h>
 #include <rfb/UpdateTracker.h>
 
@@ -51,15 +54,13 @@ namespace rfb {
   class Palette;
   class PixelBuffer;
   class RenderedCursor;
-  class EncCache;
+  class SharedVideoEncoders;
   struct Rect;
 
-  struct RectInfo;
-  struct QualityInfo;
-
   class EncodeManager: public Timer::Callback {
   public:
-    EncodeManager(SConnection* conn, EncCache *encCache, const FFmpeg& ffmpeg, const video_encoders::EncoderProbe &encoder_probe_);
+    EncodeManager(SConnection* conn, EncCache *encCache, const FFmpeg& ffmpeg, const video_encoders::EncoderProbe &encoder_probe_,
+                  SharedVideoEncoders *sharedVideoEncoders = nullptr);
     ~EncodeManager() override;
 
     void logStats();
@@ -95,6 +96,8 @@ namespace rfb {
       uint32_t ms;
       uint32_t area;
       uint32_t rects;
+      // What the scheduler expected the compressed rects to take, in ms
+      uint32_t predicted;
     };
 
     codecstats_t jpegstats, webpstats;
@@ -123,7 +126,6 @@ namespace rfb {
     void writeCopyRects(const Region& copied, const Point& delta);
     void writeCopyPassRects(const std::vector<CopyPassRect>& copypassed);
     void writeSolidRects(Region *changed, const PixelBuffer* pb);
-    void findSolidRect(const Rect& rect, Region *changed, const PixelBuffer* pb);
     void writeRects(const Region& changed, const PixelBuffer* pb,
                     const struct timeval *start = nullptr,
                     bool mainScreen = false);
@@ -131,55 +133,36 @@ namespace rfb {
     void updateVideoStats(const std::vector<Rect> &rects, const PixelBuffer* pb);
 
     void writeSubRect(const Rect& rect, const PixelBuffer *pb, uint8_t type,
-                      const Palette& pal, const std::vector<uint8_t> &compressed,
+                      const Palette& pal, const EncBuffer &compressed,
                       uint8_t isWebp);
 
     uint8_t getEncoderType(const Rect& rect, const PixelBuffer *pb, Palette *pal,
-                           std::vector<uint8_t> &compressed, uint8_t *isWebp,
-                           uint8_t *fromCache,
-                           const PixelBuffer *scaledpb, const Rect& scaledrect,
-                           uint32_t &ms) const;
+                           EncBuffer &compressed,
+                           const std::shared_ptr<EncBytes> &out,
+                           const PixelBuffer *scaledpb) const;
+    void compressFullColour(const Rect& rect, const PixelBuffer *pb,
+                            int klass, unsigned quality,
+                            EncBuffer &compressed,
+                            const std::shared_ptr<EncBytes> &out, uint8_t *isWebp,
+                            uint8_t *fromCache,
+                            const PixelBuffer *scaledpb, const Rect& scaledrect,
+                            uint32_t &us) const;
+
+    int fullColourClass() const;
+    static bool scheduledCodec(int klass, EncodeScheduler::Codec *codec);
+    static int codecClass(EncodeScheduler::Codec codec);
+    double frameBudget(int klass, const struct timeval *start) const;
 
     bool handleTimeout(Timer* t) override;
 
-    bool checkSolidTile(const Rect& r, const rdr::U8* colourValue,
-                        const PixelBuffer *pb);
-    void extendSolidAreaByBlock(const Rect& r, const rdr::U8* colourValue,
-                                const PixelBuffer *pb, Rect* er);
-    void extendSolidAreaByPixel(const Rect& r, const Rect& sr,
-                                const rdr::U8* colourValue,
-                                const PixelBuffer *pb, Rect* er);
-
     PixelBuffer* preparePixelBuffer(const Rect& rect,
                                     const PixelBuffer *pb, bool convert) const;
 
-    bool analyseRect(const PixelBuffer *pb,
-                     struct RectInfo *info, int maxColours) const;
-
     void updateQualities();
     void trackRectQuality(const Rect& rect);
     [[nodiscard]] unsigned getQuality(const Rect& rect) const;
     [[nodiscard]] unsigned scaledQuality(const Rect& rect) const;
 
-  protected:
-    // Preprocessor generated, optimised methods
-    inline bool checkSolidTile(const Rect& r, rdr::U8 colourValue,
-                               const PixelBuffer *pb);
-    inline bool checkSolidTile(const Rect& r, rdr::U16 colourValue,
-                               const PixelBuffer *pb);
-    inline bool checkSolidTile(const Rect& r, rdr::U32 colourValue,
-                               const PixelBuffer *pb);
-
-    inline bool analyseRect(int width, int height,
-                            const rdr::U8* buffer, int stride,
-                            struct RectInfo *info, int maxColours) const;
-    inline bool analyseRect(int width, int height,
-                            const rdr::U16* buffer, int stride,
-                            struct RectInfo *info, int maxColours) const;
-    inline bool analyseRect(int width, int height,
-                            const rdr::U32* buffer, int stride,
-                            struct RectInfo *info, int maxColours) const;
-
   protected:
     SConnection *conn;
     tbb::task_arena arena;
@@ -197,7 +180,7 @@ namespace rfb {
     };
     typedef std::vector< std::vector<struct EncoderStats> > StatsVector;
 
-    std::list<QualityInfo*> qualityList;
+    QualityMap qualities;
     int dynamicQualityMin;
     int dynamicQualityOff;
 
@@ -220,6 +203,17 @@ namespace rfb {
     unsigned encodingTime;
     unsigned maxEncodingTime, framesSinceEncPrint;
     unsigned scalingTime;
+    ManagedPixelBuffer scaledFb;
+    ManagedPixelBuffer scaleTmp[2];
+
+    // Where the rects of a frame are compressed to
+    EncArena encArena;
+
+    // Learns the encoders' speed and plans the rects of each frame
+    EncodeScheduler scheduler;
+
+    SolidSearch solidSearch;
+    std::vector<SolidRect> solidRects;
 
     const FFmpeg &ffmpeg;
     bool ffmpeg_available;
@@ -241,12 +235,14 @@ namespace rfb {
     };
   };
 
+  // These return a new buffer, or dst if given
   PixelBuffer *nearestScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
-                            const float diff);
+                            const float diff, ManagedPixelBuffer *dst = NULL);
   PixelBuffer *bilinearScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
-                            const float diff);
+                            const float diff, ManagedPixelBuffer *dst = NULL);
   PixelBuffer *progressiveBilinearScale(const PixelBuffer *pb, const uint16_t w, const uint16_t h,
-                            const float diff);
+                            const float diff, ManagedPixelBuffer *dst = NULL,
+                            ManagedPixelBuffer *tmp = NULL);
 }
 
 #endif
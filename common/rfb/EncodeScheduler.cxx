@@ -0,0 +1,143 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <algorithm>
+
+#include <rfb/EncodeScheduler.h>
+
+using namespace rfb;
+
+// Tiles per thread to aim for, so that a slow one can be made up for
+static const unsigned tilesPerThread = 4;
+// Smaller ones are mostly per rect overhead
+static const int minLearnArea = 4096;
+
+EncodeScheduler::EncodeScheduler()
+{
+  seed(0);
+}
+
+void EncodeScheduler::seed(unsigned webpBenchMs)
+{
+  // The benchmark is the lowest WebP quality on the worst content, at
+  // 1/16 megapixel. The rest are rough guesses relative to it.
+  const double webp = (webpBenchMs ? webpBenchMs : 1) * 16.0;
+
+  for (unsigned q = 0; q < qualities; q++) {
+    msPerMP[codecWEBP][q] = webp * (1.0 + q / 9.0);
+    msPerMP[codecJPEG][q] = webp / 4;
+    msPerMP[codecQOI][q] = webp / 4;
+  }
+}
+
+double EncodeScheduler::predict(Codec codec, unsigned quality, int area) const
+{
+  if (quality >= qualities)
+    quality = qualities - 1;
+
+  return msPerMP[codec][quality] * area / 1000000.0;
+}
+
+void EncodeScheduler::learn(Codec codec, unsigned quality, int area,
+                            unsigned us)
+{
+  double sample;
+
+  if (area < minLearnArea)
+    return;
+  if (quality >= qualities)
+    quality = qualities - 1;
+
+  sample = us / 1000.0 / (area / 1000000.0);
+
+  // Moving average, to follow what is on screen without jumping around
+  msPerMP[codec][quality] += (sample - msPerMP[codec][quality]) / 8;
+}
+
+int EncodeScheduler::tileArea(Codec codec, unsigned quality,
+                              unsigned long long frameArea,
+                              unsigned threads, double budgetMs) const
+{
+  int area = maxTileArea;
+
+  if (threads > 1) {
+    const unsigned long long spread = frameArea / (threads * tilesPerThread);
+
+    // Nearest of the allowed sizes
+    while (area > minTileArea && spread < (unsigned long long) area * 3 / 4)
+      area /= 2;
+  }
+
+  if (budgetMs > 0) {
+    while (area > minTileArea && predict(codec, quality, area) > budgetMs)
+      area /= 2;
+  }
+
+  return area;
+}
+
+void EncodeScheduler::plan(std::vector<Tile> *tiles, unsigned threads,
+                           double budgetMs) const
+{
+  std::vector<size_t> webp;
+  double total, capacity;
+
+  total = 0;
+  for (size_t i = 0; i < tiles->size(); i++) {
+    Tile &tile = (*tiles)[i];
+
+    if (tile.codec == codecWEBP) {
+      tile.codec = codecJPEG;
+      webp.push_back(i);
+    }
+
+    tile.cost = predict(tile.codec, tile.quality, tile.area);
+    total += tile.cost;
+  }
+
+  // Smallest first, so the most tiles get WebP and the biggest, that
+  // would hold up the frame, go JPEG
+  std::stable_sort(webp.begin(), webp.end(), [&](size_t a, size_t b) {
+    return (*tiles)[a].area < (*tiles)[b].area;
+  });
+
+  capacity = budgetMs * (threads ? threads : 1);
+
+  for (size_t i = 0; i < webp.size(); i++) {
+    Tile &tile = (*tiles)[webp[i]];
+    const double cost = predict(codecWEBP, tile.quality, tile.area);
+
+    if (cost > budgetMs || total + cost - tile.cost > capacity)
+      continue;
+
+    total += cost - tile.cost;
+    tile.codec = codecWEBP;
+    tile.cost = cost;
+  }
+}
+
+void EncodeScheduler::order(const std::vector<Tile> &tiles,
+                            std::vector<size_t> *order)
+{
+  order->resize(tiles.size());
+  for (size_t i = 0; i < tiles.size(); i++)
+    (*order)[i] = i;
+
+  std::stable_sort(order->begin(), order->end(), [&](size_t a, size_t b) {
+    return tiles[a].cost > tiles[b].cost;
+  });
+}
@@ -0,0 +1,90 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_ENCODESCHEDULER_H__
+#define __RFB_ENCODESCHEDULER_H__
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace rfb {
+
+  //
+  // Predicts how long the rects of a frame take to compress, from ms per
+  // megapixel figures learned for each encoder and quality, and uses that
+  // to plan the frame: how big to cut the tiles, which ones can afford
+  // WebP within the frame's budget, and in what order to compress them.
+  //
+
+  class EncodeScheduler {
+  public:
+    enum Codec { codecJPEG, codecWEBP, codecQOI, codecMax };
+
+    EncodeScheduler();
+
+    // Starting figures, from the WebP benchmark's time for 256x256
+    // random pixels. Measurements take over as rects get compressed.
+    void seed(unsigned webpBenchMs);
+
+    // Predicted ms to compress area pixels
+    double predict(Codec codec, unsigned quality, int area) const;
+
+    // Adds how long compressing area pixels took
+    void learn(Codec codec, unsigned quality, int area, unsigned us);
+
+    // The area of the tiles to cut the rects of a frame into. Small
+    // enough that all threads have several tiles to work on, and that no
+    // tile alone takes longer than budgetMs.
+    int tileArea(Codec codec, unsigned quality, unsigned long long frameArea,
+                 unsigned threads, double budgetMs) const;
+
+    struct Tile {
+      int area;
+      unsigned quality;
+      // WebP tiles may be changed to JPEG
+      Codec codec;
+      // Predicted ms, filled in by plan()
+      double cost;
+    };
+
+    // Keeps WebP for as many tiles as can be done within budgetMs on
+    // threads, switching the rest to JPEG, biggest first
+    void plan(std::vector<Tile> *tiles, unsigned threads,
+              double budgetMs) const;
+
+    // The most expensive tiles first, so that no big one is started last
+    // and left to finish on its own
+    static void order(const std::vector<Tile> &tiles,
+                      std::vector<size_t> *order);
+
+  public:
+    // Tiles are kept to a few sizes, so that the same content gets cut
+    // the same way in different frames and can be found in the cache
+    static const int minTileArea = 16384;
+    static const int maxTileArea = 65536;
+    static const int minTileHeight = 64;
+
+  protected:
+    static const unsigned qualities = 10;
+
+    double msPerMP[codecMax][qualities];
+  };
+}
+
+#endif
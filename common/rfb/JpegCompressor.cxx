@@ -74,30 +74,29 @@ JpegOutputMessage(j_common_ptr cinfo)
 
 struct JPEG_DEST_MGR {
   struct jpeg_destination_mgr pub;
-  JpegCompressor *instance;
+  rdr::OutStream *os;
 };
 
 static void
 JpegInitDestination(j_compress_ptr cinfo)
 {
   JPEG_DEST_MGR *dest = (JPEG_DEST_MGR *)cinfo->dest;
-  JpegCompressor *jc = dest->instance;
+  rdr::OutStream *os = dest->os;
 
-  jc->clear();
-  dest->pub.next_output_byte = jc->getptr();
-  dest->pub.free_in_buffer = jc->avail();
+  dest->pub.next_output_byte = os->getptr();
+  dest->pub.free_in_buffer = os->avail();
 }
 
 static boolean
 JpegEmptyOutputBuffer(j_compress_ptr cinfo)
 {
   JPEG_DEST_MGR *dest = (JPEG_DEST_MGR *)cinfo->dest;
-  JpegCompressor *jc = dest->instance;
+  rdr::OutStream *os = dest->os;
 
-  jc->setptr(jc->getend());
-  jc->check(jc->length());
-  dest->pub.next_output_byte = jc->getptr();
-  dest->pub.free_in_buffer = jc->avail();
+  os->setptr(os->getend());
+  os->check(os->length());
+  dest->pub.next_output_byte = os->getptr();
+  dest->pub.free_in_buffer = os->avail();
 
   return TRUE;
 }
@@ -106,9 +105,9 @@ static void
 JpegTermDestination(j_compress_ptr cinfo)
 {
   JPEG_DEST_MGR *dest = (JPEG_DEST_MGR *)cinfo->dest;
-  JpegCompressor *jc = dest->instance;
+  rdr::OutStream *os = dest->os;
 
-  jc->setptr(dest->pub.next_output_byte);
+  os->setptr(dest->pub.next_output_byte);
 }
 
 JpegCompressor::JpegCompressor(int bufferLen) : MemOutStream(bufferLen)
@@ -132,7 +131,7 @@ JpegCompressor::JpegCompressor(int bufferLen) : MemOutStream(bufferLen)
   dest->pub.init_destination = JpegInitDestination;
   dest->pub.empty_output_buffer = JpegEmptyOutputBuffer;
   dest->pub.term_destination = JpegTermDestination;
-  dest->instance = this;
+  dest->os = this;
   cinfo->dest = (struct jpeg_destination_mgr *)dest;
 }
 
@@ -152,20 +151,24 @@ JpegCompressor::~JpegCompressor(void)
 }
 
 void JpegCompressor::compress(const rdr::U8 *buf, int stride, const Rect& r,
-  const PixelFormat& pf, int quality, int subsamp)
+  const PixelFormat& pf, int quality, int subsamp, rdr::OutStream *os)
 {
   int w = r.width();
   int h = r.height();
   int pixelsize;
   rdr::U8 *srcBuf = NULL;
-  bool srcBufIsTemp = false;
-  JSAMPROW *rowPointer = NULL;
+  JSAMPROW *rowPointer;
+
+  if (os) {
+    dest->os = os;
+  } else {
+    clear();
+    dest->os = this;
+  }
 
   if(setjmp(err->jmpBuffer)) {
     // this will execute if libjpeg has an error
     jpeg_abort_compress(cinfo);
-    if (srcBufIsTemp && srcBuf) delete[] srcBuf;
-    if (rowPointer) delete[] rowPointer;
     throw rdr::Exception("%s", err->lastError);
   }
 
@@ -196,8 +199,9 @@ void JpegCompressor::compress(const rdr::U8 *buf, int stride, const Rect& r,
     stride = w;
 
   if (cinfo->in_color_space == JCS_RGB) {
-    srcBuf = new rdr::U8[w * h * pixelsize];
-    srcBufIsTemp = true;
+    if (rgbBuf.size() < (size_t)(w * h * pixelsize))
+      rgbBuf.resize(w * h * pixelsize);
+    srcBuf = rgbBuf.data();
     pf.rgbFromBuffer(srcBuf, (const rdr::U8 *)buf, w, stride, h);
     stride = w;
   }
@@ -233,7 +237,9 @@ void JpegCompressor::compress(const rdr::U8 *buf, int stride, const Rect& r,
     cinfo->comp_info[0].v_samp_factor = 1;
   }
 
-  rowPointer = new JSAMPROW[h];
+  if (rowBuf.size() < (size_t)h)
+    rowBuf.resize(h);
+  rowPointer = (JSAMPROW *)rowBuf.data();
   for (int dy = 0; dy < h; dy++)
     rowPointer[dy] = (JSAMPROW)(&srcBuf[dy * stride * pixelsize]);
 
@@ -243,9 +249,6 @@ void JpegCompressor::compress(const rdr::U8 *buf, int stride, const Rect& r,
       cinfo->image_height - cinfo->next_scanline);
 
   jpeg_finish_compress(cinfo);
-
-  if (srcBufIsTemp) delete[] srcBuf;
-  delete[] rowPointer;
 }
 
 void JpegCompressor::writeBytes(const void* data, int length)
@@ -25,6 +25,8 @@
 #ifndef __RFB_JPEGCOMPRESSOR_H__
 #define __RFB_JPEGCOMPRESSOR_H__
 
+#include <vector>
+
 #include <rdr/MemOutStream.h>
 #include <rfb/PixelFormat.h>
 #include <rfb/Rect.h>
@@ -43,7 +45,9 @@ namespace rfb {
     JpegCompressor(int bufferLen = 128*1024);
     virtual ~JpegCompressor();
 
-    void compress(const rdr::U8 *, int, const Rect&, const PixelFormat&, int, int);
+    // Compresses into os if given, otherwise into the compressor itself
+    void compress(const rdr::U8 *, int, const Rect&, const PixelFormat&, int, int,
+                  rdr::OutStream *os = NULL);
 
     void writeBytes(const void*, int);
 
@@ -54,6 +58,10 @@ namespace rfb {
     struct JPEG_ERROR_MGR *err;
     struct JPEG_DEST_MGR *dest;
 
+    // Kept between images, so they only grow
+    std::vector<rdr::U8> rgbBuf;
+    std::vector<rdr::U8 *> rowBuf;
+
   };
 
 } // end of namespace rfb
@@ -0,0 +1,257 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <rfb/QualityMap.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+// If this rect was touched this update, add this to its quality score
+static const unsigned SCORE_INCREMENT = 32;
+
+// Rects whose top-left corners are this close, and areas differ by at
+// most this much, are considered the same area
+static const int CloseDistance = 32;
+static const int CloseArea = 4096;
+
+// Size in pixels of each grid cell
+static const int CellSize = 64;
+
+QualityMap::QualityMap() : used(0), nextOrder(0), gridW(0), gridH(0)
+{
+}
+
+void QualityMap::clear()
+{
+  areas.clear();
+  freeAreas.clear();
+  used = 0;
+  nextOrder = 0;
+  grid.clear();
+  gridW = gridH = 0;
+}
+
+static bool closeEnough(const Rect& unioned, const int& unionArea,
+                        const Rect& check, const int& checkArea) {
+  const Point p = unioned.tl.subtract(check.tl);
+  if (abs(p.x) > CloseDistance ||
+      abs(p.y) > CloseDistance)
+      return false;
+
+  if (abs(unionArea - checkArea) > CloseArea)
+    return false;
+
+  return true;
+}
+
+bool QualityMap::matches(const Area& area, const Rect& rect) const
+{
+  const int searchArea = rect.area();
+  const int curArea = area.rect.area();
+  const Rect unioned = area.rect.union_boundary(rect);
+  const int unionArea = unioned.area();
+
+  // Is this close enough to match?
+  // e.g. ads that change parts in one frame and more in others
+  return rect.enclosed_by(area.rect) ||
+         area.rect.enclosed_by(rect) ||
+         closeEnough(unioned, unionArea, area.rect, curArea) ||
+         closeEnough(unioned, unionArea, rect, searchArea);
+}
+
+Rect QualityMap::cellsFor(const Rect& rect) const
+{
+  return Rect(std::max(rect.tl.x, 0) / CellSize,
+              std::max(rect.tl.y, 0) / CellSize,
+              std::max(rect.br.x - 1, 0) / CellSize + 1,
+              std::max(rect.br.y - 1, 0) / CellSize + 1);
+}
+
+// Returns the index of the first added area matching rect, or -1
+int QualityMap::find(const Rect& rect) const
+{
+  int best = -1;
+
+  // An area that does not overlap rect can only match if their union
+  // is barely larger, which bounds the gap between them. Ones further
+  // away than that can be skipped.
+  const int marginX = CloseArea / rect.height() + 1;
+  const int marginY = CloseArea / rect.width() + 1;
+  Rect search = cellsFor(Rect(rect.tl.x - marginX, rect.tl.y - marginY,
+                              rect.br.x + marginX, rect.br.y + marginY));
+  search = search.intersect(Rect(0, 0, gridW, gridH));
+
+  // Don't bother with the grid if there are fewer areas than cells
+  if ((size_t) search.area() > used) {
+    for (size_t i = 0; i < areas.size(); i++) {
+      const Area& area = areas[i];
+      if (!area.used)
+        continue;
+      if (best != -1 && area.order > areas[best].order)
+        continue;
+      if (matches(area, rect))
+        best = i;
+    }
+
+    return best;
+  }
+
+  for (int y = search.tl.y; y < search.br.y; y++) {
+    for (int x = search.tl.x; x < search.br.x; x++) {
+      for (unsigned idx : grid[y * gridW + x]) {
+        const Area& area = areas[idx];
+        if (best != -1 && area.order >= areas[best].order)
+          continue;
+        if (matches(area, rect))
+          best = idx;
+      }
+    }
+  }
+
+  return best;
+}
+
+void QualityMap::grow(const Rect& cells)
+{
+  if (cells.br.x <= gridW && cells.br.y <= gridH)
+    return;
+
+  const int neww = std::max(cells.br.x, gridW);
+  const int newh = std::max(cells.br.y, gridH);
+  std::vector<std::vector<unsigned> > newgrid(neww * newh);
+
+  for (int y = 0; y < gridH; y++)
+    for (int x = 0; x < gridW; x++)
+      newgrid[y * neww + x].swap(grid[y * gridW + x]);
+
+  grid.swap(newgrid);
+  gridW = neww;
+  gridH = newh;
+}
+
+void QualityMap::link(unsigned idx)
+{
+  Area& area = areas[idx];
+
+  area.cells = cellsFor(area.rect);
+  grow(area.cells);
+
+  for (int y = area.cells.tl.y; y < area.cells.br.y; y++)
+    for (int x = area.cells.tl.x; x < area.cells.br.x; x++)
+      grid[y * gridW + x].push_back(idx);
+}
+
+void QualityMap::unlink(unsigned idx)
+{
+  const Area& area = areas[idx];
+
+  for (int y = area.cells.tl.y; y < area.cells.br.y; y++) {
+    for (int x = area.cells.tl.x; x < area.cells.br.x; x++) {
+      std::vector<unsigned>& cell = grid[y * gridW + x];
+      std::vector<unsigned>::iterator it = std::find(cell.begin(), cell.end(), idx);
+      *it = cell.back();
+      cell.pop_back();
+    }
+  }
+}
+
+void QualityMap::track(const Rect& rect, const struct timeval& now)
+{
+  if (rect.is_empty())
+    return;
+
+  const int found = find(rect);
+  if (found != -1) {
+    Area& cur = areas[found];
+
+    // This existing rect matched. Set it to the larger of the two,
+    // and add to its score.
+    if (rect.area() > cur.rect.area()) {
+      const Rect cells = cellsFor(rect);
+      if (!cells.equals(cur.cells)) {
+        unlink(found);
+        cur.rect = rect;
+        link(found);
+      } else {
+        cur.rect = rect;
+      }
+    }
+
+    cur.score += SCORE_INCREMENT;
+    cur.lastUpdate = now;
+    return;
+  }
+
+  // It wasn't found, add it
+  unsigned idx;
+  if (!freeAreas.empty()) {
+    idx = freeAreas.back();
+    freeAreas.pop_back();
+  } else {
+    idx = areas.size();
+    areas.push_back(Area());
+  }
+
+  Area& info = areas[idx];
+  info.rect = rect;
+  info.score = 0;
+  info.lastUpdate = now;
+  info.order = nextOrder++;
+  info.used = true;
+  used++;
+
+  link(idx);
+}
+
+unsigned QualityMap::get(const Rect& rect) const
+{
+  if (rect.is_empty())
+    return 128;
+
+  const int found = find(rect);
+  if (found == -1)
+    return 128; // Not found, this shouldn't happen - return max quality then
+
+  unsigned score = areas[found].score;
+  if (score > 128)
+    score = 128;
+
+  return 128 - score;
+}
+
+void QualityMap::decay(const struct timeval& now)
+{
+  for (size_t i = 0; i < areas.size(); i++) {
+    Area& cur = areas[i];
+    if (!cur.used)
+      continue;
+
+    const unsigned since = msBetween(&cur.lastUpdate, &now);
+    if (since > 5000) {
+      unlink(i);
+      cur.used = false;
+      freeAreas.push_back(i);
+      used--;
+    } else {
+      cur.score -= cur.score / 16;
+    }
+  }
+}
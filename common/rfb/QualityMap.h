@@ -0,0 +1,82 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_QUALITYMAP_H__
+#define __RFB_QUALITYMAP_H__
+
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#include <rfb/Rect.h>
+
+namespace rfb {
+
+  // Tracks how often areas of the screen change, for dynamic quality.
+  //
+  // Areas are kept in a flat pool, and indexed by a coarse grid so that
+  // a rect only needs to be checked against areas near it. Matching is
+  // the same as scanning all areas in the order they were added.
+  //
+  // get() does not modify anything, and may be called from several
+  // threads at once, as long as nothing is being tracked meanwhile.
+  class QualityMap {
+  public:
+    QualityMap();
+
+    void clear();
+
+    // Adds to the score of the matching area, or starts a new one
+    void track(const Rect& rect, const struct timeval& now);
+    // Returns the quality of the matching area, 0-128, where 128 is max
+    unsigned get(const Rect& rect) const;
+    // Drops areas not touched in 5s, and decays the rest
+    void decay(const struct timeval& now);
+
+    size_t size() const { return used; }
+
+  protected:
+    struct Area {
+      struct timeval lastUpdate;
+      Rect rect;
+      Rect cells; // covered part of the grid, in cells
+      unsigned score;
+      unsigned long long order; // when it was added, lower ones match first
+      bool used;
+    };
+
+    int find(const Rect& rect) const;
+    bool matches(const Area& area, const Rect& rect) const;
+
+    Rect cellsFor(const Rect& rect) const;
+    void grow(const Rect& cells);
+    void link(unsigned idx);
+    void unlink(unsigned idx);
+
+    std::vector<Area> areas;
+    std::vector<unsigned> freeAreas;
+    size_t used;
+    unsigned long long nextOrder;
+
+    // Indices of the areas touching each cell, row by row
+    std::vector<std::vector<unsigned> > grid;
+    int gridW, gridH;
+  };
+
+}
+
+#endif
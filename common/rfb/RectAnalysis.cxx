@@ -0,0 +1,107 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include <rfb/blockcmp.h>
+#include <rfb/Palette.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/RectAnalysis.h>
+
+using namespace rfb;
+
+template<class T>
+static bool analyseRectT(int width, int height, const T *buffer, int stride,
+                         RectInfo *info, int maxColours,
+                         ColourRunFinder finder)
+{
+  T colour;
+  int count;
+
+  info->rleRuns = 0;
+  info->palette->clear();
+
+  // For efficiency, we only update the palette on changes in colour
+  colour = buffer[0];
+  count = 0;
+  while (height--) {
+    const T *pixel = buffer;
+    const T *end = buffer + width;
+
+    while (pixel < end) {
+      unsigned length;
+
+      if (*pixel != colour) {
+        if (!info->palette->insert(colour, count))
+          return false;
+        if (info->palette->size() > maxColours)
+          return false;
+
+        // FIXME: This doesn't account for switching lines
+        info->rleRuns++;
+
+        colour = *pixel;
+        count = 0;
+      }
+
+      // Only look for a longer run if the next pixel starts one, so
+      // that busy areas don't pay for the call
+      if (end - pixel < 2 || pixel[1] != colour)
+        length = 1;
+      else
+        length = finder((const uint8_t *) pixel, sizeof(T),
+                        end - pixel);
+
+      pixel += length;
+      count += length;
+    }
+    buffer += stride;
+  }
+
+  // Make sure the final pixels also get counted
+  if (!info->palette->insert(colour, count))
+    return false;
+  if (info->palette->size() > maxColours)
+    return false;
+
+  return true;
+}
+
+bool rfb::analyseRect(const PixelBuffer *pb, RectInfo *info, int maxColours,
+                      ColourRunFinder finder)
+{
+  const rdr::U8* buffer;
+  int stride;
+
+  if (!finder)
+    finder = colourRunLength;
+
+  buffer = pb->getBuffer(pb->getRect(), &stride);
+
+  switch (pb->getPF().bpp) {
+  case 32:
+    return analyseRectT(pb->width(), pb->height(),
+                        (const rdr::U32*)buffer, stride,
+                        info, maxColours, finder);
+  case 16:
+    return analyseRectT(pb->width(), pb->height(),
+                        (const rdr::U16*)buffer, stride,
+                        info, maxColours, finder);
+  default:
+    return analyseRectT(pb->width(), pb->height(),
+                        (const rdr::U8*)buffer, stride,
+                        info, maxColours, finder);
+  }
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_RECTANALYSIS_H__
+#define __RFB_RECTANALYSIS_H__
+
+#include <stdint.h>
+
+namespace rfb {
+  class Palette;
+  class PixelBuffer;
+
+  struct RectInfo {
+    int rleRuns;
+    Palette *palette;
+  };
+
+  // Finds the length of a run of same coloured pixels, like
+  // colourRunLength() in blockcmp.h
+  typedef unsigned (*ColourRunFinder)(const uint8_t *buf,
+                                      const unsigned bpp, const unsigned n);
+
+  //
+  // Counts the colours of a rect into info->palette, and how many times
+  // the colour changes. Gives up with false once there are more than
+  // maxColours. Runs of the same colour are skipped using the vector
+  // units when the CPU has them, finder only being there to test the
+  // other implementations.
+  //
+
+  bool analyseRect(const PixelBuffer *pb, RectInfo *info, int maxColours,
+                   ColourRunFinder finder = 0);
+}
+
+#endif
@@ -108,6 +108,9 @@ namespace rfb {
 
     virtual void udpUpgrade(const char *resp) = 0;
     virtual void udpDowngrade(const bool) = 0;
+    // The client lost this many of the last total UDP pieces, before
+    // any were rebuilt from parity
+    virtual void udpLoss(const unsigned lost, const unsigned total) = 0;
 
     virtual void subscribeUnixRelay(const char *name) = 0;
     virtual void unixRelay(const char *name, const rdr::U8 *buf, const unsigned len) = 0;
@@ -102,6 +102,9 @@ void SMsgReader::readMsg()
   case msgTypeUpgradeToUdp:
     readUpgradeToUdp();
     break;
+  case msgTypeUdpLoss:
+    readUdpLoss();
+    break;
   case msgTypeSubscribeUnixRelay:
     readSubscribeUnixRelay();
     break;
@@ -396,6 +399,14 @@ void SMsgReader::readUpgradeToUdp()
   handler->udpUpgrade(resp);
 }
 
+void SMsgReader::readUdpLoss()
+{
+  is->skip(3);
+  rdr::U32 lost = is->readU32();
+  rdr::U32 total = is->readU32();
+  handler->udpLoss(lost, total);
+}
+
 void SMsgReader::readSubscribeUnixRelay()
 {
   const rdr::U8 namelen = is->readU8();
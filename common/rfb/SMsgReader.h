@@ -67,6 +67,7 @@ namespace rfb {
     void readQEMUKeyEvent();
 
     void readUpgradeToUdp();
+    void readUdpLoss();
 
     void readSubscribeUnixRelay();
     void readUnixRelay();
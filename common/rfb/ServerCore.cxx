@@ -52,6 +52,11 @@ rfb::IntParameter rfb::Server::compareFB
  "Perform pixel comparison on framebuffer to reduce unnecessary updates "
  "(0: never, 1: always, 2: auto)",
  2);
+rfb::BoolParameter rfb::Server::compareHashOnly
+("CompareHashOnly",
+ "Compare the framebuffer against hashes of its blocks instead of a full "
+ "copy of it. Saves memory, at a tiny risk of missing a change",
+ false);
 rfb::IntParameter rfb::Server::frameRate
 ("FrameRate",
  "The maximum number of updates per second sent to each client",
@@ -156,6 +161,21 @@ rfb::IntParameter rfb::Server::rectThreads
 ("RectThreads",
  "Use this many threads to compress rects in parallel. Default 0 (auto), 1 = off",
  0, 0, 64);
+rfb::IntParameter rfb::Server::clientThreads
+("ClientThreads",
+ "Use this many threads to encode updates for different clients in parallel. "
+ "Default 1 (off), 0 = auto",
+ 1, 0, 64);
+rfb::IntParameter rfb::Server::encCacheSize
+("EncCacheSize",
+ "Keep up to this many MB of compressed rects to reuse across frames and clients. "
+ "0 = off",
+ 32, 0, 1024);
+rfb::BoolParameter rfb::Server::pipelineUpdates
+("PipelineUpdates",
+ "Encode the next update while the previous one is still being sent, "
+ "queueing up to one frame of data per client",
+ false);
 rfb::IntParameter rfb::Server::jpegVideoQuality
 ("JpegVideoQuality",
  "The JPEG quality to use when in video mode",
@@ -279,6 +299,11 @@ rfb::IntParameter rfb::Server::groupOfPicture
 ("GroupOfPicture",
  "The number of frames to group together for encoding",
  24, 0, 100);
+rfb::BoolParameter rfb::Server::shareVideoEncoders
+("ShareVideoEncoders",
+ "Encode each screen once for all clients with the same video settings, "
+ "instead of once per client",
+ false);
 rfb::StringParameter rfb::Server::driNode
 ("drinode",
  "Path to the hardware acceleration device (e.g. /dev/dri/renderD128)",
@@ -307,6 +332,41 @@ rfb::IntParameter rfb::Server::udpPort
  "Which port to use for UDP. Default same as websocket",
  0, 0, 65535);
 
+rfb::BoolParameter rfb::Server::udpFec
+("udpFec",
+ "Send parity pieces over UDP to clients that support it, adapted to their loss rate",
+ true);
+
+rfb::BoolParameter rfb::Server::udpPacing
+("udpPacing",
+ "Spread large UDP updates out at the estimated bandwidth, instead of sending them in one burst",
+ false);
+
+rfb::IntParameter rfb::Server::websocketThreads
+("WebsocketThreads",
+ "Number of event loops accepting websocket, HTTP and API connections",
+ 4, 1, 64);
+
+rfb::BoolParameter rfb::Server::websocketReusePort
+("WebsocketReusePort",
+ "Give each websocket event loop its own listening socket with SO_REUSEPORT, and let the kernel spread new connections between them",
+ false);
+
+rfb::BoolParameter rfb::Server::websocketPinThreads
+("WebsocketPinThreads",
+ "Pin each websocket event loop to its own CPU",
+ false);
+
+rfb::BoolParameter rfb::Server::kernelTLS
+("KernelTLS",
+ "Use kernel TLS offload for encryption when the kernel supports it",
+ false);
+
+rfb::BoolParameter rfb::Server::kernelCongestionControl
+("KernelCongestionControl",
+ "Base congestion control on the kernel's TCP statistics, when available, instead of our own RTT measurements",
+ false);
+
 rfb::StringParameter rfb::Server::videoCodec
 ("videoCodec",
  "If set, use this codec to send a video stream for WebCodecs. Supported options: auto, h264, h264_vaapi, h265, h265_vaapi, av1, av1_vaapi",
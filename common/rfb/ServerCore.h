@@ -36,12 +36,16 @@ namespace rfb {
         static IntParameter maxIdleTime;
         static IntParameter clientWaitTimeMillis;
         static IntParameter compareFB;
+        static BoolParameter compareHashOnly;
         static IntParameter frameRate;
         static IntParameter dynamicQualityMin;
         static IntParameter dynamicQualityMax;
         static IntParameter treatLossless;
         static IntParameter scrollDetectLimit;
         static IntParameter rectThreads;
+        static IntParameter clientThreads;
+        static IntParameter encCacheSize;
+        static BoolParameter pipelineUpdates;
         static IntParameter DLP_ClipSendMax;
         static IntParameter DLP_ClipAcceptMax;
         static IntParameter DLP_ClipDelay;
@@ -70,9 +74,17 @@ namespace rfb {
         static IntParameter videoScaling;
         static IntParameter videoQualityCRFCQP;
         static IntParameter groupOfPicture;
+        static BoolParameter shareVideoEncoders;
         static StringParameter driNode;
         static IntParameter udpFullFrameFrequency;
         static IntParameter udpPort;
+        static BoolParameter udpFec;
+        static BoolParameter udpPacing;
+        static IntParameter websocketThreads;
+        static BoolParameter websocketReusePort;
+        static BoolParameter websocketPinThreads;
+        static BoolParameter kernelTLS;
+        static BoolParameter kernelCongestionControl;
         static StringParameter kasmPasswordFile;
         static StringParameter publicIP;
         static StringParameter stunServer;
@@ -0,0 +1,467 @@
+/* Copyright (C) 2000-2003 Constantin Kaplinsky.  All Rights Reserved.
+ * Copyright (C) 2011 D. R. Commander.  All Rights Reserved.
+ * Copyright 2014-2018 Pierre Ossman for Cendio AB
+ * Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <rfb/PixelBuffer.h>
+#include <rfb/SolidSearch.h>
+#include <rfb/blockcmp.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
+using namespace rfb;
+
+static const int SolidSearchBlock = SolidSearch::blockSize;
+static const int SolidBlockMinArea = SolidSearch::minArea;
+
+// What is known about each block
+enum { blockMasked, blockSolid };
+
+namespace {
+
+// The search of one rectangle. It goes the same way as the old search
+// that looked at pixels only, but most tiles are answered by the map.
+// Without a map it is the old search.
+template<class T>
+class GridSearch {
+public:
+  GridSearch(const SolidSearch::Grid &grid_, rdr::U8 *solid_,
+             const rdr::U32 *colours_, rdr::U16 *masks_,
+             std::vector<SolidRect> *found_)
+    : grid(grid_), solid(solid_ ? solid_ + grid_.first : NULL),
+      colours(colours_ ? colours_ + grid_.first : NULL),
+      masks(masks_ ? masks_ + grid_.first * SolidSearchBlock : NULL),
+      found(found_) {}
+
+  void findSolidRect(const Rect& rect);
+
+private:
+  T pixel(int x, int y) const {
+    return ((const T*)grid.buffer)[(y - grid.rect.tl.y) * grid.stride +
+                                   x - grid.rect.tl.x];
+  }
+
+  bool checkSolidTile(const Rect& r, T colourValue);
+  bool checkSolidPixels(const Rect& r, T colourValue) const;
+  void extendSolidAreaByBlock(const Rect& r, T colourValue, Rect* er);
+  void extendSolidAreaByPixel(const Rect& r, const Rect& sr,
+                              T colourValue, Rect* er);
+
+  const SolidSearch::Grid &grid;
+  rdr::U8 *solid;
+  const rdr::U32 *colours;
+  rdr::U16 *masks;
+  std::vector<SolidRect> *found;
+};
+
+template<class T>
+void GridSearch<T>::findSolidRect(const Rect& rect)
+{
+  Rect sr;
+  int dx, dy, dw, dh;
+
+  // We start by finding a solid 16x16 block
+  for (dy = rect.tl.y; dy < rect.br.y; dy += SolidSearchBlock) {
+
+    dh = SolidSearchBlock;
+    if (dy + dh > rect.br.y)
+      dh = rect.br.y - dy;
+
+    for (dx = rect.tl.x; dx < rect.br.x; dx += SolidSearchBlock) {
+      T colourValue;
+
+      dw = SolidSearchBlock;
+      if (dx + dw > rect.br.x)
+        dw = rect.br.x - dx;
+
+      colourValue = pixel(dx, dy);
+
+      sr.setXYWH(dx, dy, dw, dh);
+      if (checkSolidTile(sr, colourValue)) {
+        Rect erb, erp;
+        SolidRect area;
+
+        // We then try extending the area by adding more blocks
+        // in both directions and pick the combination that gives
+        // the largest area.
+        sr.setXYWH(dx, dy, rect.br.x - dx, rect.br.y - dy);
+        extendSolidAreaByBlock(sr, colourValue, &erb);
+
+        // Did we end up getting the entire rectangle?
+        if (erb.equals(rect))
+          erp = erb;
+        else {
+          // Don't bother with sending tiny rectangles
+          if (erb.area() < SolidBlockMinArea)
+            continue;
+
+          // Extend the area again, but this time one pixel
+          // row/column at a time.
+          extendSolidAreaByPixel(rect, erb, colourValue, &erp);
+        }
+
+        area.rect = erp;
+        memset(area.colour, 0, sizeof(area.colour));
+        memcpy(area.colour, &colourValue, sizeof(T));
+        found->push_back(area);
+
+        // Search remaining areas by recursion
+        // FIXME: Is this the best way to divide things up?
+
+        // Left? (Note that we've already searched a SolidSearchBlock
+        //        pixels high strip here)
+        if ((erp.tl.x != rect.tl.x) && (erp.height() > SolidSearchBlock)) {
+          sr.setXYWH(rect.tl.x, erp.tl.y + SolidSearchBlock,
+                     erp.tl.x - rect.tl.x, erp.height() - SolidSearchBlock);
+          findSolidRect(sr);
+        }
+
+        // Right?
+        if (erp.br.x != rect.br.x) {
+          sr.setXYWH(erp.br.x, erp.tl.y, rect.br.x - erp.br.x, erp.height());
+          findSolidRect(sr);
+        }
+
+        // Below?
+        if (erp.br.y != rect.br.y) {
+          sr.setXYWH(rect.tl.x, erp.br.y, rect.width(), rect.br.y - erp.br.y);
+          findSolidRect(sr);
+        }
+
+        return;
+      }
+    }
+  }
+}
+
+// A block that isn't solid is no good if r covers all of it. If r only
+// covers some of it, its mask tells which pixels have the same colour as
+// its first one. If that is our colour, the part inside r must be all of
+// those pixels. If it isn't, r must miss all of them, and only then do
+// the rest of the pixels have to be looked at.
+template<class T>
+bool GridSearch<T>::checkSolidTile(const Rect& r, T colourValue)
+{
+  if (!solid)
+    return checkSolidPixels(r, colourValue);
+
+  const int x0 = r.tl.x - grid.rect.tl.x, x1 = r.br.x - grid.rect.tl.x;
+  const int y0 = r.tl.y - grid.rect.tl.y, y1 = r.br.y - grid.rect.tl.y;
+
+  for (int by = y0 / SolidSearchBlock; by <= (y1 - 1) / SolidSearchBlock; by++) {
+    const int top = std::max(y0 - by * SolidSearchBlock, 0);
+    const int bottom = std::min(y1 - by * SolidSearchBlock, SolidSearchBlock);
+    const int h = std::min(SolidSearchBlock,
+                           grid.rect.height() - by * SolidSearchBlock);
+
+    for (int bx = x0 / SolidSearchBlock; bx <= (x1 - 1) / SolidSearchBlock; bx++) {
+      const size_t i = by * grid.width + bx;
+      const int left = std::max(x0 - bx * SolidSearchBlock, 0);
+      const int right = std::min(x1 - bx * SolidSearchBlock, SolidSearchBlock);
+      const int w = std::min(SolidSearchBlock,
+                             grid.rect.width() - bx * SolidSearchBlock);
+      const unsigned bits = ((1u << right) - 1) & ~((1u << left) - 1);
+      const rdr::U16 *rows = masks + i * SolidSearchBlock;
+      Rect rest;
+
+      if (solid[i] == blockSolid) {
+        if (colours[i] != colourValue)
+          return false;
+        continue;
+      }
+
+      if ((left == 0) && (right == w) && (top == 0) && (bottom == h))
+        return false;
+
+      if (colours[i] == colourValue) {
+        for (int y = top; y < bottom; y++) {
+          if ((rows[y] & bits) != bits)
+            return false;
+        }
+        continue;
+      }
+
+      for (int y = top; y < bottom; y++) {
+        if (rows[y] & bits)
+          return false;
+      }
+
+      rest.setXYWH(grid.rect.tl.x + bx * SolidSearchBlock + left,
+                   grid.rect.tl.y + by * SolidSearchBlock + top,
+                   right - left, bottom - top);
+      if (!checkSolidPixels(rest, colourValue))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+template<class T>
+bool GridSearch<T>::checkSolidPixels(const Rect& r, T colourValue) const
+{
+  int w, h;
+  const T* buffer;
+  int pad;
+
+  w = r.width();
+  h = r.height();
+
+  buffer = &((const T*)grid.buffer)[(r.tl.y - grid.rect.tl.y) * grid.stride +
+                                    r.tl.x - grid.rect.tl.x];
+  pad = grid.stride - w;
+
+  while (h--) {
+    int w_ = w;
+    while (w_--) {
+      if (*buffer != colourValue)
+        return false;
+      buffer++;
+    }
+    buffer += pad;
+  }
+
+  return true;
+}
+
+template<class T>
+void GridSearch<T>::extendSolidAreaByBlock(const Rect& r, T colourValue,
+                                           Rect* er)
+{
+  int dx, dy, dw, dh;
+  int w_prev;
+  Rect sr;
+  int w_best = 0, h_best = 0;
+
+  w_prev = r.width();
+
+  // We search width first, back off when we hit a different colour,
+  // and restart with a larger height. We keep track of the
+  // width/height combination that gives us the largest area.
+  for (dy = r.tl.y; dy < r.br.y; dy += SolidSearchBlock) {
+
+    dh = SolidSearchBlock;
+    if (dy + dh > r.br.y)
+      dh = r.br.y - dy;
+
+    // We test one block here outside the x loop in order to break
+    // the y loop right away.
+    dw = SolidSearchBlock;
+    if (dw > w_prev)
+      dw = w_prev;
+
+    sr.setXYWH(r.tl.x, dy, dw, dh);
+    if (!checkSolidTile(sr, colourValue))
+      break;
+
+    for (dx = r.tl.x + dw; dx < r.tl.x + w_prev;) {
+
+      dw = SolidSearchBlock;
+      if (dx + dw > r.tl.x + w_prev)
+        dw = r.tl.x + w_prev - dx;
+
+      sr.setXYWH(dx, dy, dw, dh);
+      if (!checkSolidTile(sr, colourValue))
+        break;
+
+      dx += dw;
+    }
+
+    w_prev = dx - r.tl.x;
+    if (w_prev * (dy + dh - r.tl.y) > w_best * h_best) {
+      w_best = w_prev;
+      h_best = dy + dh - r.tl.y;
+    }
+  }
+
+  er->tl.x = r.tl.x;
+  er->tl.y = r.tl.y;
+  er->br.x = er->tl.x + w_best;
+  er->br.y = er->tl.y + h_best;
+}
+
+template<class T>
+void GridSearch<T>::extendSolidAreaByPixel(const Rect& r, const Rect& sr,
+                                           T colourValue, Rect* er)
+{
+  int cx, cy;
+  Rect tr;
+
+  // Try to extend the area upwards.
+  for (cy = sr.tl.y - 1; cy >= r.tl.y; cy--) {
+    tr.setXYWH(sr.tl.x, cy, sr.width(), 1);
+    if (!checkSolidTile(tr, colourValue))
+      break;
+  }
+  er->tl.y = cy + 1;
+
+  // ... downwards.
+  for (cy = sr.br.y; cy < r.br.y; cy++) {
+    tr.setXYWH(sr.tl.x, cy, sr.width(), 1);
+    if (!checkSolidTile(tr, colourValue))
+      break;
+  }
+  er->br.y = cy;
+
+  // ... to the left.
+  for (cx = sr.tl.x - 1; cx >= r.tl.x; cx--) {
+    tr.setXYWH(cx, er->tl.y, 1, er->height());
+    if (!checkSolidTile(tr, colourValue))
+      break;
+  }
+  er->tl.x = cx + 1;
+
+  // ... to the right.
+  for (cx = sr.br.x; cx < r.br.x; cx++) {
+    tr.setXYWH(cx, er->tl.y, 1, er->height());
+    if (!checkSolidTile(tr, colourValue))
+      break;
+  }
+  er->br.x = cx;
+}
+
+}
+
+void SolidSearch::find(const PixelBuffer *pb, const std::vector<Rect> &rects,
+                       std::vector<SolidRect> *found)
+{
+  size_t blocks;
+  bool serial;
+
+  // Mapping every pixel up front only pays off when the rectangles can
+  // be searched in parallel. On one thread the old search is faster.
+  serial = tbb::this_task_arena::max_concurrency() <= 1;
+
+  grids.resize(rects.size());
+  rows.clear();
+
+  blocks = 0;
+  for (size_t i = 0; i < rects.size(); i++) {
+    Grid &grid = grids[i];
+
+    grid.rect = rects[i];
+    grid.buffer = pb->getBuffer(grid.rect, &grid.stride);
+    grid.first = 0;
+    if (serial)
+      continue;
+
+    grid.width = (grid.rect.width() + SolidSearchBlock - 1) / SolidSearchBlock;
+    grid.height = (grid.rect.height() + SolidSearchBlock - 1) / SolidSearchBlock;
+    grid.first = blocks;
+
+    for (int by = 0; by < grid.height; by++)
+      rows.push_back(std::make_pair((unsigned)i, by));
+
+    blocks += (size_t)grid.width * grid.height;
+  }
+
+  if (serial) {
+    switch (pb->getPF().bpp) {
+    case 32:
+      searchSerial<rdr::U32>(found);
+      break;
+    case 16:
+      searchSerial<rdr::U16>(found);
+      break;
+    default:
+      searchSerial<rdr::U8>(found);
+      break;
+    }
+    return;
+  }
+
+  if (blocks == 0)
+    return;
+
+  solid.resize(blocks);
+  colours.resize(blocks);
+  masks.resize(blocks * SolidSearchBlock);
+
+  switch (pb->getPF().bpp) {
+  case 32:
+    findGrids<rdr::U32>(found);
+    break;
+  case 16:
+    findGrids<rdr::U16>(found);
+    break;
+  default:
+    findGrids<rdr::U8>(found);
+    break;
+  }
+}
+
+template<class T>
+void SolidSearch::searchSerial(std::vector<SolidRect> *found)
+{
+  for (size_t i = 0; i < grids.size(); i++) {
+    GridSearch<T> search(grids[i], NULL, NULL, NULL, found);
+
+    search.findSolidRect(grids[i].rect);
+  }
+}
+
+template<class T>
+void SolidSearch::findGrids(std::vector<SolidRect> *found)
+{
+  // Map out the blocks, a row of blocks at a time
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, rows.size()),
+                    [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t row = range.begin(); row != range.end(); row++) {
+      const Grid &grid = grids[rows[row].first];
+      const int by = rows[row].second;
+      const int y = by * SolidSearchBlock;
+      const int h = std::min(SolidSearchBlock, grid.rect.height() - y);
+
+      for (int bx = 0; bx < grid.width; bx++) {
+        const int x = bx * SolidSearchBlock;
+        const int w = std::min(SolidSearchBlock, grid.rect.width() - x);
+        const T *buffer = (const T*)grid.buffer + y * grid.stride + x;
+        const size_t i = grid.first + by * grid.width + bx;
+
+        if (blockColourMask((const rdr::U8*)buffer, grid.stride * sizeof(T),
+                            sizeof(T), w, h, &masks[i * SolidSearchBlock]))
+          solid[i] = blockSolid;
+        else
+          solid[i] = blockMasked;
+        colours[i] = *buffer;
+      }
+    }
+  });
+
+  // Then grow the areas, each rectangle on its own
+  results.resize(grids.size());
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, grids.size()),
+                    [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t i = range.begin(); i != range.end(); i++) {
+      GridSearch<T> search(grids[i], solid.data(), colours.data(),
+                           masks.data(), &results[i]);
+
+      results[i].clear();
+      search.findSolidRect(grids[i].rect);
+    }
+  });
+
+  for (size_t i = 0; i < grids.size(); i++)
+    found->insert(found->end(), results[i].begin(), results[i].end());
+}
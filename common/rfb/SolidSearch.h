@@ -0,0 +1,85 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_SOLIDSEARCH_H__
+#define __RFB_SOLIDSEARCH_H__
+
+#include <vector>
+
+#include <rdr/types.h>
+#include <rfb/Rect.h>
+
+namespace rfb {
+  class PixelBuffer;
+
+  // An area of a single colour, in the frame buffer's pixel format
+  struct SolidRect {
+    Rect rect;
+    rdr::U8 colour[4];
+  };
+
+  //
+  // Finds the areas of changed rectangles that are better sent as solid
+  // fills. All the 16x16 blocks of all the rectangles are mapped in
+  // parallel first, noting which pixels of each block match its first
+  // one. The areas are then grown using that map, only looking at pixels
+  // where the map can't tell, so the results are the same as growing
+  // them pixel by pixel. With only one thread there is nothing to gain
+  // from the map, and the rectangles are searched pixel by pixel.
+  //
+
+  class SolidSearch {
+  public:
+    // Appends the solid areas of rects, in the order a search of one
+    // rectangle after the other would find them. Runs in the caller's
+    // task arena.
+    void find(const PixelBuffer *pb, const std::vector<Rect> &rects,
+              std::vector<SolidRect> *found);
+
+  public:
+    // The size in pixels of either side of each block tested when
+    // looking for solid blocks.
+    static const int blockSize = 16;
+    // Don't bother with areas smaller than this
+    static const int minArea = 2048;
+
+    // Blocks of a rectangle, aligned with its top left corner
+    struct Grid {
+      Rect rect;
+      const rdr::U8 *buffer;
+      int stride;
+      int width, height;
+      size_t first;
+    };
+
+  protected:
+    template<class T> void searchSerial(std::vector<SolidRect> *found);
+    template<class T> void findGrids(std::vector<SolidRect> *found);
+
+  protected:
+    std::vector<Grid> grids;
+    std::vector<std::pair<unsigned, int> > rows;
+
+    std::vector<rdr::U8> solid;
+    std::vector<rdr::U32> colours;
+    std::vector<rdr::U16> masks;
+
+    std::vector< std::vector<SolidRect> > results;
+  };
+}
+
+#endif
@@ -27,6 +27,7 @@
 #include <rfb/SConnection.h>
 #include <rfb/TightEncoder.h>
 #include <rfb/TightConstants.h>
+#include <rfb/EncArena.h>
 
 using namespace rfb;
 
@@ -57,7 +58,8 @@ static const TightConf conf[10] = {
 };
 
 TightEncoder::TightEncoder(SConnection* conn) :
-  Encoder(conn, encodingTight, EncoderPlain, 256), zlibNeedsReset(false)
+  Encoder(conn, encodingTight, EncoderPlain, 256), zlibNeedsReset(false),
+  pendingResets(0)
 {
   setCompressLevel(-1);
 }
@@ -79,19 +81,89 @@ void TightEncoder::setCompressLevel(int level)
 
 void TightEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
 {
+  Output out;
+
+  if (palette.size() == 1) {
+    Encoder::writeSolidRect(pb, palette);
+    return;
+  }
+
+  out = directOutput();
+
   switch (palette.size()) {
   case 0:
-    writeFullColourRect(pb, palette);
-    break;
-  case 1:
-    Encoder::writeSolidRect(pb, palette);
+    writeFullColourRect(pb, palette, out);
     break;
   case 2:
-    writeMonoRect(pb, palette);
+    writeMonoRect(pb, palette, out);
     break;
   default:
-    writeIndexedRect(pb, palette);
+    writeIndexedRect(pb, palette, out);
+  }
+
+  pendingResets = out.resets;
+}
+
+// Each thread keeps a zlib stream for compressed rects, shared by all
+// connections. It is reset for every rect anyway.
+struct PooledZlibStream {
+  rdr::ZlibOutStream zlib;
+
+  PooledZlibStream() {
+    EncArena::contexts++;
   }
+};
+
+void TightEncoder::compressOnly(const PixelBuffer* pb, const Palette& palette,
+                                EncBytes &out) const
+{
+  static thread_local PooledZlibStream pooled;
+
+  EncOutStream os(&out);
+  Output priv;
+
+  assert(palette.size() >= 2);
+
+  priv.os = &os;
+  priv.zlib = &pooled.zlib;
+  priv.mem = NULL;
+  priv.direct = &os;
+  priv.resets = 0x0f;
+
+  if (palette.size() == 2)
+    writeMonoRect(pb, palette, priv);
+  else
+    writeIndexedRect(pb, palette, priv);
+
+  os.finish();
+}
+
+void TightEncoder::writeOnly(const EncBytes &out)
+{
+  rdr::OutStream* os;
+
+  os = conn->getOutStream(conn->cp.supportsUdp);
+  os->writeBytes(&out[0], out.size());
+
+  // The client has reset the stream this rect used, so ours is now out
+  // of step with it
+  pendingResets |= out[0] & 0x0f;
+}
+
+TightEncoder::Output TightEncoder::directOutput()
+{
+  Output out;
+
+  out.os = conn->getOutStream(conn->cp.supportsUdp);
+  out.zlib = zlibStreams;
+  out.mem = &memStream;
+  out.direct = NULL;
+  if (conn->cp.supportsUdp || zlibNeedsReset)
+    out.resets = 0x0f;
+  else
+    out.resets = pendingResets;
+
+  return out;
 }
 
 void TightEncoder::writeSolidRect(int width, int height,
@@ -106,7 +178,8 @@ void TightEncoder::writeSolidRect(int width, int height,
   writePixels(colour, pf, 1, os);
 }
 
-void TightEncoder::writeMonoRect(const PixelBuffer* pb, const Palette& palette)
+void TightEncoder::writeMonoRect(const PixelBuffer* pb, const Palette& palette,
+                                 Output& out) const
 {
   const rdr::U8* buffer;
   int stride;
@@ -116,19 +189,20 @@ void TightEncoder::writeMonoRect(const PixelBuffer* pb, const Palette& palette)
   switch (pb->getPF().bpp) {
   case 32:
     writeMonoRect(pb->width(), pb->height(), (rdr::U32*)buffer, stride,
-                  pb->getPF(), palette);
+                  pb->getPF(), palette, out);
     break;
   case 16:
     writeMonoRect(pb->width(), pb->height(), (rdr::U16*)buffer, stride,
-                  pb->getPF(), palette);
+                  pb->getPF(), palette, out);
     break;
   default:
     writeMonoRect(pb->width(), pb->height(), (rdr::U8*)buffer, stride,
-                  pb->getPF(), palette);
+                  pb->getPF(), palette, out);
   }
 }
 
-void TightEncoder::writeIndexedRect(const PixelBuffer* pb, const Palette& palette)
+void TightEncoder::writeIndexedRect(const PixelBuffer* pb, const Palette& palette,
+                                    Output& out) const
 {
   const rdr::U8* buffer;
   int stride;
@@ -138,19 +212,20 @@ void TightEncoder::writeIndexedRect(const PixelBuffer* pb, const Palette& palett
   switch (pb->getPF().bpp) {
   case 32:
     writeIndexedRect(pb->width(), pb->height(), (rdr::U32*)buffer, stride,
-                     pb->getPF(), palette);
+                     pb->getPF(), palette, out);
     break;
   case 16:
     writeIndexedRect(pb->width(), pb->height(), (rdr::U16*)buffer, stride,
-                     pb->getPF(), palette);
+                     pb->getPF(), palette, out);
     break;
   default:
     // It's more efficient to just do raw pixels
-    writeFullColourRect(pb, palette);
+    writeFullColourRect(pb, palette, out);
   }
 }
 
-void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& palette)
+void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& palette,
+                                       Output& out) const
 {
   const int streamId = 0;
 
@@ -161,8 +236,8 @@ void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& pal
   const rdr::U8* buffer;
   int stride, h;
 
-  os = conn->getOutStream(conn->cp.supportsUdp);
-  if (conn->cp.supportsUdp || zlibNeedsReset)
+  os = out.os;
+  if (out.resets & (1 << streamId))
     os->writeU8((streamId << 4) | (1 << streamId));
   else
     os->writeU8(streamId << 4);
@@ -173,7 +248,7 @@ void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& pal
   else
     length = pb->getRect().area() * 3;
 
-  zos = getZlibOutStream(streamId, rawZlibLevel, length);
+  zos = getZlibOutStream(out, streamId, rawZlibLevel, length);
 
   // And then just dump all the raw pixels
   buffer = pb->getBuffer(pb->getRect(), &stride);
@@ -185,11 +260,11 @@ void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& pal
   }
 
   // Finish the zlib stream
-  flushZlibOutStream(zos);
+  flushZlibOutStream(out, zos);
 }
 
 void TightEncoder::writePixels(const rdr::U8* buffer, const PixelFormat& pf,
-                               unsigned int count, rdr::OutStream* os)
+                               unsigned int count, rdr::OutStream* os) const
 {
   rdr::U8 rgb[2048];
 
@@ -213,7 +288,7 @@ void TightEncoder::writePixels(const rdr::U8* buffer, const PixelFormat& pf,
   }
 }
 
-void TightEncoder::writeCompact(rdr::OutStream* os, rdr::U32 value)
+void TightEncoder::writeCompact(rdr::OutStream* os, rdr::U32 value) const
 {
   rdr::U8 b;
   b = value & 0x7F;
@@ -231,25 +306,44 @@ void TightEncoder::writeCompact(rdr::OutStream* os, rdr::U32 value)
   }
 }
 
-rdr::OutStream* TightEncoder::getZlibOutStream(int streamId, int level, size_t length)
+rdr::OutStream* TightEncoder::getZlibOutStream(Output& out, int streamId,
+                                               int level, size_t length) const
 {
+  rdr::ZlibOutStream* zlib;
+
   // Minimum amount of data to be compressed. This value should not be
   // changed, doing so will break compatibility with existing clients.
   if (length < 12)
-    return conn->getOutStream(conn->cp.supportsUdp);
+    return out.os;
 
   assert(streamId >= 0);
   assert(streamId < 4);
 
-  zlibStreams[streamId].setUnderlying(&memStream);
-  zlibStreams[streamId].setCompressionLevel(level);
-  if (conn->cp.supportsUdp || zlibNeedsReset)
-    zlibStreams[streamId].resetDeflate();
+  if (out.direct) {
+    zlib = out.zlib;
+
+    // Skip the length for now
+    out.lengthPos = out.direct->length();
+    out.direct->check(3);
+    out.direct->setptr(out.direct->getptr() + 3);
+
+    zlib->setUnderlying(out.direct);
+  } else {
+    zlib = &out.zlib[streamId];
+
+    zlib->setUnderlying(out.mem);
+  }
 
-  return &zlibStreams[streamId];
+  zlib->setCompressionLevel(level);
+  if (out.resets & (1 << streamId)) {
+    zlib->resetDeflate();
+    out.resets &= ~(1 << streamId);
+  }
+
+  return zlib;
 }
 
-void TightEncoder::flushZlibOutStream(rdr::OutStream* os_)
+void TightEncoder::flushZlibOutStream(Output& out, rdr::OutStream* os_) const
 {
   rdr::OutStream* os;
   rdr::ZlibOutStream* zos;
@@ -261,11 +355,25 @@ void TightEncoder::flushZlibOutStream(rdr::OutStream* os_)
   zos->flush();
   zos->setUnderlying(NULL);
 
-  os = conn->getOutStream(conn->cp.supportsUdp);
+  if (out.direct) {
+    size_t length;
+    rdr::U8* p;
+
+    // Always in the three byte form, which clients read the same as
+    // the shorter ones
+    length = out.direct->length() - out.lengthPos - 3;
+    p = out.direct->at(out.lengthPos);
+    p[0] = (length & 0x7F) | 0x80;
+    p[1] = ((length >> 7) & 0x7F) | 0x80;
+    p[2] = (length >> 14) & 0xFF;
+    return;
+  }
+
+  os = out.os;
 
-  writeCompact(os, memStream.length());
-  os->writeBytes(memStream.data(), memStream.length());
-  memStream.clear();
+  writeCompact(os, out.mem->length());
+  os->writeBytes(out.mem->data(), out.mem->length());
+  out.mem->clear();
 }
 
 void TightEncoder::resetZlib()
@@ -22,6 +22,7 @@
 
 #include <rdr/MemOutStream.h>
 #include <rdr/ZlibOutStream.h>
+#include <rfb/EncArena.h>
 #include <rfb/Encoder.h>
 
 namespace rfb {
@@ -46,43 +47,76 @@ namespace rfb {
                             const rdr::U8 a);
     void resetZlib();
 
+    // Encodes a mono or indexed rect, header and all, with a zlib stream
+    // of its own that the client is told to reset to. Can be called from
+    // several threads at once.
+    void compressOnly(const PixelBuffer* pb, const Palette& palette,
+                      EncBytes &out) const;
+    void writeOnly(const EncBytes &out);
+
   protected:
-    void writeMonoRect(const PixelBuffer* pb, const Palette& palette);
-    void writeIndexedRect(const PixelBuffer* pb, const Palette& palette);
-    void writeFullColourRect(const PixelBuffer* pb, const Palette& palette);
+    // Where a rect is written. Rects written directly share the four
+    // zlib streams, which compress into mem first as the length goes
+    // before the data. Compressed rects have one stream to themselves,
+    // which compresses straight into direct after room for the length.
+    struct Output {
+      rdr::OutStream* os;
+      rdr::ZlibOutStream* zlib;
+      rdr::MemOutStream* mem;
+      EncOutStream* direct;
+      size_t lengthPos;
+      rdr::U8 resets;
+    };
+
+    Output directOutput();
+
+    void writeMonoRect(const PixelBuffer* pb, const Palette& palette,
+                       Output& out) const;
+    void writeIndexedRect(const PixelBuffer* pb, const Palette& palette,
+                          Output& out) const;
+    void writeFullColourRect(const PixelBuffer* pb, const Palette& palette,
+                             Output& out) const;
 
     void writePixels(const rdr::U8* buffer, const PixelFormat& pf,
-                     unsigned int count, rdr::OutStream* os);
+                     unsigned int count, rdr::OutStream* os) const;
 
-    void writeCompact(rdr::OutStream* os, rdr::U32 value);
+    void writeCompact(rdr::OutStream* os, rdr::U32 value) const;
 
-    rdr::OutStream* getZlibOutStream(int streamId, int level, size_t length);
-    void flushZlibOutStream(rdr::OutStream* os);
+    rdr::OutStream* getZlibOutStream(Output& out, int streamId, int level,
+                                     size_t length) const;
+    void flushZlibOutStream(Output& out, rdr::OutStream* os) const;
 
   protected:
     // Preprocessor generated, optimised methods
     void writeMonoRect(int width, int height,
                        const rdr::U8* buffer, int stride,
-                       const PixelFormat& pf, const Palette& palette);
+                       const PixelFormat& pf, const Palette& palette,
+                       Output& out) const;
     void writeMonoRect(int width, int height,
                        const rdr::U16* buffer, int stride,
-                       const PixelFormat& pf, const Palette& palette);
+                       const PixelFormat& pf, const Palette& palette,
+                       Output& out) const;
     void writeMonoRect(int width, int height,
                        const rdr::U32* buffer, int stride,
-                       const PixelFormat& pf, const Palette& palette);
+                       const PixelFormat& pf, const Palette& palette,
+                       Output& out) const;
 
     void writeIndexedRect(int width, int height,
                           const rdr::U16* buffer, int stride,
-                          const PixelFormat& pf, const Palette& palette);
+                          const PixelFormat& pf, const Palette& palette,
+                          Output& out) const;
     void writeIndexedRect(int width, int height,
                           const rdr::U32* buffer, int stride,
-                          const PixelFormat& pf, const Palette& palette);
+                          const PixelFormat& pf, const Palette& palette,
+                          Output& out) const;
 
     rdr::ZlibOutStream zlibStreams[4];
     rdr::MemOutStream memStream;
 
     int idxZlibLevel, monoZlibLevel, rawZlibLevel;
     bool zlibNeedsReset;
+    // Streams the client has reset since we last used ours
+    rdr::U8 pendingResets;
   };
 
 }
@@ -26,7 +26,8 @@
 void TightEncoder::writeMonoRect(int width, int height,
                                  const rdr::UBPP* buffer, int stride,
                                  const PixelFormat& pf,
-                                 const Palette& palette)
+                                 const Palette& palette,
+                                 Output& out) const
 {
   rdr::OutStream* os;
 
@@ -38,9 +39,9 @@ void TightEncoder::writeMonoRect(int width, int height,
 
   assert(palette.size() == 2);
 
-  os = conn->getOutStream(conn->cp.supportsUdp);
+  os = out.os;
 
-  if (conn->cp.supportsUdp || zlibNeedsReset)
+  if (out.resets & (1 << streamId))
     os->writeU8(((streamId | tightExplicitFilter) << 4) | (1 << streamId));
   else
     os->writeU8((streamId | tightExplicitFilter) << 4);
@@ -55,7 +56,7 @@ void TightEncoder::writeMonoRect(int width, int height,
 
   // Set up compression
   length = (width + 7)/8 * height;
-  zos = getZlibOutStream(streamId, monoZlibLevel, length);
+  zos = getZlibOutStream(out, streamId, monoZlibLevel, length);
 
   // Encode the data
   rdr::UBPP bg;
@@ -105,14 +106,15 @@ void TightEncoder::writeMonoRect(int width, int height,
   }
 
   // Finish the zlib stream
-  flushZlibOutStream(zos);
+  flushZlibOutStream(out, zos);
 }
 
 #if (BPP != 8)
 void TightEncoder::writeIndexedRect(int width, int height,
                                     const rdr::UBPP* buffer, int stride,
                                     const PixelFormat& pf,
-                                    const Palette& palette)
+                                    const Palette& palette,
+                                    Output& out) const
 {
   rdr::OutStream* os;
 
@@ -128,9 +130,9 @@ void TightEncoder::writeIndexedRect(int width, int height,
   assert(palette.size() > 0);
   assert(palette.size() <= 256);
 
-  os = conn->getOutStream(conn->cp.supportsUdp);
+  os = out.os;
 
-  if (conn->cp.supportsUdp || zlibNeedsReset)
+  if (out.resets & (1 << streamId))
     os->writeU8(((streamId | tightExplicitFilter) << 4) | (1 << streamId));
   else
     os->writeU8((streamId | tightExplicitFilter) << 4);
@@ -144,7 +146,7 @@ void TightEncoder::writeIndexedRect(int width, int height,
   writePixels((rdr::U8*)pal, pf, palette.size(), os);
 
   // Set up compression
-  zos = getZlibOutStream(streamId, idxZlibLevel, width * height);
+  zos = getZlibOutStream(out, streamId, idxZlibLevel, width * height);
 
   // Encode the data
   pad = stride - width;
@@ -166,6 +168,6 @@ void TightEncoder::writeIndexedRect(int width, int height,
   }
 
   // Finish the zlib stream
-  flushZlibOutStream(zos);
+  flushZlibOutStream(out, zos);
 }
 #endif  // #if (BPP != 8)
@@ -24,6 +24,7 @@
 #include <rfb/PixelBuffer.h>
 #include <rfb/TightJPEGEncoder.h>
 #include <rfb/TightConstants.h>
+#include <rfb/EncArena.h>
 
 #include <ctime>
 #include <fstream>
@@ -109,12 +110,25 @@ bool TightJPEGEncoder::treatLossless()
   return qualityLevel >= rfb::Server::treatLossless;
 }
 
+// Setting up libjpeg costs about as much as compressing a small rect,
+// so each thread keeps one. They are shared by all connections.
+struct PooledJpegCompressor {
+  JpegCompressor jc;
+
+  PooledJpegCompressor() : jc(1024) {
+    EncArena::contexts++;
+  }
+};
+
 void TightJPEGEncoder::compressOnly(const PixelBuffer* pb, const uint8_t qualityIn,
-                                    std::vector<uint8_t> &out, const bool lowVideoQuality) const
+                                    EncBytes &out, const bool lowVideoQuality) const
 {
+  static thread_local PooledJpegCompressor pooled;
+
   const rdr::U8* buffer;
   int stride;
-  JpegCompressor jc;
+  JpegCompressor &jc = pooled.jc;
+  EncOutStream os(&out);
 
   int quality, subsampling;
 
@@ -137,15 +151,13 @@ void TightJPEGEncoder::compressOnly(const PixelBuffer* pb, const uint8_t quality
     subsampling = subsampleUndefined;
   }
 
-  jc.clear();
   jc.compress(buffer, stride, pb->getRect(),
-              pb->getPF(), quality, subsampling);
+              pb->getPF(), quality, subsampling, &os);
 
-  out.resize(jc.length());
-  memcpy(&out[0], jc.data(), jc.length());
+  os.finish();
 }
 
-void TightJPEGEncoder::writeOnly(const std::vector<uint8_t> &out) const
+void TightJPEGEncoder::writeOnly(const EncBytes &out) const
 {
   rdr::OutStream* os;
 
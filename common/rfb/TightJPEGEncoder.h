@@ -20,6 +20,7 @@
 #ifndef __RFB_TIGHTJPEGENCODER_H__
 #define __RFB_TIGHTJPEGENCODER_H__
 
+#include <rfb/EncArena.h>
 #include <rfb/Encoder.h>
 #include <rfb/JpegCompressor.h>
 #include <stdint.h>
@@ -41,8 +42,8 @@ namespace rfb {
 
     void writeRect(const PixelBuffer* pb, const Palette& palette) override;
     virtual void compressOnly(const PixelBuffer* pb, const uint8_t quality,
-                              std::vector<uint8_t> &out, const bool lowVideoQuality) const;
-    virtual void writeOnly(const std::vector<uint8_t> &out) const;
+                              EncBytes &out, const bool lowVideoQuality) const;
+    virtual void writeOnly(const EncBytes &out) const;
     void writeSolidRect(int width, int height,
                                 const PixelFormat& pf,
                                 const rdr::U8* colour) override;
@@ -37,12 +37,17 @@ static LogWriter vlog("QOI");
 static const PixelFormat pfRGBX(32, 24, false, true, 255, 255, 255, 0, 8, 16);
 static const PixelFormat pfBGRX(32, 24, false, true, 255, 255, 255, 16, 8, 0);
 
-// An optimized version that assumes 4-alignment and RGBX/BGRX
-static void *qoi_encode_kasm(const void *data, const qoi_desc *desc, int *out_len,
-                             const unsigned isrgb, const unsigned stride) {
-	int i, max_size, p, run;
+static int qoi_max_size(const qoi_desc *desc) {
+	return desc->width * desc->height * (3 + 1) +
+		QOI_HEADER_SIZE + sizeof(qoi_padding);
+}
+
+// An optimized version that assumes 4-alignment and RGBX/BGRX. Encodes
+// into bytes, which must have room for qoi_max_size().
+static bool qoi_encode_kasm(const void *data, const qoi_desc *desc, unsigned char *bytes,
+                            int *out_len, const unsigned isrgb, const unsigned stride) {
+	int i, p, run;
 	unsigned px_len, px_end, px_pos, y, x;
-	unsigned char *bytes;
 	const uint32_t *pixels;
 	qoi_rgba_t index[64];
 	qoi_rgba_t px, px_prev;
@@ -54,18 +59,10 @@ static void *qoi_encode_kasm(const void *data, const qoi_desc *desc, int *out_le
 		desc->colorspace > 1 ||
 		desc->height >= QOI_PIXELS_MAX / desc->width
 	) {
-		return NULL;
+		return false;
 	}
 
-	max_size =
-		desc->width * desc->height * (3 + 1) +
-		QOI_HEADER_SIZE + sizeof(qoi_padding);
-
 	p = 0;
-	bytes = (unsigned char *) QOI_MALLOC(max_size);
-	if (!bytes) {
-		return NULL;
-	}
 
 	qoi_write_32(bytes, &p, QOI_MAGIC);
 	qoi_write_32(bytes, &p, desc->width);
@@ -148,7 +145,7 @@ static void *qoi_encode_kasm(const void *data, const qoi_desc *desc, int *out_le
 	}
 
 	*out_len = p;
-	return bytes;
+	return true;
 }
 
 TightQOIEncoder::TightQOIEncoder(SConnection* conn) :
@@ -169,12 +166,11 @@ bool TightQOIEncoder::isSupported() const
 }
 
 void TightQOIEncoder::compressOnly(const PixelBuffer* pb, const uint8_t qualityIn,
-                                    std::vector<uint8_t> &out, const bool lowVideoQuality) const
+                                    EncBytes &out, const bool lowVideoQuality) const
 {
   const rdr::U8* buffer;
   int stride, len;
   qoi_desc desc;
-  void *encoded;
 
   buffer = pb->getBuffer(pb->getRect(), &stride);
 
@@ -183,20 +179,18 @@ void TightQOIEncoder::compressOnly(const PixelBuffer* pb, const uint8_t qualityI
   desc.colorspace = QOI_LINEAR;
   desc.channels = 4;
 
-  encoded = qoi_encode_kasm(buffer, &desc, &len, pfRGBX.equal(pb->getPF()), stride);
+  out.resize(qoi_max_size(&desc));
 
-  if (!encoded) {
+  if (!qoi_encode_kasm(buffer, &desc, out.data(), &len, pfRGBX.equal(pb->getPF()), stride)) {
     // Error
     vlog.error("QOI error");
+    len = 0;
   }
 
   out.resize(len);
-  memcpy(&out[0], encoded, len);
-
-  free(encoded);
 }
 
-void TightQOIEncoder::writeOnly(const std::vector<uint8_t> &out) const
+void TightQOIEncoder::writeOnly(const EncBytes &out) const
 {
   rdr::OutStream* os;
 
@@ -214,7 +208,7 @@ void TightQOIEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
   const rdr::U8* buffer;
   int stride, len;
   qoi_desc desc;
-  void *encoded;
+  EncBytes encoded;
 
   buffer = pb->getBuffer(pb->getRect(), &stride);
 
@@ -223,11 +217,12 @@ void TightQOIEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
   desc.colorspace = QOI_LINEAR;
   desc.channels = 4;
 
-  encoded = qoi_encode_kasm(buffer, &desc, &len, pfRGBX.equal(pb->getPF()), stride);
+  encoded.resize(qoi_max_size(&desc));
 
-  if (!encoded) {
+  if (!qoi_encode_kasm(buffer, &desc, encoded.data(), &len, pfRGBX.equal(pb->getPF()), stride)) {
     // Error
     vlog.error("QOI error");
+    len = 0;
   }
 
   os = conn->getOutStream();
@@ -235,9 +230,7 @@ void TightQOIEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
   os->writeU8(tightQoi << 4);
 
   writeCompact(len, os);
-  os->writeBytes(encoded, len);
-
-  free(encoded);
+  os->writeBytes(encoded.data(), len);
 }
 
 void TightQOIEncoder::writeSolidRect(int width, int height,
@@ -18,6 +18,7 @@
 #ifndef __RFB_TIGHTQOIENCODER_H__
 #define __RFB_TIGHTQOIENCODER_H__
 
+#include <rfb/EncArena.h>
 #include <rfb/Encoder.h>
 #include <stdint.h>
 #include <vector>
@@ -33,8 +34,8 @@ namespace rfb {
 
     void writeRect(const PixelBuffer* pb, const Palette& palette) override;
     virtual void compressOnly(const PixelBuffer* pb, const uint8_t quality,
-                              std::vector<uint8_t> &out, const bool lowVideoQuality) const;
-    virtual void writeOnly(const std::vector<uint8_t> &out) const;
+                              EncBytes &out, const bool lowVideoQuality) const;
+    virtual void writeOnly(const EncBytes &out) const;
     void writeSolidRect(int width, int height,
                                 const PixelFormat& pf,
                                 const rdr::U8* colour) override;
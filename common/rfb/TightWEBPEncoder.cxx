@@ -117,15 +117,37 @@ bool TightWEBPEncoder::treatLossless()
   return qualityLevel >= rfb::Server::treatLossless;
 }
 
+// libwebp hands its output over in pieces, added straight to the rect's
+// buffer
+static int writeToBytes(const uint8_t* data, size_t size,
+                        const WebPPicture* pic)
+{
+  EncBytes *out = (EncBytes *) pic->custom_ptr;
+
+  out->insert(out->end(), data, data + size);
+
+  return 1;
+}
+
+// Room for rects not already in RGBX or BGRX, kept by each thread
+struct PooledWebpBuffer {
+  std::vector<rdr::U8> rgb;
+
+  PooledWebpBuffer() {
+    EncArena::contexts++;
+  }
+};
+
 void TightWEBPEncoder::compressOnly(const PixelBuffer* pb, const uint8_t qualityIn,
-                                    std::vector<uint8_t> &out, const bool lowVideoQuality) const
+                                    EncBytes &out, const bool lowVideoQuality) const
 {
+  static thread_local PooledWebpBuffer pooled;
+
   const rdr::U8* buffer;
   int stride;
   uint8_t quality, method;
   WebPConfig cfg;
   WebPPicture pic;
-  WebPMemoryWriter wrt;
 
   buffer = pb->getBuffer(pb->getRect(), &stride);
 
@@ -160,31 +182,27 @@ void TightWEBPEncoder::compressOnly(const PixelBuffer* pb, const uint8_t quality
   } else if (pfBGRX.equal(pb->getPF())) {
     WebPPictureImportBGRX(&pic, buffer, stride * 4);
   } else {
-    rdr::U8* tmpbuf = new rdr::U8[pic.width * pic.height * 3];
-    pb->getPF().rgbFromBuffer(tmpbuf, (const rdr::U8 *) buffer, pic.width, stride, pic.height);
+    if (pooled.rgb.size() < (size_t) (pic.width * pic.height * 3))
+      pooled.rgb.resize(pic.width * pic.height * 3);
+    pb->getPF().rgbFromBuffer(pooled.rgb.data(), (const rdr::U8 *) buffer, pic.width, stride, pic.height);
     stride = pic.width * 3;
 
-    WebPPictureImportRGB(&pic, tmpbuf, stride);
-    delete [] tmpbuf;
+    WebPPictureImportRGB(&pic, pooled.rgb.data(), stride);
   }
 
-  WebPMemoryWriterInit(&wrt);
-  pic.writer = WebPMemoryWrite;
-  pic.custom_ptr = &wrt;
+  out.clear();
+  pic.writer = writeToBytes;
+  pic.custom_ptr = &out;
 
   if (!WebPEncode(&cfg, &pic)) {
     // Error
     vlog.error("WEBP error %u", pic.error_code);
   }
 
-  out.resize(wrt.size);
-  memcpy(&out[0], wrt.mem, wrt.size);
-
   WebPPictureFree(&pic);
-  WebPMemoryWriterClear(&wrt);
 }
 
-void TightWEBPEncoder::writeOnly(const std::vector<uint8_t> &out) const
+void TightWEBPEncoder::writeOnly(const EncBytes &out) const
 {
   rdr::OutStream* os;
 
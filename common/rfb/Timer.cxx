@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <sys/time.h>
 
+#include <os/Mutex.h>
 #include <rfb/Timer.h>
 #include <rfb/util.h>
 #include <rfb/LogWriter.h>
@@ -53,19 +54,35 @@ inline static int diffTimeMillis(timeval later, timeval earlier) {
 
 std::list<Timer*> Timer::pending;
 
+// Timers are normally only touched from the main loop, but client
+// updates may be encoded on worker threads (see ClientThreads), and
+// those start and stop their congestion and refresh timers. Never
+// destroyed, as Timers may still be stopped during static destruction.
+static os::Mutex* pendingMutex()
+{
+  static os::Mutex* mutex = new os::Mutex();
+  return mutex;
+}
+
 int Timer::checkTimeouts() {
   timeval start;
 
-  if (pending.empty())
-    return 0;
-
   gettimeofday(&start, 0);
-  while (pending.front()->isBefore(start)) {
+  while (true) {
     Timer* timer;
     timeval before;
 
-    timer = pending.front();
-    pending.pop_front();
+    {
+      os::AutoMutex a(pendingMutex());
+
+      if (pending.empty())
+        return 0;
+      if (!pending.front()->isBefore(start))
+        break;
+
+      timer = pending.front();
+      pending.pop_front();
+    }
 
     gettimeofday(&before, 0);
     if (timer->cb->handleTimeout(timer)) {
@@ -83,9 +100,8 @@ int Timer::checkTimeouts() {
           timer->dueTime = now;
       }
 
+      os::AutoMutex a(pendingMutex());
       insertTimer(timer);
-    } else if (pending.empty()) {
-      return 0;
     }
   }
   return getNextTimeout();
@@ -94,6 +110,10 @@ int Timer::checkTimeouts() {
 int Timer::getNextTimeout() {
   timeval now;
   gettimeofday(&now, 0);
+
+  os::AutoMutex a(pendingMutex());
+  if (pending.empty())
+    return 0;
   int toWait = __rfbmax(1, pending.front()->getRemainingMs());
   if (toWait > pending.front()->timeoutMs) {
     if (toWait - pending.front()->timeoutMs < 1000) {
@@ -108,6 +128,7 @@ int Timer::getNextTimeout() {
   return toWait;
 }
 
+// Must be called with pendingMutex held
 void Timer::insertTimer(Timer* t) {
   std::list<Timer*>::iterator i;
   for (i=pending.begin(); i!=pending.end(); i++) {
@@ -128,14 +149,18 @@ void Timer::start(int timeoutMs_) {
   if (timeoutMs <= 0)
     timeoutMs = 1;
   dueTime = addMillis(now, timeoutMs);
+
+  os::AutoMutex a(pendingMutex());
   insertTimer(this);
 }
 
 void Timer::stop() {
+  os::AutoMutex a(pendingMutex());
   pending.remove(this);
 }
 
 bool Timer::isStarted() {
+  os::AutoMutex a(pendingMutex());
   std::list<Timer*>::iterator i;
   for (i=pending.begin(); i!=pending.end(); i++) {
     if (*i == this)
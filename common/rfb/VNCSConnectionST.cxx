@@ -52,6 +52,10 @@ static LogWriter vlog("VNCSConnST");
 
 static Cursor emptyCursor(0, 0, Point(0, 0), nullptr);
 
+// With PipelineUpdates, how much the socket buffer may grow to hold
+// queued updates before writes have to wait for the network again
+static const size_t MaxUpdateQueue = 32 * 1024 * 1024;
+
 namespace {
 const rdr::U32 CLIENT_KEEPALIVE_KEYSYM = 1;
 }
@@ -69,10 +73,11 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s, con
     losslessTimer(this), kbdLogTimer(this), binclipTimer(this),
     server(server_), updates(false),
     updateRenderedCursor(false), removeRenderedCursor(false),
-    continuousUpdates(false), encodeManager(this, &VNCServerST::encCache, FFmpeg::get(), encoder_probe),
+    continuousUpdates(false), encodeManager(this, &VNCServerST::encCache, FFmpeg::get(), encoder_probe,
+                                            Server::shareVideoEncoders ? &VNCServerST::videoEncoders : nullptr),
     needsPermCheck(false), pointerEventTime(0),
     clientHasCursor(false),
-    accessRights(AccessDefault), startTime(time(nullptr)), frameTracking(false),
+    accessRights(AccessDefault), deferClose(false), startTime(time(nullptr)), frameTracking(false),
     udpFramesSinceFull(0), complainedAboutNoViewRights(false),
     clientUsername("username_unavailable")
 {
@@ -113,6 +118,8 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s, con
 
   // Configure the socket
   setSocketTimeouts();
+  if (rfb::Server::pipelineUpdates)
+    sock->outStream().setMaxBufferSize(MaxUpdateQueue);
   lastEventTime = time(nullptr);
   gettimeofday(&lastRealUpdate, nullptr);
   gettimeofday(&lastClipboardOp, nullptr);
@@ -177,6 +184,13 @@ bool VNCSConnectionST::init()
 
 void VNCSConnectionST::close(const char* reason)
 {
+  // Closing touches the other clients, so leave it to the main thread
+  if (deferClose) {
+    if (!deferredCloseReason.buf)
+      deferredCloseReason.buf = strDup(reason);
+    return;
+  }
+
   // Log the reason for the close
   if (!closeReason.buf)
     closeReason.buf = strDup(reason);
@@ -271,7 +285,7 @@ void VNCSConnectionST::flushSocket()
     sock->outStream().flush();
     // Flushing the socket might release an update that was previously
     // delayed because of congestion.
-    if (sock->outStream().bufferUsage() == 0)
+    if (sock->outStream().bufferUsage() <= updateQueueLimit())
       writeFramebufferUpdate();
   } catch (rdr::Exception &e) {
     close(e.str());
@@ -337,6 +351,22 @@ void VNCSConnectionST::writeFramebufferUpdateOrClose()
   }
 }
 
+void VNCSConnectionST::writeFramebufferUpdateOrDefer()
+{
+  deferClose = true;
+  writeFramebufferUpdateOrClose();
+  deferClose = false;
+}
+
+void VNCSConnectionST::closeIfDeferred()
+{
+  if (!deferredCloseReason.buf)
+    return;
+
+  CharArray reason(deferredCloseReason.takeBuf());
+  close(reason.buf);
+}
+
 void VNCSConnectionST::screenLayoutChangeOrClose(rdr::U16 reason)
 {
   try {
@@ -1281,7 +1311,7 @@ void VNCSConnectionST::writeRTTPing()
   if (!cp.supportsFence)
     return;
 
-  congestion.updatePosition(sock->outStream().length());
+  congestion.updatePosition(sentPosition());
 
     if (!congestion.sentPing())
         return;
@@ -1300,16 +1330,26 @@ bool VNCSConnectionST::isCongested()
 
   congestionTimer.stop();
 
-  // Stuff still waiting in the send buffer?
+  // Stuff still waiting in the send buffer? When pipelining, some of
+  // it is fine, it will go out while we encode the next update.
   sock->outStream().flush();
+  // The kernel knows nothing about what goes over UDP
+  congestion.sampleSocket(Server::kernelCongestionControl && !cp.supportsUdp ?
+                          sock->getFd() : -1);
   congestion.debugTrace("congestion-trace.csv", sock->getFd());
-  if (sock->outStream().bufferUsage() > 0)
+  if (sock->outStream().bufferUsage() > updateQueueLimit())
     return true;
 
-  if (!cp.supportsFence || cp.supportsUdp)
+  // UDP updates are paced, so only hold back while the pacer is behind
+  if (cp.supportsUdp) {
+    const network::UdpStream *udp = (network::UdpStream *) getOutStream(true);
+    return udp->queuedBytes() > updateQueueLimit();
+  }
+
+  if (!cp.supportsFence && !congestion.usingKernelStats())
     return false;
 
-  congestion.updatePosition(sock->outStream().length());
+  congestion.updatePosition(sentPosition());
   if (!congestion.isCongested())
     return false;
 
@@ -1328,10 +1368,26 @@ bool VNCSConnectionST::isCongested()
   return true;
 }
 
+size_t VNCSConnectionST::updateQueueLimit() const
+{
+  if (!rfb::Server::pipelineUpdates)
+    return 0;
+
+  return congestion.getQueueLimit(1000 / rfb::Server::frameRate);
+}
+
+// Everything sent so far, over both TCP and UDP, so that the bandwidth
+// estimate also covers the updates going over UDP
+size_t VNCSConnectionST::sentPosition()
+{
+  const network::UdpStream *udp = (network::UdpStream *) getOutStream(true);
+
+  return sock->outStream().length() + udp->sentBytes();
+}
 
 void VNCSConnectionST::writeFramebufferUpdate()
 {
-  congestion.updatePosition(sock->outStream().length());
+  congestion.updatePosition(sentPosition());
   encodeManager.clearEncodingTime();
 
   // We're in the middle of processing a command that's supposed to be
@@ -1412,7 +1468,7 @@ void VNCSConnectionST::writeFramebufferUpdate()
 
   sock->cork(false);
 
-  congestion.updatePosition(sock->outStream().length());
+  congestion.updatePosition(sentPosition());
 
   struct timeval now;
   gettimeofday(&now, nullptr);
@@ -1574,6 +1630,12 @@ void VNCSConnectionST::writeDataUpdate()
   maxUpdateSize = congestion.getBandwidth() *
                   server->msToNextUpdate() / 1000;
 
+  // A little above the estimate, so the pacer probes for more. The stream
+  // only takes it as a floor, the estimate drops after every pause.
+  if (cp.supportsUdp)
+    ((network::UdpStream *) getOutStream(true))->setRate(Server::udpPacing ?
+                                                         congestion.getBandwidth() * 5 / 4 : 0);
+
   if (!ui.is_empty()) {
     encodeManager.writeUpdate(ui, server->screenLayout, server->getPixelBuffer(), cursor, pendingClientRefresh, maxUpdateSize);
     if (pendingClientRefresh)
@@ -1709,7 +1771,13 @@ void VNCSConnectionST::sendStats(const bool toClient) {
 void VNCSConnectionST::sendNetworkStats() {
   fmt::memory_buffer buf;
 
-  fmt::format_to(std::back_inserter(buf), "[{}, {}, {}]", congestion.getJitter(), congestion.getPingTime(), congestion.getBandwidth());
+  fmt::format_to(std::back_inserter(buf), "[{}, {}, {}", congestion.getJitter(), congestion.getPingTime(), congestion.getBandwidth());
+  if (cp.supportsUdp) {
+    unsigned avg, max;
+    ((network::UdpStream *) getOutStream(true))->getQueueDelay(avg, max);
+    fmt::format_to(std::back_inserter(buf), ", {}, {}", avg, max);
+  }
+  fmt::format_to(std::back_inserter(buf), "]");
   std::string value(buf.data(), buf.size());
   vlog.info("Sending diagnostic network stats:\n%s\n", value.c_str());
   writer()->writeStats(msgTypeNetworkStats, value.c_str(), value.size());
@@ -1901,6 +1969,14 @@ void VNCSConnectionST::udpDowngrade(const bool byServer)
             byServer ? "the server" : "its own request");
 }
 
+void VNCSConnectionST::udpLoss(const unsigned lost, const unsigned total)
+{
+  if (!cp.supportsUdp)
+    return;
+
+  ((network::UdpStream *) getOutStream(true))->reportLoss(lost, total);
+}
+
 void VNCSConnectionST::subscribeUnixRelay(const char *name)
 {
   bool read, write, owner;
@@ -76,6 +76,13 @@ namespace rfb {
 
     // Wrappers to make these methods "safe" for VNCServerST.
     void writeFramebufferUpdateOrClose();
+
+    // writeFramebufferUpdateOrDefer() is writeFramebufferUpdateOrClose() for
+    // use from an encode worker thread. Any close() is only recorded, and
+    // has to be carried out on the main thread with closeIfDeferred()
+    // afterwards.
+    void writeFramebufferUpdateOrDefer();
+    void closeIfDeferred();
     void screenLayoutChangeOrClose(rdr::U16 reason);
     void setCursorOrClose();
     void bellOrClose();
@@ -205,6 +212,7 @@ namespace rfb {
     }
 
     virtual void udpDowngrade(const bool byServer);
+    virtual void udpLoss(const unsigned lost, const unsigned total);
 
     bool upgradingToUdp;
 
@@ -289,6 +297,8 @@ namespace rfb {
     // Congestion control
     void writeRTTPing();
     bool isCongested();
+    size_t updateQueueLimit() const;
+    size_t sentPosition();
 
     // writeFramebufferUpdate() attempts to write a framebuffer update to the
     // client.
@@ -361,6 +371,8 @@ namespace rfb {
     AccessRights accessRights;
 
     CharArray closeReason;
+    bool deferClose;
+    CharArray deferredCloseReason;
     time_t startTime;
 
     std::vector<CopyPassRect> copypassed;
@@ -78,6 +78,7 @@
 #include <wordexp.h>
 
 #include <fmt/core.h>
+#include <tbb/parallel_for_each.h>
 #include "encoders/KasmVideoConstants.h"
 #include "encoders/EncoderProbe.h"
 
@@ -86,6 +87,7 @@ using namespace rfb;
 static LogWriter slog("VNCServerST");
 LogWriter VNCServerST::connectionsLog("Connections");
 EncCache VNCServerST::encCache;
+SharedVideoEncoders VNCServerST::videoEncoders;
 
 void SelfBench();
 
@@ -146,6 +148,10 @@ VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_, const video_enco
     frameTimer(this), screenshotTimer(this), statsTimer(this), apimessager(nullptr), trackingFrameStats(0),
     clipboardId(0), sendWatermark(false), encoder_probe(encoder_probe_)
 {
+    if (Server::clientThreads != 1)
+        clientArena.initialize(Server::clientThreads ? static_cast<int>(Server::clientThreads) :
+                                                       static_cast<int>(cpu_info::cores_count));
+
     auto to_string = [](const bool value) {
         return value ? "yes" : "no";
     };
@@ -291,6 +297,10 @@ VNCServerST::~VNCServerST()
   if (comparer)
     comparer->logStats();
   delete comparer;
+  delete blackedpb;
+
+  encCache.logStats();
+  videoEncoders.logStats();
 
   delete cursor;
 }
@@ -511,6 +521,11 @@ void VNCServerST::setPixelBuffer(PixelBuffer* pb_, const ScreenSet& layout)
   renderedCursorInvalid = true;
   add_changed(pb->getRect());
 
+  // The DLP view must not point at the old framebuffer. The clients send
+  // the whole screen after a resize anyway.
+  if (DLPRegion.enabled)
+    blackOut();
+
   // Make sure that we have at least one screen
   if (screenLayout.num_screens() == 0)
     screenLayout.add_screen(Screen(0, 0, 0, pb->width(), pb->height(), 0));
@@ -918,6 +933,8 @@ static void upgradeClientToUdp(const network::GetAPIMessager::action_data &act,
     (*ci)->upgradingToUdp = false;
     (*ci)->cp.useCopyRect = false;
     ((network::UdpStream *)(*ci)->getOutStream(true))->setClient((WuClient *) act.udp.client);
+    ((network::UdpStream *)(*ci)->getOutStream(true))->setFec((*ci)->cp.supportsUdpFec &&
+                                                             Server::udpFec);
     (*ci)->cp.supportsUdp = true;
 
     slog.info("%s upgraded to UDP", who);
@@ -1027,39 +1044,18 @@ void VNCServerST::getDLPRegionSkipFlags(const Point& pos,
   }
 }
 
-void VNCServerST::blackOut()
+bool VNCServerST::blackOut()
 {
   // Compute the region, since the resolution may have changed
   rdr::U16 x1, y1, x2, y2;
 
   translateDLPRegion(x1, y1, x2, y2);
 
-  if (blackedpb)
-    delete blackedpb;
-  blackedpb = new ManagedPixelBuffer(pb->getPF(), pb->getRect().width(), pb->getRect().height());
-
-  int stride;
-  const rdr::U8 *src = pb->getBuffer(pb->getRect(), &stride);
-  rdr::U8 *data = blackedpb->getBufferRW(pb->getRect(), &stride);
-  stride *= 4;
-
-  memcpy(data, src, stride * pb->getRect().height());
+  if (!blackedpb)
+    blackedpb = new BlackoutPixelBuffer();
 
-  rdr::U16 y;
-  const rdr::U16 w = pb->getRect().width();
-  const rdr::U16 h = pb->getRect().height();
-  for (y = 0; y < h; y++) {
-    if (y < y1 || y > y2) {
-      memset(data, 0, stride);
-    } else {
-      if (x1)
-        memset(data, 0, x1 * 4);
-      if (x2)
-        memset(&data[x2 * 4], 0, (w - x2) * 4);
-    }
-
-    data += stride;
-  }
+  // Rows up to and including y2 are visible, columns only up to x2
+  return blackedpb->update(pb, Rect(x1, y1, x2, y2 + 1));
 }
 
 // writeUpdate() is called on a regular interval in order to see what
@@ -1078,9 +1074,10 @@ void VNCServerST::writeUpdate()
 
   TRACE_STOPWATCH(start);
 
+  bool blackOutChanged = false;
   if (DLPRegion.enabled) {
     comparer->enable_copyrect(false);
-    blackOut();
+    blackOutChanged = blackOut();
   }
 
   if (watermarkData && Server::DLP_WatermarkText[0] && watermarkTextNeedsUpdate(true)) {
@@ -1125,8 +1122,17 @@ void VNCServerST::writeUpdate()
   DEBUG_STOPWATCH_PRINT_US(slog, comparer_timer);
   TRACE_STOPWATCH_END_MS(beforeAnalysis, analysisMs);
 
-  encCache.clear();
-  encCache.enabled = clients.size() > 1;
+  // Clients only ever see black outside the DLP region, so changes there
+  // are dropped, and the whole screen is only sent again when the region
+  // itself moves
+  if (DLPRegion.enabled) {
+    ui.changed.assign_intersect(blackedpb->getVisible());
+    if (blackOutChanged)
+      ui.changed.assign_union(pb->getRect());
+  }
+
+  encCache.setMaxBytes((size_t) Server::encCacheSize * 1024 * 1024);
+  videoEncoders.nextFrame();
 
   // Check if the password file was updated
   DEBUG_STOPWATCH(perm_check);
@@ -1168,6 +1174,11 @@ void VNCServerST::writeUpdate()
   if (watermarkData)
       updateWatermark();
 
+  // The rendered cursor is shared by all clients, so render it here
+  // instead of racing to do it from the encode workers
+  if (needRenderedCursor())
+    getRenderedCursor();
+
   for (auto client : clients) {
     if (permcheck)
       client->recheckPerms();
@@ -1188,7 +1199,27 @@ void VNCServerST::writeUpdate()
     client->add_copied(ui.copied, ui.copy_delta);
     client->add_copypassed(ui.copypassed);
     client->add_changed(ui.changed);
-    client->writeFramebufferUpdateOrClose();
+  }
+
+  // Each client has its own encoder and socket, so with several viewers
+  // encode them all at once, and have the frame wait only for the
+  // slowest one. Anything that touches shared state (closing, stats)
+  // is done below, back on this thread.
+  if (clients.size() > 1 && clientArena.is_active()) {
+    const std::vector<VNCSConnectionST *> writers(clients.begin(), clients.end());
+
+    clientArena.execute([&] {
+      tbb::parallel_for_each(writers.begin(), writers.end(), [](VNCSConnectionST *client) {
+        client->writeFramebufferUpdateOrDefer();
+      });
+    });
+  } else {
+    for (auto client : clients)
+      client->writeFramebufferUpdateOrClose();
+  }
+
+  for (auto client : clients) {
+    client->closeIfDeferred();
 
     if (((network::UdpStream *)client->getOutStream(true))->isFailed()) {
       ((network::UdpStream *)client->getOutStream(true))->clearFailed();
@@ -1203,10 +1234,12 @@ void VNCServerST::writeUpdate()
       jpegstats.ms += subjpeg.ms;
       jpegstats.area += subjpeg.area;
       jpegstats.rects += subjpeg.rects;
+      jpegstats.predicted += subjpeg.predicted;
 
       webpstats.ms += subwebp.ms;
       webpstats.area += subwebp.area;
       webpstats.rects += subwebp.rects;
+      webpstats.predicted += subwebp.predicted;
 
       enctime += client->getEncodingTime();
       scaletime += client->getScalingTime();
@@ -1223,6 +1256,7 @@ void VNCServerST::writeUpdate()
         apimessager->mainUpdateServerFrameStats(comparer->changedPerc, totalMs,
                                                 jpegstats.ms, webpstats.ms,
                                                 analysisMs,
+                                                jpegstats.predicted, webpstats.predicted,
                                                 jpegstats.area, webpstats.area,
                                                 jpegstats.rects, webpstats.rects,
                                                 enctime, scaletime,
@@ -28,6 +28,7 @@
 
 #include <network/Socket.h>
 #include <rfb/Blacklist.h>
+#include <rfb/BlackoutPixelBuffer.h>
 #include <rfb/Cursor.h>
 #include <rfb/EncCache.h>
 #include <rfb/LogWriter.h>
@@ -37,7 +38,9 @@
 #include <rfb/VNCServer.h>
 #include <rfb/encoders/KasmVideoConstants.h>
 #include <rfb/encoders/EncoderProbe.h>
+#include <rfb/encoders/SharedVideoEncoders.h>
 #include <string>
+#include <tbb/task_arena.h>
 
 namespace rfb {
 
@@ -234,7 +237,7 @@ namespace rfb {
     bool desktopStarted;
     int blockCounter;
     PixelBuffer* pb;
-    ManagedPixelBuffer *blackedpb;
+    BlackoutPixelBuffer *blackedpb;
     ScreenSet screenLayout;
     unsigned int ledState;
 
@@ -247,6 +250,8 @@ namespace rfb {
     std::list<network::Socket*> closingSockets;
 
     static EncCache encCache;
+    static SharedVideoEncoders videoEncoders;
+    tbb::task_arena clientArena;
 
     ComparingUpdateTracker* comparer;
 
@@ -263,7 +268,7 @@ namespace rfb {
     void stopFrameClock();
     int msToNextUpdate();
     void writeUpdate();
-    void blackOut();
+    bool blackOut();
     Region getPendingRegion();
     const RenderedCursor* getRenderedCursor();
 
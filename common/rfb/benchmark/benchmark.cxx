@@ -120,6 +120,8 @@ namespace benchmarking {
 
         void udpDowngrade(const bool) override {}
 
+        void udpLoss(const unsigned, const unsigned) override {}
+
         void subscribeUnixRelay(const char *name) override {}
 
         void unixRelay(const char *name, const rdr::U8 *buf, const unsigned len) override {}
@@ -0,0 +1,152 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+
+#include <rfb/blockcmp.h>
+#include <rfb/cpuid.h>
+
+namespace rfb {
+
+typedef int (*blockcmp_t)(const uint8_t *a, const unsigned astride,
+			const uint8_t *b, const unsigned bstride,
+			const unsigned rowBytes, const unsigned h);
+
+static blockcmp_t pickBlockCmp() {
+	if (cpu_info::has_avx2)
+		return AVX2_blockFirstChangedRow;
+	if (cpu_info::has_sse2)
+		return SSE2_blockFirstChangedRow;
+	return C_blockFirstChangedRow;
+}
+
+typedef bool (*blockmask_t)(const uint8_t *buf, const unsigned stride,
+			const unsigned bpp, const unsigned w, const unsigned h,
+			uint16_t *masks);
+
+static blockmask_t pickBlockMask() {
+	if (cpu_info::has_avx2)
+		return AVX2_blockColourMask;
+	if (cpu_info::has_sse2)
+		return SSE2_blockColourMask;
+	return C_blockColourMask;
+}
+
+typedef unsigned (*colourrun_t)(const uint8_t *buf, const unsigned bpp,
+			const unsigned n);
+
+static colourrun_t pickColourRun() {
+	if (cpu_info::has_avx2)
+		return AVX2_colourRunLength;
+	if (cpu_info::has_sse2)
+		return SSE2_colourRunLength;
+	return C_colourRunLength;
+}
+
+static const blockcmp_t blockcmp = pickBlockCmp();
+static const blockmask_t blockmask = pickBlockMask();
+static const colourrun_t colourrun = pickColourRun();
+
+int blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+			const uint8_t *b, const unsigned bstride,
+			const unsigned rowBytes, const unsigned h) {
+	return blockcmp(a, astride, b, bstride, rowBytes, h);
+}
+
+int C_blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+			const uint8_t *b, const unsigned bstride,
+			const unsigned rowBytes, const unsigned h) {
+	for (unsigned y = 0; y < h; y++) {
+		if (memcmp(a, b, rowBytes))
+			return y;
+		a += astride;
+		b += bstride;
+	}
+
+	return -1;
+}
+
+bool blockColourMask(const uint8_t *buf, const unsigned stride,
+			const unsigned bpp, const unsigned w, const unsigned h,
+			uint16_t *masks) {
+	return blockmask(buf, stride, bpp, w, h, masks);
+}
+
+template<class T>
+static bool blockColourMaskT(const uint8_t *buf, const unsigned stride,
+			const unsigned w, const unsigned h, uint16_t *masks) {
+	const T colour = *(const T *) buf;
+	const uint16_t full = (1u << w) - 1;
+	bool solid = true;
+
+	for (unsigned y = 0; y < h; y++) {
+		const T *row = (const T *) (buf + y * stride);
+		uint16_t mask = 0;
+
+		for (unsigned x = 0; x < w; x++)
+			mask |= (row[x] == colour) << x;
+
+		masks[y] = mask;
+		solid = solid && mask == full;
+	}
+
+	return solid;
+}
+
+bool C_blockColourMask(const uint8_t *buf, const unsigned stride,
+			const unsigned bpp, const unsigned w, const unsigned h,
+			uint16_t *masks) {
+	switch (bpp) {
+	case 4:
+		return blockColourMaskT<uint32_t>(buf, stride, w, h, masks);
+	case 2:
+		return blockColourMaskT<uint16_t>(buf, stride, w, h, masks);
+	default:
+		return blockColourMaskT<uint8_t>(buf, stride, w, h, masks);
+	}
+}
+
+unsigned colourRunLength(const uint8_t *buf, const unsigned bpp,
+			const unsigned n) {
+	return colourrun(buf, bpp, n);
+}
+
+template<class T>
+static unsigned colourRunLengthT(const uint8_t *buf, const unsigned n) {
+	const T *pixels = (const T *) buf;
+	unsigned i;
+
+	for (i = 1; i < n && pixels[i] == pixels[0]; i++)
+		;
+
+	return i;
+}
+
+unsigned C_colourRunLength(const uint8_t *buf, const unsigned bpp,
+			const unsigned n) {
+	switch (bpp) {
+	case 4:
+		return colourRunLengthT<uint32_t>(buf, n);
+	case 2:
+		return colourRunLengthT<uint16_t>(buf, n);
+	default:
+		return colourRunLengthT<uint8_t>(buf, n);
+	}
+}
+
+}; // namespace rfb
@@ -0,0 +1,79 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifndef __RFB_BLOCKCMP_H__
+#define __RFB_BLOCKCMP_H__
+
+#include <stdint.h>
+
+namespace rfb {
+
+	// Compares h rows of rowBytes each. Returns the index of the first row
+	// that differs, or -1 if the two blocks are identical.
+	int blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+				const uint8_t *b, const unsigned bstride,
+				const unsigned rowBytes, const unsigned h);
+
+	int C_blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+				const uint8_t *b, const unsigned bstride,
+				const unsigned rowBytes, const unsigned h);
+
+	int SSE2_blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+				const uint8_t *b, const unsigned bstride,
+				const unsigned rowBytes, const unsigned h);
+
+	int AVX2_blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+				const uint8_t *b, const unsigned bstride,
+				const unsigned rowBytes, const unsigned h);
+
+	// For a block at most 16 pixels wide, sets bit x of masks[y] for every
+	// pixel that is the same colour as the first one. Returns true if they
+	// all are. bpp is in bytes and must be 1, 2 or 4.
+	bool blockColourMask(const uint8_t *buf, const unsigned stride,
+				const unsigned bpp, const unsigned w, const unsigned h,
+				uint16_t *masks);
+
+	bool C_blockColourMask(const uint8_t *buf, const unsigned stride,
+				const unsigned bpp, const unsigned w, const unsigned h,
+				uint16_t *masks);
+
+	bool SSE2_blockColourMask(const uint8_t *buf, const unsigned stride,
+				const unsigned bpp, const unsigned w, const unsigned h,
+				uint16_t *masks);
+
+	bool AVX2_blockColourMask(const uint8_t *buf, const unsigned stride,
+				const unsigned bpp, const unsigned w, const unsigned h,
+				uint16_t *masks);
+
+	// Returns how many of the n pixels at buf, at least one, are the same
+	// colour as the first one before one that isn't. bpp is in bytes and
+	// must be 1, 2 or 4.
+	unsigned colourRunLength(const uint8_t *buf, const unsigned bpp,
+				const unsigned n);
+
+	unsigned C_colourRunLength(const uint8_t *buf, const unsigned bpp,
+				const unsigned n);
+
+	unsigned SSE2_colourRunLength(const uint8_t *buf, const unsigned bpp,
+				const unsigned n);
+
+	unsigned AVX2_colourRunLength(const uint8_t *buf, const unsigned bpp,
+				const unsigned n);
+};
+
+#endif
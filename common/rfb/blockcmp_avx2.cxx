@@ -0,0 +1,161 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+#include <immintrin.h>
+
+#include <rfb/blockcmp.h>
+
+namespace rfb {
+
+static inline bool isZero(const __m256i v) {
+	return _mm256_testz_si256(v, v);
+}
+
+// Most blocks are unchanged, so rows are checked in groups with a single
+// test per group. Only a group that differs is rescanned row by row.
+#define ROWS_PER_TEST 8
+
+static inline bool rowDiffers(const uint8_t *a, const uint8_t *b,
+				const unsigned vecBytes, const unsigned rowBytes,
+				__m256i &acc) {
+	unsigned x;
+	for (x = 0; x < vecBytes; x += 32)
+		acc = _mm256_or_si256(acc, _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (a + x)),
+					_mm256_loadu_si256((__m256i *) (b + x))));
+
+	return x < rowBytes && memcmp(a + x, b + x, rowBytes - x);
+}
+
+int AVX2_blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+			const uint8_t *b, const unsigned bstride,
+			const unsigned rowBytes, const unsigned h) {
+	const unsigned vecBytes = rowBytes & ~(32 - 1);
+
+	for (unsigned y = 0; y < h; y += ROWS_PER_TEST) {
+		const unsigned rows = h - y < ROWS_PER_TEST ? h - y : ROWS_PER_TEST;
+		__m256i acc = _mm256_setzero_si256();
+		bool tail = false;
+
+		for (unsigned i = 0; i < rows; i++)
+			tail |= rowDiffers(a + i * astride, b + i * bstride, vecBytes, rowBytes, acc);
+
+		if (tail || !isZero(acc)) {
+			for (unsigned i = 0; i < rows; i++) {
+				__m256i row = _mm256_setzero_si256();
+				if (rowDiffers(a + i * astride, b + i * bstride, vecBytes, rowBytes, row) ||
+				    !isZero(row))
+					return y + i;
+			}
+		}
+
+		a += astride * rows;
+		b += bstride * rows;
+	}
+
+	return -1;
+}
+
+// The first pixel repeated over a whole vector
+static inline __m256i splat(const uint8_t *buf, const unsigned bpp) {
+	switch (bpp) {
+	case 4:
+		return _mm256_set1_epi32(*(const int32_t *) buf);
+	case 2:
+		return _mm256_set1_epi16(*(const int16_t *) buf);
+	default:
+		return _mm256_set1_epi8(*buf);
+	}
+}
+
+// Which of the 16 pixels at row match colour, a bit each
+static inline unsigned rowMask(const uint8_t *row, const unsigned bpp,
+				const __m256i colour) {
+	__m256i eq;
+
+	switch (bpp) {
+	case 4:
+		return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *) row), colour))) |
+		       _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i *) (row + 32)), colour))) << 8;
+	case 2:
+		eq = _mm256_cmpeq_epi16(_mm256_loadu_si256((__m256i *) row), colour);
+		return _mm_movemask_epi8(_mm_packs_epi16(_mm256_castsi256_si128(eq),
+							_mm256_extracti128_si256(eq, 1)));
+	default:
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) row),
+							_mm256_castsi256_si128(colour)));
+	}
+}
+
+bool AVX2_blockColourMask(const uint8_t *buf, const unsigned stride,
+			const unsigned bpp, const unsigned w, const unsigned h,
+			uint16_t *masks) {
+	__m256i colour;
+	unsigned all;
+
+	// Blocks cut short by the edge of a rectangle are rare
+	if (w != 16)
+		return C_blockColourMask(buf, stride, bpp, w, h, masks);
+
+	colour = splat(buf, bpp);
+
+	all = 0xffff;
+	for (unsigned y = 0; y < h; y++) {
+		masks[y] = rowMask(buf + y * stride, bpp, colour);
+		all &= masks[y];
+	}
+
+	return all == 0xffff;
+}
+
+// Whole vectors are compared byte for byte, but with the pixel size, so a
+// pixel that differs clears all its bytes in the mask
+static inline unsigned matchMask(const uint8_t *buf, const unsigned bpp,
+				const __m256i colour) {
+	const __m256i v = _mm256_loadu_si256((__m256i *) buf);
+
+	switch (bpp) {
+	case 4:
+		return _mm256_movemask_epi8(_mm256_cmpeq_epi32(v, colour));
+	case 2:
+		return _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, colour));
+	default:
+		return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, colour));
+	}
+}
+
+unsigned AVX2_colourRunLength(const uint8_t *buf, const unsigned bpp,
+			const unsigned n) {
+	const unsigned bytes = n * bpp;
+	const __m256i colour = splat(buf, bpp);
+	unsigned x, mask;
+
+	for (x = 0; x + 32 <= bytes; x += 32) {
+		mask = matchMask(buf + x, bpp, colour);
+		if (mask != 0xffffffffu)
+			return (x + __builtin_ctz(~mask)) / bpp;
+	}
+
+	if (!x)
+		return C_colourRunLength(buf, bpp, n);
+
+	// Carry on from the last pixel known to match
+	return x / bpp - 1 + C_colourRunLength(buf + x - bpp, bpp, n - x / bpp + 1);
+}
+
+}; // namespace rfb
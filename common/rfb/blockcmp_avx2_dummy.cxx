@@ -0,0 +1,40 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <rfb/blockcmp.h>
+
+namespace rfb {
+
+int AVX2_blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+			const uint8_t *b, const unsigned bstride,
+			const unsigned rowBytes, const unsigned h) {
+	return C_blockFirstChangedRow(a, astride, b, bstride, rowBytes, h);
+}
+
+bool AVX2_blockColourMask(const uint8_t *buf, const unsigned stride,
+			const unsigned bpp, const unsigned w, const unsigned h,
+			uint16_t *masks) {
+	return C_blockColourMask(buf, stride, bpp, w, h, masks);
+}
+
+unsigned AVX2_colourRunLength(const uint8_t *buf, const unsigned bpp,
+			const unsigned n) {
+	return C_colourRunLength(buf, bpp, n);
+}
+
+}; // namespace rfb
@@ -0,0 +1,160 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include <rfb/blockcmp.h>
+
+namespace rfb {
+
+static inline bool isZero(const __m128i v) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xffff;
+}
+
+// Most blocks are unchanged, so rows are checked in groups with a single
+// test per group. Only a group that differs is rescanned row by row.
+#define ROWS_PER_TEST 8
+
+static inline bool rowDiffers(const uint8_t *a, const uint8_t *b,
+				const unsigned vecBytes, const unsigned rowBytes,
+				__m128i &acc) {
+	unsigned x;
+	for (x = 0; x < vecBytes; x += 16)
+		acc = _mm_or_si128(acc, _mm_xor_si128(_mm_loadu_si128((__m128i *) (a + x)),
+					_mm_loadu_si128((__m128i *) (b + x))));
+
+	return x < rowBytes && memcmp(a + x, b + x, rowBytes - x);
+}
+
+int SSE2_blockFirstChangedRow(const uint8_t *a, const unsigned astride,
+			const uint8_t *b, const unsigned bstride,
+			const unsigned rowBytes, const unsigned h) {
+	const unsigned vecBytes = rowBytes & ~(16 - 1);
+
+	for (unsigned y = 0; y < h; y += ROWS_PER_TEST) {
+		const unsigned rows = h - y < ROWS_PER_TEST ? h - y : ROWS_PER_TEST;
+		__m128i acc = _mm_setzero_si128();
+		bool tail = false;
+
+		for (unsigned i = 0; i < rows; i++)
+			tail |= rowDiffers(a + i * astride, b + i * bstride, vecBytes, rowBytes, acc);
+
+		if (tail || !isZero(acc)) {
+			for (unsigned i = 0; i < rows; i++) {
+				__m128i row = _mm_setzero_si128();
+				if (rowDiffers(a + i * astride, b + i * bstride, vecBytes, rowBytes, row) ||
+				    !isZero(row))
+					return y + i;
+			}
+		}
+
+		a += astride * rows;
+		b += bstride * rows;
+	}
+
+	return -1;
+}
+
+// The first pixel repeated over a whole vector
+static inline __m128i splat(const uint8_t *buf, const unsigned bpp) {
+	switch (bpp) {
+	case 4:
+		return _mm_set1_epi32(*(const int32_t *) buf);
+	case 2:
+		return _mm_set1_epi16(*(const int16_t *) buf);
+	default:
+		return _mm_set1_epi8(*buf);
+	}
+}
+
+// Which of the 16 pixels at row match colour, a bit each
+static inline unsigned rowMask(const uint8_t *row, const unsigned bpp,
+				const __m128i colour) {
+	switch (bpp) {
+	case 4:
+		return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i *) row), colour))) |
+		       _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i *) (row + 16)), colour))) << 4 |
+		       _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i *) (row + 32)), colour))) << 8 |
+		       _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i *) (row + 48)), colour))) << 12;
+	case 2:
+		return _mm_movemask_epi8(_mm_packs_epi16(
+				_mm_cmpeq_epi16(_mm_loadu_si128((__m128i *) row), colour),
+				_mm_cmpeq_epi16(_mm_loadu_si128((__m128i *) (row + 16)), colour)));
+	default:
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *) row), colour));
+	}
+}
+
+bool SSE2_blockColourMask(const uint8_t *buf, const unsigned stride,
+			const unsigned bpp, const unsigned w, const unsigned h,
+			uint16_t *masks) {
+	__m128i colour;
+	unsigned all;
+
+	// Blocks cut short by the edge of a rectangle are rare
+	if (w != 16)
+		return C_blockColourMask(buf, stride, bpp, w, h, masks);
+
+	colour = splat(buf, bpp);
+
+	all = 0xffff;
+	for (unsigned y = 0; y < h; y++) {
+		masks[y] = rowMask(buf + y * stride, bpp, colour);
+		all &= masks[y];
+	}
+
+	return all == 0xffff;
+}
+
+// Whole vectors are compared byte for byte, but with the pixel size, so a
+// pixel that differs clears all its bytes in the mask
+static inline unsigned matchMask(const uint8_t *buf, const unsigned bpp,
+				const __m128i colour) {
+	const __m128i v = _mm_loadu_si128((__m128i *) buf);
+
+	switch (bpp) {
+	case 4:
+		return _mm_movemask_epi8(_mm_cmpeq_epi32(v, colour));
+	case 2:
+		return _mm_movemask_epi8(_mm_cmpeq_epi16(v, colour));
+	default:
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(v, colour));
+	}
+}
+
+unsigned SSE2_colourRunLength(const uint8_t *buf, const unsigned bpp,
+			const unsigned n) {
+	const unsigned bytes = n * bpp;
+	const __m128i colour = splat(buf, bpp);
+	unsigned x, mask;
+
+	for (x = 0; x + 16 <= bytes; x += 16) {
+		mask = matchMask(buf + x, bpp, colour);
+		if (mask != 0xffffu)
+			return (x + __builtin_ctz(~mask)) / bpp;
+	}
+
+	if (!x)
+		return C_colourRunLength(buf, bpp, n);
+
+	// Carry on from the last pixel known to match
+	return x / bpp - 1 + C_colourRunLength(buf + x - bpp, bpp, n - x / bpp + 1);
+}
+
+}; // namespace rfb
@@ -72,6 +72,7 @@ namespace rfb {
     template<AVHWDeviceType HWDeviceType, AVPixelFormat AVPixFmt>
     bool FFMPEGHWEncoder<HWDeviceType, AVPixFmt>::init(int width, int height, VideoEncoderParams params) {
         current_params = params;
+        frame_stale = true;
         AVHWFramesContext *frames_ctx{};
         int err{};
 
@@ -261,7 +262,7 @@ namespace rfb {
     }
 
     template<AVHWDeviceType HWDeviceType, AVPixelFormat AVPixFmt>
-    bool FFMPEGHWEncoder<HWDeviceType, AVPixFmt>::render(const PixelBuffer *pb, bool forceKeyFrame) {
+    bool FFMPEGHWEncoder<HWDeviceType, AVPixFmt>::render(const PixelBuffer *pb, const Region &changed, bool forceKeyFrame) {
         // compress
         int stride;
         const auto rect = layout.dimensions;
@@ -315,11 +316,30 @@ namespace rfb {
         DEBUG_LOG(vlog, "Converting ARGB to NV12: src_stride=%d, dst_linesize[0]=%d, dst_linesize[1]=%d, dst_width=%d, dst_height=%d",
                    src_stride_bytes, frame->linesize[0], frame->linesize[1], dst_width, dst_height);
 
-        if (err = libyuv::ARGBToNV12(buffer, src_stride_bytes, frame->data[0], frame->linesize[0],
-            frame->data[1], frame->linesize[1], dst_width, dst_height); err != 0) {
-            vlog.error("libyuv::ARGBToNV12 failed with code: %d", err);
-            return false;
+        // The frame still holds the previous screen contents, so only
+        // convert what changed since
+        std::vector<Rect> rects;
+        if (frame_stale)
+            rects.emplace_back(0, 0, dst_width, dst_height);
+        else
+            rects = encoders::macroblock_rects(changed, dst_width, dst_height);
+
+        frame_stale = true;
+
+        for (const auto &r: rects) {
+            const int x = r.tl.x;
+            const int y = r.tl.y;
+
+            if (err = libyuv::ARGBToNV12(buffer + y * src_stride_bytes + x * bpp, src_stride_bytes,
+                frame->data[0] + y * frame->linesize[0] + x, frame->linesize[0],
+                frame->data[1] + y / 2 * frame->linesize[1] + x, frame->linesize[1],
+                r.width(), r.height()); err != 0) {
+                vlog.error("libyuv::ARGBToNV12 failed with code: %d", err);
+                return false;
+            }
         }
+
+        frame_stale = false;
         DEBUG_LOG(vlog, "ARGB to NV12 conversion successful");
 
         frame->pts = pts++;
@@ -381,8 +401,12 @@ namespace rfb {
 
     template<AVHWDeviceType HWDeviceType, AVPixelFormat AVPixFmt>
     void FFMPEGHWEncoder<HWDeviceType, AVPixFmt>::writeRect(const PixelBuffer *pb, const Palette &palette) {
+        writePacket(conn->getOutStream(conn->cp.supportsUdp));
+    }
+
+    template<AVHWDeviceType HWDeviceType, AVPixelFormat AVPixFmt>
+    void FFMPEGHWEncoder<HWDeviceType, AVPixFmt>::writePacket(rdr::OutStream *os) {
         auto *pkt = pkt_guard.get();
-        auto *os = conn->getOutStream(conn->cp.supportsUdp);
         os->writeU8(layout.id);
         os->writeU8(msg_codec_id);
         os->writeU8(msg_codec_type_id);
@@ -394,6 +418,11 @@ namespace rfb {
         ffmpeg.av_packet_unref(pkt);
     }
 
+    template<AVHWDeviceType HWDeviceType, AVPixelFormat AVPixFmt>
+    bool FFMPEGHWEncoder<HWDeviceType, AVPixFmt>::isKeyFrame() const {
+        return pkt_guard.get()->flags & AV_PKT_FLAG_KEY;
+    }
+
     template<AVHWDeviceType HWDeviceType, AVPixelFormat AVPixFmt>
     void FFMPEGHWEncoder<HWDeviceType, AVPixFmt>::writeSolidRect(int width, int height, const PixelFormat &pf, const rdr::U8 *colour) {}
 
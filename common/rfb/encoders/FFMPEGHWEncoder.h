@@ -45,6 +45,7 @@ class FFMPEGHWEncoder final : public VideoEncoder {
 
     int64_t pts{};
     int bpp{};
+    bool frame_stale{true}; // needs a full conversion
     const char *dri_node{};
 
     [[nodiscard]] bool init(int width, int height, VideoEncoderParams params);
@@ -58,7 +59,9 @@ public:
     bool isSupported() const override;
     void writeRect(const PixelBuffer *pb, const Palette &palette) override;
     void writeSolidRect(int width, int height, const PixelFormat &pf, const rdr::U8 *colour) override;
-    bool render(const PixelBuffer *pb, bool forceKeyFrame = false) override;
+    bool render(const PixelBuffer *pb, const Region &changed, bool forceKeyFrame = false) override;
+    void writePacket(rdr::OutStream *os) override;
+    [[nodiscard]] bool isKeyFrame() const override;
     void writeSkipRect() override;
 };
 
@@ -31,10 +31,12 @@ namespace rfb {
 
     template<uint8_t T>
     ScreenEncoderManager<T>::ScreenEncoderManager(const FFmpeg &ffmpeg_, const KasmVideoEncoders::EncoderConfig &encoder,
-        const KasmVideoEncoders::EncoderConfigs &encoders, SConnection *conn, VideoEncoderParams params) :
+        const KasmVideoEncoders::EncoderConfigs &encoders, SConnection *conn, VideoEncoderParams params,
+        SharedVideoEncoders *shared) :
         Encoder(conn, encodingKasmVideo, static_cast<EncoderFlags>(EncoderUseNativePF | EncoderLossy), -1),
         ffmpeg(ffmpeg_),
         current_params(params),
+        shared_encoders(shared),
         base_video_encoder(encoder),
         available_encoders(encoders) {
         screens_to_refresh.reserve(T);
@@ -65,15 +67,15 @@ namespace rfb {
 
 
     template<uint8_t T>
-    VideoEncoder *ScreenEncoderManager<T>::add_encoder(const Screen &layout) const {
+    VideoEncoder *ScreenEncoderManager<T>::add_encoder(const Screen &layout, SConnection *owner) const {
         VideoEncoder *encoder{};
         try {
-            encoder = create_encoder(layout, &ffmpeg, conn, base_video_encoder.encoder, base_video_encoder.dri_path.c_str(), current_params);
+            encoder = create_encoder(layout, &ffmpeg, owner, base_video_encoder.encoder, base_video_encoder.dri_path.c_str(), current_params);
         } catch (const std::exception &e) {
             if (base_video_encoder.encoder != KasmVideoEncoders::Encoder::h264_software) {
                 vlog.error("Attempting fallback to software encoder due to error: %s", e.what());
                 try {
-                    encoder = create_encoder(layout, &ffmpeg, conn, KasmVideoEncoders::Encoder::h264_software, nullptr, current_params);
+                    encoder = create_encoder(layout, &ffmpeg, owner, KasmVideoEncoders::Encoder::h264_software, nullptr, current_params);
                 } catch (const std::exception &exception) {
                     vlog.error("Failed to create software encoder: %s", exception.what());
                 }
@@ -88,7 +90,18 @@ namespace rfb {
     bool ScreenEncoderManager<T>::add_screen(uint8_t index, const Screen &layout) {
         screens[index] = {layout, nullptr, true};
         screens[index].layout.id = index;
-        screens[index].encoder = add_encoder(screens[index].layout);
+
+        if (shared_encoders) {
+            const SharedVideoEncoders::Key key{
+                screens[index].layout, base_video_encoder.encoder, base_video_encoder.dri_path, current_params};
+
+            screens[index].shared = shared_encoders->subscribe(key, [this, &key] {
+                return add_encoder(key.layout, nullptr);
+            });
+            if (screens[index].shared)
+                screens[index].encoder = screens[index].shared->encoder;
+        } else
+            screens[index].encoder = add_encoder(screens[index].layout, conn);
 
         if (!screens[index].encoder) {
             screens[index] = {};
@@ -109,7 +122,12 @@ namespace rfb {
 
     template<uint8_t T>
     void ScreenEncoderManager<T>::remove_screen(uint8_t index) {
-        if (screens[index].encoder) {
+        if (screens[index].shared) {
+            shared_encoders->unsubscribe(screens[index].shared);
+            screens[index].encoder = nullptr;
+
+            --count;
+        } else if (screens[index].encoder) {
             delete screens[index].encoder;
             screens[index].encoder = nullptr;
 
@@ -150,8 +168,6 @@ namespace rfb {
 
     template<uint8_t T>
     bool ScreenEncoderManager<T>::sync_layout(const ScreenSet &layout, const Region &region) {
-        const auto bounds = region.get_bounding_rect();
-
         const auto old_mask = mask;
         mask_t new_mask = 0;
 
@@ -169,7 +185,7 @@ namespace rfb {
                 remove_screen(id);
                 if (!add_screen(id, screen))
                     return false;
-            } else if (screen.dimensions.overlaps(bounds)) {
+            } else if (!region.intersect(screen.dimensions).is_empty()) {
                 screens[id].dirty = true;
             }
         }
@@ -187,6 +203,8 @@ namespace rfb {
     template<uint8_t T>
     bool ScreenEncoderManager<T>::isSupported() const {
         const auto index = screens_to_refresh[0];
+        if (screens[index].shared)
+            return conn->cp.supportsEncoding(encoding);
         if (const auto *encoder = screens[index].encoder; encoder)
             return encoder->isSupported();
 
@@ -194,10 +212,28 @@ namespace rfb {
     }
 
     template<uint8_t T>
-    bool ScreenEncoderManager<T>::writeFrame(const PixelBuffer *pb, const Palette &palette, bool forceKeyFrame) {
+    bool ScreenEncoderManager<T>::writeFrame(const PixelBuffer *pb, const Region &changed, const Palette &palette, bool forceKeyFrame) {
         if (screens_to_refresh.empty())
             return true;
 
+        // What changed on a screen, relative to that screen
+        const auto screen_changes = [&changed](const screen_t &screen) {
+            const auto &rect = screen.layout.dimensions;
+            auto region = changed.intersect(rect);
+            region.translate(rect.tl.negate());
+            return region;
+        };
+
+        // Shared encoders hand back the framed packets, which are kept for
+        // send_frame()
+        const auto render = [this, pb, &screen_changes, forceKeyFrame](screen_t &screen) {
+            if (screen.shared)
+                return shared_encoders->encode(screen.shared, screen.seq, pb, screen_changes(screen), forceKeyFrame,
+                    screen.packets);
+
+            return screen.encoder->render(pb, screen_changes(screen), forceKeyFrame);
+        };
+
         const auto bpp = conn->cp.pf().bpp >> 3;
         auto *out_conn = conn->getOutStream(conn->cp.supportsUdp);
 
@@ -218,9 +254,19 @@ namespace rfb {
 
             const auto &encoder = screen.encoder;
 
-            conn->writer()->startRect(rect, encoder->encoding);
-            encoder->writeRect(pb, palette);
-            conn->writer()->endRect();
+            if (screen.shared) {
+                // A subscriber catching up gets several packets in a row
+                for (const auto &packet: screen.packets) {
+                    conn->writer()->startRect(rect, encoder->encoding);
+                    out_conn->writeBytes(packet->data(), packet->size());
+                    conn->writer()->endRect();
+                }
+                screen.packets.clear();
+            } else {
+                conn->writer()->startRect(rect, encoder->encoding);
+                encoder->writeRect(pb, palette);
+                conn->writer()->endRect();
+            }
 
             screen.dirty = false;
 
@@ -234,21 +280,30 @@ namespace rfb {
             arena.execute([&] {
                 tbb::parallel_for_each(screens_to_refresh.begin(),
                     screens_to_refresh.end(),
-                    [this, pb, &ctx, forceKeyFrame](uint8_t index) {
+                    [this, &ctx, &render](uint8_t index) {
                         if (ctx.is_group_execution_cancelled())
                             return;
 
                         auto &screen = screens[index];
-                        if (auto *encoder = screen.encoder; encoder) {
-                            screen.dirty = encoder->render(pb, forceKeyFrame);
+                        if (screen.encoder) {
+                            screen.dirty = render(screen);
                             if (!screen.dirty)
                                 ctx.cancel_group_execution();
                         }
                     });
             });
 
-            if (ctx.is_group_execution_cancelled())
+            if (ctx.is_group_execution_cancelled()) {
+                // Packets from shared encoders that are not sent now leave a
+                // gap, so start those screens over from the last key frame
+                for (auto index: screens_to_refresh) {
+                    if (!screens[index].packets.empty()) {
+                        screens[index].packets.clear();
+                        screens[index].seq = 0;
+                    }
+                }
                 return false;
+            }
 
             for (auto index: screens_to_refresh) {
                 auto &screen = screens[index];
@@ -258,8 +313,8 @@ namespace rfb {
             }
         } else {
             const auto index = screens_to_refresh[0];
-            if (auto encoder = screens[index].encoder; encoder) {
-                if (encoder->render(pb, forceKeyFrame))
+            if (screens[index].encoder) {
+                if (render(screens[index]))
                     send_frame(screens[index]);
                 else
                     return false;
@@ -19,6 +19,7 @@
 #include <tbb/task_arena.h>
 #include <vector>
 #include "KasmVideoConstants.h"
+#include "SharedVideoEncoders.h"
 #include "VideoEncoder.h"
 #include "rfb/Encoder.h"
 #include "rfb/ffmpeg.h"
@@ -35,6 +36,11 @@ namespace rfb {
             Screen layout{};
             VideoEncoder *encoder{};
             bool dirty{};
+
+            // Set when the encoder comes from SharedVideoEncoders
+            SharedVideoEncoders::Entry *shared{};
+            uint64_t seq{};
+            std::vector<EncBuffer> packets;
         };
 
         uint8_t count{};
@@ -45,11 +51,12 @@ namespace rfb {
         tbb::task_arena arena;
         const FFmpeg &ffmpeg;
         VideoEncoderParams current_params;
+        SharedVideoEncoders *shared_encoders;
 
         KasmVideoEncoders::EncoderConfig base_video_encoder;
         KasmVideoEncoders::EncoderConfigs available_encoders;
 
-        [[nodiscard]] VideoEncoder *add_encoder(const Screen &layout) const;
+        [[nodiscard]] VideoEncoder *add_encoder(const Screen &layout, SConnection *owner) const;
         bool add_screen(uint8_t index, const Screen &layout);
         [[nodiscard]] size_t get_screen_count() const;
         void remove_screen(uint8_t index);
@@ -83,7 +90,8 @@ namespace rfb {
         }
 
         explicit ScreenEncoderManager(const FFmpeg &ffmpeg_, const KasmVideoEncoders::EncoderConfig &encoder,
-            const KasmVideoEncoders::EncoderConfigs &encoders, SConnection *conn, VideoEncoderParams params);
+            const KasmVideoEncoders::EncoderConfigs &encoders, SConnection *conn, VideoEncoderParams params,
+            SharedVideoEncoders *shared = nullptr);
         ~ScreenEncoderManager() override;
 
         ScreenEncoderManager(const ScreenEncoderManager &) = delete;
@@ -103,7 +111,8 @@ namespace rfb {
         // Encoder
         [[nodiscard]] bool isSupported() const override;
 
-        bool writeFrame(const PixelBuffer *pb, const Palette &palette, bool forceKeyFrame = false);
+        // Only the screens touched by changed are encoded
+        bool writeFrame(const PixelBuffer *pb, const Region &changed, const Palette &palette, bool forceKeyFrame = false);
         void writeRect(const PixelBuffer *pb, const Palette &palette) override {}
         void writeSolidRect(int width, int height, const PixelFormat &pf, const rdr::U8 *colour) override;
 
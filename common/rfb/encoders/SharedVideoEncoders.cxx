@@ -0,0 +1,135 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#include "SharedVideoEncoders.h"
+#include <algorithm>
+#include <memory>
+#include <rfb/LogWriter.h>
+
+namespace rfb {
+    static LogWriter vlog("SharedVideoEncoders");
+
+    SharedVideoEncoders::~SharedVideoEncoders() {
+        for (auto *entry: entries) {
+            delete entry->encoder;
+            delete entry;
+        }
+    }
+
+    SharedVideoEncoders::Entry *SharedVideoEncoders::subscribe(const Key &key, const Factory &create) {
+        os::AutoMutex a(&mutex);
+
+        for (auto *entry: entries) {
+            if (entry->key == key) {
+                ++entry->subscribers;
+                return entry;
+            }
+        }
+
+        auto *encoder = create();
+        if (!encoder)
+            return nullptr;
+
+        auto *entry = new Entry;
+        entry->key = key;
+        entry->encoder = encoder;
+        entry->subscribers = 1;
+        entries.push_back(entry);
+
+        vlog.debug("Encoder for screen %u (%dx%d) created, %zu in use", key.layout.id, key.layout.dimensions.width(),
+            key.layout.dimensions.height(), entries.size());
+
+        return entry;
+    }
+
+    void SharedVideoEncoders::unsubscribe(Entry *entry) {
+        os::AutoMutex a(&mutex);
+
+        if (--entry->subscribers)
+            return;
+
+        entries.erase(std::find(entries.begin(), entries.end(), entry));
+        delete entry->encoder;
+        delete entry;
+    }
+
+    // Most packets kept per entry. The encoder starts a new group of
+    // pictures well before this, it only matters without one.
+    static constexpr size_t MAX_GOP_PACKETS = 128;
+
+    bool SharedVideoEncoders::encode(Entry *entry, uint64_t &seq, const PixelBuffer *pb, const Region &changed,
+        bool forceKeyFrame, std::vector<EncBuffer> &packets) {
+        os::AutoMutex a(&entry->mutex);
+
+        const auto now = frame.load();
+
+        packets.clear();
+
+        // The first subscriber this server frame moves the stream on. Its
+        // damage covers at least everything since the last packet.
+        if (entry->frame != now || entry->gop.empty()) {
+            const bool key_frame = entry->gop.empty() || entry->gop.size() >= MAX_GOP_PACKETS;
+            Region region = changed;
+            if (key_frame)
+                region = Rect(0, 0, entry->key.layout.dimensions.width(), entry->key.layout.dimensions.height());
+
+            // After a failure the encoder starts over with a key frame
+            if (!entry->encoder->render(pb, region, key_frame)) {
+                entry->gop.clear();
+                return false;
+            }
+
+            auto packet = std::make_shared<EncBytes>();
+            EncOutStream os(packet.get());
+            entry->encoder->writePacket(&os);
+            os.finish();
+
+            ++entry->seq;
+            if (entry->gop.empty() || entry->encoder->isKeyFrame()) {
+                entry->gop.clear();
+                entry->gop_seq = entry->seq;
+            }
+            entry->gop.push_back(packet);
+            entry->frame = now;
+
+            ++encodes;
+        } else {
+            ++reuses;
+        }
+
+        // Whatever this subscriber has not had yet, or everything from the
+        // key frame on if it can't follow on from what it has
+        size_t first = 0;
+        if (!forceKeyFrame && seq + 1 >= entry->gop_seq && seq <= entry->seq)
+            first = seq + 1 - entry->gop_seq;
+        else
+            ++catchUps;
+
+        packets.assign(entry->gop.begin() + first, entry->gop.end());
+        seq = entry->seq;
+
+        return true;
+    }
+
+    void SharedVideoEncoders::logStats() {
+        if (!encodes)
+            return;
+
+        vlog.info("%llu frames encoded, %llu shared (%.1f%%), %llu catch-ups from the last key frame for new or "
+            "lagging clients", encodes.load(), reuses.load(), reuses * 100.0 / (encodes + reuses), catchUps.load());
+    }
+} // namespace rfb
@@ -0,0 +1,101 @@
+/* Copyright (C) 2025 Kasm.  All Rights Reserved.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <os/Mutex.h>
+#include <rfb/EncCache.h>
+#include <rfb/ScreenSet.h>
+#include "KasmVideoEncoders.h"
+#include "VideoEncoder.h"
+
+namespace rfb {
+    // Video encoders shared between every client watching the same screen
+    // with the same settings. Each server frame is encoded once and the
+    // packet is handed to all of them.
+    class SharedVideoEncoders {
+    public:
+        struct Key {
+            Screen layout;
+            KasmVideoEncoders::Encoder encoder{};
+            std::string dri_path;
+            VideoEncoderParams params;
+
+            bool operator==(const Key &rhs) const {
+                return layout == rhs.layout && encoder == rhs.encoder && dri_path == rhs.dri_path && params == rhs.params;
+            }
+        };
+
+        struct Entry {
+            Key key;
+            VideoEncoder *encoder{};
+            unsigned subscribers{};
+
+            // Packets since the last key frame, so that subscribers that
+            // fell behind can catch up without a new one
+            std::vector<EncBuffer> gop;
+            uint64_t gop_seq{}; // seq of the key frame at gop[0]
+            uint64_t frame{}; // server frame of the last packet
+            uint64_t seq{}; // packets encoded so far
+
+            os::Mutex mutex;
+        };
+
+        using Factory = std::function<VideoEncoder *()>;
+
+        SharedVideoEncoders() = default;
+        ~SharedVideoEncoders();
+
+        SharedVideoEncoders(const SharedVideoEncoders &) = delete;
+        SharedVideoEncoders &operator=(const SharedVideoEncoders &) = delete;
+
+        // Returns the entry for key, calling create() if this is the first
+        // subscriber. NULL if no encoder could be created.
+        [[nodiscard]] Entry *subscribe(const Key &key, const Factory &create);
+        void unsubscribe(Entry *entry);
+
+        // Starts a new server frame, the next encode() for any entry
+        // produces a new packet
+        void nextFrame() {
+            ++frame;
+        }
+
+        // Encodes the packet for this server frame, unless another
+        // subscriber has already, and fills packets with what this
+        // subscriber still needs, in order. seq is the last packet it was
+        // sent. One that missed some, has none yet, or wants a full
+        // refresh is sent the stream from the last key frame, so the
+        // others' stream is never disturbed. changed is relative to the
+        // screen. False if encoding failed.
+        bool encode(Entry *entry, uint64_t &seq, const PixelBuffer *pb, const Region &changed, bool forceKeyFrame,
+            std::vector<EncBuffer> &packets);
+
+        void logStats();
+
+    private:
+        std::vector<Entry *> entries;
+        std::atomic<uint64_t> frame{1};
+
+        std::atomic<unsigned long long> encodes{}, reuses{}, catchUps{};
+
+        os::Mutex mutex;
+    };
+} // namespace rfb
@@ -57,7 +57,7 @@ namespace rfb {
         return conn->cp.supportsEncoding(encodingKasmVideo);
     }
 
-    bool SoftwareEncoder::render(const PixelBuffer *pb, bool forceKeyFrame) {
+    bool SoftwareEncoder::render(const PixelBuffer *pb, const Region &changed, bool forceKeyFrame) {
         // compress
         int stride;
 
@@ -99,21 +99,40 @@ namespace rfb {
             frame->pict_type = AV_PICTURE_TYPE_I;
 
         const int src_stride_bytes = stride * bpp;
-        int err = libyuv::ARGBToI420(buffer,
-            src_stride_bytes,
-            frame->data[0],
-            frame->linesize[0],
-            frame->data[1],
-            frame->linesize[1],
-            frame->data[2],
-            frame->linesize[2],
-            dst_width,
-            dst_height);
-        if (err != 0) {
-            vlog.error("libyuv::ARGBToI420 failed with code: %d", err);
-            return false;
+        int err{};
+
+        // The frame still holds the previous screen contents, so only
+        // convert what changed since
+        std::vector<Rect> rects;
+        if (frame_stale)
+            rects.emplace_back(0, 0, dst_width, dst_height);
+        else
+            rects = encoders::macroblock_rects(changed, dst_width, dst_height);
+
+        frame_stale = true;
+
+        for (const auto &r: rects) {
+            const int x = r.tl.x;
+            const int y = r.tl.y;
+
+            err = libyuv::ARGBToI420(buffer + y * src_stride_bytes + x * bpp,
+                src_stride_bytes,
+                frame->data[0] + y * frame->linesize[0] + x,
+                frame->linesize[0],
+                frame->data[1] + y / 2 * frame->linesize[1] + x / 2,
+                frame->linesize[1],
+                frame->data[2] + y / 2 * frame->linesize[2] + x / 2,
+                frame->linesize[2],
+                r.width(),
+                r.height());
+            if (err != 0) {
+                vlog.error("libyuv::ARGBToI420 failed with code: %d", err);
+                return false;
+            }
         }
 
+        frame_stale = false;
+
         frame->pts = pts++;
 
         if (ffmpeg.avcodec_send_frame(ctx_guard.get(), frame) < 0) {
@@ -132,7 +151,6 @@ namespace rfb {
 
         if (err < 0) {
             vlog.error("Error receiving packet from codec");
-            writeSkipRect();
             return false;
         }
 
@@ -143,9 +161,12 @@ namespace rfb {
     }
 
     void SoftwareEncoder::writeRect(const PixelBuffer *pb, const Palette &palette) {
+        writePacket(conn->getOutStream(conn->cp.supportsUdp));
+    }
+
+    void SoftwareEncoder::writePacket(rdr::OutStream *os) {
         auto *pkt = pkt_guard.get();
 
-        auto *os = conn->getOutStream(conn->cp.supportsUdp);
         os->writeU8(layout.id);
         os->writeU8(msg_codec_id);
         os->writeU8(msg_codec_type_id);
@@ -157,6 +178,10 @@ namespace rfb {
         ffmpeg.av_packet_unref(pkt);
     }
 
+    bool SoftwareEncoder::isKeyFrame() const {
+        return pkt_guard.get()->flags & AV_PKT_FLAG_KEY;
+    }
+
     void SoftwareEncoder::writeSolidRect(int width, int height, const PixelFormat &pf, const rdr::U8 *colour) {}
 
     void SoftwareEncoder::writeSkipRect() {
@@ -167,6 +192,7 @@ namespace rfb {
 
     bool SoftwareEncoder::init(int width, int height, VideoEncoderParams params) {
         current_params = params;
+        frame_stale = true;
         vlog.debug("FRAME RESIZE (%d, %d): RATE: %d, GOP: %d, QUALITY: %d", width, height, current_params.frame_rate, current_params.group_of_picture, current_params.quality);
 
         auto *ctx = ffmpeg.avcodec_alloc_context3(codec);
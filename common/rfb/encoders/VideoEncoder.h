@@ -17,7 +17,9 @@
  */
 #pragma once
 
+#include <rdr/OutStream.h>
 #include <rfb/PixelBuffer.h>
+#include <rfb/Region.h>
 #include "rfb/Encoder.h"
 
 namespace rfb {
@@ -41,7 +43,15 @@ namespace rfb {
     public:
         VideoEncoder(Id id, SConnection *conn) :
             Encoder(id, conn, encodingKasmVideo, static_cast<EncoderFlags>(EncoderUseNativePF | EncoderLossy), -1) {}
-        virtual bool render(const PixelBuffer *pb, bool forceKeyFrame = false) = 0;
+        // render() encodes the screen into a packet for writeRect(). The
+        // converted frame is kept between calls, so only the parts in
+        // changed (relative to the screen) are converted again.
+        virtual bool render(const PixelBuffer *pb, const Region &changed, bool forceKeyFrame = false) = 0;
+        // writePacket() writes the rendered packet to os and releases it,
+        // writeRect() does the same to the connection's stream. Encoders
+        // shared between clients have no connection, so only use this one.
+        virtual void writePacket(rdr::OutStream *os) = 0;
+        [[nodiscard]] virtual bool isKeyFrame() const = 0;
         virtual void writeSkipRect() = 0;
         ~VideoEncoder() override = default;
     };
@@ -104,8 +104,8 @@ namespace rfb {
             if (layout.id == INVALID_ID)
                 throw std::runtime_error("Encoder does not have a valid id");
 
-            if (!conn)
-                throw std::runtime_error("Connection is required");
+            // conn may be NULL for encoders shared between clients, which
+            // only ever use writePacket()
 
             if constexpr (is_ffmpeg_based<T>::value) {
                 if (!ffmpeg)
@@ -16,4 +16,25 @@ namespace rfb::encoders {
             }
         }
     }
+
+    std::vector<Rect> macroblock_rects(const Region &changed, int width, int height) {
+        constexpr int mb_size = 16;
+
+        std::vector<Rect> rects;
+        changed.get_rects(&rects);
+
+        Region aligned;
+        for (const auto &rect: rects) {
+            const Rect grown(rect.tl.x & ~(mb_size - 1), rect.tl.y & ~(mb_size - 1),
+                (rect.br.x + mb_size - 1) & ~(mb_size - 1), (rect.br.y + mb_size - 1) & ~(mb_size - 1));
+            aligned.assign_union(grown);
+        }
+
+        aligned.assign_intersect(Rect(0, 0, width, height));
+
+        rects.clear();
+        aligned.get_rects(&rects);
+
+        return rects;
+    }
 } // namespace rfb::encoders
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <vector>
 #include "rdr/OutStream.h"
+#include "rfb/Region.h"
 
 namespace rfb::encoders {
 
@@ -12,4 +14,8 @@ namespace rfb::encoders {
 #endif
 
     void write_compact(rdr::OutStream *os, int value);
+
+    // Returns the changed parts of a width x height frame, grown to whole
+    // macroblocks, as non-overlapping rects
+    std::vector<Rect> macroblock_rects(const Region &changed, int width, int height);
 } // namespace rfb::encoders
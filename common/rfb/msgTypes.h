@@ -77,6 +77,8 @@ namespace rfb {
 
   //  constexpr int msgTypeSystemStats = 191;
 
+  constexpr int msgTypeUdpLoss = 192;
+
   constexpr int msgTypeClientFence = 248;
 
   constexpr int msgTypeSetDesktopSize = 251;
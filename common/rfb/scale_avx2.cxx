@@ -0,0 +1,246 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <immintrin.h>
+
+#include <rfb/scale_avx2.h>
+#include <rfb/scale_sse2.h>
+
+namespace rfb {
+
+void AVX2_halve(const uint8_t *oldpx,
+			const uint16_t tgtw, const uint16_t tgth,
+			uint8_t *newpx,
+			const unsigned oldstride, const unsigned newstride) {
+	uint16_t x, y;
+	const uint16_t srcw = tgtw * 2, srch = tgth * 2;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m128i shift = _mm_set_epi32(0, 0, 0, 2);
+	const __m256i low = _mm256_set_epi32(0, 0, 0xffffffff, 0xffffffff,
+						0, 0, 0xffffffff, 0xffffffff);
+	const __m256i high = _mm256_set_epi32(0xffffffff, 0xffffffff, 0, 0,
+						0xffffffff, 0xffffffff, 0, 0);
+
+	for (y = 0; y < srch; y += 2) {
+		const uint8_t * const row0 = oldpx + oldstride * y * 4;
+		const uint8_t * const row1 = oldpx + oldstride * (y + 1) * 4;
+
+		uint8_t * const dst = newpx + newstride * (y / 2) * 4;
+
+		// Same steps as SSE2, each 128-bit lane doing four source pixels
+		for (x = 0; x + 7 < srcw; x += 8) {
+			__m256i lo, hi, a, b, c, d;
+			lo = _mm256_loadu_si256((__m256i *) &row0[x * 4]);
+			hi = _mm256_loadu_si256((__m256i *) &row1[x * 4]);
+
+			a = _mm256_unpacklo_epi8(lo, zero);
+			b = _mm256_unpackhi_epi8(lo, zero);
+			c = _mm256_unpacklo_epi8(hi, zero);
+			d = _mm256_unpackhi_epi8(hi, zero);
+
+			a = _mm256_add_epi16(a, c);
+			b = _mm256_add_epi16(b, d);
+
+			c = _mm256_srli_si256(a, 8);
+			a = _mm256_and_si256(a, low);
+			a = _mm256_add_epi16(a, c);
+
+			d = _mm256_slli_si256(b, 8);
+			b = _mm256_and_si256(b, high);
+			b = _mm256_add_epi16(b, d);
+
+			a = _mm256_add_epi16(a, b);
+
+			a = _mm256_srl_epi16(a, shift);
+			a = _mm256_packus_epi16(a, zero);
+			a = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(3, 1, 2, 0));
+
+			_mm_storeu_si128((__m128i *) &dst[(x / 2) * 4], _mm256_castsi256_si128(a));
+		}
+
+		for (; x < srcw; x += 2) {
+			// Remainder in C
+			uint8_t i;
+			for (i = 0; i < 4; i++) {
+				dst[(x / 2) * 4 + i] =
+					(row0[x * 4 + i] +
+					row0[(x + 1) * 4 + i] +
+					row1[x * 4 + i] +
+					row1[(x + 1) * 4 + i]) / 4;
+			}
+		}
+	}
+}
+
+void AVX2_scale(const uint8_t *oldpx,
+		const uint16_t tgtw, const uint16_t tgth,
+		uint8_t *newpx,
+		const unsigned oldstride, const unsigned newstride,
+		const float tgtdiff,
+		const uint16_t starty, const uint16_t endy) {
+
+	uint16_t x, y;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i low = _mm256_set_epi32(0, 0, 0xffffffff, 0xffffffff,
+						0, 0, 0xffffffff, 0xffffffff);
+	const __m256i high = _mm256_set_epi32(0xffffffff, 0xffffffff, 0, 0,
+						0xffffffff, 0xffffffff, 0, 0);
+	const float invdiff = 1 / tgtdiff;
+
+	const uint16_t srcw = (uint16_t)(tgtw * invdiff);
+	const uint16_t srch = (uint16_t)(tgth * invdiff);
+
+	for (y = starty; y < endy; y++) {
+		const float ny = y * invdiff;
+		const uint16_t lowy = ny;
+		const uint16_t highy = lowy + 1;
+
+		// The bottom edge has nothing to interpolate with
+		if (highy >= srch) {
+			SSE2_scaleRow(oldpx, tgtw, y, 0, newpx, oldstride, newstride,
+					invdiff, srcw, srch);
+			continue;
+		}
+
+		const uint16_t bot = (ny - lowy) * 256;
+		const uint16_t top = 256 - bot;
+		const uint32_t * const row0 = (uint32_t *) (oldpx + oldstride * lowy * 4);
+		const uint32_t * const row1 = (uint32_t *) (oldpx + oldstride * highy * 4);
+
+		uint8_t * const dst = newpx + newstride * y * 4;
+
+		const __m256i vertmul = _mm256_set1_epi16(top);
+		const __m256i vertmul2 = _mm256_set1_epi16(bot);
+
+		for (x = 0; x + 3 < tgtw; x += 4) {
+			uint16_t lowx[4], highx[4], left[4], right[4];
+			unsigned i;
+
+			for (i = 0; i < 4; i++) {
+				const float nx = (x + i) * invdiff;
+				lowx[i] = nx;
+				highx[i] = lowx[i] + 1;
+				right[i] = (nx - lowx[i]) * 256;
+				left[i] = 256 - right[i];
+			}
+
+			// The right edge is left to the SSE2 code below
+			if (highx[3] >= srcw)
+				break;
+
+			// Each 128-bit lane does what SSE2 does for two pixels
+			const __m256i horzmul = _mm256_setr_epi16(
+				left[0], left[0], left[0], left[0],
+				right[0], right[0], right[0], right[0],
+				left[2], left[2], left[2], left[2],
+				right[2], right[2], right[2], right[2]
+			);
+			const __m256i horzmul2 = _mm256_setr_epi16(
+				left[1], left[1], left[1], left[1],
+				right[1], right[1], right[1], right[1],
+				left[3], left[3], left[3], left[3],
+				right[3], right[3], right[3], right[3]
+			);
+
+			__m256i lo, hi, a, b, c, d;
+
+			lo = _mm256_setr_epi32(row0[lowx[0]], row0[highx[0]],
+						row0[lowx[1]], row0[highx[1]],
+						row0[lowx[2]], row0[highx[2]],
+						row0[lowx[3]], row0[highx[3]]);
+			hi = _mm256_setr_epi32(row1[lowx[0]], row1[highx[0]],
+						row1[lowx[1]], row1[highx[1]],
+						row1[lowx[2]], row1[highx[2]],
+						row1[lowx[3]], row1[highx[3]]);
+
+			a = _mm256_unpacklo_epi8(lo, zero);
+			b = _mm256_unpackhi_epi8(lo, zero);
+			c = _mm256_unpacklo_epi8(hi, zero);
+			d = _mm256_unpackhi_epi8(hi, zero);
+
+			a = _mm256_mullo_epi16(a, vertmul);
+			b = _mm256_mullo_epi16(b, vertmul);
+			c = _mm256_mullo_epi16(c, vertmul2);
+			d = _mm256_mullo_epi16(d, vertmul2);
+
+			a = _mm256_add_epi16(a, c);
+			a = _mm256_srli_epi16(a, 8);
+			b = _mm256_add_epi16(b, d);
+			b = _mm256_srli_epi16(b, 8);
+
+			a = _mm256_mullo_epi16(a, horzmul);
+			b = _mm256_mullo_epi16(b, horzmul2);
+
+			lo = _mm256_srli_si256(a, 8);
+			a = _mm256_and_si256(a, low);
+			a = _mm256_add_epi16(a, lo);
+
+			hi = _mm256_slli_si256(b, 8);
+			b = _mm256_and_si256(b, high);
+			b = _mm256_add_epi16(b, hi);
+
+			a = _mm256_add_epi16(a, b);
+			a = _mm256_srli_epi16(a, 8);
+
+			a = _mm256_packus_epi16(a, zero);
+			a = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(3, 1, 2, 0));
+
+			_mm_storeu_si128((__m128i *) &dst[x * 4], _mm256_castsi256_si128(a));
+		}
+
+		if (x < tgtw)
+			SSE2_scaleRow(oldpx, tgtw, y, x, newpx, oldstride, newstride,
+					invdiff, srcw, srch);
+	}
+}
+
+void AVX2_nearest(const uint8_t *oldpx,
+		const uint16_t tgtw,
+		uint8_t *newpx,
+		const unsigned oldstride, const unsigned newstride,
+		const float diff,
+		const uint16_t starty, const uint16_t endy) {
+
+	uint16_t x, y;
+	const float rowstep = 1 / diff;
+	const __m256 diffs = _mm256_set1_ps(diff);
+	const __m256i steps = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	for (y = starty; y < endy; y++) {
+		const uint16_t ny = rowstep * y;
+		const int * const row = (const int *) (oldpx + oldstride * ny * 4);
+		uint32_t * const dst = (uint32_t *) (newpx + newstride * y * 4);
+
+		// Same float math as the C version, so the same pixels get picked
+		for (x = 0; x + 7 < tgtw; x += 8) {
+			const __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), steps);
+			const __m256i idx = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(xs),
+										diffs));
+
+			_mm256_storeu_si256((__m256i *) &dst[x],
+						_mm256_i32gather_epi32(row, idx, 4));
+		}
+
+		for (; x < tgtw; x++) {
+			const uint16_t newx = x / diff;
+			dst[x] = row[newx];
+		}
+	}
+}
+
+}; // namespace rfb
@@ -0,0 +1,65 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <string.h>
+
+#include <rfb/scale_avx2.h>
+#include <rfb/scale_sse2.h>
+
+namespace rfb {
+
+// The compiler can't do AVX2, but the CPU may still pick these
+
+void AVX2_halve(const uint8_t *oldpx,
+			const uint16_t tgtw, const uint16_t tgth,
+			uint8_t *newpx,
+			const unsigned oldstride, const unsigned newstride) {
+	SSE2_halve(oldpx, tgtw, tgth, newpx, oldstride, newstride);
+}
+
+void AVX2_scale(const uint8_t *oldpx,
+		const uint16_t tgtw, const uint16_t tgth,
+		uint8_t *newpx,
+		const unsigned oldstride, const unsigned newstride,
+		const float tgtdiff,
+		const uint16_t starty, const uint16_t endy) {
+	SSE2_scale(oldpx, tgtw, tgth, newpx, oldstride, newstride, tgtdiff,
+		   starty, endy);
+}
+
+void AVX2_nearest(const uint8_t *oldpx,
+		const uint16_t tgtw,
+		uint8_t *newpx,
+		const unsigned oldstride, const unsigned newstride,
+		const float diff,
+		const uint16_t starty, const uint16_t endy) {
+	const float rowstep = 1 / diff;
+	uint16_t x, y;
+
+	newpx += newstride * 4 * starty;
+	for (y = starty; y < endy; y++) {
+		const uint8_t *src = oldpx + oldstride * 4 * (uint16_t) (rowstep * y);
+		for (x = 0; x < tgtw; x++) {
+			const uint16_t newx = x / diff;
+			memcpy(&newpx[x * 4], &src[newx * 4], 4);
+		}
+		newpx += newstride * 4;
+	}
+}
+
+}; // namespace rfb
@@ -31,7 +31,15 @@ void SSE2_scale(const uint8_t *oldpx,
 		const uint16_t tgtw, const uint16_t tgth,
 		uint8_t *newpx,
 		const unsigned oldstride, const unsigned newstride,
-		const float tgtdiff) {
+		const float tgtdiff,
+		const uint16_t starty, const uint16_t endy) {
+}
+
+void SSE2_scaleRow(const uint8_t *oldpx,
+		const uint16_t tgtw, const uint16_t y, const uint16_t startx,
+		uint8_t *newpx,
+		const unsigned oldstride, const unsigned newstride,
+		const float invdiff, const uint16_t srcw, const uint16_t srch) {
 }
 
 }; // namespace rfb
@@ -0,0 +1,412 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * Measures how fast the colours of encoder sized rects are counted, and
+ * checks that skipping runs of a colour with the vector units gives
+ * exactly the same result as the old loop that looked at every pixel.
+ * Every run finder the CPU can use is tested, at all pixel sizes, on
+ * rects of awkward widths with padding at the end of each line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include <rfb/blockcmp.h>
+#include <rfb/Configuration.h>
+#include <rfb/cpuid.h>
+#include <rfb/Palette.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/RectAnalysis.h>
+
+#include "util.h"
+
+static rfb::IntParameter count("count", "Number of rects per test", 2000);
+
+typedef void (*preparefn) (rdr::U32 *pixels, int size);
+
+struct TestEntry {
+  const char *label;
+  preparefn fn;
+};
+
+struct Finder {
+  const char *label;
+  rfb::ColourRunFinder fn;
+  bool usable;
+};
+
+static rdr::U32 randomColour()
+{
+  return ((rdr::U32)rand() << 16) ^ rand();
+}
+
+static void solid(rdr::U32 *pixels, int size)
+{
+  rdr::U32 colour = randomColour();
+
+  for (int i = 0; i < size; i++)
+    pixels[i] = colour;
+}
+
+// Flat areas of a few colours, runs of any length
+static void flat(rdr::U32 *pixels, int size)
+{
+  rdr::U32 colours[4];
+
+  for (int i = 0; i < 4; i++)
+    colours[i] = randomColour();
+
+  for (int i = 0; i < size;) {
+    rdr::U32 colour = colours[rand() % 4];
+    int run = 1 + rand() % 200;
+
+    for (; run && i < size; run--, i++)
+      pixels[i] = colour;
+  }
+}
+
+// Anti-aliased text, mostly background with short runs of a few shades
+static void text(rdr::U32 *pixels, int size)
+{
+  rdr::U32 colours[12];
+
+  for (int i = 0; i < 12; i++)
+    colours[i] = randomColour();
+
+  for (int i = 0; i < size;) {
+    rdr::U32 colour = rand() % 3 ? colours[0] : colours[rand() % 12];
+    int run = 1 + rand() % 40;
+
+    for (; run && i < size; run--, i++)
+      pixels[i] = colour;
+  }
+}
+
+// Runs ending on and around vector boundaries, limit always exceeded
+static void boundaries(rdr::U32 *pixels, int size)
+{
+  for (int i = 0; i < size;) {
+    rdr::U32 colour = randomColour();
+    int run = 1 + rand() % 34;
+
+    for (; run && i < size; run--, i++)
+      pixels[i] = colour;
+  }
+}
+
+static void photo(rdr::U32 *pixels, int size)
+{
+  for (int i = 0; i < size; i++)
+    pixels[i] = randomColour();
+}
+
+static struct TestEntry tests[] = {
+  {"solid", solid},
+  {"flat", flat},
+  {"text", text},
+  {"boundaries", boundaries},
+  {"photo", photo},
+};
+
+static struct Finder finders[] = {
+  {"dispatched", rfb::colourRunLength, true},
+  {"C", rfb::C_colourRunLength, true},
+  {"SSE2", rfb::SSE2_colourRunLength, cpu_info::has_sse2},
+  {"AVX2", rfb::AVX2_colourRunLength, cpu_info::has_avx2},
+};
+
+static const rfb::PixelFormat formats[] = {
+  rfb::PixelFormat(8, 8, false, true, 7, 7, 3, 5, 2, 0),
+  rfb::PixelFormat(16, 16, false, true, 31, 63, 31, 11, 5, 0),
+  rfb::PixelFormat(32, 24, false, true, 255, 255, 255, 16, 8, 0),
+};
+
+static const int maxColourLimits[] = { 2, 16, 256 };
+
+// The analysis as it was before runs were skipped
+template<class T>
+static bool referenceAnalyseT(int width, int height, const T *buffer,
+                              int stride, rfb::RectInfo *info,
+                              int maxColours)
+{
+  int pad;
+
+  T colour;
+  int count;
+
+  info->rleRuns = 0;
+  info->palette->clear();
+
+  pad = stride - width;
+
+  colour = buffer[0];
+  count = 0;
+  while (height--) {
+    int w_ = width;
+    while (w_--) {
+      if (*buffer != colour) {
+        if (!info->palette->insert(colour, count))
+          return false;
+        if (info->palette->size() > maxColours)
+          return false;
+
+        info->rleRuns++;
+
+        colour = *buffer;
+        count = 0;
+      }
+      buffer++;
+      count++;
+    }
+    buffer += pad;
+  }
+
+  if (!info->palette->insert(colour, count))
+    return false;
+  if (info->palette->size() > maxColours)
+    return false;
+
+  return true;
+}
+
+static bool referenceAnalyse(const rfb::PixelBuffer *pb,
+                             rfb::RectInfo *info, int maxColours)
+{
+  const rdr::U8* buffer;
+  int stride;
+
+  buffer = pb->getBuffer(pb->getRect(), &stride);
+
+  switch (pb->getPF().bpp) {
+  case 32:
+    return referenceAnalyseT(pb->width(), pb->height(),
+                             (const rdr::U32*)buffer, stride,
+                             info, maxColours);
+  case 16:
+    return referenceAnalyseT(pb->width(), pb->height(),
+                             (const rdr::U16*)buffer, stride,
+                             info, maxColours);
+  default:
+    return referenceAnalyseT(pb->width(), pb->height(),
+                             (const rdr::U8*)buffer, stride,
+                             info, maxColours);
+  }
+}
+
+static bool sameResult(bool expectedOk, const rfb::RectInfo &expected,
+                       bool ok, const rfb::RectInfo &info)
+{
+  if (ok != expectedOk)
+    return false;
+
+  // Nothing else is used when the limit was exceeded
+  if (!ok)
+    return true;
+
+  if (info.rleRuns != expected.rleRuns)
+    return false;
+  if (info.palette->size() != expected.palette->size())
+    return false;
+
+  for (int i = 0; i < info.palette->size(); i++) {
+    if (info.palette->getColour(i) != expected.palette->getColour(i))
+      return false;
+    if (info.palette->getCount(i) != expected.palette->getCount(i))
+      return false;
+  }
+
+  return true;
+}
+
+static void fillRect(std::vector<rdr::U8> *data, const rfb::PixelFormat &pf,
+                     int width, int height, int stride,
+                     const TestEntry &test)
+{
+  std::vector<rdr::U32> pixels(width * height);
+  const int bytes = pf.bpp / 8;
+
+  test.fn(pixels.data(), pixels.size());
+
+  // Padding gets junk, which must never be counted
+  data->resize(stride * height * bytes);
+  for (size_t i = 0; i < data->size(); i++)
+    (*data)[i] = rand();
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      rdr::U8 *pixel = data->data() + (y * stride + x) * bytes;
+      rdr::U32 value = pixels[y * width + x];
+
+      switch (bytes) {
+      case 4:
+        *(rdr::U32*)pixel = value;
+        break;
+      case 2:
+        *(rdr::U16*)pixel = value;
+        break;
+      default:
+        *pixel = value;
+      }
+    }
+  }
+}
+
+static bool doTest(const TestEntry &test, const rfb::PixelFormat &pf)
+{
+  const int finderCount = sizeof(finders)/sizeof(finders[0]);
+
+  std::vector<std::vector<rdr::U8> > data(count);
+  std::vector<rfb::Rect> sizes(count);
+  std::vector<int> strides(count);
+
+  rfb::Palette expectedPalette, palette;
+  rfb::RectInfo expected, info;
+
+  double referenceTime, times[finderCount];
+  int mismatches;
+
+  bool ok;
+
+  srand(1);
+
+  for (int i = 0; i < count; i++) {
+    // Mostly the 64x64 tiles rects are cut into, otherwise odd sizes
+    int width = rand() % 4 ? 64 : 1 + rand() % 100;
+    int height = rand() % 4 ? 64 : 1 + rand() % 100;
+
+    sizes[i].setXYWH(0, 0, width, height);
+    strides[i] = width + rand() % 3 * 7;
+    fillRect(&data[i], pf, width, height, strides[i], test);
+  }
+
+  expected.palette = &expectedPalette;
+  info.palette = &palette;
+
+  referenceTime = 0;
+  for (int i = 0; i < finderCount; i++)
+    times[i] = 0;
+
+  mismatches = 0;
+
+  for (size_t l = 0; l < sizeof(maxColourLimits)/sizeof(maxColourLimits[0]); l++) {
+    const int maxColours = maxColourLimits[l];
+
+    for (int i = 0; i < count; i++) {
+      rfb::FullFramePixelBuffer pb(pf, sizes[i].width(), sizes[i].height(),
+                                   data[i].data(), strides[i]);
+      bool expectedOk;
+
+      startTimeCounter();
+      expectedOk = referenceAnalyse(&pb, &expected, maxColours);
+      endTimeCounter();
+      referenceTime += getTimeCounter();
+
+      for (int f = 0; f < finderCount; f++) {
+        if (!finders[f].usable)
+          continue;
+
+        startTimeCounter();
+        ok = rfb::analyseRect(&pb, &info, maxColours, finders[f].fn);
+        endTimeCounter();
+        times[f] += getTimeCounter();
+
+        if (!sameResult(expectedOk, expected, ok, info)) {
+          fprintf(stderr, "%s %dbpp: %s differs on a %dx%d rect with at "
+                  "most %d colours\n", test.label, pf.bpp, finders[f].label,
+                  sizes[i].width(), sizes[i].height(), maxColours);
+          mismatches++;
+        }
+      }
+    }
+  }
+
+  printf("%s,%d,%g", test.label, pf.bpp, referenceTime * 1000.0);
+  for (int f = 0; f < finderCount; f++) {
+    if (finders[f].usable)
+      printf(",%g", times[f] * 1000.0);
+    else
+      printf(",");
+  }
+  printf("\n");
+
+  return mismatches == 0;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  bool ok;
+
+  time_t t;
+  char datebuffer[256];
+
+  size_t i, j;
+
+  for (i = 1; i < (size_t)argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < (size_t)argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Rect Colour Analysis Performance Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Rects per test: %d, each at every colour limit\n", (int)count);
+  printf("# SSE2: %s, AVX2: %s\n", cpu_info::has_sse2 ? "yes" : "no",
+         cpu_info::has_avx2 ? "yes" : "no");
+  printf("#\n");
+  printf("# Note: Times are total ms, empty where the CPU lacks support\n");
+  printf("#\n");
+
+  printf("Rects,BPP,Reference ms");
+  for (j = 0; j < sizeof(finders)/sizeof(finders[0]); j++)
+    printf(",%s ms", finders[j].label);
+  printf("\n");
+
+  ok = true;
+  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++) {
+    for (j = 0;j < sizeof(formats)/sizeof(formats[0]);j++)
+      ok = doTest(tests[i], formats[j]) && ok;
+  }
+
+  return ok ? 0 : 1;
+}
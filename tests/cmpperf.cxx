@@ -0,0 +1,184 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * Measures how fast ComparingUpdateTracker can find the changed parts of
+ * a frame. The whole screen is always marked as damaged, like a full
+ * frame from the X server, and the tracker has to work out the rest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <rfb/ComparingUpdateTracker.h>
+#include <rfb/Configuration.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/ServerCore.h>
+
+#include "util.h"
+
+static rfb::IntParameter width("width", "Frame buffer width", 3840);
+static rfb::IntParameter height("height", "Frame buffer height", 2160);
+static rfb::IntParameter count("count", "Number of frames per test", 100);
+
+static rdr::U8 *frames[2];
+static int stride;
+
+typedef void (*preparefn) (rfb::ManagedPixelBuffer *fb, int frame);
+
+struct TestEntry {
+  const char *label;
+  preparefn fn;
+  bool scroll;
+};
+
+// Every block differs from the previous frame
+static void prepareFull(rfb::ManagedPixelBuffer *fb, int frame)
+{
+  fb->imageRect(fb->getRect(), frames[frame % 2], stride);
+}
+
+// A few small spots change, the rest of the damaged area is identical
+static void prepareSparse(rfb::ManagedPixelBuffer *fb, int frame)
+{
+  rdr::U8 pix[4];
+
+  for (int i = 0; i < 32; i++) {
+    int x = rand() % (fb->width() - 16);
+    int y = rand() % (fb->height() - 16);
+
+    pix[0] = pix[1] = pix[2] = pix[3] = rand();
+    fb->fillRect(rfb::Rect(x, y, x + 16, y + 16), pix);
+  }
+}
+
+// The content moves up a bit every frame
+static void prepareScroll(rfb::ManagedPixelBuffer *fb, int frame)
+{
+  const int step = 16;
+  int offset = (frame * step) % (fb->height() / 2);
+
+  fb->imageRect(fb->getRect(), frames[0] + offset * stride * 4, stride);
+}
+
+struct TestEntry tests[] = {
+  {"full", prepareFull, false},
+  {"sparse", prepareSparse, false},
+  {"scroll", prepareScroll, true},
+};
+
+static void doTest(const TestEntry &test)
+{
+  rfb::PixelFormat pf(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+  rfb::ManagedPixelBuffer fb(pf, width, height);
+  rfb::ComparingUpdateTracker tracker(&fb);
+  double time, data;
+
+  rfb::Server::detectScrolling.setParam(test.scroll);
+
+  test.fn(&fb, 0);
+  tracker.compare(true, rfb::Region());
+  tracker.clear();
+
+  time = 0;
+  for (int i = 1; i <= count; i++) {
+    test.fn(&fb, i);
+    tracker.add_changed(fb.getRect());
+
+    startTimeCounter();
+    tracker.compare(!test.scroll, rfb::Region());
+    endTimeCounter();
+
+    time += getTimeCounter();
+    tracker.clear();
+  }
+
+  data = (double)fb.area() * 4 * count;
+
+  printf("%s,%g,%g\n", test.label, time * 1000.0 / count,
+         data / (1000.0*1000.0*1000.0) / time);
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  size_t bufsize;
+
+  time_t t;
+  char datebuffer[256];
+
+  size_t i;
+
+  for (i = 1; i < (size_t)argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < (size_t)argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  // The scroll test slides a window over a frame twice the screen height
+  stride = width;
+  bufsize = (size_t)stride * height * 2 * 4;
+
+  frames[0] = new rdr::U8[bufsize];
+  frames[1] = new rdr::U8[bufsize];
+
+  for (i = 0;i < bufsize;i++) {
+    frames[0][i] = rand();
+    frames[1][i] = rand();
+  }
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Framebuffer Compare Performance Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Frame buffer: %dx%d pixels\n", (int)width, (int)height);
+  printf("# Frames per test: %d\n", (int)count);
+  printf("#\n");
+  printf("# Note: Results are ms/frame and GB/s of damaged framebuffer\n");
+  printf("#\n");
+
+  printf("Test,ms,GB/s\n");
+
+  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++)
+    doTest(tests[i]);
+
+  delete [] frames[0];
+  delete [] frames[1];
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * Measures the video mode scalers. The target buffer is reused between
+ * frames, the same way EncodeManager does it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <rfb/Configuration.h>
+#include <rfb/EncodeManager.h>
+#include <rfb/PixelBuffer.h>
+
+#include "util.h"
+
+static rfb::IntParameter width("width", "Frame buffer width", 3840);
+static rfb::IntParameter height("height", "Frame buffer height", 2160);
+static rfb::IntParameter count("count", "Number of frames per test", 50);
+
+typedef rfb::PixelBuffer *(*scalefn) (const rfb::PixelBuffer *pb,
+                                      const uint16_t w, const uint16_t h,
+                                      const float diff,
+                                      rfb::ManagedPixelBuffer *dst);
+
+static rfb::ManagedPixelBuffer scaleTmp[2];
+
+static rfb::PixelBuffer *progressive(const rfb::PixelBuffer *pb,
+                                     const uint16_t w, const uint16_t h,
+                                     const float diff,
+                                     rfb::ManagedPixelBuffer *dst)
+{
+  return rfb::progressiveBilinearScale(pb, w, h, diff, dst, scaleTmp);
+}
+
+struct TestEntry {
+  const char *label;
+  scalefn fn;
+  float diff;
+};
+
+struct TestEntry tests[] = {
+  {"nearest 0.8", rfb::nearestScale, 0.8f},
+  {"nearest 0.4", rfb::nearestScale, 0.4f},
+  {"bilinear 0.8", rfb::bilinearScale, 0.8f},
+  {"bilinear 0.4", rfb::bilinearScale, 0.4f},
+  {"progressive 0.8", progressive, 0.8f},
+  {"progressive 0.4", progressive, 0.4f},
+};
+
+static void doTest(const rfb::PixelBuffer *pb, const TestEntry &test)
+{
+  rfb::ManagedPixelBuffer dst;
+  const uint16_t w = pb->width() * test.diff;
+  const uint16_t h = pb->height() * test.diff;
+  double time, data;
+
+  // Warm up, and get the target buffer allocated
+  test.fn(pb, w, h, test.diff, &dst);
+
+  startTimeCounter();
+  for (int i = 0; i < count; i++)
+    test.fn(pb, w, h, test.diff, &dst);
+  endTimeCounter();
+
+  time = getTimeCounter();
+  data = (double)pb->area() * count;
+
+  printf("%s,%g,%g\n", test.label, time * 1000.0 / count,
+         data / (1000.0*1000.0) / time);
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  rdr::U8 *buffer;
+  int stride;
+  size_t bufsize;
+
+  time_t t;
+  char datebuffer[256];
+
+  size_t i;
+
+  for (i = 1; i < (size_t)argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < (size_t)argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  rfb::PixelFormat pf(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+  rfb::ManagedPixelBuffer pb(pf, width, height);
+
+  buffer = pb.getBufferRW(pb.getRect(), &stride);
+  bufsize = (size_t)stride * height * 4;
+  for (i = 0;i < bufsize;i++)
+    buffer[i] = rand();
+  pb.commitBufferRW(pb.getRect());
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Scaling Performance Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Frame buffer: %dx%d pixels\n", (int)width, (int)height);
+  printf("# Frames per test: %d\n", (int)count);
+  printf("#\n");
+  printf("# Note: Results are ms/frame and Mpixels/s of source framebuffer\n");
+  printf("#\n");
+
+  printf("Test,ms,Mpixels/s\n");
+
+  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++)
+    doTest(&pb, tests[i]);
+
+  return 0;
+}
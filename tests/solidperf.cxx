@@ -0,0 +1,483 @@
+/* Copyright (C) 2022 Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * Measures how fast the solid areas of a changed frame are found, on
+ * screens made to look like typical desktops. SolidSearch is run against
+ * a copy of the old search that looked at every pixel on one thread, and
+ * the two must find exactly the same areas.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include <rfb/Configuration.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/Region.h>
+#include <rfb/SolidSearch.h>
+#include <tbb/task_arena.h>
+
+#include "util.h"
+
+static rfb::IntParameter width("width", "Frame buffer width", 3840);
+static rfb::IntParameter height("height", "Frame buffer height", 2160);
+static rfb::IntParameter count("count", "Number of searches per test", 20);
+static rfb::IntParameter threads("threads",
+                                 "Threads for SolidSearch, 0 for one per CPU", 0);
+
+static const int SolidSearchBlock = rfb::SolidSearch::blockSize;
+static const int SolidBlockMinArea = rfb::SolidSearch::minArea;
+
+typedef void (*preparefn) (rfb::ManagedPixelBuffer *fb, rfb::Region *changed);
+
+struct TestEntry {
+  const char *label;
+  preparefn fn;
+};
+
+static void fill(rfb::ManagedPixelBuffer *fb, const rfb::Rect &r,
+                 rdr::U32 colour)
+{
+  fb->fillRect(r.intersect(fb->getRect()), &colour);
+}
+
+// Lines of text, a glyph is a few random pixels of fg in a 9x14 cell
+static void text(rfb::ManagedPixelBuffer *fb, const rfb::Rect &r,
+                 rdr::U32 fg)
+{
+  rdr::U32 *buffer;
+  int stride;
+
+  buffer = (rdr::U32*)fb->getBufferRW(fb->getRect(), &stride);
+
+  for (int y = r.tl.y + 4; y + 14 <= r.br.y; y += 18) {
+    const int end = r.br.x - rand() % (r.width() / 2 + 1);
+
+    for (int x = r.tl.x + 8; x + 9 <= end; x += 9) {
+      // Spaces
+      if (rand() % 6 == 0)
+        continue;
+
+      for (int gy = 2; gy < 13; gy++) {
+        for (int gx = 1; gx < 8; gx++) {
+          if (rand() % 4 == 0)
+            buffer[(y + gy) * stride + x + gx] = fg;
+        }
+      }
+    }
+  }
+
+  fb->commitBufferRW(fb->getRect());
+}
+
+static void window(rfb::ManagedPixelBuffer *fb, const rfb::Rect &r,
+                   rfb::Region *changed)
+{
+  fill(fb, r, 0x404040);
+  fill(fb, rfb::Rect(r.tl.x + 1, r.tl.y + 1, r.br.x - 1, r.tl.y + 31), 0x2a5db0);
+  fill(fb, rfb::Rect(r.tl.x + 1, r.tl.y + 31, r.br.x - 1, r.br.y - 1), 0xffffff);
+  text(fb, rfb::Rect(r.tl.x + 1, r.tl.y + 31, r.br.x - 1, r.br.y - 1), 0x202020);
+
+  if (changed)
+    changed->assign_union(rfb::Region(r));
+}
+
+// Nothing to find anywhere
+static void preparePhoto(rfb::ManagedPixelBuffer *fb, rfb::Region *changed)
+{
+  rdr::U32 *buffer;
+  int stride;
+
+  buffer = (rdr::U32*)fb->getBufferRW(fb->getRect(), &stride);
+  for (int y = 0; y < fb->height(); y++) {
+    for (int x = 0; x < fb->width(); x++)
+      buffer[y * stride + x] = rand() & 0xffffff;
+  }
+  fb->commitBufferRW(fb->getRect());
+
+  changed->assign_union(rfb::Region(fb->getRect()));
+}
+
+static void prepareBlank(rfb::ManagedPixelBuffer *fb, rfb::Region *changed)
+{
+  fill(fb, fb->getRect(), 0x3465a4);
+  changed->assign_union(rfb::Region(fb->getRect()));
+}
+
+// Windows over a photo wallpaper, with a panel at the bottom
+static void prepareDesktop(rfb::ManagedPixelBuffer *fb, rfb::Region *changed)
+{
+  const int w = fb->width(), h = fb->height();
+
+  preparePhoto(fb, changed);
+
+  window(fb, rfb::Rect(w / 10, h / 10, w / 2, h / 2), NULL);
+  window(fb, rfb::Rect(w / 3, h / 4, w * 9 / 10, h * 4 / 5), NULL);
+  window(fb, rfb::Rect(w / 20, h / 2, w / 3, h * 9 / 10), NULL);
+  fill(fb, rfb::Rect(0, h - 40, w, h), 0x303030);
+}
+
+// Only the windows changed, not the wallpaper
+static void prepareWindows(rfb::ManagedPixelBuffer *fb, rfb::Region *changed)
+{
+  const int w = fb->width(), h = fb->height();
+  rfb::Region ignored;
+
+  preparePhoto(fb, &ignored);
+
+  window(fb, rfb::Rect(w / 10, h / 10, w / 2, h / 2), changed);
+  window(fb, rfb::Rect(w / 2 + 40, h / 10, w * 9 / 10, h / 2), changed);
+  window(fb, rfb::Rect(w / 20, h / 2 + 40, w / 3, h * 9 / 10), changed);
+  window(fb, rfb::Rect(w / 2, h / 2 + 40, w * 19 / 20, h * 9 / 10), changed);
+}
+
+// A maximized editor
+static void prepareDocument(rfb::ManagedPixelBuffer *fb, rfb::Region *changed)
+{
+  window(fb, fb->getRect(), changed);
+}
+
+// A dark terminal in coloured text
+static void prepareTerminal(rfb::ManagedPixelBuffer *fb, rfb::Region *changed)
+{
+  const rdr::U32 colours[] = { 0xd0d0d0, 0x4e9a06, 0xc4a000, 0x3465a4 };
+  const int w = fb->width(), h = fb->height();
+
+  fill(fb, fb->getRect(), 0x1e1e1e);
+  for (int i = 0; i < 4; i++)
+    text(fb, rfb::Rect(0, h * i / 4, w, h * (i + 1) / 4), colours[i]);
+
+  changed->assign_union(rfb::Region(fb->getRect()));
+}
+
+// Buttons and fields on a grey dialog
+static void prepareWidgets(rfb::ManagedPixelBuffer *fb, rfb::Region *changed)
+{
+  const int w = fb->width(), h = fb->height();
+
+  fill(fb, fb->getRect(), 0xefefef);
+  for (int y = 20; y + 40 < h; y += 60) {
+    for (int x = 20; x + 200 < w; x += 240) {
+      const rfb::Rect button(x, y, x + 200, y + 40);
+
+      fill(fb, button, 0x8c8c8c);
+      fill(fb, rfb::Rect(x + 1, y + 1, x + 199, y + 39),
+           rand() % 3 ? 0xfafafa : 0x3584e4);
+      if (rand() % 2)
+        text(fb, rfb::Rect(x + 1, y + 8, x + 199, y + 32), 0x202020);
+    }
+  }
+
+  changed->assign_union(rfb::Region(fb->getRect()));
+}
+
+struct TestEntry tests[] = {
+  {"blank", prepareBlank},
+  {"photo", preparePhoto},
+  {"desktop", prepareDesktop},
+  {"windows", prepareWindows},
+  {"document", prepareDocument},
+  {"terminal", prepareTerminal},
+  {"widgets", prepareWidgets},
+};
+
+// The search before SolidSearch, trimmed to 32 bpp
+
+static bool checkSolidTile(const rfb::Rect& r, rdr::U32 colourValue,
+                           const rfb::PixelBuffer *pb)
+{
+  const rdr::U32 *buffer;
+  int stride;
+
+  buffer = (const rdr::U32*)pb->getBuffer(r, &stride);
+
+  for (int y = 0; y < r.height(); y++) {
+    for (int x = 0; x < r.width(); x++) {
+      if (buffer[y * stride + x] != colourValue)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+static void extendSolidAreaByBlock(const rfb::Rect& r, rdr::U32 colourValue,
+                                   const rfb::PixelBuffer *pb, rfb::Rect* er)
+{
+  int dx, dy, dw, dh;
+  int w_prev;
+  rfb::Rect sr;
+  int w_best = 0, h_best = 0;
+
+  w_prev = r.width();
+
+  for (dy = r.tl.y; dy < r.br.y; dy += SolidSearchBlock) {
+    dh = SolidSearchBlock;
+    if (dy + dh > r.br.y)
+      dh = r.br.y - dy;
+
+    dw = SolidSearchBlock;
+    if (dw > w_prev)
+      dw = w_prev;
+
+    sr.setXYWH(r.tl.x, dy, dw, dh);
+    if (!checkSolidTile(sr, colourValue, pb))
+      break;
+
+    for (dx = r.tl.x + dw; dx < r.tl.x + w_prev;) {
+      dw = SolidSearchBlock;
+      if (dx + dw > r.tl.x + w_prev)
+        dw = r.tl.x + w_prev - dx;
+
+      sr.setXYWH(dx, dy, dw, dh);
+      if (!checkSolidTile(sr, colourValue, pb))
+        break;
+
+      dx += dw;
+    }
+
+    w_prev = dx - r.tl.x;
+    if (w_prev * (dy + dh - r.tl.y) > w_best * h_best) {
+      w_best = w_prev;
+      h_best = dy + dh - r.tl.y;
+    }
+  }
+
+  er->tl.x = r.tl.x;
+  er->tl.y = r.tl.y;
+  er->br.x = er->tl.x + w_best;
+  er->br.y = er->tl.y + h_best;
+}
+
+static void extendSolidAreaByPixel(const rfb::Rect& r, const rfb::Rect& sr,
+                                   rdr::U32 colourValue,
+                                   const rfb::PixelBuffer *pb, rfb::Rect* er)
+{
+  int cx, cy;
+  rfb::Rect tr;
+
+  for (cy = sr.tl.y - 1; cy >= r.tl.y; cy--) {
+    tr.setXYWH(sr.tl.x, cy, sr.width(), 1);
+    if (!checkSolidTile(tr, colourValue, pb))
+      break;
+  }
+  er->tl.y = cy + 1;
+
+  for (cy = sr.br.y; cy < r.br.y; cy++) {
+    tr.setXYWH(sr.tl.x, cy, sr.width(), 1);
+    if (!checkSolidTile(tr, colourValue, pb))
+      break;
+  }
+  er->br.y = cy;
+
+  for (cx = sr.tl.x - 1; cx >= r.tl.x; cx--) {
+    tr.setXYWH(cx, er->tl.y, 1, er->height());
+    if (!checkSolidTile(tr, colourValue, pb))
+      break;
+  }
+  er->tl.x = cx + 1;
+
+  for (cx = sr.br.x; cx < r.br.x; cx++) {
+    tr.setXYWH(cx, er->tl.y, 1, er->height());
+    if (!checkSolidTile(tr, colourValue, pb))
+      break;
+  }
+  er->br.x = cx;
+}
+
+static void findSolidRect(const rfb::Rect& rect, const rfb::PixelBuffer *pb,
+                          std::vector<rfb::SolidRect> *found)
+{
+  rfb::Rect sr;
+  int dx, dy, dw, dh;
+
+  for (dy = rect.tl.y; dy < rect.br.y; dy += SolidSearchBlock) {
+    dh = SolidSearchBlock;
+    if (dy + dh > rect.br.y)
+      dh = rect.br.y - dy;
+
+    for (dx = rect.tl.x; dx < rect.br.x; dx += SolidSearchBlock) {
+      rdr::U32 colourValue;
+
+      dw = SolidSearchBlock;
+      if (dx + dw > rect.br.x)
+        dw = rect.br.x - dx;
+
+      pb->getImage(&colourValue, rfb::Rect(dx, dy, dx+1, dy+1));
+
+      sr.setXYWH(dx, dy, dw, dh);
+      if (checkSolidTile(sr, colourValue, pb)) {
+        rfb::Rect erb, erp;
+        rfb::SolidRect area;
+
+        sr.setXYWH(dx, dy, rect.br.x - dx, rect.br.y - dy);
+        extendSolidAreaByBlock(sr, colourValue, pb, &erb);
+
+        if (erb.equals(rect))
+          erp = erb;
+        else {
+          if (erb.area() < SolidBlockMinArea)
+            continue;
+          extendSolidAreaByPixel(rect, erb, colourValue, pb, &erp);
+        }
+
+        area.rect = erp;
+        memcpy(area.colour, &colourValue, sizeof(colourValue));
+        found->push_back(area);
+
+        if ((erp.tl.x != rect.tl.x) && (erp.height() > SolidSearchBlock)) {
+          sr.setXYWH(rect.tl.x, erp.tl.y + SolidSearchBlock,
+                     erp.tl.x - rect.tl.x, erp.height() - SolidSearchBlock);
+          findSolidRect(sr, pb, found);
+        }
+
+        if (erp.br.x != rect.br.x) {
+          sr.setXYWH(erp.br.x, erp.tl.y, rect.br.x - erp.br.x, erp.height());
+          findSolidRect(sr, pb, found);
+        }
+
+        if (erp.br.y != rect.br.y) {
+          sr.setXYWH(rect.tl.x, erp.br.y, rect.width(), rect.br.y - erp.br.y);
+          findSolidRect(sr, pb, found);
+        }
+
+        return;
+      }
+    }
+  }
+}
+
+static bool sameAreas(const std::vector<rfb::SolidRect> &a,
+                      const std::vector<rfb::SolidRect> &b)
+{
+  if (a.size() != b.size())
+    return false;
+
+  for (size_t i = 0; i < a.size(); i++) {
+    if (!a[i].rect.equals(b[i].rect) ||
+        memcmp(a[i].colour, b[i].colour, sizeof(a[i].colour)))
+      return false;
+  }
+
+  return true;
+}
+
+static bool doTest(const TestEntry &test)
+{
+  rfb::PixelFormat pf(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+  rfb::ManagedPixelBuffer fb(pf, width, height);
+  rfb::Region changed;
+  rfb::SolidSearch search;
+  tbb::task_arena arena(threads ? (int)threads : tbb::task_arena::automatic);
+  std::vector<rfb::Rect> rects;
+  std::vector<rfb::SolidRect> serial, parallel;
+  double serialTime, parallelTime;
+
+  srand(1);
+  test.fn(&fb, &changed);
+  changed.get_rects(&rects);
+
+  serialTime = parallelTime = 0;
+  for (int i = 0; i < count; i++) {
+    serial.clear();
+    startTimeCounter();
+    for (size_t j = 0; j < rects.size(); j++)
+      findSolidRect(rects[j], &fb, &serial);
+    endTimeCounter();
+    serialTime += getTimeCounter();
+
+    parallel.clear();
+    startTimeCounter();
+    arena.execute([&] {
+      search.find(&fb, rects, &parallel);
+    });
+    endTimeCounter();
+    parallelTime += getTimeCounter();
+  }
+
+  printf("%s,%d,%d,%g,%g,%g\n", test.label, (int)rects.size(),
+         (int)parallel.size(), serialTime * 1000.0 / count,
+         parallelTime * 1000.0 / count, serialTime / parallelTime);
+
+  if (!sameAreas(serial, parallel)) {
+    fprintf(stderr, "%s: found %d areas, the serial search %d\n",
+            test.label, (int)parallel.size(), (int)serial.size());
+    return false;
+  }
+
+  return true;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  bool ok;
+
+  time_t t;
+  char datebuffer[256];
+
+  size_t i;
+
+  for (i = 1; i < (size_t)argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < (size_t)argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Solid Area Search Performance Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Frame buffer: %dx%d pixels\n", (int)width, (int)height);
+  printf("# Searches per test: %d\n", (int)count);
+  printf("# Threads: %d\n", tbb::task_arena(threads ? (int)threads :
+                                              tbb::task_arena::automatic).max_concurrency());
+  printf("#\n");
+  printf("# Note: Times are ms per frame\n");
+  printf("#\n");
+
+  printf("Screen,Rects,Areas,Serial ms,Parallel ms,Speedup\n");
+
+  ok = true;
+  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++)
+    ok = doTest(tests[i]) && ok;
+
+  return ok ? 0 : 1;
+}
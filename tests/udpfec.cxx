@@ -0,0 +1,271 @@
+/* Copyright (C) Kasm
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * Lossy link simulation for the UDP transport. Messages of typical update
+ * sizes are split in to pieces like UdpStream does, pieces are dropped at
+ * random, and what arrives is put back together the way a client would,
+ * rebuilding lost pieces from parity when FEC is on. Reports how many
+ * messages arrive whole and how much of what went over the wire was
+ * useful, with and without FEC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include <rfb/Configuration.h>
+#include <rfb/xxhash.h>
+#include <network/UdpFec.h>
+
+using namespace network;
+
+static rfb::IntParameter count("count", "Number of messages per test", 5000);
+static rfb::IntParameter pieceSize("piecesize", "UDP piece data size", 1296);
+static rfb::IntParameter reportInterval("reportinterval",
+                                        "Messages between loss reports", 16);
+static rfb::IntParameter seed("seed", "Random seed", 1);
+
+struct Piece {
+  uint32_t index;
+  uint32_t count;
+  const uint8_t *payload;
+  unsigned len;
+};
+
+// Rebuilds the message from the pieces that made it, returns false if
+// too many were lost
+static bool decode(const std::vector<Piece> &received, std::vector<uint8_t> &out)
+{
+  const uint32_t pieces = received[0].count & 0xffff;
+  const unsigned group = received[0].count >> 16;
+  std::vector<const Piece*> data(pieces, NULL), parity;
+  uint32_t i, g;
+
+  if (group)
+    parity.resize((pieces + group - 1) / group, NULL);
+
+  for (i = 0; i < received.size(); i++) {
+    const Piece *p = &received[i];
+    const uint32_t hash = XXH64(p->payload, p->len, 0);
+    uint32_t sent;
+
+    memcpy(&sent, p->payload - UDP_PIECE_HEADER + 12, sizeof(uint32_t));
+    if (hash != sent)
+      return false;
+
+    if (p->index < pieces)
+      data[p->index] = p;
+    else
+      parity[p->index - pieces] = p;
+  }
+
+  std::vector<std::vector<uint8_t> > rebuilt(pieces);
+
+  for (g = 0; g < parity.size(); g++) {
+    const uint32_t first = g * group;
+    const uint32_t last = first + group < pieces ? first + group : pieces;
+    uint32_t missing = pieces;
+    unsigned lost = 0;
+
+    for (i = first; i < last; i++) {
+      if (!data[i]) {
+        missing = i;
+        lost++;
+      }
+    }
+
+    if (lost != 1 || !parity[g])
+      continue;
+
+    uint16_t len;
+    memcpy(&len, parity[g]->payload, sizeof(uint16_t));
+
+    std::vector<uint8_t> &piece = rebuilt[missing];
+    piece.assign(parity[g]->payload + UDP_PARITY_EXTRA,
+                 parity[g]->payload + parity[g]->len);
+
+    for (i = first; i < last; i++) {
+      if (i == missing)
+        continue;
+      len ^= data[i]->len;
+      for (unsigned j = 0; j < data[i]->len; j++)
+        piece[j] ^= data[i]->payload[j];
+    }
+
+    piece.resize(len);
+  }
+
+  out.clear();
+  for (i = 0; i < pieces; i++) {
+    if (data[i])
+      out.insert(out.end(), data[i]->payload, data[i]->payload + data[i]->len);
+    else if (!rebuilt[i].empty())
+      out.insert(out.end(), rebuilt[i].begin(), rebuilt[i].end());
+    else
+      return false;
+  }
+
+  return true;
+}
+
+// Mostly small updates, some larger ones and the odd key frame
+static unsigned messageSize()
+{
+  const int r = rand() % 100;
+
+  if (r < 70)
+    return 2000 + rand() % 18000;
+  if (r < 95)
+    return 20000 + rand() % 180000;
+  return 800000 + rand() % 200000;
+}
+
+static void runTest(double loss, bool fec)
+{
+  std::vector<uint8_t> message, buf, decoded;
+  std::vector<const uint8_t*> ptrs;
+  std::vector<int32_t> lens;
+  std::vector<Piece> received;
+
+  unsigned long long wireBytes, goodBytes, parityBytes;
+  unsigned complete, lostPieces, sentPieces;
+  double estimate;
+  int i;
+
+  srand(seed);
+
+  wireBytes = goodBytes = parityBytes = 0;
+  complete = lostPieces = sentPieces = 0;
+  estimate = 0;
+
+  for (i = 0; i < count; i++) {
+    const unsigned len = messageSize();
+    const unsigned group = fec ? udpFecGroupSize(estimate,
+                                                 (len + pieceSize - 1) / pieceSize) : 0;
+    const uint32_t total = udpPieceCount(len, pieceSize, group);
+    uint32_t n, j;
+
+    message.resize(len);
+    for (j = 0; j < len; j++)
+      message[j] = j * 31 + i;
+
+    buf.resize(len + total * (UDP_PIECE_HEADER + UDP_PARITY_EXTRA) +
+               (total - (len + pieceSize - 1) / pieceSize) * pieceSize);
+    ptrs.resize(total);
+    lens.resize(total);
+
+    n = udpBuildPieces(buf.data(), ptrs.data(), lens.data(), message.data(),
+                       len, pieceSize, i, i, group);
+
+    received.clear();
+    for (j = 0; j < n; j++) {
+      Piece p;
+
+      wireBytes += lens[j];
+      sentPieces++;
+
+      memcpy(&p.index, ptrs[j] + 4, sizeof(uint32_t));
+      memcpy(&p.count, ptrs[j] + 8, sizeof(uint32_t));
+      if (p.index >= (p.count & 0xffff))
+        parityBytes += lens[j];
+
+      if (rand() < loss * RAND_MAX) {
+        lostPieces++;
+        continue;
+      }
+
+      p.payload = ptrs[j] + UDP_PIECE_HEADER;
+      p.len = lens[j] - UDP_PIECE_HEADER;
+      received.push_back(p);
+    }
+
+    if (!received.empty() && decode(received, decoded)) {
+      if (decoded != message) {
+        fprintf(stderr, "Message %d decoded wrong\n", i);
+        exit(1);
+      }
+      complete++;
+      goodBytes += len;
+    }
+
+    // Same smoothing as UdpStream::reportLoss()
+    if ((i + 1) % reportInterval == 0) {
+      estimate = estimate * 0.75 + (double) lostPieces / sentPieces * 0.25;
+      lostPieces = sentPieces = 0;
+    }
+  }
+
+  printf("%g,%s,%g,%g,%g\n", loss * 100, fec ? "adaptive" : "off",
+         complete * 100.0 / count, goodBytes * 100.0 / wireBytes,
+         parityBytes * 100.0 / wireBytes);
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  time_t t;
+  char datebuffer[256];
+
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# UDP Forward Error Correction Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Messages: %d, pieces of %d bytes, loss reported every %d messages\n",
+         (int)count, (int)pieceSize, (int)reportInterval);
+  printf("#\n");
+  printf("# Note: Goodput is bytes of whole messages per byte sent\n");
+  printf("#\n");
+
+  printf("Loss %%,FEC,Complete %%,Goodput %%,Parity %%\n");
+  for (i = 0; i <= 5; i++) {
+    runTest(i / 100.0, false);
+    runTest(i / 100.0, true);
+  }
+
+  return 0;
+}
@@ -0,0 +1,196 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * Measures how many datagrams per second of CPU time the WebUDP send path
+ * can hand to the kernel. A message the size of a key frame is cut into
+ * datagrams the size UdpStream and DTLS produce, and sent one sendto()
+ * each, with sendmmsg(), and with UDP GSO.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <vector>
+
+#include <rfb/Configuration.h>
+#include <network/webudp/WuNetwork.h>
+
+static rfb::StringParameter host("host", "Address to send to", "127.0.0.1");
+static rfb::IntParameter port("port", "Port to send to, 0 for a local sink", 0);
+static rfb::IntParameter messageSize("messagesize", "Size of each message",
+                                     1024 * 1024);
+// udpSize, plus the piece header, SCTP and DTLS overhead
+static rfb::IntParameter datagramSize("datagramsize", "Size of each datagram",
+                                      1381);
+static rfb::IntParameter count("count", "Number of messages per test", 200);
+
+static double cpuTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static double wallTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void runTest(const char *name, int fd, const struct sockaddr_in *addr,
+                    const std::vector<const uint8_t*> &data,
+                    const std::vector<size_t> &lengths, int mode)
+{
+  double startCpu, startWall, cpu, wall;
+  long long packets;
+  int i;
+
+  packets = 0;
+  startCpu = cpuTime();
+  startWall = wallTime();
+
+  for (i = 0; i < count; i++) {
+    if (mode == 0) {
+      for (size_t j = 0; j < data.size(); j++) {
+        if (sendto(fd, data[j], lengths[j], 0, (const struct sockaddr*)addr,
+                   sizeof(*addr)) >= 0)
+          packets++;
+      }
+    } else {
+      int gso = mode == 2;
+      int32_t sent = SendUDPBatch(fd, addr, data.data(), lengths.data(),
+                                  data.size(), &gso);
+      if (sent > 0)
+        packets += sent;
+      if (mode == 2 && !gso) {
+        fprintf(stderr, "UDP GSO not supported here\n");
+        return;
+      }
+    }
+  }
+
+  cpu = cpuTime() - startCpu;
+  wall = wallTime() - startWall;
+
+  printf("%s,%lld,%g,%g,%g\n", name, packets, wall, cpu, packets / cpu);
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen;
+  int fd, sink;
+
+  time_t t;
+  char datebuffer[256];
+
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    fprintf(stderr, "Invalid address %s\n", (const char*)host);
+    return 1;
+  }
+
+  // Nobody reads the sink, the kernel drops what doesn't fit
+  sink = -1;
+  if (port == 0) {
+    sink = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sink < 0 || bind(sink, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      perror("bind");
+      return 1;
+    }
+    addrlen = sizeof(addr);
+    getsockname(sink, (struct sockaddr*)&addr, &addrlen);
+  } else {
+    addr.sin_port = htons((int)port);
+  }
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return 1;
+  }
+
+  std::vector<uint8_t> message(messageSize);
+  std::vector<const uint8_t*> data;
+  std::vector<size_t> lengths;
+
+  for (i = 0; i < (int)message.size(); i++)
+    message[i] = rand();
+  for (i = 0; i < (int)message.size(); i += datagramSize) {
+    data.push_back(&message[i]);
+    lengths.push_back(std::min((int)datagramSize, (int)message.size() - i));
+  }
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# WebUDP Send Path Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Destination: %s:%d\n", (const char*)host, ntohs(addr.sin_port));
+  printf("# Messages: %d of %d bytes, %d datagrams of %d bytes each\n",
+         (int)count, (int)messageSize, (int)data.size(), (int)datagramSize);
+  printf("#\n");
+  printf("# Note: Packets/s is per second of CPU time in the sending thread\n");
+  printf("#\n");
+
+  printf("Method,Packets,Wall s,CPU s,Packets/s\n");
+  runTest("sendto", fd, &addr, data, lengths, 0);
+  runTest("sendmmsg", fd, &addr, data, lengths, 1);
+  runTest("gso", fd, &addr, data, lengths, 2);
+
+  close(fd);
+  if (sink != -1)
+    close(sink);
+
+  return 0;
+}
@@ -0,0 +1,284 @@
+/* Copyright (C) 2021 Kasm Web
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * Load test for the websocket front end of a running server. Opens many
+ * short connections, like a reconnect storm or an orchestrator polling the
+ * API, and measures how many are handled per second and how long the
+ * server takes to answer each one. With tls, each connection does a full
+ * TLS handshake like a browser would; the certificate isn't checked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <rfb/Configuration.h>
+
+static rfb::StringParameter host("host", "Server to connect to", "127.0.0.1");
+static rfb::IntParameter port("port", "Websocket port of the server", 6901);
+static rfb::StringParameter path("path", "Path to request", "/websockify");
+static rfb::BoolParameter upgrade("upgrade", "Request a websocket upgrade, "
+                                  "rather than a plain HTTP GET", true);
+static rfb::StringParameter user("user", "User for basic auth", "");
+static rfb::StringParameter password("password", "Password for basic auth", "");
+static rfb::IntParameter count("count", "Number of connections in total", 2000);
+static rfb::IntParameter concurrency("concurrency",
+                                     "Number of connections at a time", 32);
+static rfb::BoolParameter tls("tls", "Connect with TLS", false);
+
+static struct addrinfo *server;
+static SSL_CTX *sslctx;
+static std::string request;
+
+static std::atomic<int> started, failures;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static std::string base64(const std::string &in)
+{
+  static const char table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  size_t i;
+
+  for (i = 0; i < in.size(); i += 3) {
+    unsigned v = (unsigned char)in[i] << 16;
+    if (i + 1 < in.size())
+      v |= (unsigned char)in[i + 1] << 8;
+    if (i + 2 < in.size())
+      v |= (unsigned char)in[i + 2];
+
+    out += table[(v >> 18) & 0x3f];
+    out += table[(v >> 12) & 0x3f];
+    out += (i + 1 < in.size()) ? table[(v >> 6) & 0x3f] : '=';
+    out += (i + 2 < in.size()) ? table[v & 0x3f] : '=';
+  }
+
+  return out;
+}
+
+// Returns the time until the response headers were in, or a negative
+// value on failure
+static double doConnection()
+{
+  char buf[4096];
+  size_t len;
+  double start;
+  int sock;
+  SSL *ssl;
+
+  start = now();
+
+  sock = socket(server->ai_family, SOCK_STREAM, 0);
+  if (sock < 0)
+    return -1;
+
+  if (connect(sock, server->ai_addr, server->ai_addrlen) < 0) {
+    close(sock);
+    return -1;
+  }
+
+  ssl = NULL;
+  if (tls) {
+    ssl = SSL_new(sslctx);
+    SSL_set_fd(ssl, sock);
+    if (SSL_connect(ssl) <= 0) {
+      SSL_free(ssl);
+      close(sock);
+      return -1;
+    }
+  }
+
+  ssize_t sent;
+  if (ssl)
+    sent = SSL_write(ssl, request.data(), request.size());
+  else
+    sent = send(sock, request.data(), request.size(), 0);
+  if (sent != (ssize_t)request.size()) {
+    SSL_free(ssl);
+    close(sock);
+    return -1;
+  }
+
+  len = 0;
+  while (len < sizeof(buf) - 1) {
+    ssize_t n;
+    if (ssl)
+      n = SSL_read(ssl, buf + len, sizeof(buf) - 1 - len);
+    else
+      n = recv(sock, buf + len, sizeof(buf) - 1 - len, 0);
+    if (n <= 0)
+      break;
+    len += n;
+    buf[len] = '\0';
+    if (strstr(buf, "\r\n\r\n"))
+      break;
+  }
+
+  SSL_free(ssl);
+  close(sock);
+
+  buf[len] = '\0';
+  if (!strstr(buf, "\r\n\r\n"))
+    return -1;
+  if (strncmp(buf, upgrade ? "HTTP/1.1 101" : "HTTP/1.1 200", 12) != 0)
+    return -1;
+
+  return now() - start;
+}
+
+static void worker(std::vector<double> *latencies)
+{
+  while (started++ < count) {
+    double t = doConnection();
+    if (t < 0)
+      failures++;
+    else
+      latencies->push_back(t);
+  }
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  struct addrinfo hints;
+  char portstr[16];
+  double start, elapsed;
+
+  time_t t;
+  char datebuffer[256];
+
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  sprintf(portstr, "%d", (int)port);
+  if (getaddrinfo(host, portstr, &hints, &server) != 0) {
+    fprintf(stderr, "Unable to resolve %s\n", (const char*)host);
+    return 1;
+  }
+
+  request = std::string("GET ") + (const char*)path + " HTTP/1.1\r\n"
+            "Host: " + (const char*)host + "\r\n";
+  if (upgrade) {
+    request += "Upgrade: websocket\r\n"
+               "Connection: Upgrade\r\n"
+               "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+               "Origin: http://" + std::string(host) + "\r\n"
+               "Sec-WebSocket-Version: 13\r\n"
+               "Sec-WebSocket-Protocol: binary\r\n";
+  }
+  if (((const char*)user)[0] != '\0') {
+    request += "Authorization: Basic " +
+               base64(std::string(user) + ":" + (const char*)password) +
+               "\r\n";
+  }
+  request += "\r\n";
+
+  if (tls) {
+    sslctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(sslctx, SSL_VERIFY_NONE, NULL);
+  }
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Websocket Front End Load Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Server: %s:%d%s (%s%s)\n", (const char*)host, (int)port,
+         (const char*)path, upgrade ? "websocket" : "http", tls ? ", TLS" : "");
+  printf("# Connections: %d, %d at a time\n", (int)count, (int)concurrency);
+  printf("#\n");
+  printf("# Note: Latency is from connect() until the response headers are in\n");
+  printf("#\n");
+
+  std::vector<std::vector<double> > latencies(concurrency);
+  std::vector<std::thread> threads;
+
+  start = now();
+  for (i = 0; i < concurrency; i++)
+    threads.push_back(std::thread(worker, &latencies[i]));
+  for (i = 0; i < concurrency; i++)
+    threads[i].join();
+  elapsed = now() - start;
+
+  std::vector<double> all;
+  for (i = 0; i < concurrency; i++)
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+
+  if (all.empty()) {
+    fprintf(stderr, "No successful connections\n");
+    return 1;
+  }
+
+  std::sort(all.begin(), all.end());
+
+  printf("Connections/s,Failed,p50 ms,p99 ms,Max ms\n");
+  printf("%g,%d,%g,%g,%g\n", all.size() / elapsed, (int)failures,
+         all[all.size() / 2] * 1000.0,
+         all[std::min(all.size() - 1, all.size() * 99 / 100)] * 1000.0,
+         all.back() * 1000.0);
+
+  freeaddrinfo(server);
+  if (sslctx)
+    SSL_CTX_free(sslctx);
+
+  return 0;
+}